@@ -1,7 +1,60 @@
 glslc src/tri.frag -o bin/tri.frag.spv
 glslc src/tri.vert -o bin/tri.vert.spv
+glslc --target-env=vulkan1.3 src/trace.comp -o bin/trace.comp.spv
+glslc --target-env=vulkan1.3 -DRAY_QUERY src/trace.comp -o bin/trace_rq.comp.spv
+glslc --target-env=vulkan1.3 src/wavefront_generate.comp -o bin/wavefront_generate.comp.spv
+glslc --target-env=vulkan1.3 src/wavefront_extend.comp -o bin/wavefront_extend.comp.spv
+glslc --target-env=vulkan1.3 -DRAY_QUERY src/wavefront_extend.comp -o bin/wavefront_extend_rq.comp.spv
+glslc --target-env=vulkan1.3 src/wavefront_shade.comp -o bin/wavefront_shade.comp.spv
+glslc --target-env=vulkan1.3 src/wavefront_connect.comp -o bin/wavefront_connect.comp.spv
+glslc --target-env=vulkan1.3 -DRAY_QUERY src/wavefront_connect.comp -o bin/wavefront_connect_rq.comp.spv
+glslc --target-env=vulkan1.3 src/wavefront_accumulate.comp -o bin/wavefront_accumulate.comp.spv
+glslc --target-env=vulkan1.3 src/wavefront_sort_rays.comp -o bin/wavefront_sort_rays.comp.spv
+glslc --target-env=vulkan1.3 src/wavefront_sort_hits.comp -o bin/wavefront_sort_hits.comp.spv
+glslc src/radix_count.comp -o bin/radix_count.comp.spv
+glslc src/radix_scan.comp -o bin/radix_scan.comp.spv
+glslc src/radix_scatter.comp -o bin/radix_scatter.comp.spv
+glslc src/denoise_temporal.comp -o bin/denoise_temporal.comp.spv
+glslc src/denoise_atrous.comp -o bin/denoise_atrous.comp.spv
+glslc src/denoise_error.comp -o bin/denoise_error.comp.spv
+glslc src/adaptive_classify.comp -o bin/adaptive_classify.comp.spv
 gcc -c src/swapchain_support_details.c -o build/scsd.o
 gcc -c src/util.c -o build/util.o
 gcc -c src/main.c -o build/main.o
 gcc -c src/app.c -o build/app.o
-gcc build/util.o build/main.o build/app.o build/scsd.o -o bin/main -lglfw -lvulkan
+gcc -c src/bindless.c -o build/bindless.o
+gcc -c src/worker.c -o build/worker.o
+gcc -c src/gpu_memory.c -o build/gpu_memory.o
+gcc -c src/host_memory.c -o build/host_memory.o
+gcc -c src/image.c -o build/image.o
+gcc -c src/texture.c -o build/texture.o
+gcc -c src/timeline.c -o build/timeline.o
+gcc -c src/options.c -o build/options.o
+gcc -c src/pipeline.c -o build/pipeline.o
+gcc -c src/trace.c -o build/trace.o
+gcc -O2 -c src/scene.c -o build/scene.o
+gcc -O2 -c src/bvh.c -o build/bvh.o
+gcc -O2 -c src/tlas.c -o build/tlas.o
+gcc -O2 -c src/animation.c -o build/animation.o
+gcc -c src/accel.c -o build/accel.o
+gcc -c src/wavefront.c -o build/wavefront.o
+gcc -c src/radix_sort.c -o build/radix_sort.o
+gcc -c src/denoise.c -o build/denoise.o
+gcc -c src/profiler.c -o build/profiler.o
+gcc -c src/adaptive.c -o build/adaptive.o
+gcc -c src/graph.c -o build/graph.o
+gcc -c src/startup.c -o build/startup.o
+gcc -c src/idle.c -o build/idle.o
+gcc -c src/resolution.c -o build/resolution.o
+gcc -c src/net.c -o build/net.o
+gcc -O2 -c src/cpu_trace.c -o build/cpu_trace.o
+gcc -c src/distributed.c -o build/distributed.o
+gcc -c src/server.c -o build/server.o
+gcc -c src/regress.c -o build/regress.o
+gcc -c src/offscreen.c -o build/offscreen.o
+gcc -c src/environment.c -o build/environment.o
+gcc -c src/light_tree.c -o build/light_tree.o
+gcc -O2 -c src/sampler.c -o build/sampler.o
+gcc -c src/capture.c -o build/capture.o
+gcc -O2 -c src/video.c -o build/video.o
+gcc build/util.o build/main.o build/app.o build/scsd.o build/bindless.o build/worker.o build/gpu_memory.o build/host_memory.o build/image.o build/texture.o build/timeline.o build/options.o build/pipeline.o build/trace.o build/scene.o build/bvh.o build/tlas.o build/animation.o build/accel.o build/denoise.o build/profiler.o build/adaptive.o build/capture.o build/video.o build/graph.o build/startup.o build/idle.o build/resolution.o build/net.o build/cpu_trace.o build/distributed.o build/server.o build/regress.o build/offscreen.o build/environment.o build/light_tree.o build/sampler.o build/wavefront.o build/radix_sort.o -o bin/main -lglfw -lvulkan -lpthread -lm
@@ -0,0 +1,15 @@
+#!/bin/sh
+# Golden image and timing checks against the references in regress/, failing
+# with a nonzero status on a regression. Builds first. Extra arguments go to
+# the binary, e.g. --regress-tolerance 20, or --regress-update to take the
+# current images and timings as the new references after an intended change.
+# Timings only compare between runs on the same machine: the first run
+# records them into regress/baselines.txt, which stays out of git, and later
+# runs check against it. --regress-gpu also traces every scene with the
+# compiled kernel on an offscreen device and compares it against the same
+# golden images; without a GPU, point the loader at lavapipe, e.g.
+# VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json sh regress.sh --regress-gpu
+set -e
+cd "$(dirname "$0")"
+sh compile.sh
+exec bin/main --regress regress "$@"
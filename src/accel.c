@@ -0,0 +1,425 @@
+#include <vulkan/vulkan.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+#include "gpu_memory.h"
+#include "accel.h"
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+    return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+static int accel_create_structure(
+        struct Accel *accel,
+        VkPhysicalDevice physical_device,
+        VkAccelerationStructureTypeKHR type,
+        VkDeviceSize size,
+        struct AccelStructure *structure) {
+    int result = create_buffer(
+            accel->device,
+            physical_device,
+            size,
+            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            GpuMemoryCategory_Bvh,
+            &structure->buffer,
+            &structure->memory);
+    if (result > 0) return 2;
+
+    VkAccelerationStructureCreateInfoKHR structure_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+        .buffer = structure->buffer,
+        .offset = 0,
+        .size = size,
+        .type = type,
+    };
+    VkResult vk_result = accel->create_acceleration_structure(
+            accel->device,
+            &structure_cinfo,
+            NULL,
+            &structure->handle);
+    if (vk_result != VK_SUCCESS) return 3;
+
+    VkAccelerationStructureDeviceAddressInfoKHR address_info = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+        .accelerationStructure = structure->handle,
+    };
+    structure->address = accel->get_device_address(accel->device, &address_info);
+    structure->size = size;
+
+    return 0;
+}
+
+static void accel_destroy_structure(struct Accel *accel, struct AccelStructure *structure) {
+    if (accel->destroy_acceleration_structure != NULL)
+        accel->destroy_acceleration_structure(accel->device, structure->handle, NULL);
+    vkDestroyBuffer(accel->device, structure->buffer, NULL);
+    gpu_memory_free(accel->device, structure->memory);
+    memset(structure, 0, sizeof(*structure));
+}
+
+static int accel_begin(VkCommandBuffer command_buffer) {
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    return vkBeginCommandBuffer(command_buffer, &begin_info) == VK_SUCCESS ? 0 : 2;
+}
+
+static int accel_submit(VkQueue queue, VkCommandBuffer command_buffer) {
+    vkEndCommandBuffer(command_buffer);
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &command_buffer,
+    };
+    if (vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS) return 2;
+    if (vkQueueWaitIdle(queue) != VK_SUCCESS) return 3;
+
+    return 0;
+}
+
+static void accel_build_barrier(VkCommandBuffer command_buffer) {
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+        .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+    };
+    vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            0,
+            1,
+            &barrier,
+            0,
+            NULL,
+            0,
+            NULL);
+}
+
+int accel_init(
+        struct Accel *accel,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        VkQueue queue,
+        uint32_t queue_family,
+        VkBuffer positions,
+        uint32_t vertices_n,
+        VkBuffer indices,
+        uint32_t triangles_n) {
+#if DEBUG_INPUT_VALIDATION
+    if (accel == NULL) return 1;
+    if (!IS_ZERO_PTR(accel)) return 1;
+    if (device == VK_NULL_HANDLE) return 1;
+    if (queue == VK_NULL_HANDLE) return 1;
+    if (positions == VK_NULL_HANDLE || indices == VK_NULL_HANDLE) return 1;
+    if (vertices_n == 0 || triangles_n == 0) return 1;
+#endif
+
+    int res = 0;
+    int result = 0;
+    double start = time_now();
+    accel->device = device;
+
+    // Extension entry points.
+    accel->create_acceleration_structure = (PFN_vkCreateAccelerationStructureKHR)
+        vkGetDeviceProcAddr(device, "vkCreateAccelerationStructureKHR");
+    accel->destroy_acceleration_structure = (PFN_vkDestroyAccelerationStructureKHR)
+        vkGetDeviceProcAddr(device, "vkDestroyAccelerationStructureKHR");
+    accel->get_build_sizes = (PFN_vkGetAccelerationStructureBuildSizesKHR)
+        vkGetDeviceProcAddr(device, "vkGetAccelerationStructureBuildSizesKHR");
+    accel->get_device_address = (PFN_vkGetAccelerationStructureDeviceAddressKHR)
+        vkGetDeviceProcAddr(device, "vkGetAccelerationStructureDeviceAddressKHR");
+    accel->cmd_build = (PFN_vkCmdBuildAccelerationStructuresKHR)
+        vkGetDeviceProcAddr(device, "vkCmdBuildAccelerationStructuresKHR");
+    accel->cmd_write_properties = (PFN_vkCmdWriteAccelerationStructuresPropertiesKHR)
+        vkGetDeviceProcAddr(device, "vkCmdWriteAccelerationStructuresPropertiesKHR");
+    accel->cmd_copy = (PFN_vkCmdCopyAccelerationStructureKHR)
+        vkGetDeviceProcAddr(device, "vkCmdCopyAccelerationStructureKHR");
+    if (accel->create_acceleration_structure == NULL
+            || accel->destroy_acceleration_structure == NULL
+            || accel->get_build_sizes == NULL
+            || accel->get_device_address == NULL
+            || accel->cmd_build == NULL
+            || accel->cmd_write_properties == NULL
+            || accel->cmd_copy == NULL)
+        return 2;
+
+    VkPhysicalDeviceAccelerationStructurePropertiesKHR accel_properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR,
+    };
+    VkPhysicalDeviceProperties2 properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &accel_properties,
+    };
+    vkGetPhysicalDeviceProperties2(physical_device, &properties);
+    VkDeviceSize scratch_alignment = accel_properties.minAccelerationStructureScratchOffsetAlignment;
+
+    // Bottom level geometry.
+    VkAccelerationStructureGeometryKHR blas_geometry = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+        .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
+        .geometry.triangles = {
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+            .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+            .vertexData.deviceAddress = buffer_device_address(device, positions),
+            .vertexStride = 4 * sizeof(float),
+            .maxVertex = vertices_n - 1,
+            .indexType = VK_INDEX_TYPE_UINT32,
+            .indexData.deviceAddress = buffer_device_address(device, indices),
+        },
+        .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
+    };
+    VkAccelerationStructureBuildGeometryInfoKHR blas_build_info = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR
+            | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR,
+        .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+        .geometryCount = 1,
+        .pGeometries = &blas_geometry,
+    };
+    VkAccelerationStructureBuildSizesInfoKHR blas_sizes = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
+    };
+    accel->get_build_sizes(
+            device,
+            VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+            &blas_build_info,
+            &triangles_n,
+            &blas_sizes);
+
+    // Top level geometry, one instance. The address is filled in once the
+    // compacted bottom level exists.
+    result = create_buffer(
+            device,
+            physical_device,
+            sizeof(VkAccelerationStructureInstanceKHR),
+            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
+                | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            GpuMemoryCategory_Bvh,
+            &accel->instances,
+            &accel->instances_memory);
+    if (result > 0) return 3;
+    VkAccelerationStructureGeometryKHR tlas_geometry = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+        .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
+        .geometry.instances = {
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
+            .arrayOfPointers = VK_FALSE,
+            .data.deviceAddress = buffer_device_address(device, accel->instances),
+        },
+        .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
+    };
+    VkAccelerationStructureBuildGeometryInfoKHR tlas_build_info = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+        .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+        .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+        .geometryCount = 1,
+        .pGeometries = &tlas_geometry,
+    };
+    uint32_t instances_n = 1;
+    VkAccelerationStructureBuildSizesInfoKHR tlas_sizes = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
+    };
+    accel->get_build_sizes(
+            device,
+            VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+            &tlas_build_info,
+            &instances_n,
+            &tlas_sizes);
+
+    // One scratch buffer serves both builds, they never overlap.
+    VkBuffer scratch = VK_NULL_HANDLE;
+    VkDeviceMemory scratch_memory = VK_NULL_HANDLE;
+    VkCommandPool pool = VK_NULL_HANDLE;
+    VkQueryPool query_pool = VK_NULL_HANDLE;
+    struct AccelStructure built = {0};
+
+    accel->scratch_size = blas_sizes.buildScratchSize > tlas_sizes.buildScratchSize
+        ? blas_sizes.buildScratchSize
+        : tlas_sizes.buildScratchSize;
+    result = create_buffer(
+            device,
+            physical_device,
+            accel->scratch_size + scratch_alignment,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            GpuMemoryCategory_Bvh,
+            &scratch,
+            &scratch_memory);
+    if (result > 0) {
+        res = 4;
+        goto fail;
+    }
+    VkDeviceAddress scratch_address = align_up(buffer_device_address(device, scratch), scratch_alignment);
+
+    //
+    VkCommandPoolCreateInfo pool_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = queue_family,
+    };
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    VkCommandBufferAllocateInfo command_buffer_ainfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    VkQueryPoolCreateInfo query_pool_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+        .queryCount = 1,
+    };
+    if (vkCreateCommandPool(device, &pool_cinfo, NULL, &pool) != VK_SUCCESS
+            || vkCreateQueryPool(device, &query_pool_cinfo, NULL, &query_pool) != VK_SUCCESS) {
+        res = 5;
+        goto fail;
+    }
+    command_buffer_ainfo.commandPool = pool;
+    if (vkAllocateCommandBuffers(device, &command_buffer_ainfo, &command_buffer) != VK_SUCCESS) {
+        res = 5;
+        goto fail;
+    }
+
+    // Build the bottom level and ask for its compacted size.
+    result = accel_create_structure(
+            accel,
+            physical_device,
+            VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+            blas_sizes.accelerationStructureSize,
+            &built);
+    if (result > 0) {
+        res = 6;
+        goto fail;
+    }
+    accel->blas_built_size = built.size;
+    blas_build_info.dstAccelerationStructure = built.handle;
+    blas_build_info.scratchData.deviceAddress = scratch_address;
+    VkAccelerationStructureBuildRangeInfoKHR blas_range = { .primitiveCount = triangles_n };
+    const VkAccelerationStructureBuildRangeInfoKHR *blas_ranges = &blas_range;
+
+    if (accel_begin(command_buffer) > 0) {
+        res = 7;
+        goto fail;
+    }
+    vkCmdResetQueryPool(command_buffer, query_pool, 0, 1);
+    accel->cmd_build(command_buffer, 1, &blas_build_info, &blas_ranges);
+    accel_build_barrier(command_buffer);
+    accel->cmd_write_properties(
+            command_buffer,
+            1,
+            &built.handle,
+            VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+            query_pool,
+            0);
+    if (accel_submit(queue, command_buffer) > 0) {
+        res = 7;
+        goto fail;
+    }
+
+    VkDeviceSize compacted_size = 0;
+    VkResult vk_result = vkGetQueryPoolResults(
+            device,
+            query_pool,
+            0,
+            1,
+            sizeof(compacted_size),
+            &compacted_size,
+            sizeof(compacted_size),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    if (vk_result != VK_SUCCESS || compacted_size == 0) compacted_size = built.size;
+
+    // Compact, then build the top level over the compacted copy.
+    result = accel_create_structure(
+            accel,
+            physical_device,
+            VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+            compacted_size,
+            &accel->blas);
+    if (result > 0) {
+        res = 6;
+        goto fail;
+    }
+    result = accel_create_structure(
+            accel,
+            physical_device,
+            VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+            tlas_sizes.accelerationStructureSize,
+            &accel->tlas);
+    if (result > 0) {
+        res = 6;
+        goto fail;
+    }
+
+    VkAccelerationStructureInstanceKHR *instance = NULL;
+    if (vkMapMemory(device, accel->instances_memory, 0, sizeof(*instance), 0, (void **)&instance) != VK_SUCCESS) {
+        res = 8;
+        goto fail;
+    }
+    *instance = (VkAccelerationStructureInstanceKHR) {
+        .transform.matrix = {
+            { 1.0f, 0.0f, 0.0f, 0.0f },
+            { 0.0f, 1.0f, 0.0f, 0.0f },
+            { 0.0f, 0.0f, 1.0f, 0.0f },
+        },
+        .instanceCustomIndex = 0,
+        .mask = 0xFF,
+        .instanceShaderBindingTableRecordOffset = 0,
+        .flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR,
+        .accelerationStructureReference = accel->blas.address,
+    };
+    vkUnmapMemory(device, accel->instances_memory);
+
+    tlas_build_info.dstAccelerationStructure = accel->tlas.handle;
+    tlas_build_info.scratchData.deviceAddress = scratch_address;
+    VkAccelerationStructureBuildRangeInfoKHR tlas_range = { .primitiveCount = instances_n };
+    const VkAccelerationStructureBuildRangeInfoKHR *tlas_ranges = &tlas_range;
+    VkCopyAccelerationStructureInfoKHR copy_info = {
+        .sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR,
+        .src = built.handle,
+        .dst = accel->blas.handle,
+        .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR,
+    };
+
+    vkResetCommandBuffer(command_buffer, 0);
+    if (accel_begin(command_buffer) > 0) {
+        res = 7;
+        goto fail;
+    }
+    accel->cmd_copy(command_buffer, &copy_info);
+    accel_build_barrier(command_buffer);
+    accel->cmd_build(command_buffer, 1, &tlas_build_info, &tlas_ranges);
+    if (accel_submit(queue, command_buffer) > 0) {
+        res = 7;
+        goto fail;
+    }
+
+    accel->build_time = time_now() - start;
+    printf("[accel] blas %llu -> %llu KiB compacted, tlas %llu KiB, scratch %llu KiB, %.2f ms\n",
+            (unsigned long long)(accel->blas_built_size >> 10),
+            (unsigned long long)(accel->blas.size >> 10),
+            (unsigned long long)(accel->tlas.size >> 10),
+            (unsigned long long)(accel->scratch_size >> 10),
+            accel->build_time * 1e3);
+
+fail:
+    accel_destroy_structure(accel, &built);
+    vkDestroyQueryPool(device, query_pool, NULL);
+    vkDestroyCommandPool(device, pool, NULL);
+    vkDestroyBuffer(device, scratch, NULL);
+    gpu_memory_free(device, scratch_memory);
+    return res;
+}
+
+void accel_free(struct Accel *accel) {
+    accel_destroy_structure(accel, &accel->tlas);
+    accel_destroy_structure(accel, &accel->blas);
+    vkDestroyBuffer(accel->device, accel->instances, NULL);
+    gpu_memory_free(accel->device, accel->instances_memory);
+
+    memset(accel, 0, sizeof(*accel));
+}
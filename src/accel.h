@@ -0,0 +1,49 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+
+struct AccelStructure {
+    VkAccelerationStructureKHR handle;
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    VkDeviceAddress address;
+};
+
+// Hardware acceleration structures for one static triangle mesh: a compacted
+// bottom level and a top level holding a single identity instance of it.
+struct Accel {
+    VkDevice device;
+    PFN_vkCreateAccelerationStructureKHR create_acceleration_structure;
+    PFN_vkDestroyAccelerationStructureKHR destroy_acceleration_structure;
+    PFN_vkGetAccelerationStructureBuildSizesKHR get_build_sizes;
+    PFN_vkGetAccelerationStructureDeviceAddressKHR get_device_address;
+    PFN_vkCmdBuildAccelerationStructuresKHR cmd_build;
+    PFN_vkCmdWriteAccelerationStructuresPropertiesKHR cmd_write_properties;
+    PFN_vkCmdCopyAccelerationStructureKHR cmd_copy;
+    //
+    struct AccelStructure blas;
+    struct AccelStructure tlas;
+    VkBuffer instances;
+    VkDeviceMemory instances_memory;
+    // Stats.
+    VkDeviceSize blas_built_size; // before compaction
+    VkDeviceSize scratch_size;
+    double build_time; // seconds, both levels including compaction
+};
+
+// positions holds vertices_n vertices with a stride of 16 bytes, indices 3
+// uint32 per triangle. Both need SHADER_DEVICE_ADDRESS and
+// ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY usage. Builds on queue and
+// waits for it to go idle.
+int accel_init(
+        struct Accel *accel,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        VkQueue queue,
+        uint32_t queue_family,
+        VkBuffer positions,
+        uint32_t vertices_n,
+        VkBuffer indices,
+        uint32_t triangles_n);
+void accel_free(struct Accel *accel);
@@ -0,0 +1,413 @@
+#include <vulkan/vulkan.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+#include "gpu_memory.h"
+#include "pipeline.h"
+#include "adaptive.h"
+
+// Must match adaptive_classify.comp.
+struct AdaptiveClassifyPush {
+    uint32_t accum;
+    uint32_t moments;
+    uint32_t target; // BINDLESS_INVALID when the trace resolved it
+    uint32_t list;
+    uint32_t width;
+    uint32_t height;
+    float target_error;
+    uint32_t min_samples;
+};
+
+static const char *sampling_mode_name(enum SamplingMode mode) {
+    return mode == SamplingMode_Adaptive ? "adaptive" : "uniform";
+}
+
+// Tiles over the rendered part of the images.
+static uint32_t render_tiles_x(const struct AdaptiveSampler *adaptive) {
+    return (adaptive->render_extent.width + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE;
+}
+
+static uint32_t render_tiles_y(const struct AdaptiveSampler *adaptive) {
+    return (adaptive->render_extent.height + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE;
+}
+
+static void adaptive_buffer_barrier(
+        VkCommandBuffer command_buffer,
+        VkBuffer buffer,
+        VkPipelineStageFlags src_stage,
+        VkAccessFlags src_access,
+        VkPipelineStageFlags dst_stage,
+        VkAccessFlags dst_access) {
+    VkBufferMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = src_access,
+        .dstAccessMask = dst_access,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = buffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE,
+    };
+    vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0, 0, NULL, 1, &barrier, 0, NULL);
+}
+
+int adaptive_init(
+        struct AdaptiveSampler *adaptive,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        const char *path,
+        struct PipelineBatch *pipelines,
+        struct Bindless *bindless,
+        VkExtent2D extent,
+        const struct AdaptiveSettings *settings) {
+#if DEBUG_INPUT_VALIDATION
+    if (adaptive == NULL) return 1;
+    if (!IS_ZERO_PTR(adaptive)) return 1;
+    if (device == VK_NULL_HANDLE) return 1;
+    if (physical_device == VK_NULL_HANDLE) return 1;
+    if (path == NULL) return 1;
+    if (bindless == NULL) return 1;
+    if (settings == NULL) return 1;
+    if (extent.width == 0 || extent.height == 0) return 1;
+#endif
+
+    int result = 0;
+
+    adaptive->device = device;
+    adaptive->bindless = bindless;
+    adaptive->extent = extent;
+    adaptive->render_extent = extent;
+    adaptive->moments_slot = BINDLESS_INVALID;
+    adaptive->list_slot = BINDLESS_INVALID;
+    adaptive->tiles_x = (extent.width + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE;
+    adaptive->tiles_n = adaptive->tiles_x * ((extent.height + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE);
+    adaptive->active_n = adaptive->tiles_n;
+    adaptive->started_at = time_now();
+
+    // Settings.
+    adaptive->settings = *settings;
+    struct AdaptiveSettings *s = &adaptive->settings;
+    if (s->target_error <= 0.0f) s->target_error = ADAPTIVE_DEFAULT_ERROR;
+    if (s->min_samples == 0) s->min_samples = ADAPTIVE_DEFAULT_MIN_SAMPLES;
+
+    // Pipeline.
+    result = create_pipeline_layout(device, NULL, bindless->layout, &adaptive->pipeline_layout);
+    if (result > 0) return 2;
+    result = take_compute_pipeline(
+            pipelines,
+            device,
+            path,
+            "adaptive_classify.comp.spv",
+            adaptive->pipeline_layout,
+            &adaptive->classify_pipeline);
+    if (result > 0) return 3;
+
+    // Luminance moments, next to the tracer's accumulation.
+    result = create_image(
+            device,
+            physical_device,
+            extent,
+            1,
+            TRACE_FORMAT,
+            VK_IMAGE_USAGE_STORAGE_BIT,
+            GpuMemoryCategory_Frame,
+            &adaptive->moments_image,
+            &adaptive->moments_memory,
+            NULL);
+    if (result > 0) return 4;
+    result = create_image_view(device, adaptive->moments_image, TRACE_FORMAT, 1, &adaptive->moments_view);
+    if (result > 0) return 4;
+    adaptive->moments_slot = bindless_add_storage_image(bindless, device, adaptive->moments_view);
+    if (adaptive->moments_slot == BINDLESS_INVALID) return 5;
+
+    // Tile list, also the indirect dispatch arguments.
+    VkDeviceSize list_size = (ADAPTIVE_LIST_HEADER + adaptive->tiles_n) * sizeof(uint32_t);
+    result = create_buffer(
+            device,
+            physical_device,
+            list_size,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+                | VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+                | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            GpuMemoryCategory_Frame,
+            &adaptive->list,
+            &adaptive->list_memory);
+    if (result > 0) return 6;
+    adaptive->list_slot = bindless_add_storage_buffer(bindless, device, adaptive->list, 0, list_size);
+    if (adaptive->list_slot == BINDLESS_INVALID) return 5;
+
+    // Active tile counts for the host.
+    VkDeviceSize status_size = TRACE_OUTPUTS * sizeof(uint32_t);
+    result = create_buffer(
+            device,
+            physical_device,
+            status_size,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            GpuMemoryCategory_Staging,
+            &adaptive->status,
+            &adaptive->status_memory);
+    if (result > 0) return 6;
+    void *mapped = NULL;
+    if (vkMapMemory(device, adaptive->status_memory, 0, status_size, 0, &mapped) != VK_SUCCESS) return 6;
+    adaptive->status_mapped = mapped;
+
+    return 0;
+}
+
+void adaptive_free(struct AdaptiveSampler *adaptive) {
+    VkDevice device = adaptive->device;
+
+    // Only called once the device is idle, slots can go back immediately.
+    if (adaptive->bindless != NULL) {
+        bindless_release(adaptive->bindless, BindlessKind_StorageImage, adaptive->moments_slot, 0);
+        bindless_release(adaptive->bindless, BindlessKind_StorageBuffer, adaptive->list_slot, 0);
+    }
+    vkDestroyImageView(device, adaptive->moments_view, NULL);
+    vkDestroyImage(device, adaptive->moments_image, NULL);
+    gpu_memory_free(device, adaptive->moments_memory);
+    vkDestroyBuffer(device, adaptive->list, NULL);
+    gpu_memory_free(device, adaptive->list_memory);
+    vkDestroyBuffer(device, adaptive->status, NULL);
+    gpu_memory_free(device, adaptive->status_memory); // Unmaps.
+
+    vkDestroyPipeline(device, adaptive->classify_pipeline, NULL);
+    vkDestroyPipelineLayout(device, adaptive->pipeline_layout, NULL);
+
+    memset(adaptive, 0, sizeof(*adaptive));
+}
+
+void adaptive_set_render_extent(struct AdaptiveSampler *adaptive, VkExtent2D extent) {
+#if DEBUG_INPUT_VALIDATION
+    if (adaptive == NULL) return;
+    if (extent.width == 0 || extent.width > adaptive->extent.width) return;
+    if (extent.height == 0 || extent.height > adaptive->extent.height) return;
+#endif
+
+    if (extent.width == adaptive->render_extent.width && extent.height == adaptive->render_extent.height) return;
+    adaptive->render_extent = extent;
+    adaptive->converged = 0;
+    adaptive->active_n = render_tiles_x(adaptive) * render_tiles_y(adaptive);
+    memset(adaptive->status_pending, 0, sizeof(adaptive->status_pending)); // counts of the old tiles
+}
+
+// Recording into this output again means its previous frame completed.
+static void adaptive_collect_status(struct AdaptiveSampler *adaptive, const struct Tracer *tracer, uint32_t output) {
+    if (!adaptive->status_pending[output]) return;
+    adaptive->status_pending[output] = 0;
+
+    uint32_t active_n = adaptive->status_mapped[output];
+    adaptive->active_n = active_n;
+    if (adaptive->settings.mode == SamplingMode_Adaptive)
+        adaptive->samples_n += (uint64_t)active_n * ADAPTIVE_TILE_SIZE * ADAPTIVE_TILE_SIZE
+            * tracer->settings.samples_per_dispatch;
+    if (active_n > 0 || adaptive->converged) return;
+
+    adaptive->converged = 1;
+    adaptive->converged_after = adaptive->status_recorded_at[output] - adaptive->started_at;
+    adaptive->converged_frames_n = adaptive->status_frame[output];
+    adaptive->converged_samples_n = adaptive->samples_n;
+    double pixels_n = (double)adaptive->render_extent.width * adaptive->render_extent.height;
+    printf("[sampling] %s reached error %g in every tile after %llu frames, %.2f s, %llu samples (%.1f spp equivalent)\n",
+            sampling_mode_name(adaptive->settings.mode),
+            adaptive->settings.target_error,
+            (unsigned long long)adaptive->converged_frames_n,
+            adaptive->converged_after,
+            (unsigned long long)adaptive->converged_samples_n,
+            adaptive->converged_samples_n / pixels_n);
+}
+
+void adaptive_prepare(
+        struct AdaptiveSampler *adaptive,
+        VkCommandBuffer command_buffer,
+        const struct Tracer *tracer,
+        uint32_t output,
+        struct TraceTiles *tiles) {
+#if DEBUG_INPUT_VALIDATION
+    if (adaptive == NULL) return;
+    if (command_buffer == VK_NULL_HANDLE) return;
+    if (tracer == NULL) return;
+    if (output >= TRACE_OUTPUTS) return;
+    if (tiles == NULL) return;
+#endif
+
+    adaptive_collect_status(adaptive, tracer, output);
+
+    // A restart throws the moments away along with the accumulation, and the
+    // old list no longer covers every pixel.
+    if (tracer->samples_n == 0) {
+        adaptive->classified = 0;
+        if (!adaptive->converged) {
+            adaptive->started_at = time_now();
+            adaptive->frames_n = 0;
+            adaptive->samples_n = 0;
+        }
+    }
+
+    if (!adaptive->initialized) {
+        VkImageMemoryBarrier barrier = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = adaptive->moments_image,
+            .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+        };
+        vkCmdPipelineBarrier(
+                command_buffer,
+                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                0,
+                0,
+                NULL,
+                0,
+                NULL,
+                1,
+                &barrier);
+        // Dispatch y and z never change.
+        vkCmdFillBuffer(command_buffer, adaptive->list, sizeof(uint32_t), 2 * sizeof(uint32_t), 1);
+        adaptive_buffer_barrier(
+                command_buffer,
+                adaptive->list,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT);
+        adaptive->initialized = 1;
+    }
+
+    tiles->moments = adaptive->moments_slot;
+    tiles->list = adaptive->list_slot;
+    tiles->list_buffer = adaptive->list;
+    tiles->indirect = adaptive->settings.mode == SamplingMode_Adaptive && adaptive->classified;
+    if (!tiles->indirect)
+        adaptive->samples_n += (uint64_t)adaptive->render_extent.width * adaptive->render_extent.height
+            * tracer->settings.samples_per_dispatch;
+}
+
+void adaptive_record(
+        struct AdaptiveSampler *adaptive,
+        VkCommandBuffer command_buffer,
+        const struct Tracer *tracer,
+        uint32_t output) {
+#if DEBUG_INPUT_VALIDATION
+    if (adaptive == NULL) return;
+    if (command_buffer == VK_NULL_HANDLE) return;
+    if (tracer == NULL) return;
+    if (output >= TRACE_OUTPUTS) return;
+#endif
+
+    // The trace consumed the list, start a new one.
+    adaptive_buffer_barrier(
+            command_buffer,
+            adaptive->list,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_TRANSFER_WRITE_BIT);
+    vkCmdFillBuffer(command_buffer, adaptive->list, 0, sizeof(uint32_t), 0);
+    adaptive_buffer_barrier(
+            command_buffer,
+            adaptive->list,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    // The trace wrote the accumulation and moments.
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+    vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            1,
+            &barrier,
+            0,
+            NULL,
+            0,
+            NULL);
+
+    // One workgroup per tile.
+    struct AdaptiveClassifyPush push = {
+        .accum = tracer->accum_slot,
+        .moments = adaptive->moments_slot,
+        .target = adaptive->settings.mode == SamplingMode_Adaptive
+            ? tracer->outputs[output].storage_slot
+            : BINDLESS_INVALID,
+        .list = adaptive->list_slot,
+        .width = adaptive->render_extent.width,
+        .height = adaptive->render_extent.height,
+        .target_error = adaptive->settings.target_error,
+        .min_samples = adaptive->settings.min_samples,
+    };
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, adaptive->classify_pipeline);
+    vkCmdBindDescriptorSets(
+            command_buffer,
+            VK_PIPELINE_BIND_POINT_COMPUTE,
+            adaptive->pipeline_layout,
+            0,
+            1,
+            &adaptive->bindless->set,
+            0,
+            NULL);
+    vkCmdPushConstants(command_buffer, adaptive->pipeline_layout, VK_SHADER_STAGE_ALL, 0, sizeof(push), &push);
+    vkCmdDispatch(command_buffer, render_tiles_x(adaptive), render_tiles_y(adaptive), 1);
+
+    // The next trace dispatches from the list, the host reads its count.
+    adaptive_buffer_barrier(
+            command_buffer,
+            adaptive->list,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT);
+    VkBufferCopy region = {
+        .srcOffset = 0,
+        .dstOffset = output * sizeof(uint32_t),
+        .size = sizeof(uint32_t),
+    };
+    vkCmdCopyBuffer(command_buffer, adaptive->list, adaptive->status, 1, &region);
+    adaptive_buffer_barrier(
+            command_buffer,
+            adaptive->status,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_HOST_BIT,
+            VK_ACCESS_HOST_READ_BIT);
+
+    adaptive->classified = 1;
+    adaptive->frames_n += 1;
+    adaptive->status_pending[output] = 1;
+    adaptive->status_recorded_at[output] = time_now();
+    adaptive->status_frame[output] = adaptive->frames_n;
+}
+
+void adaptive_report(const struct AdaptiveSampler *adaptive) {
+    if (adaptive->device == VK_NULL_HANDLE) return;
+
+    double pixels_n = (double)adaptive->render_extent.width * adaptive->render_extent.height;
+    if (adaptive->converged) {
+        printf("[sampling] %s converged to %g after %.2f s, %.1f spp equivalent\n",
+                sampling_mode_name(adaptive->settings.mode),
+                adaptive->settings.target_error,
+                adaptive->converged_after,
+                adaptive->converged_samples_n / pixels_n);
+    } else {
+        printf("[sampling] %s %u of %u tiles above %g, %.1f spp equivalent\n",
+                sampling_mode_name(adaptive->settings.mode),
+                adaptive->active_n,
+                render_tiles_x(adaptive) * render_tiles_y(adaptive),
+                adaptive->settings.target_error,
+                adaptive->samples_n / pixels_n);
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include "bindless.h"
+#include "pipeline.h"
+#include "trace.h"
+
+#define ADAPTIVE_TILE_SIZE TRACE_GROUP_SIZE // one trace workgroup per tile
+#define ADAPTIVE_LIST_HEADER 4 // uints ahead of the tile ids: dispatch x, y, z and padding
+#define ADAPTIVE_DEFAULT_ERROR 0.02f
+#define ADAPTIVE_DEFAULT_MIN_SAMPLES 8
+
+enum SamplingMode {
+    SamplingMode_Uniform = 0,
+    SamplingMode_Adaptive,
+};
+
+// Zero fields take the defaults.
+struct AdaptiveSettings {
+    enum SamplingMode mode;
+    float target_error; // relative standard error of the pixel mean, per tile
+    uint32_t min_samples; // before a tile may converge
+};
+
+// Tracks per-pixel luminance moments next to the tracer's accumulation and,
+// every frame, lists the tiles whose worst pixel is still above the target
+// error. In adaptive mode the next trace dispatch is indirect over that list,
+// so converged tiles stop costing anything. In uniform mode the list is only
+// counted, to compare how long each mode takes to reach the same error.
+struct AdaptiveSampler {
+    VkDevice device;
+    struct Bindless *bindless;
+    VkExtent2D extent; // allocated
+    VkExtent2D render_extent; // sampled, the top left of extent
+    struct AdaptiveSettings settings;
+    VkPipelineLayout pipeline_layout;
+    VkPipeline classify_pipeline;
+    //
+    VkImage moments_image;
+    VkDeviceMemory moments_memory;
+    VkImageView moments_view;
+    uint32_t moments_slot;
+    VkBuffer list; // dispatch header then tile ids
+    VkDeviceMemory list_memory;
+    uint32_t list_slot;
+    uint32_t tiles_x; // over extent
+    uint32_t tiles_n;
+    int initialized; // moments left UNDEFINED, list header written
+    int classified; // a list exists to dispatch from
+    // Active tile counts read back per frame slot, host visible.
+    VkBuffer status;
+    VkDeviceMemory status_memory;
+    const uint32_t *status_mapped;
+    int status_pending[TRACE_OUTPUTS];
+    double status_recorded_at[TRACE_OUTPUTS];
+    uint64_t status_frame[TRACE_OUTPUTS];
+    // Stats.
+    double started_at;
+    uint64_t frames_n;
+    uint64_t samples_n; // pixel samples traced
+    uint32_t active_n; // tiles above the target after the latest readback
+    int converged;
+    double converged_after; // seconds
+    uint64_t converged_frames_n;
+    uint64_t converged_samples_n;
+};
+
+int adaptive_init(
+        struct AdaptiveSampler *adaptive,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        const char *path,
+        struct PipelineBatch *pipelines,
+        struct Bindless *bindless,
+        VkExtent2D extent,
+        const struct AdaptiveSettings *settings);
+void adaptive_free(struct AdaptiveSampler *adaptive);
+
+// Classifies only the tiles over the top left extent from the next frame on.
+// A change starts convergence over, along with the tracer's accumulation.
+void adaptive_set_render_extent(struct AdaptiveSampler *adaptive, VkExtent2D extent);
+
+// Call before tracer_record on the same command buffer, with the frame slot.
+// Reads back the slot's previous count and fills what the trace should do.
+// A restarted accumulation always traces every tile.
+void adaptive_prepare(
+        struct AdaptiveSampler *adaptive,
+        VkCommandBuffer command_buffer,
+        const struct Tracer *tracer,
+        uint32_t output,
+        struct TraceTiles *tiles);
+// Classifies tiles after tracer_record and, in adaptive mode, resolves the
+// accumulation into tracer->outputs[output].
+void adaptive_record(
+        struct AdaptiveSampler *adaptive,
+        VkCommandBuffer command_buffer,
+        const struct Tracer *tracer,
+        uint32_t output);
+void adaptive_report(const struct AdaptiveSampler *adaptive);
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "util.h"
+#include "animation.h"
+
+#define GRID_VERTICES ((ANIMATION_GRID_SIZE + 1) * (ANIMATION_GRID_SIZE + 1))
+
+static float hash(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return (float)(x >> 8) / 16777216.0f;
+}
+
+// Unit grid in xz, waving along y.
+static void grid_deform(struct Animation *animation, float time) {
+    for (uint32_t z = 0; z <= ANIMATION_GRID_SIZE; z++) {
+        for (uint32_t x = 0; x <= ANIMATION_GRID_SIZE; x++) {
+            float u = (float)x / ANIMATION_GRID_SIZE;
+            float v = (float)z / ANIMATION_GRID_SIZE;
+            float *p = animation->grid_positions + (z * (ANIMATION_GRID_SIZE + 1) + x) * 4;
+            p[0] = u - 0.5f;
+            p[1] = 0.1f * sinf(10.0f * u + 3.0f * time) * cosf(7.0f * v + 2.0f * time) + 0.3f * u * v * sinf(time);
+            p[2] = v - 0.5f;
+            p[3] = 0.0f;
+        }
+    }
+}
+
+int animation_init(struct Animation *animation, struct Workers *workers, const struct Scene *scene, uint32_t instances_n) {
+#if DEBUG_INPUT_VALIDATION
+    if (animation == NULL) return 1;
+    if (!IS_ZERO_PTR(animation)) return 1;
+    if (scene == NULL || scene->triangles_n == 0) return 1;
+    if (instances_n == 0) return 1;
+#endif
+
+    // Grid.
+    animation->grid_triangles_n = ANIMATION_GRID_SIZE * ANIMATION_GRID_SIZE * 2;
+    animation->grid_positions = malloc(GRID_VERTICES * 4 * sizeof(float));
+    animation->grid_indices = malloc(animation->grid_triangles_n * 3 * sizeof(uint32_t));
+    animation->orbits = malloc(instances_n * 4 * sizeof(float));
+    if (animation->grid_positions == NULL || animation->grid_indices == NULL || animation->orbits == NULL) {
+        animation_free(animation);
+        return 2;
+    }
+    uint32_t *index = animation->grid_indices;
+    for (uint32_t z = 0; z < ANIMATION_GRID_SIZE; z++) {
+        for (uint32_t x = 0; x < ANIMATION_GRID_SIZE; x++) {
+            uint32_t a = z * (ANIMATION_GRID_SIZE + 1) + x;
+            uint32_t b = a + ANIMATION_GRID_SIZE + 1;
+            uint32_t quad[6] = { a, b, a + 1, a + 1, b, b + 1 };
+            memcpy(index, quad, sizeof(quad));
+            index += 6;
+        }
+    }
+    grid_deform(animation, 0.0f);
+
+    //
+    if (tlas_init(&animation->tlas, workers, 0.0f) > 0) {
+        animation_free(animation);
+        return 3;
+    }
+    animation->scene_mesh = tlas_add_mesh(&animation->tlas, scene->positions, scene->indices, scene->triangles_n, 0);
+    animation->grid_mesh = tlas_add_mesh(
+            &animation->tlas,
+            animation->grid_positions,
+            animation->grid_indices,
+            animation->grid_triangles_n,
+            1);
+    if (animation->scene_mesh == UINT32_MAX || animation->grid_mesh == UINT32_MAX) {
+        animation_free(animation);
+        return 3;
+    }
+
+    // Instances scattered on orbits a few scene sizes out.
+    float diagonal = 0.0f;
+    for (int c = 0; c < 3; c++)
+        diagonal += (scene->bounds_max[c] - scene->bounds_min[c]) * (scene->bounds_max[c] - scene->bounds_min[c]);
+    animation->extent = sqrtf(diagonal);
+    const float identity[12] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0 };
+    for (uint32_t i = 0; i < instances_n; i++) {
+        float *orbit = animation->orbits + i * 4;
+        orbit[0] = animation->extent * (1.0f + 20.0f * hash(i * 4));
+        orbit[1] = animation->extent * (10.0f * hash(i * 4 + 1) - 5.0f);
+        orbit[2] = 0.2f + hash(i * 4 + 2);
+        orbit[3] = 6.2831853f * hash(i * 4 + 3);
+        uint32_t mesh = i % 2 == 0 ? animation->scene_mesh : animation->grid_mesh;
+        if (tlas_add_instance(&animation->tlas, mesh, identity) == UINT32_MAX) {
+            animation_free(animation);
+            return 2;
+        }
+    }
+    if (animation_update(animation, 0.0) > 0) {
+        animation_free(animation);
+        return 3;
+    }
+
+    return 0;
+}
+
+void animation_free(struct Animation *animation) {
+    tlas_free(&animation->tlas); // Zeroes itself.
+    free(animation->grid_positions);
+    free(animation->grid_indices);
+    free(animation->orbits);
+    memset(animation, 0, sizeof(*animation));
+}
+
+int animation_update(struct Animation *animation, double time) {
+    double start = time_now();
+    float t = (float)time;
+
+    grid_deform(animation, t);
+
+    // Each instance orbits the scene, turning about y to face along its path.
+    struct Tlas *tlas = &animation->tlas;
+    for (uint32_t i = 0; i < tlas->instances_n; i++) {
+        const float *orbit = animation->orbits + i * 4;
+        float angle = orbit[3] + orbit[2] * t;
+        float c = cosf(angle), s = sinf(angle);
+        float scale = tlas->instances[i].mesh == animation->grid_mesh ? animation->extent * 0.1f : 0.2f;
+        float transform[12] = {
+            c * scale, 0.0f, s * scale, orbit[0] * c,
+            0.0f, scale, 0.0f, orbit[1],
+            -s * scale, 0.0f, c * scale, orbit[0] * s,
+        };
+        memcpy(tlas->instances[i].transform, transform, sizeof(transform));
+    }
+
+    //
+    if (tlas_update(tlas) > 0) return 2;
+    animation->update_time = time_now() - start;
+
+    return 0;
+}
+
+void animation_report(const struct Animation *animation) {
+    printf("[animation] last update %.3f ms\n", animation->update_time * 1e3);
+    tlas_report(&animation->tlas);
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+#include "scene.h"
+#include "tlas.h"
+#include "worker.h"
+
+#define ANIMATION_GRID_SIZE 128 // quads per side of the deforming mesh
+
+// Animated instances of the scene's mesh and of a waving grid, kept in a
+// two level structure on the CPU. Every update moves the instances and the
+// grid's vertices, then updates the structure. Only benchmarks the updates,
+// the trace kernels keep traversing the static scene.
+struct Animation {
+    struct Tlas tlas;
+    // Deforming grid, rest positions are implied by the grid coordinates.
+    float *grid_positions; // 4 floats per vertex
+    uint32_t *grid_indices;
+    uint32_t grid_triangles_n;
+    uint32_t grid_mesh;
+    uint32_t scene_mesh;
+    // Per instance orbit around the scene.
+    float *orbits; // radius, height, speed and phase per instance
+    float extent; // scene bounds diagonal
+    double update_time; // seconds, last animation_update
+};
+
+// instances_n alternates between the scene and the grid.
+int animation_init(struct Animation *animation, struct Workers *workers, const struct Scene *scene, uint32_t instances_n);
+void animation_free(struct Animation *animation);
+
+// time in seconds. Returns 2 when the structure could not be updated.
+int animation_update(struct Animation *animation, double time);
+void animation_report(const struct Animation *animation);
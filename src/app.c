@@ -10,14 +10,28 @@
 
 #include "app.h"
 #include "util.h"
-
-int create_vk_instance(VkInstance *instance);
+#include "pipeline.h"
+#include "gpu_memory.h"
+
+// Must match tri.frag.
+struct CompositePush {
+    uint32_t image;
+    uint32_t upscale; // enum Upscale
+    uint32_t width; // rendered rectangle, the top left of the image
+    uint32_t height;
+};
+
+int create_vk_instance(struct HostMemory *host, VkInstance *instance);
 int create_vk_device(
+        struct HostMemory *host,
         VkInstance instance, 
         VkSurfaceKHR surface, 
         VkPhysicalDevice *pdevice, 
         VkDevice *device, 
-        uint32_t *gqf, uint32_t *pqf);
+        uint32_t *gqf, uint32_t *pqf, uint32_t *cqf,
+        int want_ray_query,
+        int *ray_query,
+        int *memory_budget);
 int query_device_swapchain_support(
         VkPhysicalDevice physical_device,
         VkSurfaceKHR surface,
@@ -28,6 +42,7 @@ int query_device_swapchain_support(
         VkPresentModeKHR **present_modes); 
 int create_vk_swapchain(
         VkDevice device, 
+        const VkAllocationCallbacks *allocator,
         VkPhysicalDevice pdevice, 
         VkSurfaceKHR surface, 
         const struct SwapchainSupportDetails *details,
@@ -37,11 +52,12 @@ int create_vk_swapchain(
         VkExtent2D *extent);
 int create_vk_image_views(
         VkDevice device, 
+        const VkAllocationCallbacks *allocator,
         int n, 
         VkImage *images, 
         VkFormat format, 
         VkImageView *image_views);
-int create_vk_render_pass(VkDevice device, VkFormat format, VkRenderPass *render_pass);
+int create_vk_render_pass(VkDevice device, const VkAllocationCallbacks *allocator, VkFormat format, VkRenderPass *render_pass);
 int create_shader_modules(
         VkDevice device,
         const char *path,
@@ -50,13 +66,16 @@ int create_shader_modules(
         VkShaderModule *shader_modules);
 int create_graphics_pipeline(
         VkDevice device, 
+        const VkAllocationCallbacks *allocator,
         const char * const path, 
-        VkFormat *swapchain_format,
+        VkFormat swapchain_format,
+        VkDescriptorSetLayout set_layout,
         VkPipelineLayout *pipeline_layout, 
         VkPipeline *pipeline);
-int create_vertex_buffer(VkDevice device, size_t size, VkBuffer *buffer);
+int create_vertex_buffer(VkDevice device, const VkAllocationCallbacks *allocator, size_t size, VkBuffer *buffer);
 int create_framebuffers(
         VkDevice device,
+        struct HostMemory *host,
         VkRenderPass render_pass,
         VkExtent2D extent,
         uint32_t n,
@@ -64,15 +83,31 @@ int create_framebuffers(
         VkFramebuffer **framebuffers);
 int create_command_pool(
         VkDevice device, 
-        uint32_t graphics_queue_family, 
+        const VkAllocationCallbacks *allocator,
+        uint32_t queue_family, 
+        uint32_t command_buffers_n,
         VkCommandPool *command_pool, 
-        VkCommandBuffer *command_buffer);
+        VkCommandBuffer *command_buffers);
+int create_frame_graph(struct App *app, const struct Options *options);
+void load_scene_job(void *arg);
+void load_environment_job(void *arg);
+void build_sampler_job(void *arg);
+void create_composite_pipeline_job(void *arg);
 int draw(struct App *app); // TODO
-
-enum AppErr app_init(struct App *app, const char *path) {
+void report_kernels(struct App *app);
+void report_paths(struct App *app);
+void memory_pressure(void *user, uint32_t heap, VkDeviceSize usage, VkDeviceSize budget);
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods);
+void cursor_position_callback(GLFWwindow *window, double x, double y);
+void scroll_callback(GLFWwindow *window, double x, double y);
+void framebuffer_size_callback(GLFWwindow *window, int width, int height);
+void window_refresh_callback(GLFWwindow *window);
+
+enum AppErr app_init(struct App *app, const char *path, const struct Options *options) {
 #if DEBUG_INPUT_VALIDATION
     // Check inputs.
-    if (app == NULL || path == NULL)
+    if (app == NULL || path == NULL || options == NULL)
         return AppErr_InvalidInput;
 
     // Check if app is zeroed.
@@ -81,8 +116,34 @@ enum AppErr app_init(struct App *app, const char *path) {
 #endif
 
     int result = 0; // Generic int for returns.
-   
+    uint32_t stage = 0; // Of the startup timeline.
+
+    // Host allocations of the app and its Vulkan objects go through here.
+    result = host_memory_init(&app->host);
+    if (result > 0) return AppErr_InitHostMemoryErr;
+    const VkAllocationCallbacks *allocator = &app->host.callbacks;
+
+    result = startup_init(&app->startup);
+    if (result > 0) return AppErr_InitStartupErr;
+    app->path = path;
+
+    // Spin up worker threads first, startup work overlaps on them.
+    stage = startup_begin(&app->startup, "workers", 0);
+    result = workers_init(&app->workers, 0);
+    if (result > 0) return AppErr_InitWorkersErr;
+    startup_end(&app->startup, stage);
+
+    // Load the scene and build its BVH alongside device creation.
+    app->scene_path = options->scene_path;
+    workers_push(&app->workers, load_scene_job, app);
+    app->environment_path = options->environment_path;
+    app->environment_sampling = options->environment_sampling;
+    if (app->environment_path != NULL) workers_push(&app->workers, load_environment_job, app);
+    app->sample_sequence = options->sample_sequence;
+    if (app->sample_sequence == SamplerSequence_Sobol) workers_push(&app->workers, build_sampler_job, app);
+
     // Set up GLFW.
+    stage = startup_begin(&app->startup, "glfw", 0);
     int glfw_status = glfwInit();
     if (glfw_status == GLFW_FALSE)
         return AppErr_GlfwInitErr;
@@ -90,40 +151,123 @@ enum AppErr app_init(struct App *app, const char *path) {
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
     app->window = glfwCreateWindow(800, 600, "Raytrace", NULL, NULL);
     if (app->window == NULL) return AppErr_InitWindowErr;
+    startup_end(&app->startup, stage);
 
     // Create vulkan instance
-    result = create_vk_instance(&app->instance);
+    stage = startup_begin(&app->startup, "instance", 0);
+    result = create_vk_instance(&app->host, &app->instance);
     if (result > 0) return AppErr_InitVkInstanceErr;
+    startup_end(&app->startup, stage);
 
     // Create vulkan surface though GLFW.
-    result = glfwCreateWindowSurface(app->instance, app->window, NULL, &app->surface);
+    stage = startup_begin(&app->startup, "surface", 0);
+    result = glfwCreateWindowSurface(app->instance, app->window, allocator, &app->surface);
     if (result > 0) return AppErr_InitVkSurfaceErr;
+    startup_end(&app->startup, stage);
 
     // Create vulkan device.
-    VkPhysicalDevice physical_device = VK_NULL_HANDLE;
+    stage = startup_begin(&app->startup, "device", 0);
     uint32_t graphics_queue_family = -1;
     uint32_t present_queue_family = -1;
+    uint32_t compute_queue_family = -1;
+    int memory_budget = 0;
     result = create_vk_device(
+            &app->host,
             app->instance, 
             app->surface, 
-            &physical_device, 
+            &app->physical_device, 
             &app->device, 
             &graphics_queue_family, 
-            &present_queue_family);
+            &present_queue_family,
+            &compute_queue_family,
+            options->traversal_mode != TraversalMode_Software,
+            &app->ray_query,
+            &memory_budget);
     if (result > 0) return AppErr_InitVkDeviceErr;
+    startup_end(&app->startup, stage);
+
+    // Track every device allocation from here on.
+    result = gpu_memory_tracker_init(app->physical_device, memory_budget, options->memory_soft_limit);
+    if (result > 0) return AppErr_InitMemoryErr;
+    printf("[memory] %s, soft limit at %.0f%% of each heap's budget\n",
+            memory_budget ? "driver budgets" : "no VK_EXT_memory_budget, budgets are heap sizes",
+            (options->memory_soft_limit > 0.0f ? options->memory_soft_limit : GPU_MEMORY_DEFAULT_SOFT_LIMIT) * 100.0f);
+    if (options->traversal_mode == TraversalMode_Hardware && !app->ray_query)
+        printf("[trace] ray queries unsupported, using software traversal\n");
+    printf("[trace] %s traversal\n", app->ray_query ? "hardware" : "software");
     
     // Extract vk queues.
     vkGetDeviceQueue(app->device, graphics_queue_family, 0, &app->graphics_queue);
     vkGetDeviceQueue(app->device, present_queue_family, 0, &app->present_queue);
+    vkGetDeviceQueue(app->device, compute_queue_family, 0, &app->compute_queue);
+    app->graphics_queue_family = graphics_queue_family;
+    app->compute_queue_family = compute_queue_family;
+
+    // Async compute needs a family of its own, otherwise it falls back to
+    // recording the trace into the graphics submission.
+    int dedicated_compute = compute_queue_family != graphics_queue_family;
+    if (options->queue_mode == QueueMode_Async && !dedicated_compute)
+        printf("[queue] no dedicated compute family, using a single queue\n");
+    app->async_compute = dedicated_compute && options->queue_mode != QueueMode_Single;
+    printf("[queue] graphics family %u, compute family %u, %s\n",
+            graphics_queue_family,
+            compute_queue_family,
+            app->async_compute ? "async compute" : "single queue");
+
+    // Create the global bindless descriptor set, every pipeline layout
+    // starts from it.
+    stage = startup_begin(&app->startup, "bindless", 0);
+    result = bindless_init(&app->bindless, &app->host, app->device, app->physical_device, app->ray_query);
+    if (result > 0) return AppErr_InitBindlessErr;
+    startup_end(&app->startup, stage);
+
+    // Read shaders and compile pipelines on the workers while the swapchain
+    // is created. The modules take their pipelines from the batch later.
+    app->denoise_enabled = options->denoise;
+    app->adaptive_enabled = options->sampling;
+    app->path_mode = options->path_mode;
+    if (app->path_mode != PathMode_Megakernel && (app->denoise_enabled || app->adaptive_enabled)) {
+        printf("[trace] wavefront paths write no denoiser guides or sample moments, using the megakernel\n");
+        app->path_mode = PathMode_Megakernel;
+    }
+    app->wavefront_active = app->path_mode == PathMode_Wavefront;
+    result = pipeline_batch_init(&app->pipelines, app->device, path, app->bindless.layout, &app->workers);
+    if (result > 0) return AppErr_InitPipelinesErr;
+    // Adaptive tiles are one trace workgroup each.
+    struct TraceSettings trace_settings = options->trace_settings;
+    if (app->adaptive_enabled && trace_settings.group_size != 0 && trace_settings.group_size != TRACE_GROUP_SIZE) {
+        printf("[trace] adaptive sampling needs %dx%d groups\n", TRACE_GROUP_SIZE, TRACE_GROUP_SIZE);
+        trace_settings.group_size = TRACE_GROUP_SIZE;
+    }
+    int tiled = app->adaptive_enabled
+        && options->adaptive_settings.mode == SamplingMode_Adaptive
+        && !app->denoise_enabled;
+    uint32_t trace_features = (app->denoise_enabled ? TRACE_FEATURE_GUIDES : 0)
+        | (app->adaptive_enabled ? TRACE_FEATURE_MOMENTS : 0)
+        | (tiled ? TRACE_FEATURE_TILES : 0);
+    result = tracer_precompile(&app->pipelines, app->ray_query, &trace_settings, trace_features);
+    if (app->path_mode != PathMode_Megakernel)
+        result |= wavefront_precompile(&app->pipelines, app->ray_query, options->wavefront_sort);
+    if (app->denoise_enabled) {
+        result |= pipeline_batch_push(&app->pipelines, "denoise_temporal.comp.spv");
+        result |= pipeline_batch_push(&app->pipelines, "denoise_atrous.comp.spv");
+        result |= pipeline_batch_push(&app->pipelines, "denoise_error.comp.spv");
+    }
+    if (app->adaptive_enabled)
+        result |= pipeline_batch_push(&app->pipelines, "adaptive_classify.comp.spv");
+    if (result > 0) return AppErr_InitPipelinesErr;
+    workers_push(&app->workers, create_composite_pipeline_job, app);
   
     // Query physical device for swapchain support details.
-    result = swapchain_support_details_init(&app->swapchain_support, physical_device, app->surface);
+    result = swapchain_support_details_init(&app->swapchain_support, app->physical_device, app->surface);
     assert(result == 0); // Only way this can fail is via an input error.
 
     // Create swapchain.
+    stage = startup_begin(&app->startup, "swapchain", 0);
     result = create_vk_swapchain(
             app->device, 
-            physical_device, 
+            allocator,
+            app->physical_device, 
             app->surface, 
             &app->swapchain_support,
             graphics_queue_family, 
@@ -132,108 +276,629 @@ enum AppErr app_init(struct App *app, const char *path) {
             &app->swapchain_format, 
             &app->swapchain_extent);
     if (result > 0) return AppErr_InitVkSwapchainErr;
+    startup_end(&app->startup, stage);
 
     // Extract swapchain images.
+    stage = startup_begin(&app->startup, "image views", 0);
     vkGetSwapchainImagesKHR(app->device, app->swapchain, &app->swapchain_images_n, NULL);
-    app->swapchain_images = calloc(app->swapchain_images_n, sizeof(VkImage));
+    app->swapchain_images = host_alloc(
+            &app->host,
+            app->swapchain_images_n * sizeof(VkImage),
+            _Alignof(VkImage),
+            VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    if (app->swapchain_images == NULL) return AppErr_InitVkImageViewErr;
     vkGetSwapchainImagesKHR(
             app->device, 
             app->swapchain, 
             &app->swapchain_images_n, 
             app->swapchain_images);
-    app->swapchain_image_views = calloc(app->swapchain_images_n, sizeof(VkImageView));
+    app->swapchain_image_views = host_alloc(
+            &app->host,
+            app->swapchain_images_n * sizeof(VkImageView),
+            _Alignof(VkImageView),
+            VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    if (app->swapchain_image_views == NULL) return AppErr_InitVkImageViewErr;
+    memset(app->swapchain_image_views, 0, app->swapchain_images_n * sizeof(VkImageView));
     result = create_vk_image_views(
             app->device, 
+            allocator,
             app->swapchain_images_n, 
             app->swapchain_images, 
             app->swapchain_format, 
             app->swapchain_image_views); 
     if (result > 0) return AppErr_InitVkImageViewErr; 
+    startup_end(&app->startup, stage);
+
+    // Create the per queue timelines.
+    result = timeline_init(&app->graphics_timeline, app->device);
+    if (result > 0) return AppErr_InitSyncErr;
+    result = timeline_init(&app->compute_timeline, app->device);
+    if (result > 0) return AppErr_InitSyncErr;
+
+    // Create texture streamer. It uploads on the queue the trace samples
+    // from, so its images stay with one queue family.
+    stage = startup_begin(&app->startup, "texture streamer", 0);
+    result = texture_streamer_init(
+            &app->textures,
+            &app->host,
+            app->device,
+            app->physical_device,
+            app->async_compute ? compute_queue_family : graphics_queue_family,
+            app->async_compute ? app->compute_queue : app->graphics_queue,
+            app->async_compute ? &app->compute_timeline : &app->graphics_timeline,
+            &app->bindless,
+            &app->workers,
+            TEXTURE_DEFAULT_BUDGET);
+    if (result > 0) return AppErr_InitTexturesErr;
+    startup_end(&app->startup, stage);
+    gpu_memory_set_pressure_callback(memory_pressure, app);
+
+    // Create frame capture.
+    stage = startup_begin(&app->startup, "capture", 0);
+    app->capture_enabled =
+        (app->swapchain_support.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) != 0;
+    app->capture_every = options->capture_every;
+    app->video_enabled = options->video_path != NULL;
+    if (app->video_enabled) {
+        if (!app->capture_enabled) return AppErr_InitVideoErr;
+        result = video_init(
+                &app->video,
+                options->video_path,
+                options->video_format,
+                app->swapchain_extent.width,
+                app->swapchain_extent.height,
+                options->video_fps > 0 ? options->video_fps : 30);
+        if (result > 0) return AppErr_InitVideoErr;
+        app->capture_every = 1;
+    }
+    if (app->capture_enabled) {
+        result = capture_init(
+                &app->capture,
+                &app->host,
+                app->device,
+                app->physical_device,
+                &app->graphics_timeline,
+                &app->workers,
+                app->video_enabled ? &app->video : NULL,
+                app->swapchain_extent,
+                options->capture_format,
+                options->capture_directory != NULL ? options->capture_directory : ".");
+        if (result > 0) return AppErr_InitCaptureErr;
+    } else {
+        printf("[capture] swapchain images cannot be copied, capture disabled\n");
+    }
+    startup_end(&app->startup, stage);
+
+    // Idle once converged, unless every frame is wanted: video, periodic
+    // captures and the comparisons need a steady stream of frames.
+    int continuous = options->continuous
+        || app->capture_every > 0
+        || options->trace_settings.kernel == TraceKernel_Compare
+        || app->path_mode == PathMode_Compare;
+    result = idle_init(&app->idle, !continuous, options->idle_samples);
+    if (result > 0) return AppErr_InitIdleErr;
+    glfwSetWindowUserPointer(app->window, app);
+    glfwSetKeyCallback(app->window, key_callback);
+    glfwSetMouseButtonCallback(app->window, mouse_button_callback);
+    glfwSetCursorPosCallback(app->window, cursor_position_callback);
+    glfwSetScrollCallback(app->window, scroll_callback);
+    glfwSetFramebufferSizeCallback(app->window, framebuffer_size_callback);
+    glfwSetWindowRefreshCallback(app->window, window_refresh_callback);
+
+    // Join the scene and pipeline jobs, nothing else runs on the workers yet.
+    stage = startup_begin(&app->startup, "wait for workers", 0);
+    workers_wait_idle(&app->workers);
+    pipeline_batch_wait(&app->pipelines);
+    startup_end(&app->startup, stage);
+    for (uint32_t i = 0; i < app->pipelines.jobs_n; i++) {
+        const struct PipelineBatchJob *job = &app->pipelines.jobs[i];
+        char name[STARTUP_NAME_MAX];
+        snprintf(name, sizeof(name), "read %s", job->name);
+        startup_record(&app->startup, name, 1, job->started_at, job->read_at);
+        snprintf(name, sizeof(name), "compile %s", job->name);
+        startup_record(&app->startup, name, 1, job->read_at, job->finished_at);
+    }
+    if (app->scene_result > 0) return AppErr_InitSceneErr;
+    if (app->environment_result > 0) return AppErr_InitEnvironmentErr;
+    if (app->sampler_result > 0) return AppErr_InitSequenceErr;
+    if (app->pipeline_result > 0) return AppErr_InitVkGraphicsPipelineErr;
+    printf("[scene] %u triangles, bvh %u nodes, sah %.1f, built in %.2f ms\n",
+            app->scene.triangles_n,
+            app->bvh.nodes_n,
+            bvh_sah_cost(&app->bvh),
+            app->bvh.build_time * 1e3);
+    light_tree_report(&app->lights);
+    if (app->environment_path != NULL) environment_report(&app->environment);
+    if (app->sample_sequence == SamplerSequence_Sobol) sampler_report(&app->sampler);
+
+    // Wavefront paths shade without textures, so on a textured scene the
+    // comparison would only measure the missing textures. The wavefront
+    // pipelines already compiled are destroyed with the batch.
+    if (app->path_mode == PathMode_Compare && app->scene.textures_n > 0) {
+        printf("[trace] wavefront paths shade without textures, nothing to compare on a textured scene, using the megakernel\n");
+        app->path_mode = PathMode_Megakernel;
+    }
 
-    // Create graphics pipeline. 
-    result = create_graphics_pipeline(
-            app->device, 
+    // Size the trace and denoise images for the largest scale, frames render
+    // into their top left.
+    result = resolution_init(&app->resolution, app->swapchain_extent, &options->resolution_settings);
+    if (result > 0) return AppErr_InitResolutionErr;
+    VkExtent2D render_extent = app->resolution.max_extent;
+
+    // Create path tracer. Its buffers belong to the queue it runs on.
+    stage = startup_begin(&app->startup, "tracer", 0);
+    result = tracer_init(
+            &app->tracer,
+            app->device,
+            app->physical_device,
+            app->async_compute ? app->compute_queue : app->graphics_queue,
+            app->async_compute ? compute_queue_family : graphics_queue_family,
             path,
-            &app->swapchain_format,
-            &app->pipeline_layout, 
-            &app->pipeline);
-    if (result > 0) return AppErr_InitVkGraphicsPipelineErr;
+            &app->pipelines,
+            &app->bindless,
+            &app->scene,
+            &app->bvh,
+            app->environment_path != NULL ? &app->environment : NULL,
+            app->sample_sequence == SamplerSequence_Sobol ? &app->sampler : NULL,
+            app->ray_query,
+            render_extent,
+            &trace_settings,
+            trace_features);
+    if (result > 0) return AppErr_InitTracerErr;
+    startup_end(&app->startup, stage);
+    static const char *kernel_names[] = { "specialized", "uniform branching", "compare" };
+    printf("[trace] %s kernel, %u bounces, %u spp per frame, %ux%u groups\n",
+            kernel_names[app->tracer.settings.kernel],
+            app->tracer.settings.bounces,
+            app->tracer.settings.samples_per_dispatch,
+            app->tracer.settings.group_size,
+            app->tracer.settings.group_size);
+
+    // Stream the scene's textures. Loaded in scene order, their ids are
+    // their scene indices.
+    if (app->scene.textures_n > 0) {
+        app->texture_footprints = host_alloc(
+                &app->host,
+                app->scene.textures_n * sizeof(float),
+                _Alignof(float),
+                VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+        app->texture_slots = host_alloc(
+                &app->host,
+                app->scene.textures_n * sizeof(uint32_t),
+                _Alignof(uint32_t),
+                VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+        if (app->texture_footprints == NULL || app->texture_slots == NULL) return AppErr_InitTexturesErr;
+        for (uint32_t i = 0; i < app->scene.textures_n; i++)
+            texture_streamer_load(&app->textures, app->scene.textures[i].path);
+        printf("[texture] %u scene textures%s\n",
+                app->scene.textures_n,
+                app->path_mode == PathMode_Megakernel ? "" : ", wavefront paths shade without them");
+    }
+
+    // Wavefront stages over the tracer's scene and accumulation.
+    if (app->path_mode != PathMode_Megakernel) {
+        stage = startup_begin(&app->startup, "wavefront", 0);
+        result = wavefront_init(
+                &app->wavefront,
+                app->device,
+                app->physical_device,
+                app->async_compute ? app->compute_queue : app->graphics_queue,
+                app->async_compute ? compute_queue_family : graphics_queue_family,
+                path,
+                &app->pipelines,
+                &app->bindless,
+                &app->scene,
+                &app->lights,
+                &app->tracer,
+                options->wavefront_sort);
+        if (result > 0) return AppErr_InitWavefrontErr;
+        startup_end(&app->startup, stage);
+        static const char *path_mode_names[] = { "megakernel", "wavefront", "compare" };
+        static const char *sort_names[] = { "unsorted", "morton sorted", "material sorted" };
+        printf("[wavefront] %s paths, %s, %u paths per queue, %u emissive triangles\n",
+                path_mode_names[app->path_mode],
+                sort_names[app->wavefront.sort],
+                app->wavefront.capacity,
+                app->wavefront.lights_n);
+    }
+
+    // Animated instances, updated on the CPU next to each frame.
+    app->animation_enabled = options->animated_instances > 0;
+    if (app->animation_enabled) {
+        stage = startup_begin(&app->startup, "animation", 0);
+        result = animation_init(&app->animation, &app->workers, &app->scene, options->animated_instances);
+        if (result > 0) return AppErr_InitAnimationErr;
+        startup_end(&app->startup, stage);
+        printf("[animation] %u instances, %u triangle deforming grid, blas built in %.2f ms\n",
+                app->animation.tlas.instances_n,
+                app->animation.grid_triangles_n,
+                app->animation.tlas.meshes[app->animation.grid_mesh].bvh.build_time * 1e3);
+    }
+
+    // Build the frame graph, which owns the denoiser's per-frame images.
+    stage = startup_begin(&app->startup, "frame graph", 0);
+    result = create_frame_graph(app, options);
+    if (result > 0) return AppErr_InitGraphErr;
+    startup_end(&app->startup, stage);
+
+    // Create denoiser.
+    if (app->denoise_enabled) {
+        stage = startup_begin(&app->startup, "denoiser", 0);
+        result = denoiser_init(
+                &app->denoiser,
+                app->device,
+                app->physical_device,
+                path,
+                &app->pipelines,
+                &app->bindless,
+                render_extent,
+                &options->denoise_settings,
+                app->denoise_scratch);
+        if (result > 0) return AppErr_InitDenoiserErr;
+        startup_end(&app->startup, stage);
+        printf("[denoise] %u iterations, weights %g,%g,%g, alpha %g\n",
+                app->denoiser.settings.iterations,
+                app->denoiser.settings.sigma_luminance,
+                app->denoiser.settings.sigma_normal,
+                app->denoiser.settings.sigma_depth,
+                app->denoiser.settings.alpha);
+    }
+
+    // Create per-tile sampler. The denoiser needs every pixel's sample each
+    // frame, so only the statistics are kept alongside it.
+    if (app->adaptive_enabled) {
+        struct AdaptiveSettings settings = options->adaptive_settings;
+        if (app->denoise_enabled && settings.mode == SamplingMode_Adaptive) {
+            printf("[sampling] adaptive sampling is off while denoising, measuring uniform\n");
+            settings.mode = SamplingMode_Uniform;
+        }
+        stage = startup_begin(&app->startup, "sampler", 0);
+        result = adaptive_init(
+                &app->adaptive,
+                app->device,
+                app->physical_device,
+                path,
+                &app->pipelines,
+                &app->bindless,
+                render_extent,
+                &settings);
+        if (result > 0) return AppErr_InitSamplerErr;
+        startup_end(&app->startup, stage);
+        printf("[sampling] %s, target error %g, %u tiles of %dx%d\n",
+                app->adaptive.settings.mode == SamplingMode_Adaptive ? "adaptive" : "uniform",
+                app->adaptive.settings.target_error,
+                app->adaptive.tiles_n,
+                ADAPTIVE_TILE_SIZE,
+                ADAPTIVE_TILE_SIZE);
+    }
+    pipeline_batch_free(&app->pipelines); // Zeroes itself, every pipeline was taken.
 
-    // Create command pool and alloc command buffer.
+    // GPU timestamps around the trace work.
+    result = profiler_init(
+            &app->profiler,
+            app->device,
+            app->physical_device,
+            app->async_compute ? compute_queue_family : graphics_queue_family,
+            FRAMES_IN_FLIGHT);
+    if (result > 0) return AppErr_InitProfilerErr;
+    if (app->resolution.settings.target_ms > 0.0f) {
+        static const char *upscale_names[] = { "bilinear", "edge aware" };
+        printf("[resolution] %.2f ms target, scale %g to %g of %ux%u, %s upscale\n",
+                app->resolution.settings.target_ms,
+                app->resolution.settings.min_scale,
+                app->resolution.settings.max_scale,
+                app->swapchain_extent.width,
+                app->swapchain_extent.height,
+                upscale_names[app->resolution.settings.upscale]);
+        if (app->profiler.query_pool == VK_NULL_HANDLE)
+            printf("[resolution] no GPU times to steer by, staying at %ux%u\n",
+                    app->resolution.max_extent.width,
+                    app->resolution.max_extent.height);
+    }
+
+    // Create command pools and alloc a command buffer per frame in flight.
+    VkCommandBuffer command_buffers[FRAMES_IN_FLIGHT] = { VK_NULL_HANDLE };
     result = create_command_pool(
             app->device,
+            allocator,
             graphics_queue_family,
+            FRAMES_IN_FLIGHT,
             &app->command_pool,
-            &app->command_buffer);
+            command_buffers);
     if (result > 0) return AppErr_InitCommandPoolErr;
+    for (int i = 0; i < FRAMES_IN_FLIGHT; i++)
+        app->frames[i].graphics_command_buffer = command_buffers[i];
+    if (app->async_compute) {
+        VkCommandBuffer compute_command_buffers[FRAMES_IN_FLIGHT] = { VK_NULL_HANDLE };
+        result = create_command_pool(
+                app->device,
+                allocator,
+                compute_queue_family,
+                FRAMES_IN_FLIGHT,
+                &app->compute_command_pool,
+                compute_command_buffers);
+        if (result > 0) return AppErr_InitCommandPoolErr;
+        for (int i = 0; i < FRAMES_IN_FLIGHT; i++)
+            app->frames[i].compute_command_buffer = compute_command_buffers[i];
+    }
 
-    // Create sync objects. (TODO: error check this?)
+    // Create sync objects.
     VkSemaphoreCreateInfo semaphore_cinfo = { .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
-    vkCreateSemaphore(app->device, &semaphore_cinfo, NULL, &app->image_available);
-    vkCreateSemaphore(app->device, &semaphore_cinfo, NULL, &app->render_finished);
-    VkFenceCreateInfo fence_cinfo = { 
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        .flags = VK_FENCE_CREATE_SIGNALED_BIT,
-    };
-    vkCreateFence(app->device, &fence_cinfo, NULL, &app->in_flight);
+    for (int i = 0; i < FRAMES_IN_FLIGHT; i++) {
+        struct Frame *frame = &app->frames[i];
+        if (vkCreateSemaphore(app->device, &semaphore_cinfo, allocator, &frame->image_available) != VK_SUCCESS)
+            return AppErr_InitSyncErr;
+        if (vkCreateSemaphore(app->device, &semaphore_cinfo, allocator, &frame->render_finished) != VK_SUCCESS)
+            return AppErr_InitSyncErr;
+    }
 
     return AppErr_None;
 }
 
 enum AppErr app_run(struct App *app) {
+    app->report_time = time_now();
+    app->report_frame_n = app->frame_n;
     while(!glfwWindowShouldClose(app->window)) {
-        glfwPollEvents();
-
-        // Draw.
+        // Sleeps in the event loop while idle, the timeout picks up async work.
+        if (app->idle.idle)
+            glfwWaitEventsTimeout(IDLE_WAIT_TIMEOUT);
+        else
+            glfwPollEvents();
+
+        // F12 captures the next frame.
+        int capture_key_down = glfwGetKey(app->window, GLFW_KEY_F12) == GLFW_PRESS;
+        if (capture_key_down && !app->capture_key_down) app->capture_requested = 1;
+        app->capture_key_down = capture_key_down;
+
+        gpu_memory_update();
+
+        //
+        int converged = app->adaptive_enabled
+            ? app->adaptive.converged
+            : app->tracer.samples_n >= app->idle.target_samples;
+        int busy = app->textures.textures_n > 0 && texture_streamer_busy(&app->textures);
+        if (!idle_should_draw(&app->idle, converged, busy, app->animation_enabled, app->profiler.busy_ms))
+            continue;
+
+        // Move the animated instances, then draw.
+        if (app->animation_enabled && animation_update(&app->animation, time_now()) > 0)
+            return AppErr_Unspecified;
+        uint64_t system_allocations_n = host_memory_system_allocations(&app->host);
         int i = draw(app);
         if (i > 0) return AppErr_Unspecified;
+        app->draw_system_allocations_n += host_memory_system_allocations(&app->host) - system_allocations_n;
+        if (app->startup.first_frame == 0.0) {
+            startup_first_frame(&app->startup);
+            startup_report(&app->startup);
+        }
+
+        if (app->frame_n % 600 == 0) {
+            double now = time_now();
+            printf("[frame] %s: %.3f ms/frame, %u samples\n",
+                    app->async_compute ? "async compute" : "single queue",
+                    1000.0 * (now - app->report_time) / (app->frame_n - app->report_frame_n),
+                    app->tracer.samples_n);
+            app->report_time = now;
+            app->report_frame_n = app->frame_n;
+            if (app->tracer.settings.kernel == TraceKernel_Compare) report_kernels(app);
+            if (app->wavefront_active)
+                wavefront_report(&app->wavefront, profiler_average(&app->profiler, "trace"));
+            if (app->path_mode == PathMode_Compare) report_paths(app);
+            profiler_report(&app->profiler);
+            resolution_report(&app->resolution);
+            if (app->adaptive_enabled)
+                adaptive_report(&app->adaptive);
+            if (app->animation_enabled)
+                animation_report(&app->animation);
+            gpu_memory_report();
+            printf("[host] %llu system allocations in draw over the last 600 frames\n",
+                    (unsigned long long)app->draw_system_allocations_n);
+            app->draw_system_allocations_n = 0;
+            host_memory_report(&app->host);
+            idle_report(&app->idle, app->profiler.busy_ms);
+
+            if (app->textures.textures_n > 0)
+                texture_streamer_report(&app->textures);
+            if (app->capture_enabled)
+                capture_report(&app->capture);
+            if (app->video_enabled)
+                video_report(&app->video);
+        }
     }
     
     // Wait for the device to finish.
     vkDeviceWaitIdle(app->device);
 
+    if (app->textures.textures_n > 0)
+        texture_streamer_report(&app->textures);
+    if (app->capture_enabled) {
+        capture_update(&app->capture, timeline_completed(&app->graphics_timeline, app->device));
+        workers_wait_idle(&app->workers);
+        capture_report(&app->capture);
+    }
+    if (app->video_enabled)
+        video_report(&app->video);
+    variant_cache_report(&app->tracer.variants);
+
     return AppErr_None;
 }
 
+// Trace time per sample of the variant that ran since the last report, then
+// switches to the other one for the next.
+void report_kernels(struct App *app) {
+    double ms = profiler_average(&app->profiler, "trace") / app->tracer.settings.samples_per_dispatch;
+    app->kernel_ms[app->tracer.uniform] = ms;
+    app->tracer.uniform = !app->tracer.uniform;
+    if (app->kernel_ms[0] <= 0.0 || app->kernel_ms[1] <= 0.0) return;
+    printf("[trace] specialized %.3f ms/spp, uniform branching %.3f ms/spp, %.1f%% faster\n",
+            app->kernel_ms[0],
+            app->kernel_ms[1],
+            100.0 * (app->kernel_ms[1] / app->kernel_ms[0] - 1.0));
+}
+
+// Past the soft limit on a device local heap, textures give back what the heap
+// is over by.
+void memory_pressure(void *user, uint32_t heap, VkDeviceSize usage, VkDeviceSize budget) {
+    struct App *app = user;
+    struct GpuMemoryStats stats;
+    gpu_memory_stats(&stats);
+    if (!stats.heaps[heap].device_local || stats.heaps[heap].categories[GpuMemoryCategory_Textures] == 0) return;
+
+    VkDeviceSize limit = (VkDeviceSize)(stats.soft_limit * budget);
+    VkDeviceSize over = usage > limit ? usage - limit : 0;
+    VkDeviceSize resident = app->textures.resident_bytes;
+    VkDeviceSize texture_budget = resident > over ? resident - over : 0;
+    if (texture_budget >= app->textures.budget) return;
+    texture_streamer_set_budget(&app->textures, texture_budget);
+    printf("[memory] texture budget lowered to %.1f MiB\n", texture_budget / 1048576.0);
+}
+
+// Window events, each asks for a frame when the loop is idle.
+
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods) {
+    struct App *app = glfwGetWindowUserPointer(window);
+    idle_request(&app->idle, IdleWake_Input);
+}
+
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods) {
+    struct App *app = glfwGetWindowUserPointer(window);
+    idle_request(&app->idle, IdleWake_Input);
+}
+
+void cursor_position_callback(GLFWwindow *window, double x, double y) {
+    struct App *app = glfwGetWindowUserPointer(window);
+    idle_request(&app->idle, IdleWake_Input);
+}
+
+void scroll_callback(GLFWwindow *window, double x, double y) {
+    struct App *app = glfwGetWindowUserPointer(window);
+    idle_request(&app->idle, IdleWake_Input);
+}
+
+void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
+    struct App *app = glfwGetWindowUserPointer(window);
+    idle_request(&app->idle, IdleWake_Resize);
+}
+
+void window_refresh_callback(GLFWwindow *window) {
+    struct App *app = glfwGetWindowUserPointer(window);
+    idle_request(&app->idle, IdleWake_Resize);
+}
+
+// Trace time per sample of the path mode that ran since the last report,
+// then switches to the other one for the next.
+void report_paths(struct App *app) {
+    double ms = profiler_average(&app->profiler, "trace") / app->tracer.settings.samples_per_dispatch;
+    app->path_ms[app->wavefront_active] = ms;
+    app->wavefront_active = !app->wavefront_active;
+    if (app->path_ms[0] <= 0.0 || app->path_ms[1] <= 0.0) return;
+    double paths_n = (double)app->tracer.render_extent.width * app->tracer.render_extent.height;
+    printf("[trace] megakernel %.3f ms/spp, %.1f Mpaths/s, wavefront %.3f ms/spp, %.1f Mpaths/s\n",
+            app->path_ms[0],
+            paths_n / app->path_ms[0] * 1e-3,
+            app->path_ms[1],
+            paths_n / app->path_ms[1] * 1e-3);
+}
+
 enum AppErr app_free(struct App *app) {
 #if DEBUG_INPUT_VALIDATION
     if (app == NULL) return AppErr_InvalidInput;
 #endif
+    const VkAllocationCallbacks *allocator = &app->host.callbacks;
 
     // Syncronization.
-    vkDestroySemaphore(app->device, app->image_available, NULL);
-    vkDestroySemaphore(app->device, app->render_finished, NULL);
-    vkDestroyFence(app->device, app->in_flight, NULL);
-    app->image_available = VK_NULL_HANDLE;
-    app->render_finished = VK_NULL_HANDLE;
-    app->in_flight = VK_NULL_HANDLE;
-
-    // Command pool.
-    vkDestroyCommandPool(app->device, app->command_pool, NULL);
+    for (int i = 0; i < FRAMES_IN_FLIGHT; i++) {
+        vkDestroySemaphore(app->device, app->frames[i].image_available, allocator);
+        vkDestroySemaphore(app->device, app->frames[i].render_finished, allocator);
+    }
+
+    // Command pools. Frees the per frame command buffers with them.
+    vkDestroyCommandPool(app->device, app->command_pool, allocator);
+    vkDestroyCommandPool(app->device, app->compute_command_pool, allocator);
     app->command_pool = VK_NULL_HANDLE;
-    app->command_buffer = VK_NULL_HANDLE;
+    app->compute_command_pool = VK_NULL_HANDLE;
+    memset(app->frames, 0, sizeof(app->frames));
+    app->report_time = 0.0;
+    app->report_frame_n = 0;
 
     // Buffers.
-    vkDestroyBuffer(app->device, app->vert_pos, NULL);
-    vkDestroyBuffer(app->device, app->vert_color, NULL);
+    vkDestroyBuffer(app->device, app->vert_pos, allocator);
+    vkDestroyBuffer(app->device, app->vert_color, allocator);
 
     // Pipeline.
-    vkDestroyPipeline(app->device, app->pipeline, NULL);
-    vkDestroyPipelineLayout(app->device, app->pipeline_layout, NULL);
+    pipeline_batch_free(&app->pipelines); // Zeroes itself.
+    vkDestroyPipeline(app->device, app->pipeline, allocator);
+    vkDestroyPipelineLayout(app->device, app->pipeline_layout, allocator);
     app->pipeline_layout = VK_NULL_HANDLE;
     app->pipeline = VK_NULL_HANDLE; 
 
+    // Path tracer.
+    profiler_free(&app->profiler); // Zeroes itself.
+    adaptive_free(&app->adaptive); // Zeroes itself.
+    app->adaptive_enabled = 0;
+    for (uint32_t i = 0; i < DENOISE_SCRATCH_N && app->denoise_enabled; i++)
+        bindless_release(&app->bindless, BindlessKind_StorageImage, app->denoise_scratch[i], 0);
+    graph_free(&app->graph); // Zeroes itself.
+    denoiser_free(&app->denoiser); // Zeroes itself.
+    app->denoise_enabled = 0;
+    wavefront_free(&app->wavefront); // Zeroes itself.
+    app->path_mode = PathMode_Megakernel;
+    app->wavefront_active = 0;
+    memset(app->path_ms, 0, sizeof(app->path_ms));
+    animation_free(&app->animation); // Zeroes itself.
+    app->animation_enabled = 0;
+    tracer_free(&app->tracer); // Zeroes itself.
+    memset(app->kernel_ms, 0, sizeof(app->kernel_ms));
+    resolution_free(&app->resolution); // Zeroes itself.
+    light_tree_free(&app->lights); // Zeroes itself.
+    bvh_free(&app->bvh); // Zeroes itself.
+    scene_free(&app->scene); // Zeroes itself.
+    environment_free(&app->environment); // Zeroes itself.
+    sampler_free(&app->sampler); // Zeroes itself.
+    app->ray_query = 0;
+
+    // Frame capture, before the workers its encodes run on.
+    capture_free(&app->capture); // Zeroes itself.
+    app->capture_enabled = 0;
+    app->capture_every = 0;
+    app->capture_requested = 0;
+    app->capture_key_down = 0;
+
+    // Video output, drains what capture handed it.
+    video_free(&app->video); // Zeroes itself.
+    app->video_enabled = 0;
+
+    // Texture streamer.
+    texture_streamer_free(&app->textures); // Zeroes itself.
+    host_free(&app->host, app->texture_footprints);
+    host_free(&app->host, app->texture_slots);
+    app->texture_footprints = NULL;
+    app->texture_slots = NULL;
+
+    // Workers.
+    workers_free(&app->workers); // Zeroes itself.
+
+    // Memory tracker, every allocation is gone by now.
+    gpu_memory_tracker_free();
+
+    // Bindless descriptor set.
+    bindless_free(&app->bindless, app->device); // Zeroes itself.
+
+    // Timelines.
+    timeline_free(&app->graphics_timeline, app->device);
+    timeline_free(&app->compute_timeline, app->device);
+
     // Image views.
     for (int i = 0; i < app->swapchain_images_n; i++)
-        vkDestroyImageView(app->device, app->swapchain_image_views[i], NULL);
-    free(app->swapchain_image_views);
-    free(app->swapchain_images);
+        vkDestroyImageView(app->device, app->swapchain_image_views[i], allocator);
+    host_free(&app->host, app->swapchain_image_views);
+    host_free(&app->host, app->swapchain_images);
     app->swapchain_images_n = 0;
     app->swapchain_images = NULL;
     app->swapchain_image_views = NULL;
 
     // Swapchain.
-    vkDestroySwapchainKHR(app->device, app->swapchain, NULL);
+    vkDestroySwapchainKHR(app->device, app->swapchain, allocator);
     app->swapchain = VK_NULL_HANDLE;
     ZERO(app->swapchain_format);
     ZERO(app->swapchain_extent);
@@ -242,17 +907,23 @@ enum AppErr app_free(struct App *app) {
     swapchain_support_details_free(&app->swapchain_support); // Zeroes itself.
 
     // Logical device
-    vkDestroyDevice(app->device, NULL);
+    vkDestroyDevice(app->device, allocator);
     app->device = VK_NULL_HANDLE;
+    app->physical_device = VK_NULL_HANDLE;
+    app->frame_n = 0;
     app->graphics_queue = VK_NULL_HANDLE;
     app->present_queue = VK_NULL_HANDLE;
+    app->compute_queue = VK_NULL_HANDLE;
+    app->graphics_queue_family = 0;
+    app->compute_queue_family = 0;
+    app->async_compute = 0;
 
     // Surface.
-    vkDestroySurfaceKHR(app->instance, app->surface, NULL);
+    vkDestroySurfaceKHR(app->instance, app->surface, allocator);
     app->surface = VK_NULL_HANDLE;
 
     // Instance.
-    vkDestroyInstance(app->instance, NULL);
+    vkDestroyInstance(app->instance, allocator);
     app->instance = VK_NULL_HANDLE;
 
     // Window.
@@ -261,12 +932,31 @@ enum AppErr app_free(struct App *app) {
 
     // GLFW.
     glfwTerminate();
+
+    // Idle.
+    idle_free(&app->idle); // Zeroes itself.
+
+    // Startup.
+    startup_free(&app->startup); // Zeroes itself.
+    app->path = NULL;
+    app->scene_path = NULL;
+    app->scene_result = 0;
+    app->environment_path = NULL;
+    app->environment_sampling = 0;
+    app->environment_result = 0;
+    app->sample_sequence = 0;
+    app->sampler_result = 0;
+    app->pipeline_result = 0;
+
+    // Host memory, after everything allocated from it.
+    host_memory_free(&app->host); // Zeroes itself.
+    app->draw_system_allocations_n = 0;
     
     return AppErr_None;
 }
 
 // Returns the first extension that does not match, or -1 on success.
-int verify_instance_extensions(uint32_t extensions_n, const char **extensions) {
+int verify_instance_extensions(struct HostMemory *host, uint32_t extensions_n, const char **extensions) {
 #if DEBUG_INPUT_VALIDATION
     if (extensions_n == 0) return INT_MAX;
     if (extensions == NULL) return INT_MAX;
@@ -279,8 +969,11 @@ int verify_instance_extensions(uint32_t extensions_n, const char **extensions) {
     vkEnumerateInstanceExtensionProperties(NULL, &available_extensions_n, NULL);
 
     // Get names of said extensions.
-    VkExtensionProperties *available_extensions = 
-        malloc(available_extensions_n * sizeof(*available_extensions));
+    VkExtensionProperties *available_extensions = host_alloc(
+            host,
+            available_extensions_n * sizeof(*available_extensions),
+            _Alignof(VkExtensionProperties),
+            VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
     vkEnumerateInstanceExtensionProperties(NULL, &available_extensions_n, available_extensions);
     
     int i = 0;
@@ -299,14 +992,14 @@ continue_outer:;
     }
 
     //
-    free(available_extensions);
+    host_free(host, available_extensions);
     
     //
     return i < extensions_n ? i : -1;
 }
 
 // Returns the first layer that does not match, or -1 on success.
-int verify_instance_validation_layers(uint32_t layers_n, const char **layers) {
+int verify_instance_validation_layers(struct HostMemory *host, uint32_t layers_n, const char **layers) {
 #if DEBUG_INPUT_VALIDATION
     if (layers_n == 0) return INT_MAX;
     if (layers == NULL) return INT_MAX;
@@ -319,8 +1012,11 @@ int verify_instance_validation_layers(uint32_t layers_n, const char **layers) {
     vkEnumerateInstanceLayerProperties(&available_layers_n, NULL);
 
     // Get names of said validation layers.
-    VkLayerProperties *available_layers = 
-        malloc(available_layers_n * sizeof(*available_layers));
+    VkLayerProperties *available_layers = host_alloc(
+            host,
+            available_layers_n * sizeof(*available_layers),
+            _Alignof(VkLayerProperties),
+            VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
     vkEnumerateInstanceLayerProperties(&available_layers_n, available_layers);
    
     // Check if each element of layers is contained in avalable_layers.
@@ -340,13 +1036,13 @@ continue_outer:;
     }
 
     //
-    free(available_layers);
+    host_free(host, available_layers);
     
     // If the above loop didn't make it to completion, return error. 
     return i < layers_n ? i : -1;
 }
 
-int create_vk_instance(VkInstance *instance) {
+int create_vk_instance(struct HostMemory *host, VkInstance *instance) {
 #if DEBUG_INPUT_VALIDATION
     if (instance == NULL) return 1;
     if (*instance != VK_NULL_HANDLE) return 1;
@@ -364,13 +1060,13 @@ int create_vk_instance(VkInstance *instance) {
     //
     uint32_t glfw_extensions_n = 0;
     const char** glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extensions_n);
-    int verify_ext_result = verify_instance_extensions(glfw_extensions_n, glfw_extensions);
+    int verify_ext_result = verify_instance_extensions(host, glfw_extensions_n, glfw_extensions);
     if (verify_ext_result != -1) return 2;
 
     //
     const char *validation_layers[] = { "VK_LAYER_KHRONOS_validation" };
     int validation_layers_n = sizeof(validation_layers) / sizeof(*validation_layers);
-    int verify_vl_result = verify_instance_validation_layers(validation_layers_n, validation_layers);
+    int verify_vl_result = verify_instance_validation_layers(host, validation_layers_n, validation_layers);
     if (verify_vl_result != -1) return 3;
 
     //
@@ -384,7 +1080,7 @@ int create_vk_instance(VkInstance *instance) {
     };
 
     //
-    int make_instance_result = vkCreateInstance(&instance_cinfo, NULL, instance);
+    int make_instance_result = vkCreateInstance(&instance_cinfo, &host->callbacks, instance);
     if (make_instance_result != VK_SUCCESS) return 4; // Failed to create VK instance.
 
     //
@@ -418,7 +1114,7 @@ int find_present_queue_family(
     return 2;
 }
 
-int find_graphics_queue_family(VkPhysicalDevice device, uint32_t *graphics_queue_family) {
+int find_graphics_queue_family(struct HostMemory *host, VkPhysicalDevice device, uint32_t *graphics_queue_family) {
     if (device == VK_NULL_HANDLE) return 1;
     if (graphics_queue_family == NULL) return 1;
 
@@ -427,8 +1123,11 @@ int find_graphics_queue_family(VkPhysicalDevice device, uint32_t *graphics_queue
     vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_n, NULL);
 
     //
-    VkQueueFamilyProperties* queue_families =
-        malloc(queue_family_n * sizeof(VkQueueFamilyProperties));
+    VkQueueFamilyProperties* queue_families = host_alloc(
+            host,
+            queue_family_n * sizeof(VkQueueFamilyProperties),
+            _Alignof(VkQueueFamilyProperties),
+            VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
     vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_n, queue_families);
 
     //
@@ -442,19 +1141,62 @@ int find_graphics_queue_family(VkPhysicalDevice device, uint32_t *graphics_queue
     }
 
     //
-    free(queue_families);
+    host_free(host, queue_families);
     return (i == queue_family_n) ? 2 : 0;
 }
 
+// Prefers a family with compute but no graphics, which real hardware runs
+// alongside the graphics queue. Falls back to graphics_queue_family.
+int find_compute_queue_family(
+        struct HostMemory *host,
+        VkPhysicalDevice device,
+        uint32_t graphics_queue_family,
+        uint32_t *compute_queue_family) {
+    if (device == VK_NULL_HANDLE) return 1;
+    if (compute_queue_family == NULL) return 1;
+
+    //
+    uint32_t queue_family_n;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_n, NULL);
+
+    //
+    VkQueueFamilyProperties* queue_families = host_alloc(
+            host,
+            queue_family_n * sizeof(VkQueueFamilyProperties),
+            _Alignof(VkQueueFamilyProperties),
+            VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_n, queue_families);
+
+    //
+    *compute_queue_family = graphics_queue_family;
+    for (int i = 0; i < queue_family_n; i += 1) {
+        VkQueueFlags flags = queue_families[i].queueFlags;
+        if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+            *compute_queue_family = i;
+            break;
+        }
+    }
+
+    //
+    host_free(host, queue_families);
+    return 0;
+}
+
 // Returns the first extension that does not match, or -1 on success.
-int verify_device_extensions(VkPhysicalDevice physical_device, uint32_t extensions_n, const char **extensions) {
+int verify_device_extensions(
+        struct HostMemory *host,
+        VkPhysicalDevice physical_device,
+        uint32_t extensions_n, const char **extensions) {
     // Get number of available extensions.
     uint32_t available_extensions_n;
     vkEnumerateDeviceExtensionProperties(physical_device, NULL, &available_extensions_n, NULL);
 
     // Get names of said extensions.
-    VkExtensionProperties *available_extensions = 
-        malloc(available_extensions_n * sizeof(*available_extensions));
+    VkExtensionProperties *available_extensions = host_alloc(
+            host,
+            available_extensions_n * sizeof(*available_extensions),
+            _Alignof(VkExtensionProperties),
+            VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
     vkEnumerateDeviceExtensionProperties(physical_device, NULL, &available_extensions_n, available_extensions);
     
     int i = 0;
@@ -473,19 +1215,24 @@ continue_outer:;
     }
 
     //
-    free(available_extensions);
+    host_free(host, available_extensions);
     
     //
     return i < extensions_n ? i : -1;
 }
 
 int create_vk_device(
+        struct HostMemory *host,
         VkInstance instance, 
         VkSurfaceKHR surface, 
         VkPhysicalDevice *physical_device, 
         VkDevice *device, 
         uint32_t *graphics_queue_family, 
-        uint32_t *present_queue_family) {
+        uint32_t *present_queue_family,
+        uint32_t *compute_queue_family,
+        int want_ray_query,
+        int *ray_query,
+        int *memory_budget) {
 #if DEBUG_INPUT_VALIDATION
     if (instance == VK_NULL_HANDLE) return 1;
     if (surface == VK_NULL_HANDLE) return 1;
@@ -493,6 +1240,8 @@ int create_vk_device(
     if (*physical_device != VK_NULL_HANDLE) return 1;
     if (device == NULL) return 1;
     if (*device != VK_NULL_HANDLE) return 1;
+    if (ray_query == NULL) return 1;
+    if (memory_budget == NULL) return 1;
 #endif
 
     // Take first physical device.
@@ -505,7 +1254,7 @@ int create_vk_device(
     // TODO: Check physical device for compatibility.
 
     //
-    int find_gqf_result = find_graphics_queue_family(*physical_device, graphics_queue_family);
+    int find_gqf_result = find_graphics_queue_family(host, *physical_device, graphics_queue_family);
     if (find_gqf_result > 0) return 3; // No graphics queue family.
 
     //
@@ -513,22 +1262,25 @@ int create_vk_device(
     if (find_pqf_result > 0) return 4; // No present queue family.
 
     //
+    find_compute_queue_family(host, *physical_device, *graphics_queue_family, compute_queue_family);
+
+    // One queue per distinct family.
     float queue_priority = 1.0;
-    VkDeviceQueueCreateInfo queue_cinfos[2] = { 
-        {
+    uint32_t families[] = { *graphics_queue_family, *present_queue_family, *compute_queue_family };
+    VkDeviceQueueCreateInfo queue_cinfos[3];
+    uint32_t queue_cinfos_n = 0;
+    for (int i = 0; i < 3; i++) {
+        int seen = 0;
+        for (int j = 0; j < queue_cinfos_n; j++)
+            seen |= queue_cinfos[j].queueFamilyIndex == families[i];
+        if (seen) continue;
+        queue_cinfos[queue_cinfos_n++] = (VkDeviceQueueCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            .queueFamilyIndex = *graphics_queue_family,
+            .queueFamilyIndex = families[i],
             .queueCount = 1,
             .pQueuePriorities = &queue_priority,
-        },
-        {
-            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            .queueFamilyIndex = *present_queue_family,
-            .queueCount = 1,
-            .pQueuePriorities = &queue_priority,
-
-        },
-    };
+        };
+    }
 
 
     // TODO
@@ -538,30 +1290,130 @@ int create_vk_device(
     const char *device_extensions[] = {
         "VK_KHR_swapchain",
         "VK_KHR_dynamic_rendering",
+        // Optional, only enabled for ray queries.
+        "VK_KHR_acceleration_structure",
+        "VK_KHR_ray_query",
+        "VK_KHR_deferred_host_operations",
+        // Optional, driver budgets for the memory tracker.
+        "VK_EXT_memory_budget",
     };
-    const int device_extensions_n = sizeof(device_extensions) / sizeof(*device_extensions);
+    const int required_extensions_n = 2;
+    const int ray_query_extensions_n = 3;
+    int device_extensions_n = required_extensions_n + ray_query_extensions_n;
 
     //
-    int vde = verify_device_extensions(*physical_device, device_extensions_n, device_extensions);
-    if (vde > 0) return 5;
+    int vde = verify_device_extensions(host, *physical_device, required_extensions_n, device_extensions);
+    if (vde >= 0) return 5;
+    int ray_query_extensions = verify_device_extensions(
+            host,
+            *physical_device,
+            ray_query_extensions_n,
+            device_extensions + required_extensions_n) < 0;
+    *memory_budget = verify_device_extensions(
+            host,
+            *physical_device,
+            1,
+            device_extensions + required_extensions_n + ray_query_extensions_n) < 0;
+
+    // Check for the descriptor indexing features the bindless set relies on.
+    VkPhysicalDeviceRayQueryFeaturesKHR supported_ray_query_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR,
+    };
+    VkPhysicalDeviceAccelerationStructureFeaturesKHR supported_accel_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR,
+        .pNext = &supported_ray_query_features,
+    };
+    VkPhysicalDeviceVulkan12Features supported_vulkan12_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .pNext = ray_query_extensions ? &supported_accel_features : NULL,
+    };
+    VkPhysicalDeviceVulkan13Features supported_vulkan13_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+        .pNext = &supported_vulkan12_features,
+    };
+    VkPhysicalDeviceFeatures2 supported_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &supported_vulkan13_features,
+    };
+    vkGetPhysicalDeviceFeatures2(*physical_device, &supported_features);
+    if (!supported_vulkan12_features.descriptorIndexing
+            || !supported_vulkan12_features.runtimeDescriptorArray
+            || !supported_vulkan12_features.descriptorBindingPartiallyBound
+            || !supported_vulkan12_features.descriptorBindingUpdateUnusedWhilePending
+            || !supported_vulkan12_features.descriptorBindingStorageBufferUpdateAfterBind
+            || !supported_vulkan12_features.descriptorBindingSampledImageUpdateAfterBind
+            || !supported_vulkan12_features.descriptorBindingStorageImageUpdateAfterBind
+            || !supported_vulkan12_features.shaderSampledImageArrayNonUniformIndexing
+            || !supported_vulkan12_features.shaderStorageBufferArrayNonUniformIndexing)
+        return 7; // No descriptor indexing.
+    if (!supported_vulkan12_features.timelineSemaphore)
+        return 8; // No timeline semaphores.
+    if (!supported_vulkan13_features.synchronization2 || !supported_vulkan13_features.dynamicRendering)
+        return 9; // No synchronization2 barriers or dynamic rendering.
+
+    // Ray queries are optional, the BVH in the trace shader covers the rest.
+    *ray_query = want_ray_query
+        && ray_query_extensions
+        && supported_vulkan12_features.bufferDeviceAddress
+        && supported_accel_features.accelerationStructure
+        && supported_accel_features.descriptorBindingAccelerationStructureUpdateAfterBind
+        && supported_ray_query_features.rayQuery;
+    if (!*ray_query) device_extensions_n = required_extensions_n;
+
+    // Enabled extensions are the required ones, then whichever optional
+    // groups are supported.
+    const char *enabled_extensions[sizeof(device_extensions) / sizeof(*device_extensions)];
+    memcpy(enabled_extensions, device_extensions, device_extensions_n * sizeof(*device_extensions));
+    if (*memory_budget) enabled_extensions[device_extensions_n++] = "VK_EXT_memory_budget";
+
+    VkPhysicalDeviceVulkan12Features vulkan12_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .descriptorIndexing = VK_TRUE,
+        .runtimeDescriptorArray = VK_TRUE,
+        .descriptorBindingPartiallyBound = VK_TRUE,
+        .descriptorBindingUpdateUnusedWhilePending = VK_TRUE,
+        .descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE,
+        .descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+        .descriptorBindingStorageImageUpdateAfterBind = VK_TRUE,
+        .shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
+        .shaderStorageBufferArrayNonUniformIndexing = VK_TRUE,
+        .shaderStorageImageArrayNonUniformIndexing =
+            supported_vulkan12_features.shaderStorageImageArrayNonUniformIndexing,
+        .timelineSemaphore = VK_TRUE,
+        .bufferDeviceAddress = *ray_query ? VK_TRUE : VK_FALSE,
+    };
+    VkPhysicalDeviceRayQueryFeaturesKHR ray_query_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR,
+        .rayQuery = VK_TRUE,
+    };
+    VkPhysicalDeviceAccelerationStructureFeaturesKHR accel_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR,
+        .pNext = &ray_query_features,
+        .accelerationStructure = VK_TRUE,
+        .descriptorBindingAccelerationStructureUpdateAfterBind = VK_TRUE,
+    };
+    if (*ray_query) vulkan12_features.pNext = &accel_features;
 
-    const VkPhysicalDeviceDynamicRenderingFeatures dynamic_rendering_features = {
-        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES,
+    // Both core in 1.3, the frame graph records synchronization2 barriers.
+    VkPhysicalDeviceVulkan13Features vulkan13_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+        .pNext = &vulkan12_features,
         .dynamicRendering = VK_TRUE,
+        .synchronization2 = VK_TRUE,
     };
 
     VkDeviceCreateInfo device_cinfo = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-        .pNext = &dynamic_rendering_features,
+        .pNext = &vulkan13_features,
         .pQueueCreateInfos = queue_cinfos,
-        .queueCreateInfoCount = *present_queue_family == *graphics_queue_family ? 1 : 2,
+        .queueCreateInfoCount = queue_cinfos_n,
         .pEnabledFeatures = &device_features,
         .enabledExtensionCount = device_extensions_n,
-        .ppEnabledExtensionNames = device_extensions,
+        .ppEnabledExtensionNames = enabled_extensions,
     };
 
     //
-    int make_device_result = vkCreateDevice(*physical_device, &device_cinfo, NULL, device);
+    int make_device_result = vkCreateDevice(*physical_device, &device_cinfo, &host->callbacks, device);
     if (make_device_result != VK_SUCCESS) return 6; // Could not create logical device.
     
     return 0;
@@ -569,6 +1421,7 @@ int create_vk_device(
 
 int create_vk_swapchain(
         VkDevice device, 
+        const VkAllocationCallbacks *allocator,
         VkPhysicalDevice physical_device, 
         VkSurfaceKHR surface,
         const struct SwapchainSupportDetails *details,
@@ -589,7 +1442,7 @@ int create_vk_swapchain(
 
     // Assume this format is supported.
     VkSurfaceFormatKHR surface_format = {
-        .format = VK_FORMAT_B8G8R8A8_SRGB,
+        .format = SWAPCHAIN_FORMAT,
         .colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
     };
     /*for (int i = 0; i < details->formats_n; i++) {
@@ -631,7 +1484,8 @@ int create_vk_swapchain(
         .imageColorSpace = surface_format.colorSpace,
         .imageExtent = *extent,
         .imageArrayLayers = 1,
-        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+            | (capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT), // for capture
         .imageSharingMode = sharing_mode,
         .queueFamilyIndexCount = 2,
         .pQueueFamilyIndices = queue_family_indices,
@@ -646,7 +1500,7 @@ int create_vk_swapchain(
     uint32_t make_sc_result = vkCreateSwapchainKHR(
             device, 
             &swapchain_cinfo, 
-            NULL, 
+            allocator, 
             swapchain);
     if (make_sc_result != VK_SUCCESS) return 2;
 
@@ -658,6 +1512,7 @@ int create_vk_swapchain(
 
 int create_vk_image_views(
         VkDevice device, 
+        const VkAllocationCallbacks *allocator,
         int n, 
         VkImage *images, 
         VkFormat format, 
@@ -693,14 +1548,14 @@ int create_vk_image_views(
             },
         };
 
-        uint32_t make_iv_result = vkCreateImageView(device, &cinfo, NULL, image_views + i);
+        uint32_t make_iv_result = vkCreateImageView(device, &cinfo, allocator, image_views + i);
         if (make_iv_result != VK_SUCCESS) return 1;
     }
 
     return 0;
 }
 
-int create_vk_render_pass(VkDevice device, VkFormat format, VkRenderPass *render_pass) {
+int create_vk_render_pass(VkDevice device, const VkAllocationCallbacks *allocator, VkFormat format, VkRenderPass *render_pass) {
 #if DEBUG_INPUT_VALIDATION
     if (device == VK_NULL_HANDLE) return 1;
     if (render_pass == NULL) return 1;
@@ -742,64 +1597,24 @@ int create_vk_render_pass(VkDevice device, VkFormat format, VkRenderPass *render
     };
 
     //
-    int make_rp_result = vkCreateRenderPass(device, &render_pass_cinfo, NULL, render_pass);
+    int make_rp_result = vkCreateRenderPass(device, &render_pass_cinfo, allocator, render_pass);
     if (make_rp_result != VK_SUCCESS) return 2;
 
     return 0;
 }
 
-int create_shader_module(VkDevice device, const char *path, const char *name, VkShaderModule *shader_module) {
-#if DEBUG_INPUT_VALIDATION
-    if (device == VK_NULL_HANDLE) return 1;
-    if (path == NULL) return 1;
-    if (shader_module == NULL) return 1;
-    if (*shader_module != VK_NULL_HANDLE) return 1;
-#endif
-
-    // Create shader path.
-    char shader_path[256];
-    size_t l = strlen(path);
-    strncpy(shader_path, path, 256);
-    strncat(shader_path, name, 256 - l);
-
-    // Extract shader bytecode from file.
-    FILE *file = fopen(shader_path, "rb+");
-    if (file == NULL) return 2;
-    fseek(file, 0, SEEK_END);
-    int size = ftell(file);
-    rewind(file);
-    char *shader = malloc(size);
-    fread(shader, 1, size, file);
-    fclose(file);
-
-    //
-    VkShaderModuleCreateInfo shader_cinfo = {
-        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        .codeSize = size,
-        .pCode = (const uint32_t*)shader,
-    };
-
-    //
-    uint32_t make_shader_result = vkCreateShaderModule(
-            device, 
-            &shader_cinfo, 
-            NULL, 
-            shader_module);
-    free(shader);
-    if (make_shader_result != VK_SUCCESS) return 3;
-
-    return 0;
-}
-
 int create_graphics_pipeline(
         VkDevice device, 
+        const VkAllocationCallbacks *allocator,
         const char * const path,
-        VkFormat *swapchain_format,
+        VkFormat swapchain_format,
+        VkDescriptorSetLayout set_layout,
         VkPipelineLayout *pipeline_layout, 
         VkPipeline *pipeline) {
 #if DEBUG_INPUT_VALIDATION
     if (device == VK_NULL_HANDLE) return 1;
     if (path == NULL) return 1;
+    if (set_layout == VK_NULL_HANDLE) return 1;
     if (pipeline_layout == NULL) return 1;
     if (*pipeline_layout != VK_NULL_HANDLE) return 1;
     if (pipeline == NULL) return 1;
@@ -810,8 +1625,8 @@ int create_graphics_pipeline(
 
     // Create two shader modules.
     VkShaderModule shader_modules[2] = { VK_NULL_HANDLE };
-    int r1 = create_shader_module(device, path, "tri.vert.spv", shader_modules + 0);
-    int r2 = create_shader_module(device, path, "tri.frag.spv", shader_modules + 1);
+    int r1 = create_shader_module(device, allocator, path, "tri.vert.spv", shader_modules + 0);
+    int r2 = create_shader_module(device, allocator, path, "tri.frag.spv", shader_modules + 1);
     if (r1 > 0 || r2 > 0) {
         res = 2;
         goto fail;
@@ -835,41 +1650,10 @@ int create_graphics_pipeline(
         },
     };
 
-    //
-    const VkVertexInputBindingDescription vertex_input_binding_descs[] = {
-        {
-            .binding = 0,
-            .stride = 2 * sizeof(float),
-            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
-        },
-        {
-            .binding = 1,
-            .stride = 3 * sizeof(float),
-            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
-        }
-    };
-
-    // 
-    VkVertexInputAttributeDescription vertex_input_attribute_descs[] = {
-        {
-            .binding = 0,
-            .location = 0,
-            .format = VK_FORMAT_R32G32_SFLOAT,
-        },
-        {
-            .binding = 1,
-            .location = 1,
-            .format = VK_FORMAT_R32G32B32_SFLOAT,
-        }
-    };
-    
-    // Pipeline input create info. 
+    // Pipeline input create info. The composite triangle comes from
+    // gl_VertexIndex alone.
     VkPipelineVertexInputStateCreateInfo vertex_input_cinfo = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-        .vertexBindingDescriptionCount = 2,
-        .pVertexBindingDescriptions = vertex_input_binding_descs,
-        .vertexAttributeDescriptionCount = 2,
-        .pVertexAttributeDescriptions = vertex_input_attribute_descs,
     };
 
     //
@@ -911,7 +1695,7 @@ int create_graphics_pipeline(
         .rasterizerDiscardEnable = VK_FALSE,
         .polygonMode = VK_POLYGON_MODE_FILL,
         .lineWidth = 1.0f,
-        .cullMode = VK_CULL_MODE_BACK_BIT,
+        .cullMode = VK_CULL_MODE_NONE,
         .frontFace = VK_FRONT_FACE_CLOCKWISE,
         .depthBiasEnable = VK_FALSE,
     };
@@ -940,13 +1724,8 @@ int create_graphics_pipeline(
     };
 
     //
-    VkPipelineLayoutCreateInfo pipeline_layout_cinfo = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 0,
-        .pushConstantRangeCount = 0,
-    };
-    int make_pl_result = vkCreatePipelineLayout(device, &pipeline_layout_cinfo, NULL, pipeline_layout);
-    if (make_pl_result != VK_SUCCESS) {
+    int make_pl_result = create_pipeline_layout(device, allocator, set_layout, pipeline_layout);
+    if (make_pl_result > 0) {
         res = 3;
         goto fail;
     }
@@ -954,7 +1733,7 @@ int create_graphics_pipeline(
     VkPipelineRenderingCreateInfo pipeline_rendering_cinfo = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
         .colorAttachmentCount = 1,
-        .pColorAttachmentFormats = swapchain_format,
+        .pColorAttachmentFormats = &swapchain_format,
     };
 
     //
@@ -979,7 +1758,7 @@ int create_graphics_pipeline(
     };
 
     //
-    int make_pipeline_result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_cinfo, NULL, pipeline);
+    int make_pipeline_result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_cinfo, allocator, pipeline);
     if (make_pipeline_result != VK_SUCCESS) {
         const char *out = vk_result_to_string(make_pipeline_result);
         printf("%s\n", out);
@@ -988,12 +1767,12 @@ int create_graphics_pipeline(
     }
 
 fail:
-    vkDestroyShaderModule(device, shader_modules[0], NULL);
-    vkDestroyShaderModule(device, shader_modules[1], NULL);
+    vkDestroyShaderModule(device, shader_modules[0], allocator);
+    vkDestroyShaderModule(device, shader_modules[1], allocator);
     return res;
 }
 
-int create_vertex_buffer(VkDevice device, size_t size, VkBuffer *buffer) {
+int create_vertex_buffer(VkDevice device, const VkAllocationCallbacks *allocator, size_t size, VkBuffer *buffer) {
 #if DEBUG_INPUT_VALIDATION
     if (device == VK_NULL_HANDLE) return 1;
     if (size == 0) return 1;
@@ -1007,7 +1786,7 @@ int create_vertex_buffer(VkDevice device, size_t size, VkBuffer *buffer) {
         .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
     };
 
-    VkResult result = vkCreateBuffer(device, &buffer_cinfo, NULL, buffer);
+    VkResult result = vkCreateBuffer(device, &buffer_cinfo, allocator, buffer);
     if (result != VK_SUCCESS) return 2;
 
     return 0;
@@ -1015,6 +1794,7 @@ int create_vertex_buffer(VkDevice device, size_t size, VkBuffer *buffer) {
 
 int create_framebuffers(
         VkDevice device,
+        struct HostMemory *host,
         VkRenderPass render_pass,
         VkExtent2D extent,
         uint32_t n,
@@ -1032,7 +1812,9 @@ int create_framebuffers(
 #endif
 
     //
-    *framebuffers = calloc(n, sizeof(VkFramebuffer));
+    *framebuffers = host_alloc(host, n * sizeof(VkFramebuffer), _Alignof(VkFramebuffer), VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    if (*framebuffers == NULL) return 2;
+    memset(*framebuffers, 0, n * sizeof(VkFramebuffer));
 
     //
     for (int i = 0; i < n; i++) {
@@ -1046,7 +1828,7 @@ int create_framebuffers(
             .layers = 1,
         };
 
-        int create_fb_result = vkCreateFramebuffer(device, &framebuffer_cinfo, NULL, (*framebuffers) + i);
+        int create_fb_result = vkCreateFramebuffer(device, &framebuffer_cinfo, &host->callbacks, (*framebuffers) + i);
         if (create_fb_result != VK_SUCCESS) return 2;
     }
 
@@ -1055,16 +1837,20 @@ int create_framebuffers(
 
 int create_command_pool(
         VkDevice device, 
-        uint32_t graphics_queue_family, 
+        const VkAllocationCallbacks *allocator,
+        uint32_t queue_family, 
+        uint32_t command_buffers_n,
         VkCommandPool *command_pool, 
-        VkCommandBuffer *command_buffer) {
+        VkCommandBuffer *command_buffers) {
 #if DEBUG_INPUT_VALIDATION
     if (device == VK_NULL_HANDLE) return 1;
-    if (graphics_queue_family == UINT32_MAX) return 1;
+    if (queue_family == UINT32_MAX) return 1;
     if (command_pool == NULL) return 1;
     if (*command_pool != VK_NULL_HANDLE) return 1;
-    if (command_buffer == NULL) return 1;
-    if (*command_buffer != VK_NULL_HANDLE) return 1;
+    if (command_buffers_n == 0) return 1;
+    if (command_buffers == NULL) return 1;
+    for (int i = 0; i < command_buffers_n; i++)
+        if (command_buffers[i] != VK_NULL_HANDLE) return 1;
 #endif
 
     int result = 0;
@@ -1072,85 +1858,134 @@ int create_command_pool(
     VkCommandPoolCreateInfo pool_cinfo = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
         .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-        .queueFamilyIndex = graphics_queue_family,
+        .queueFamilyIndex = queue_family,
     };
 
-    result = vkCreateCommandPool(device, &pool_cinfo, NULL, command_pool);
+    result = vkCreateCommandPool(device, &pool_cinfo, allocator, command_pool);
     if (result != VK_SUCCESS) return 2;
 
     VkCommandBufferAllocateInfo buffer_cinfo = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
         .commandPool = *command_pool,
         .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = 1,
+        .commandBufferCount = command_buffers_n,
     };
 
-    result = vkAllocateCommandBuffers(device, &buffer_cinfo, command_buffer);
+    result = vkAllocateCommandBuffers(device, &buffer_cinfo, command_buffers);
     if (result != VK_SUCCESS) return 3;
 
     return 0;
 }
 
-// Lazy copout
-int draw(struct App *app) {
-#if DEBUG_INPUT_VALIDATION
-    if (app == NULL) return 1;
-#endif
+// Startup jobs, run on the workers while app_init carries on.
 
-    VkResult result = VK_RESULT_MAX_ENUM;
+void load_scene_job(void *arg) {
+    struct App *app = arg;
 
-    // Wait for signal that rendering is finished.
-    vkWaitForFences(app->device, 1, &app->in_flight, VK_TRUE, UINT64_MAX);
-    vkResetFences(app->device, 1, &app->in_flight);
+    uint32_t stage = startup_begin(&app->startup, "scene load", 1);
+    app->scene_result = app->scene_path != NULL
+        ? scene_load_obj(&app->scene, app->scene_path)
+        : scene_init_default(&app->scene);
+    startup_end(&app->startup, stage);
+    if (app->scene_result > 0) return;
 
-    // Aquire next swapchain image.
-    uint32_t img_index = 0;
-    vkAcquireNextImageKHR(app->device, app->swapchain, UINT64_MAX, app->image_available, VK_NULL_HANDLE, &img_index);
-    
-    // Reset command buffer for pushing.
-    vkResetCommandBuffer(app->command_buffer, 0);
+    // The software path traverses the BVH.
+    stage = startup_begin(&app->startup, "bvh build", 1);
+    app->scene_result = bvh_build(&app->bvh, app->scene.positions, app->scene.indices, app->scene.triangles_n);
+    startup_end(&app->startup, stage);
+    if (app->scene_result > 0) return;
 
-    // The next lines just submit commands to the command buffer.
-    VkCommandBufferBeginInfo command_buffer_begin_info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = 0,
-        .pInheritanceInfo = NULL,
-    };
+    // Next to it, the tree the wavefront picks lights through.
+    stage = startup_begin(&app->startup, "light tree build", 1);
+    app->scene_result = light_tree_build(&app->lights, &app->scene);
+    startup_end(&app->startup, stage);
+}
 
-    result = vkBeginCommandBuffer(app->command_buffer, &command_buffer_begin_info);
-    if (result != VK_SUCCESS) return 2;
+// Alias table of the environment map, alongside the scene.
+void load_environment_job(void *arg) {
+    struct App *app = arg;
 
-    const VkImageMemoryBarrier imb = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-        .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-        .image = app->swapchain_images[img_index],
-        .subresourceRange = {
-            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .baseMipLevel = 0,
-            .levelCount = 1,
-            .baseArrayLayer = 0,
-            .layerCount = 1,
-        },
-    };
+    uint32_t stage = startup_begin(&app->startup, "environment", 1);
+    app->environment_result = environment_init(&app->environment, app->environment_path, app->environment_sampling);
+    startup_end(&app->startup, stage);
+}
 
-    vkCmdPipelineBarrier(
-            app->command_buffer,
-            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-            0,
-            0,
-            NULL,
-            0,
-            NULL,
-            1,
-            &imb);
+// Sobol points and blue noise mask, alongside the scene.
+void build_sampler_job(void *arg) {
+    struct App *app = arg;
+
+    uint32_t stage = startup_begin(&app->startup, "sampler", 1);
+    app->sampler_result = sampler_init(&app->sampler);
+    startup_end(&app->startup, stage);
+}
+
+// The swapchain format is fixed, so this does not wait for the swapchain.
+void create_composite_pipeline_job(void *arg) {
+    struct App *app = arg;
+
+    uint32_t stage = startup_begin(&app->startup, "composite pipeline", 1);
+    app->pipeline_result = create_graphics_pipeline(
+            app->device,
+            &app->host.callbacks,
+            app->path,
+            SWAPCHAIN_FORMAT,
+            app->bindless.layout,
+            &app->pipeline_layout,
+            &app->pipeline);
+    startup_end(&app->startup, stage);
+}
+
+// Frame graph passes, recording for the frame app->frame_n.
+
+static void record_trace_pass(VkCommandBuffer command_buffer, void *user) {
+    struct App *app = user;
+    uint32_t frame_index = app->frame_n % FRAMES_IN_FLIGHT;
+
+    struct TraceTiles tiles;
+    if (app->adaptive_enabled)
+        adaptive_prepare(&app->adaptive, command_buffer, &app->tracer, frame_index, &tiles);
+    struct TraceGuides guides;
+    if (app->denoise_enabled)
+        denoiser_prepare(&app->denoiser, command_buffer, &guides);
+    if (app->wavefront_active)
+        wavefront_record(&app->wavefront, command_buffer, &app->tracer, frame_index);
+    else
+        tracer_record(
+                &app->tracer,
+                command_buffer,
+                frame_index,
+                app->denoise_enabled ? &guides : NULL,
+                app->adaptive_enabled ? &tiles : NULL);
+    profiler_mark(&app->profiler, command_buffer, frame_index, "trace");
+}
+
+static void record_denoise_temporal_pass(VkCommandBuffer command_buffer, void *user) {
+    struct App *app = user;
+    denoiser_record_temporal(&app->denoiser, command_buffer, &app->tracer);
+}
+
+static void record_denoise_atrous_pass(VkCommandBuffer command_buffer, void *user) {
+    struct App *app = user;
+    uint32_t frame_index = app->frame_n % FRAMES_IN_FLIGHT;
+    denoiser_record_atrous(&app->denoiser, command_buffer, &app->tracer, frame_index);
+    profiler_mark(&app->profiler, command_buffer, frame_index, "denoise");
+}
+
+static void record_classify_pass(VkCommandBuffer command_buffer, void *user) {
+    struct App *app = user;
+    uint32_t frame_index = app->frame_n % FRAMES_IN_FLIGHT;
+    adaptive_record(&app->adaptive, command_buffer, &app->tracer, frame_index);
+    profiler_mark(&app->profiler, command_buffer, frame_index, "classify");
+}
+
+static void record_composite_pass(VkCommandBuffer command_buffer, void *user) {
+    struct App *app = user;
+    const struct TraceOutput *output = &app->tracer.outputs[app->frame_n % FRAMES_IN_FLIGHT];
 
     const VkRenderingAttachmentInfo attachment_info = {
         .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-        .imageView = app->swapchain_image_views[img_index],
-        .imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
+        .imageView = app->swapchain_image_views[app->image_index],
+        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
         .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
         .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
         .clearValue = {{{ 0.0f, 0.0f, 0.0f, 1.0f }}},
@@ -1165,65 +2000,306 @@ int draw(struct App *app) {
         .colorAttachmentCount = 1,
         .pColorAttachments = &attachment_info,
     }; 
-    vkCmdBeginRendering(app->command_buffer, &rendering_info);
-    vkCmdBindPipeline(app->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, app->pipeline);
-    vkCmdDraw(app->command_buffer, 3, 1, 0, 0);
-    vkCmdEndRendering(app->command_buffer);
-
-    const VkImageMemoryBarrier imb2 = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-        .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-        .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-        .image = app->swapchain_images[img_index],
-        .subresourceRange = {
-            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .baseMipLevel = 0,
-            .levelCount = 1,
-            .baseArrayLayer = 0,
-            .layerCount = 1,
-        },
+    struct CompositePush push = {
+        .image = output->sampled_slot,
+        .upscale = app->resolution.settings.upscale,
+        .width = app->tracer.render_extent.width,
+        .height = app->tracer.render_extent.height,
     };
-
-    vkCmdPipelineBarrier(
-            app->command_buffer,
-            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+    vkCmdBeginRendering(command_buffer, &rendering_info);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, app->pipeline);
+    vkCmdBindDescriptorSets(
+            command_buffer,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            app->pipeline_layout,
             0,
+            1,
+            &app->bindless.set,
             0,
-            NULL,
+            NULL);
+    vkCmdPushConstants(
+            command_buffer,
+            app->pipeline_layout,
+            VK_SHADER_STAGE_ALL,
             0,
-            NULL,
-            1,
-            &imb2);
+            sizeof(push),
+            &push);
+    vkCmdDraw(command_buffer, 3, 1, 0, 0);
+    vkCmdEndRendering(command_buffer);
+}
+
+// The copy is picked up frames later, once the graphics timeline passes
+// this frame's value.
+static void record_capture_pass(VkCommandBuffer command_buffer, void *user) {
+    struct App *app = user;
+    capture_record(
+            &app->capture,
+            command_buffer,
+            app->swapchain_images[app->image_index],
+            app->graphics_timeline.value + 1,
+            app->frame_n);
+    app->capture_requested = 0;
+}
+
+int create_frame_graph(struct App *app, const struct Options *options) {
+#if DEBUG_INPUT_VALIDATION
+    if (app == NULL) return 1;
+    if (options == NULL) return 1;
+#endif
+
+    int result = 0;
+    for (uint32_t i = 0; i < DENOISE_SCRATCH_N; i++)
+        app->denoise_scratch[i] = BINDLESS_INVALID;
+    app->graph_capture = GRAPH_INVALID;
+
+    struct FrameGraph *graph = &app->graph;
+    const uint32_t queue_families[GraphQueue_N] = {
+        [GraphQueue_Graphics] = app->graphics_queue_family,
+        [GraphQueue_Trace] = app->async_compute ? app->compute_queue_family : app->graphics_queue_family,
+    };
+    result = graph_init(graph, app->device, queue_families);
+    if (result > 0) return 2;
+
+    // Resources.
+    uint32_t output = graph_import_image(graph, "output", 0);
+    uint32_t swapchain = graph_import_image(graph, "swapchain", 1);
+    static const char *scratch_names[DENOISE_SCRATCH_N] = { "noisy", "albedo", "filter0", "filter1" };
+    uint32_t scratch[DENOISE_SCRATCH_N];
+    for (uint32_t i = 0; i < DENOISE_SCRATCH_N && app->denoise_enabled; i++) {
+        scratch[i] = graph_create_image(
+                graph,
+                scratch_names[i],
+                app->resolution.max_extent,
+                TRACE_FORMAT,
+                VK_IMAGE_USAGE_STORAGE_BIT);
+    }
+
+    // Passes, in order. Adaptive sampling resolves the output itself unless
+    // it only measures next to the denoiser.
+    result = 0;
+    uint32_t trace = graph_add_pass(graph, "trace", GraphQueue_Trace, 0, record_trace_pass, app);
+    result |= graph_use(graph, trace, output, GraphUse_ComputeWrite);
+    if (app->denoise_enabled) {
+        result |= graph_use(graph, trace, scratch[0], GraphUse_ComputeWrite);
+        result |= graph_use(graph, trace, scratch[1], GraphUse_ComputeWrite);
+        uint32_t temporal = graph_add_pass(
+                graph, "denoise temporal", GraphQueue_Trace, 0, record_denoise_temporal_pass, app);
+        result |= graph_use(graph, temporal, scratch[0], GraphUse_ComputeRead);
+        result |= graph_use(graph, temporal, scratch[1], GraphUse_ComputeRead);
+        result |= graph_use(graph, temporal, scratch[2], GraphUse_ComputeWrite);
+        uint32_t atrous = graph_add_pass(
+                graph, "denoise atrous", GraphQueue_Trace, 0, record_denoise_atrous_pass, app);
+        result |= graph_use(graph, atrous, scratch[1], GraphUse_ComputeRead);
+        result |= graph_use(graph, atrous, scratch[2], GraphUse_ComputeReadWrite);
+        result |= graph_use(graph, atrous, scratch[3], GraphUse_ComputeReadWrite);
+        result |= graph_use(graph, atrous, output, GraphUse_ComputeWrite);
+    }
+    if (app->adaptive_enabled) {
+        uint32_t classify = graph_add_pass(
+                graph, "classify", GraphQueue_Trace, GRAPH_PASS_SIDE_EFFECT, record_classify_pass, app);
+        if (options->adaptive_settings.mode == SamplingMode_Adaptive && !app->denoise_enabled)
+            result |= graph_use(graph, classify, output, GraphUse_ComputeWrite);
+    }
+    uint32_t composite = graph_add_pass(graph, "composite", GraphQueue_Graphics, 0, record_composite_pass, app);
+    result |= graph_use(graph, composite, output, GraphUse_FragmentSample);
+    result |= graph_use(graph, composite, swapchain, GraphUse_ColorAttachment);
+    if (app->capture_enabled) {
+        app->graph_capture = graph_add_pass(
+                graph, "capture", GraphQueue_Graphics, GRAPH_PASS_SIDE_EFFECT, record_capture_pass, app);
+        result |= graph_use(graph, app->graph_capture, swapchain, GraphUse_TransferRead);
+    }
+    if (result > 0) return 2;
+
+    // Present, and hand the output back to the trace queue for the next
+    // frame that uses it.
+    graph_set_final(graph, swapchain, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_QUEUE_FAMILY_IGNORED);
+    if (app->async_compute)
+        graph_set_final(graph, output, VK_IMAGE_LAYOUT_GENERAL, queue_families[GraphQueue_Trace]);
+
+    result = graph_compile(graph, app->physical_device);
+    if (result > 0) return 3;
+    app->graph_output = output;
+    app->graph_swapchain = swapchain;
+    for (uint32_t i = 0; i < TRACE_OUTPUTS; i++)
+        graph_state_init(&app->output_states[i], VK_PIPELINE_STAGE_2_NONE);
+
+    for (uint32_t i = 0; i < DENOISE_SCRATCH_N && app->denoise_enabled; i++) {
+        app->denoise_scratch[i] = bindless_add_storage_image(
+                &app->bindless,
+                app->device,
+                graph_image_view(graph, scratch[i]));
+        if (app->denoise_scratch[i] == BINDLESS_INVALID) return 4;
+    }
+
+    // Barriers only exist once a frame has run, dump again after the first.
+    app->dump_graph = options->dump_graph;
+    if (app->dump_graph) graph_dump(graph);
 
-    // vkCmdSetViewport
-    // vkCmdSetScissor
+    return 0;
+}
 
-    result = vkEndCommandBuffer(app->command_buffer);
+// Lazy copout
+int draw(struct App *app) {
+#if DEBUG_INPUT_VALIDATION
+    if (app == NULL) return 1;
+#endif
+
+    VkResult result = VK_RESULT_MAX_ENUM;
+    uint32_t frame_index = app->frame_n % FRAMES_IN_FLIGHT;
+    struct Frame *frame = &app->frames[frame_index];
+    struct TraceOutput *output = &app->tracer.outputs[frame_index];
+
+    // Wait for the last frame that used these command buffers. Its graphics
+    // submission waited on its compute work, so this covers both queues.
+    if (timeline_wait(&app->graphics_timeline, app->device, frame->graphics_value, UINT64_MAX) > 0) return 6;
+    uint64_t completed = timeline_completed(&app->graphics_timeline, app->device);
+
+    // Recycle the slots completed work held.
+    bindless_retire(&app->bindless, completed);
+
+    // Ask for the mips the scene's textures cover on screen, swap in finished
+    // uploads and kick off the next batch, on the trace's queue. The trace
+    // samples whatever is resident.
+    if (app->scene.textures_n > 0) {
+        scene_texture_footprints(
+                &app->scene,
+                &app->tracer.camera,
+                app->tracer.render_extent.height,
+                app->texture_footprints);
+        for (uint32_t i = 0; i < app->scene.textures_n; i++)
+            if (app->texture_footprints[i] > 0.0f)
+                texture_streamer_request(&app->textures, i, app->texture_footprints[i]);
+    }
+    uint64_t trace_completed = app->async_compute
+        ? timeline_completed(&app->compute_timeline, app->device)
+        : completed;
+    if (texture_streamer_update(&app->textures, trace_completed) > 0) return 5;
+    if (app->scene.textures_n > 0) {
+        for (uint32_t i = 0; i < app->scene.textures_n; i++)
+            app->texture_slots[i] = texture_streamer_slot(&app->textures, i);
+        tracer_set_texture_slots(&app->tracer, frame_index, app->texture_slots);
+    }
+
+    // Encode captures whose copies have landed.
+    if (app->capture_enabled) capture_update(&app->capture, completed);
+
+    // Aquire next swapchain image.
+    uint32_t img_index = 0;
+    vkAcquireNextImageKHR(app->device, app->swapchain, UINT64_MAX, frame->image_available, VK_NULL_HANDLE, &img_index);
+    
+    // Reset command buffers for pushing.
+    VkCommandBufferBeginInfo command_buffer_begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .pInheritanceInfo = NULL,
+    };
+    vkResetCommandBuffer(frame->graphics_command_buffer, 0);
+    result = vkBeginCommandBuffer(frame->graphics_command_buffer, &command_buffer_begin_info);
+    if (result != VK_SUCCESS) return 2;
+    VkCommandBuffer trace_command_buffer = frame->graphics_command_buffer;
+    if (app->async_compute) {
+        trace_command_buffer = frame->compute_command_buffer;
+        vkResetCommandBuffer(trace_command_buffer, 0);
+        result = vkBeginCommandBuffer(trace_command_buffer, &command_buffer_begin_info);
+        if (result != VK_SUCCESS) return 2;
+    }
+
+    // Record every pass. The graph hands the output between the queue
+    // families on the async path, and carries its state to the next frame
+    // that uses it.
+    app->image_index = img_index;
+    profiler_begin(&app->profiler, trace_command_buffer, frame_index);
+
+    // Resize to the frame time target. Only dispatch sizes change, the
+    // accumulation and the denoiser's history start over.
+    if (resolution_update(&app->resolution, frame_index, app->profiler.frame_ms)) {
+        VkExtent2D extent = app->resolution.extent;
+        tracer_set_render_extent(&app->tracer, extent);
+        if (app->denoise_enabled) denoiser_set_render_extent(&app->denoiser, extent);
+        if (app->adaptive_enabled) adaptive_set_render_extent(&app->adaptive, extent);
+    }
+    int capture = app->capture_enabled
+        && (app->capture_requested || (app->capture_every > 0 && app->frame_n % app->capture_every == 0));
+    if (app->graph_capture != GRAPH_INVALID) graph_enable_pass(&app->graph, app->graph_capture, capture);
+    struct GraphState swapchain_state;
+    graph_state_init(&swapchain_state, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT); // acquire waits there
+    graph_bind_image(&app->graph, app->graph_output, output->image, &app->output_states[frame_index]);
+    graph_bind_image(&app->graph, app->graph_swapchain, app->swapchain_images[img_index], &swapchain_state);
+    const VkCommandBuffer command_buffers[GraphQueue_N] = {
+        [GraphQueue_Graphics] = frame->graphics_command_buffer,
+        [GraphQueue_Trace] = trace_command_buffer,
+    };
+    graph_execute(&app->graph, command_buffers);
+    app->output_states[frame_index] = *graph_state(&app->graph, app->graph_output);
+    if (app->dump_graph) {
+        graph_dump(&app->graph);
+        app->dump_graph = 0;
+    }
+
+    if (app->async_compute) {
+        result = vkEndCommandBuffer(trace_command_buffer);
+        if (result != VK_SUCCESS) return 3;
+
+        // Only waits for the composite that last sampled this output, so it
+        // runs alongside the previous frame's composite and present.
+        struct TimelineWait wait = {
+            .timeline = &app->graphics_timeline,
+            .value = frame->graphics_value,
+            .stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        };
+        int submit_result = timeline_submit(
+                app->compute_queue,
+                trace_command_buffer,
+                1,
+                &wait,
+                &app->compute_timeline,
+                &frame->compute_value);
+        if (submit_result > 0) return 4;
+    }
+
+    result = vkEndCommandBuffer(frame->graphics_command_buffer);
     if (result != VK_SUCCESS) return 3;
 
-    // Submit command buffer.
-    VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+    // Submit command buffer. Signals the binary semaphore present waits on, and
+    // the next graphics timeline value.
+    VkSemaphore wait_semaphores[] = { frame->image_available, app->compute_timeline.semaphore };
+    VkPipelineStageFlags wait_stages[] = {
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+    };
+    uint64_t wait_values[] = { 0, frame->compute_value }; // Binary value is ignored.
+    VkSemaphore signal_semaphores[] = { frame->render_finished, app->graphics_timeline.semaphore };
+    uint64_t frame_value = timeline_next(&app->graphics_timeline);
+    uint64_t signal_values[] = { 0, frame_value };
+    VkTimelineSemaphoreSubmitInfo timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount = app->async_compute ? 2 : 1,
+        .pWaitSemaphoreValues = wait_values,
+        .signalSemaphoreValueCount = 2,
+        .pSignalSemaphoreValues = signal_values,
+    };
     VkSubmitInfo submit_info = {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &app->image_available,
+        .pNext = &timeline_info,
+        .waitSemaphoreCount = app->async_compute ? 2 : 1,
+        .pWaitSemaphores = wait_semaphores,
         .pWaitDstStageMask = wait_stages, 
         .commandBufferCount = 1,
-        .pCommandBuffers = &app->command_buffer,
-        .signalSemaphoreCount = 1,
-        .pSignalSemaphores = &app->render_finished,
+        .pCommandBuffers = &frame->graphics_command_buffer,
+        .signalSemaphoreCount = 2,
+        .pSignalSemaphores = signal_semaphores,
     };
 
-    result = vkQueueSubmit(app->graphics_queue, 1, &submit_info, app->in_flight);
+    result = vkQueueSubmit(app->graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
     if (result != VK_SUCCESS) return 4;
+    frame->graphics_value = frame_value;
+    app->frame_n += 1;
 
     // Present?
     VkPresentInfoKHR present_info = {
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
         .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &app->render_finished,
+        .pWaitSemaphores = &frame->render_finished,
         .swapchainCount = 1,
         .pSwapchains = &app->swapchain,
         .pImageIndices = &img_index,
@@ -2,6 +2,32 @@
 #include <GLFW/glfw3.h>
 #include <vulkan/vulkan_core.h>
 #include "swapchain_support_details.h"
+#include "options.h"
+#include "bindless.h"
+#include "timeline.h"
+#include "worker.h"
+#include "texture.h"
+#include "scene.h"
+#include "bvh.h"
+#include "light_tree.h"
+#include "environment.h"
+#include "sampler.h"
+#include "trace.h"
+#include "wavefront.h"
+#include "animation.h"
+#include "denoise.h"
+#include "adaptive.h"
+#include "graph.h"
+#include "profiler.h"
+#include "capture.h"
+#include "pipeline.h"
+#include "startup.h"
+#include "host_memory.h"
+#include "idle.h"
+#include "resolution.h"
+
+#define FRAMES_IN_FLIGHT TRACE_OUTPUTS
+#define SWAPCHAIN_FORMAT VK_FORMAT_B8G8R8A8_SRGB // assumed supported
 
 enum AppErr {
     AppErr_None = 0,
@@ -19,17 +45,68 @@ enum AppErr {
     AppErr_InitVkGraphicsPipelineErr,
     AppErr_InitFramebuffersErr,
     AppErr_InitCommandPoolErr,
+    AppErr_InitSyncErr,
+    AppErr_InitBindlessErr,
+    AppErr_InitWorkersErr,
+    AppErr_InitTexturesErr,
+    AppErr_InitTracerErr,
+    AppErr_InitCaptureErr,
+    AppErr_InitVideoErr,
+    AppErr_InitSceneErr,
+    AppErr_InitDenoiserErr,
+    AppErr_InitProfilerErr,
+    AppErr_InitSamplerErr,
+    AppErr_InitGraphErr,
+    AppErr_InitPipelinesErr,
+    AppErr_InitWavefrontErr,
+    AppErr_InitAnimationErr,
+    AppErr_InitMemoryErr,
+    AppErr_InitHostMemoryErr,
+    AppErr_InitIdleErr,
+    AppErr_InitEnvironmentErr,
+    AppErr_InitResolutionErr,
+    AppErr_InitSequenceErr,
+    AppErr_InitStartupErr,
+};
+
+// Per frame in flight. Reused once the graphics timeline passes
+// graphics_value, which also covers the frame's compute work.
+struct Frame {
+    VkCommandBuffer graphics_command_buffer;
+    VkCommandBuffer compute_command_buffer; // async compute only
+    VkSemaphore image_available;
+    VkSemaphore render_finished;
+    uint64_t graphics_value;
+    uint64_t compute_value;
 };
 
 // Reify application.
 struct App {
+    // Host memory behind the app's allocation callbacks.
+    struct HostMemory host;
+    uint64_t draw_system_allocations_n; // since the last report, 0 once warmed up
+    // Startup, overlapped on the workers.
+    struct StartupTimeline startup;
+    struct PipelineBatch pipelines; // until the modules took theirs
+    const char *path; // shader binaries
+    const char *scene_path; // NULL for the default scene
+    int scene_result; // of the scene job
+    const char *environment_path; // NULL for the sky
+    enum EnvironmentSampling environment_sampling;
+    int environment_result; // of the environment job
+    enum SamplerSequence sample_sequence;
+    int sampler_result; // of the sampler job
+    int pipeline_result; // of the composite pipeline job
     // GLFW
     GLFWwindow *window;
     // Instance.
     VkInstance instance;
     VkSurfaceKHR surface;
+    VkPhysicalDevice physical_device;
     VkDevice device;
-    VkQueue graphics_queue, present_queue;
+    VkQueue graphics_queue, present_queue, compute_queue;
+    uint32_t graphics_queue_family, compute_queue_family;
+    int async_compute; // trace work runs on compute_queue, overlapping the graphics queue
     // Device swapchain support.
     struct SwapchainSupportDetails swapchain_support;
     // Swapchain.
@@ -39,22 +116,75 @@ struct App {
     uint32_t swapchain_images_n;
     VkImage *swapchain_images; // array with size of swapchain_images_n
     VkImageView *swapchain_image_views; // array with size of swapchain_images_n
-    // Pipeline.
+    // Global descriptor set.
+    struct Bindless bindless;
+    // Background jobs.
+    struct Workers workers;
+    // Texture streaming, the scene's textures by their scene index.
+    struct TextureStreamer textures;
+    float *texture_footprints; // per scene texture, this frame's request
+    uint32_t *texture_slots; // per scene texture, what this frame's trace samples
+    // Path tracer.
+    struct Scene scene;
+    struct Bvh bvh;
+    struct LightTree lights; // over the scene's emitters, for the wavefront's connections
+    struct Environment environment; // loaded with environment_path
+    struct Sampler sampler; // built unless the sequence is random
+    int ray_query; // device traverses with ray queries, else the shader walks bvh
+    struct Resolution resolution; // the trace and denoise images' size, adjusted to a frame time target
+    struct Tracer tracer;
+    double kernel_ms[2]; // trace time per sample, specialized and uniform, with --kernel compare
+    struct Wavefront wavefront; // unless the path mode is megakernel only
+    enum PathMode path_mode;
+    int wavefront_active; // this frame's paths run through the wavefront stages
+    double path_ms[2]; // trace time per sample, megakernel and wavefront, with --path-mode compare
+    struct Animation animation; // with --instances
+    int animation_enabled;
+    struct Denoiser denoiser;
+    int denoise_enabled;
+    struct AdaptiveSampler adaptive; // per-tile error, and the tile list in adaptive mode
+    int adaptive_enabled;
+    struct Profiler profiler; // on the queue the trace runs on
+    // Frame capture, disabled when the swapchain cannot be a transfer source.
+    struct Capture capture;
+    int capture_enabled;
+    uint32_t capture_every;
+    int capture_requested; // F12 was pressed
+    int capture_key_down;
+    // Video output, fed by capture.
+    struct VideoStream video;
+    int video_enabled;
+    // Frame graph over the trace, denoise, composite and capture passes.
+    struct FrameGraph graph;
+    uint32_t graph_output; // resources
+    uint32_t graph_swapchain;
+    uint32_t graph_capture; // pass, GRAPH_INVALID without capture
+    uint32_t denoise_scratch[DENOISE_SCRATCH_N]; // storage slots of the graph's transients
+    struct GraphState output_states[TRACE_OUTPUTS]; // carried between the frames using each output
+    uint32_t image_index; // swapchain image of the frame being recorded
+    int dump_graph;
+    // Composite pipeline.
     VkPipelineLayout pipeline_layout;
     VkPipeline pipeline;
     // Buffers.
     VkBuffer vert_pos;
     VkBuffer vert_color;
-    // Command pool.
+    // Command pools.
     VkCommandPool command_pool;
-    VkCommandBuffer command_buffer;
-    // Syncronization.
-    VkSemaphore image_available;
-    VkSemaphore render_finished;
-    VkFence in_flight;
+    VkCommandPool compute_command_pool;
+    // Syncronization. Binary semaphores only where the swapchain needs them.
+    struct Frame frames[FRAMES_IN_FLIGHT];
+    struct Timeline graphics_timeline;
+    struct Timeline compute_timeline;
+    uint64_t frame_n; // Frames submitted so far.
+    // Waits for events instead of drawing once the image is static.
+    struct IdleMonitor idle;
+    // Frame time, since the last report.
+    double report_time;
+    uint64_t report_frame_n;
 };
 
-enum AppErr app_init(struct App *app, const char * const path);
+enum AppErr app_init(struct App *app, const char * const path, const struct Options *options);
 enum AppErr app_free(struct App *app);
 
 enum AppErr app_run(struct App *app);
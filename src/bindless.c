@@ -0,0 +1,357 @@
+#include <vulkan/vulkan.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "bindless.h"
+
+// Upper bounds per kind. Clamped further to what the device allows.
+static const uint32_t bindless_desired_capacity[BindlessKind_N] = {
+    [BindlessKind_StorageBuffer] = 16384,
+    [BindlessKind_SampledImage] = 16384,
+    [BindlessKind_StorageImage] = 1024,
+};
+
+static const VkDescriptorType bindless_descriptor_type[BindlessKind_N] = {
+    [BindlessKind_StorageBuffer] = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+    [BindlessKind_SampledImage] = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+    [BindlessKind_StorageImage] = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+};
+
+static uint32_t min_u32(uint32_t a, uint32_t b) {
+    return a < b ? a : b;
+}
+
+int bindless_init(
+        struct Bindless *bindless,
+        struct HostMemory *host,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        int acceleration_structure) {
+#if DEBUG_INPUT_VALIDATION
+    if (bindless == NULL) return 1;
+    if (!IS_ZERO_PTR(bindless)) return 1;
+    if (host == NULL) return 1;
+    if (device == VK_NULL_HANDLE) return 1;
+    if (physical_device == VK_NULL_HANDLE) return 1;
+#endif
+
+    // Query update-after-bind limits.
+    VkPhysicalDeviceVulkan12Properties vulkan12_properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES,
+    };
+    VkPhysicalDeviceProperties2 properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &vulkan12_properties,
+    };
+    vkGetPhysicalDeviceProperties2(physical_device, &properties);
+
+    bindless->capacity[BindlessKind_StorageBuffer] = min_u32(
+            bindless_desired_capacity[BindlessKind_StorageBuffer],
+            min_u32(vulkan12_properties.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+                vulkan12_properties.maxDescriptorSetUpdateAfterBindStorageBuffers));
+    bindless->capacity[BindlessKind_SampledImage] = min_u32(
+            bindless_desired_capacity[BindlessKind_SampledImage],
+            min_u32(vulkan12_properties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                vulkan12_properties.maxDescriptorSetUpdateAfterBindSampledImages));
+    bindless->capacity[BindlessKind_StorageImage] = min_u32(
+            bindless_desired_capacity[BindlessKind_StorageImage],
+            min_u32(vulkan12_properties.maxPerStageDescriptorUpdateAfterBindStorageImages,
+                vulkan12_properties.maxDescriptorSetUpdateAfterBindStorageImages));
+
+    // Samplers.
+    for (int i = 0; i < BindlessSampler_N; i++) {
+        int linear = i != BindlessSampler_NearestClamp;
+        VkSamplerAddressMode address_mode = i == BindlessSampler_LinearRepeat
+            ? VK_SAMPLER_ADDRESS_MODE_REPEAT
+            : VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        VkSamplerCreateInfo sampler_cinfo = {
+            .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+            .magFilter = linear ? VK_FILTER_LINEAR : VK_FILTER_NEAREST,
+            .minFilter = linear ? VK_FILTER_LINEAR : VK_FILTER_NEAREST,
+            .mipmapMode = linear ? VK_SAMPLER_MIPMAP_MODE_LINEAR : VK_SAMPLER_MIPMAP_MODE_NEAREST,
+            .addressModeU = address_mode,
+            .addressModeV = address_mode,
+            .addressModeW = address_mode,
+            .minLod = 0.0f,
+            .maxLod = 16.0f,
+            .borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK,
+        };
+        if (vkCreateSampler(device, &sampler_cinfo, NULL, bindless->samplers + i) != VK_SUCCESS)
+            return 5;
+    }
+
+    //
+    VkDescriptorSetLayoutBinding bindings[BindlessKind_N + 2];
+    VkDescriptorBindingFlags binding_flags[BindlessKind_N + 2];
+    VkDescriptorPoolSize pool_sizes[BindlessKind_N + 2];
+    uint32_t bindings_n = BindlessKind_N + 1;
+    for (int i = 0; i < BindlessKind_N; i++) {
+        bindings[i] = (VkDescriptorSetLayoutBinding) {
+            .binding = i,
+            .descriptorType = bindless_descriptor_type[i],
+            .descriptorCount = bindless->capacity[i],
+            .stageFlags = VK_SHADER_STAGE_ALL,
+            .pImmutableSamplers = NULL,
+        };
+        binding_flags[i] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+            | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT
+            | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+        pool_sizes[i] = (VkDescriptorPoolSize) {
+            .type = bindless_descriptor_type[i],
+            .descriptorCount = bindless->capacity[i],
+        };
+    }
+    bindings[BINDLESS_SAMPLER_BINDING] = (VkDescriptorSetLayoutBinding) {
+        .binding = BINDLESS_SAMPLER_BINDING,
+        .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+        .descriptorCount = BindlessSampler_N,
+        .stageFlags = VK_SHADER_STAGE_ALL,
+        .pImmutableSamplers = bindless->samplers,
+    };
+    binding_flags[BINDLESS_SAMPLER_BINDING] = 0;
+    pool_sizes[BINDLESS_SAMPLER_BINDING] = (VkDescriptorPoolSize) {
+        .type = VK_DESCRIPTOR_TYPE_SAMPLER,
+        .descriptorCount = BindlessSampler_N,
+    };
+    if (acceleration_structure) {
+        bindings[BINDLESS_ACCEL_BINDING] = (VkDescriptorSetLayoutBinding) {
+            .binding = BINDLESS_ACCEL_BINDING,
+            .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_ALL,
+        };
+        binding_flags[BINDLESS_ACCEL_BINDING] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+            | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+        pool_sizes[BINDLESS_ACCEL_BINDING] = (VkDescriptorPoolSize) {
+            .type = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
+            .descriptorCount = 1,
+        };
+        bindings_n += 1;
+    }
+    bindless->acceleration_structure = acceleration_structure;
+
+    //
+    VkDescriptorSetLayoutBindingFlagsCreateInfo binding_flags_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+        .bindingCount = bindings_n,
+        .pBindingFlags = binding_flags,
+    };
+    VkDescriptorSetLayoutCreateInfo layout_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = &binding_flags_cinfo,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+        .bindingCount = bindings_n,
+        .pBindings = bindings,
+    };
+    VkResult result = vkCreateDescriptorSetLayout(device, &layout_cinfo, NULL, &bindless->layout);
+    if (result != VK_SUCCESS) return 2;
+
+    //
+    VkDescriptorPoolCreateInfo pool_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+        .maxSets = 1,
+        .poolSizeCount = bindings_n,
+        .pPoolSizes = pool_sizes,
+    };
+    result = vkCreateDescriptorPool(device, &pool_cinfo, NULL, &bindless->pool);
+    if (result != VK_SUCCESS) return 3;
+
+    //
+    VkDescriptorSetAllocateInfo set_ainfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = bindless->pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &bindless->layout,
+    };
+    result = vkAllocateDescriptorSets(device, &set_ainfo, &bindless->set);
+    if (result != VK_SUCCESS) return 4;
+
+    // Slot free lists start empty, fresh slots come from the high-water mark.
+    bindless->host = host;
+    for (int i = 0; i < BindlessKind_N; i++) {
+        bindless->free[i] = host_alloc(
+                host,
+                bindless->capacity[i] * sizeof(uint32_t),
+                _Alignof(uint32_t),
+                VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
+        if (bindless->free[i] == NULL) return 4;
+    }
+
+    return 0;
+}
+
+void bindless_free(struct Bindless *bindless, VkDevice device) {
+    vkDestroyDescriptorPool(device, bindless->pool, NULL); // Frees the set.
+    vkDestroyDescriptorSetLayout(device, bindless->layout, NULL);
+    for (int i = 0; i < BindlessSampler_N; i++)
+        vkDestroySampler(device, bindless->samplers[i], NULL);
+    if (bindless->host != NULL) {
+        for (int i = 0; i < BindlessKind_N; i++)
+            host_free(bindless->host, bindless->free[i]);
+        host_free(bindless->host, bindless->retired);
+    }
+
+    memset(bindless, 0, sizeof(*bindless));
+}
+
+static uint32_t bindless_alloc_slot(struct Bindless *bindless, enum BindlessKind kind) {
+    if (bindless->free_n[kind] > 0)
+        return bindless->free[kind][--bindless->free_n[kind]];
+    if (bindless->high[kind] < bindless->capacity[kind])
+        return bindless->high[kind]++;
+    return BINDLESS_INVALID;
+}
+
+static void bindless_write(
+        struct Bindless *bindless,
+        VkDevice device,
+        enum BindlessKind kind,
+        uint32_t slot,
+        const VkDescriptorBufferInfo *buffer_info,
+        const VkDescriptorImageInfo *image_info) {
+    VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = bindless->set,
+        .dstBinding = kind,
+        .dstArrayElement = slot,
+        .descriptorCount = 1,
+        .descriptorType = bindless_descriptor_type[kind],
+        .pBufferInfo = buffer_info,
+        .pImageInfo = image_info,
+    };
+    vkUpdateDescriptorSets(device, 1, &write, 0, NULL);
+}
+
+uint32_t bindless_add_storage_buffer(
+        struct Bindless *bindless,
+        VkDevice device,
+        VkBuffer buffer,
+        VkDeviceSize offset,
+        VkDeviceSize range) {
+#if DEBUG_INPUT_VALIDATION
+    if (bindless == NULL) return BINDLESS_INVALID;
+    if (buffer == VK_NULL_HANDLE) return BINDLESS_INVALID;
+#endif
+
+    uint32_t slot = bindless_alloc_slot(bindless, BindlessKind_StorageBuffer);
+    if (slot == BINDLESS_INVALID) return BINDLESS_INVALID;
+
+    VkDescriptorBufferInfo buffer_info = {
+        .buffer = buffer,
+        .offset = offset,
+        .range = range,
+    };
+    bindless_write(bindless, device, BindlessKind_StorageBuffer, slot, &buffer_info, NULL);
+
+    return slot;
+}
+
+uint32_t bindless_add_sampled_image(
+        struct Bindless *bindless,
+        VkDevice device,
+        VkImageView view,
+        VkImageLayout layout) {
+#if DEBUG_INPUT_VALIDATION
+    if (bindless == NULL) return BINDLESS_INVALID;
+    if (view == VK_NULL_HANDLE) return BINDLESS_INVALID;
+#endif
+
+    uint32_t slot = bindless_alloc_slot(bindless, BindlessKind_SampledImage);
+    if (slot == BINDLESS_INVALID) return BINDLESS_INVALID;
+
+    bindless_write_sampled_image(bindless, device, slot, view, layout);
+
+    return slot;
+}
+
+uint32_t bindless_add_storage_image(struct Bindless *bindless, VkDevice device, VkImageView view) {
+#if DEBUG_INPUT_VALIDATION
+    if (bindless == NULL) return BINDLESS_INVALID;
+    if (view == VK_NULL_HANDLE) return BINDLESS_INVALID;
+#endif
+
+    uint32_t slot = bindless_alloc_slot(bindless, BindlessKind_StorageImage);
+    if (slot == BINDLESS_INVALID) return BINDLESS_INVALID;
+
+    VkDescriptorImageInfo image_info = {
+        .imageView = view,
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+    };
+    bindless_write(bindless, device, BindlessKind_StorageImage, slot, NULL, &image_info);
+
+    return slot;
+}
+
+void bindless_write_sampled_image(
+        struct Bindless *bindless,
+        VkDevice device,
+        uint32_t slot,
+        VkImageView view,
+        VkImageLayout layout) {
+    VkDescriptorImageInfo image_info = {
+        .imageView = view,
+        .imageLayout = layout,
+    };
+    bindless_write(bindless, device, BindlessKind_SampledImage, slot, NULL, &image_info);
+}
+
+void bindless_write_acceleration_structure(
+        struct Bindless *bindless,
+        VkDevice device,
+        VkAccelerationStructureKHR acceleration_structure) {
+#if DEBUG_INPUT_VALIDATION
+    if (bindless == NULL) return;
+    if (!bindless->acceleration_structure) return;
+#endif
+
+    VkWriteDescriptorSetAccelerationStructureKHR accel_write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR,
+        .accelerationStructureCount = 1,
+        .pAccelerationStructures = &acceleration_structure,
+    };
+    VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .pNext = &accel_write,
+        .dstSet = bindless->set,
+        .dstBinding = BINDLESS_ACCEL_BINDING,
+        .dstArrayElement = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
+    };
+    vkUpdateDescriptorSets(device, 1, &write, 0, NULL);
+}
+
+void bindless_release(struct Bindless *bindless, enum BindlessKind kind, uint32_t slot, uint64_t value) {
+    if (slot == BINDLESS_INVALID) return;
+
+    if (bindless->retired_n == bindless->retired_cap) {
+        bindless->retired_cap = bindless->retired_cap ? bindless->retired_cap * 2 : 64;
+        bindless->retired = host_realloc(
+                bindless->host,
+                bindless->retired,
+                bindless->retired_cap * sizeof(*bindless->retired),
+                _Alignof(struct BindlessRetired),
+                VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
+    }
+
+    bindless->retired[bindless->retired_n++] = (struct BindlessRetired) {
+        .value = value,
+        .kind = kind,
+        .slot = slot,
+    };
+}
+
+void bindless_retire(struct Bindless *bindless, uint64_t completed_value) {
+    // Entries are appended in timeline order, so retire from the front.
+    uint32_t i = 0;
+    for (; i < bindless->retired_n; i++) {
+        struct BindlessRetired *r = &bindless->retired[i];
+        if (r->value > completed_value) break;
+        bindless->free[r->kind][bindless->free_n[r->kind]++] = r->slot;
+    }
+
+    //
+    bindless->retired_n -= i;
+    memmove(bindless->retired, bindless->retired + i, bindless->retired_n * sizeof(*bindless->retired));
+}
@@ -0,0 +1,27 @@
+// Global resource table, see bindless.h. Include from any stage.
+#extension GL_EXT_nonuniform_qualifier : require
+
+#define BINDLESS_STORAGE_BUFFER 0
+#define BINDLESS_SAMPLED_IMAGE 1
+#define BINDLESS_STORAGE_IMAGE 2
+#define BINDLESS_SAMPLER 3
+#define BINDLESS_ACCEL 4 // only with ray query support
+#define SAMPLER_LINEAR_REPEAT 0
+#define SAMPLER_LINEAR_CLAMP 1
+#define SAMPLER_NEAREST_CLAMP 2
+#define BINDLESS_INVALID 0xFFFFFFFFu
+
+// Storage buffers alias the same binding once per element type:
+//     BINDLESS_BUFFER(Vertices, vec4) -> Vertices[handle].data[i]
+#define BINDLESS_BUFFER(name, type) \
+    layout(set = 0, binding = BINDLESS_STORAGE_BUFFER, std430) buffer name##_t { type data[]; } name[]
+
+#define BINDLESS_BUFFER_RO(name, type) \
+    layout(set = 0, binding = BINDLESS_STORAGE_BUFFER, std430) readonly buffer name##_t { type data[]; } name[]
+
+layout(set = 0, binding = BINDLESS_SAMPLED_IMAGE) uniform texture2D bindless_textures[];
+layout(set = 0, binding = BINDLESS_STORAGE_IMAGE, rgba32f) uniform image2D bindless_images[];
+layout(set = 0, binding = BINDLESS_SAMPLER) uniform sampler bindless_samplers[3];
+
+#define bindless_texture(handle, s) \
+    sampler2D(bindless_textures[nonuniformEXT(handle)], bindless_samplers[s])
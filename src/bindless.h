@@ -0,0 +1,95 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include "host_memory.h"
+
+// Descriptor binding of each resource kind inside the global set. Must match
+// the layout declared in bindless.glsl.
+enum BindlessKind {
+    BindlessKind_StorageBuffer = 0,
+    BindlessKind_SampledImage = 1,
+    BindlessKind_StorageImage = 2,
+    BindlessKind_N,
+};
+
+// Immutable samplers, bound after the resource kinds.
+enum BindlessSampler {
+    BindlessSampler_LinearRepeat = 0,
+    BindlessSampler_LinearClamp = 1,
+    BindlessSampler_NearestClamp = 2,
+    BindlessSampler_N,
+};
+
+#define BINDLESS_SAMPLER_BINDING BindlessKind_N
+// Single top level acceleration structure, only with ray query support.
+#define BINDLESS_ACCEL_BINDING (BindlessKind_N + 1)
+#define BINDLESS_INVALID UINT32_MAX
+
+// Handles reach the shaders through push constants of at most this size.
+#define BINDLESS_PUSH_CONSTANT_SIZE 128
+
+// Slot waiting for the graphics timeline to pass the last work that might
+// still reference it.
+struct BindlessRetired {
+    uint64_t value;
+    uint32_t kind;
+    uint32_t slot;
+};
+
+// One update-after-bind, partially bound descriptor set holding every buffer
+// and image the shaders can see. Resources are addressed by their slot index.
+struct Bindless {
+    VkDescriptorSetLayout layout;
+    VkDescriptorPool pool;
+    VkDescriptorSet set;
+    VkSampler samplers[BindlessSampler_N];
+    int acceleration_structure; // layout has BINDLESS_ACCEL_BINDING
+    // Slot allocator, per kind.
+    uint32_t capacity[BindlessKind_N];
+    uint32_t high[BindlessKind_N]; // slots [high, capacity) have never been handed out
+    uint32_t free_n[BindlessKind_N];
+    uint32_t *free[BindlessKind_N]; // stack with size of capacity
+    struct HostMemory *host; // of free and retired
+    // Deferred recycling.
+    uint32_t retired_n;
+    uint32_t retired_cap;
+    struct BindlessRetired *retired;
+};
+
+int bindless_init(
+        struct Bindless *bindless,
+        struct HostMemory *host,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        int acceleration_structure);
+void bindless_free(struct Bindless *bindless, VkDevice device);
+
+uint32_t bindless_add_storage_buffer(
+        struct Bindless *bindless,
+        VkDevice device,
+        VkBuffer buffer,
+        VkDeviceSize offset,
+        VkDeviceSize range);
+uint32_t bindless_add_sampled_image(
+        struct Bindless *bindless,
+        VkDevice device,
+        VkImageView view,
+        VkImageLayout layout);
+uint32_t bindless_add_storage_image(struct Bindless *bindless, VkDevice device, VkImageView view);
+void bindless_write_sampled_image(
+        struct Bindless *bindless,
+        VkDevice device,
+        uint32_t slot,
+        VkImageView view,
+        VkImageLayout layout);
+
+void bindless_write_acceleration_structure(
+        struct Bindless *bindless,
+        VkDevice device,
+        VkAccelerationStructureKHR acceleration_structure);
+
+// Returns slot to the allocator once the graphics timeline reaches value. The
+// descriptor itself is left untouched, a partially bound set never reads it
+// again.
+void bindless_release(struct Bindless *bindless, enum BindlessKind kind, uint32_t slot, uint64_t value);
+void bindless_retire(struct Bindless *bindless, uint64_t completed_value);
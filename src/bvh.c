@@ -0,0 +1,375 @@
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include "util.h"
+#include "bvh.h"
+
+#define TRAVERSAL_COST 1.0f
+#define INTERSECTION_COST 1.0f
+
+struct Aabb {
+    float min[3];
+    float max[3];
+};
+
+static void aabb_empty(struct Aabb *b) {
+    for (int c = 0; c < 3; c++) {
+        b->min[c] = FLT_MAX;
+        b->max[c] = -FLT_MAX;
+    }
+}
+
+static void aabb_grow(struct Aabb *b, const float *p) {
+    for (int c = 0; c < 3; c++) {
+        b->min[c] = fminf(b->min[c], p[c]);
+        b->max[c] = fmaxf(b->max[c], p[c]);
+    }
+}
+
+static void aabb_merge(struct Aabb *b, const struct Aabb *o) {
+    aabb_grow(b, o->min);
+    aabb_grow(b, o->max);
+}
+
+static float aabb_area(const struct Aabb *b) {
+    float e[3];
+    for (int c = 0; c < 3; c++) e[c] = fmaxf(b->max[c] - b->min[c], 0.0f);
+    return 2.0f * (e[0] * e[1] + e[1] * e[2] + e[2] * e[0]);
+}
+
+struct BuildContext {
+    struct Bvh *bvh;
+    struct Aabb *bounds; // per triangle
+    float *centroids; // 3 per triangle
+};
+
+static void node_fit(struct BuildContext *ctx, struct BvhNode *node) {
+    struct Aabb b;
+    aabb_empty(&b);
+    for (uint32_t i = 0; i < node->count; i++)
+        aabb_merge(&b, &ctx->bounds[ctx->bvh->triangles[node->left_first + i]]);
+    memcpy(node->min, b.min, sizeof(b.min));
+    memcpy(node->max, b.max, sizeof(b.max));
+}
+
+// Returns the best split cost, with its axis and plane in *axis, *split.
+static float find_split(struct BuildContext *ctx, const struct BvhNode *node, int *axis, float *split) {
+    float best = FLT_MAX;
+    for (int a = 0; a < 3; a++) {
+        // Bin over the centroid bounds, not the node bounds.
+        float lo = FLT_MAX, hi = -FLT_MAX;
+        for (uint32_t i = 0; i < node->count; i++) {
+            float c = ctx->centroids[ctx->bvh->triangles[node->left_first + i] * 3 + a];
+            lo = fminf(lo, c);
+            hi = fmaxf(hi, c);
+        }
+        if (hi - lo <= 1e-12f) continue;
+
+        struct Aabb bins[BVH_BINS];
+        uint32_t counts[BVH_BINS] = { 0 };
+        for (int b = 0; b < BVH_BINS; b++) aabb_empty(&bins[b]);
+        float scale = BVH_BINS / (hi - lo);
+        for (uint32_t i = 0; i < node->count; i++) {
+            uint32_t t = ctx->bvh->triangles[node->left_first + i];
+            int b = (int)((ctx->centroids[t * 3 + a] - lo) * scale);
+            b = b < BVH_BINS - 1 ? b : BVH_BINS - 1;
+            counts[b] += 1;
+            aabb_merge(&bins[b], &ctx->bounds[t]);
+        }
+
+        // Sweep from both sides.
+        float left_area[BVH_BINS - 1], right_area[BVH_BINS - 1];
+        uint32_t left_n[BVH_BINS - 1], right_n[BVH_BINS - 1];
+        struct Aabb left, right;
+        aabb_empty(&left);
+        aabb_empty(&right);
+        uint32_t ln = 0, rn = 0;
+        for (int i = 0; i < BVH_BINS - 1; i++) {
+            if (counts[i] > 0) aabb_merge(&left, &bins[i]);
+            ln += counts[i];
+            left_n[i] = ln;
+            left_area[i] = aabb_area(&left);
+            int j = BVH_BINS - 1 - i;
+            if (counts[j] > 0) aabb_merge(&right, &bins[j]);
+            rn += counts[j];
+            right_n[j - 1] = rn;
+            right_area[j - 1] = aabb_area(&right);
+        }
+        for (int i = 0; i < BVH_BINS - 1; i++) {
+            if (left_n[i] == 0 || right_n[i] == 0) continue;
+            float cost = left_n[i] * left_area[i] + right_n[i] * right_area[i];
+            if (cost < best) {
+                best = cost;
+                *axis = a;
+                *split = lo + (i + 1) / scale;
+            }
+        }
+    }
+
+    return best;
+}
+
+static void subdivide(struct BuildContext *ctx, uint32_t index) {
+    struct BvhNode *node = &ctx->bvh->nodes[index];
+    if (node->count <= 1) return;
+
+    int axis = 0;
+    float split = 0.0f;
+    float cost = find_split(ctx, node, &axis, &split);
+    struct Aabb self = { { node->min[0], node->min[1], node->min[2] }, { node->max[0], node->max[1], node->max[2] } };
+    float leaf_cost = node->count * INTERSECTION_COST;
+    float split_cost = TRAVERSAL_COST + INTERSECTION_COST * cost / aabb_area(&self);
+    if (cost == FLT_MAX || (node->count <= BVH_LEAF_SIZE && split_cost >= leaf_cost)) return;
+
+    // Partition in place.
+    uint32_t *triangles = ctx->bvh->triangles;
+    uint32_t i = node->left_first, j = node->left_first + node->count;
+    while (i < j) {
+        if (ctx->centroids[triangles[i] * 3 + axis] < split) i++;
+        else {
+            uint32_t t = triangles[i];
+            triangles[i] = triangles[--j];
+            triangles[j] = t;
+        }
+    }
+    uint32_t left_n = i - node->left_first;
+    if (left_n == 0 || left_n == node->count) return;
+
+    //
+    uint32_t left = ctx->bvh->nodes_n;
+    ctx->bvh->nodes_n += 2;
+    struct BvhNode *children = &ctx->bvh->nodes[left];
+    children[0].left_first = node->left_first;
+    children[0].count = left_n;
+    children[1].left_first = i;
+    children[1].count = node->count - left_n;
+    node->left_first = left;
+    node->count = 0;
+    node_fit(ctx, &children[0]);
+    node_fit(ctx, &children[1]);
+
+    subdivide(ctx, left);
+    subdivide(ctx, left + 1);
+}
+
+// Builds over ctx's per-primitive bounds, then frees them.
+static void build(struct Bvh *bvh, struct BuildContext *ctx, uint32_t primitives_n, double start) {
+    for (uint32_t t = 0; t < primitives_n; t++) {
+        bvh->triangles[t] = t;
+        for (int c = 0; c < 3; c++)
+            ctx->centroids[t * 3 + c] = 0.5f * (ctx->bounds[t].min[c] + ctx->bounds[t].max[c]);
+    }
+
+    //
+    bvh->nodes_n = 1;
+    bvh->nodes[0].left_first = 0;
+    bvh->nodes[0].count = primitives_n;
+    node_fit(ctx, &bvh->nodes[0]);
+    subdivide(ctx, 0);
+
+    free(ctx->bounds);
+    free(ctx->centroids);
+    bvh->nodes = realloc(bvh->nodes, bvh->nodes_n * sizeof(*bvh->nodes));
+    bvh->build_time = time_now() - start;
+}
+
+// Allocates for primitives_n primitives, ctx bounds still to be filled.
+static int build_alloc(struct Bvh *bvh, struct BuildContext *ctx, uint32_t primitives_n) {
+    // A binary tree with one primitive per leaf at worst.
+    bvh->nodes = malloc((2 * (size_t)primitives_n - 1) * sizeof(*bvh->nodes));
+    bvh->triangles = malloc(primitives_n * sizeof(uint32_t));
+    bvh->triangles_n = primitives_n;
+    ctx->bvh = bvh;
+    ctx->bounds = malloc(primitives_n * sizeof(struct Aabb));
+    ctx->centroids = malloc(primitives_n * 3 * sizeof(float));
+    if (bvh->nodes == NULL || bvh->triangles == NULL || ctx->bounds == NULL || ctx->centroids == NULL) {
+        free(ctx->bounds);
+        free(ctx->centroids);
+        bvh_free(bvh);
+        return 2;
+    }
+
+    return 0;
+}
+
+int bvh_build(struct Bvh *bvh, const float *positions, const uint32_t *indices, uint32_t triangles_n) {
+#if DEBUG_INPUT_VALIDATION
+    if (bvh == NULL) return 1;
+    if (!IS_ZERO_PTR(bvh)) return 1;
+    if (positions == NULL || indices == NULL) return 1;
+    if (triangles_n == 0) return 1;
+#endif
+
+    double start = time_now();
+    struct BuildContext ctx;
+    if (build_alloc(bvh, &ctx, triangles_n) > 0) return 2;
+    for (uint32_t t = 0; t < triangles_n; t++) {
+        aabb_empty(&ctx.bounds[t]);
+        for (int v = 0; v < 3; v++) aabb_grow(&ctx.bounds[t], positions + indices[t * 3 + v] * 4);
+    }
+    build(bvh, &ctx, triangles_n, start);
+
+    return 0;
+}
+
+int bvh_build_boxes(struct Bvh *bvh, const float *bounds, uint32_t boxes_n) {
+#if DEBUG_INPUT_VALIDATION
+    if (bvh == NULL) return 1;
+    if (!IS_ZERO_PTR(bvh)) return 1;
+    if (bounds == NULL) return 1;
+    if (boxes_n == 0) return 1;
+#endif
+
+    double start = time_now();
+    struct BuildContext ctx;
+    if (build_alloc(bvh, &ctx, boxes_n) > 0) return 2;
+    for (uint32_t i = 0; i < boxes_n; i++) {
+        memcpy(ctx.bounds[i].min, bounds + i * 6, 3 * sizeof(float));
+        memcpy(ctx.bounds[i].max, bounds + i * 6 + 3, 3 * sizeof(float));
+    }
+    build(bvh, &ctx, boxes_n, start);
+
+    return 0;
+}
+
+void bvh_free(struct Bvh *bvh) {
+    free(bvh->nodes);
+    free(bvh->triangles);
+    memset(bvh, 0, sizeof(*bvh));
+}
+
+float bvh_sah_cost(const struct Bvh *bvh) {
+    if (bvh->nodes_n == 0) return 0.0f;
+
+    struct Aabb root = {
+        { bvh->nodes[0].min[0], bvh->nodes[0].min[1], bvh->nodes[0].min[2] },
+        { bvh->nodes[0].max[0], bvh->nodes[0].max[1], bvh->nodes[0].max[2] },
+    };
+    float root_area = aabb_area(&root);
+    if (root_area <= 0.0f) return 0.0f;
+
+    float cost = 0.0f;
+    for (uint32_t i = 0; i < bvh->nodes_n; i++) {
+        const struct BvhNode *node = &bvh->nodes[i];
+        struct Aabb b = {
+            { node->min[0], node->min[1], node->min[2] },
+            { node->max[0], node->max[1], node->max[2] },
+        };
+        float area = aabb_area(&b) / root_area;
+        cost += area * (node->count == 0 ? TRAVERSAL_COST : node->count * INTERSECTION_COST);
+    }
+
+    return cost;
+}
+
+// Refit.
+
+struct RefitContext {
+    struct Bvh *bvh;
+    const float *positions;
+    const uint32_t *indices;
+    uint32_t roots[BVH_REFIT_MAX_JOBS]; // subtrees refit by jobs
+    uint32_t roots_n;
+    struct WorkerGroup group;
+};
+
+struct RefitJob {
+    struct RefitContext *ctx;
+    uint32_t root;
+};
+
+static void refit_leaf(const struct RefitContext *ctx, struct BvhNode *node) {
+    struct Aabb b;
+    aabb_empty(&b);
+    for (uint32_t i = 0; i < node->count; i++) {
+        const uint32_t *triangle = ctx->indices + ctx->bvh->triangles[node->left_first + i] * 3;
+        for (int v = 0; v < 3; v++) aabb_grow(&b, ctx->positions + triangle[v] * 4);
+    }
+    memcpy(node->min, b.min, sizeof(b.min));
+    memcpy(node->max, b.max, sizeof(b.max));
+}
+
+static void refit_merge(struct BvhNode *node, const struct BvhNode *children) {
+    for (int c = 0; c < 3; c++) {
+        node->min[c] = fminf(children[0].min[c], children[1].min[c]);
+        node->max[c] = fmaxf(children[0].max[c], children[1].max[c]);
+    }
+}
+
+// Post order below index. With stop set, subtrees rooted at ctx->roots are
+// already refit.
+static void refit_subtree(struct RefitContext *ctx, uint32_t index, int stop) {
+    if (stop) {
+        for (uint32_t i = 0; i < ctx->roots_n; i++)
+            if (ctx->roots[i] == index) return;
+    }
+
+    struct BvhNode *node = &ctx->bvh->nodes[index];
+    if (node->count > 0) {
+        refit_leaf(ctx, node);
+        return;
+    }
+    refit_subtree(ctx, node->left_first, stop);
+    refit_subtree(ctx, node->left_first + 1, stop);
+    refit_merge(node, &ctx->bvh->nodes[node->left_first]);
+}
+
+static void refit_job(void *arg) {
+    struct RefitJob *job = arg;
+    refit_subtree(job->ctx, job->root, 0);
+    worker_group_done(&job->ctx->group);
+}
+
+void bvh_refit(struct Bvh *bvh, const float *positions, const uint32_t *indices, struct Workers *workers) {
+#if DEBUG_INPUT_VALIDATION
+    if (bvh == NULL || bvh->nodes_n == 0) return;
+    if (positions == NULL || indices == NULL) return;
+#endif
+
+    struct RefitContext ctx = {
+        .bvh = bvh,
+        .positions = positions,
+        .indices = indices,
+    };
+    if (workers == NULL || workers->threads_n < 2) {
+        refit_subtree(&ctx, 0, 0);
+        return;
+    }
+
+    // Split the tree level by level into a few subtrees per thread.
+    uint32_t target = workers->threads_n * 4 < BVH_REFIT_MAX_JOBS ? workers->threads_n * 4 : BVH_REFIT_MAX_JOBS;
+    ctx.roots[0] = 0;
+    ctx.roots_n = 1;
+    while (ctx.roots_n < target) {
+        uint32_t next[BVH_REFIT_MAX_JOBS];
+        uint32_t next_n = 0;
+        int split = 0;
+        for (uint32_t i = 0; i < ctx.roots_n && next_n + 2 <= BVH_REFIT_MAX_JOBS; i++) {
+            const struct BvhNode *node = &bvh->nodes[ctx.roots[i]];
+            if (node->count > 0) {
+                next[next_n++] = ctx.roots[i];
+            } else {
+                next[next_n++] = node->left_first;
+                next[next_n++] = node->left_first + 1;
+                split = 1;
+            }
+        }
+        if (!split || next_n > BVH_REFIT_MAX_JOBS || next_n < ctx.roots_n) break;
+        memcpy(ctx.roots, next, next_n * sizeof(uint32_t));
+        ctx.roots_n = next_n;
+    }
+
+    //
+    struct RefitJob jobs[BVH_REFIT_MAX_JOBS];
+    worker_group_init(&ctx.group);
+    for (uint32_t i = 0; i < ctx.roots_n; i++) {
+        jobs[i] = (struct RefitJob) { .ctx = &ctx, .root = ctx.roots[i] };
+        workers_push_group(workers, &ctx.group, refit_job, jobs + i);
+    }
+    worker_group_wait(&ctx.group);
+    worker_group_free(&ctx.group);
+
+    // Nodes above the subtrees.
+    refit_subtree(&ctx, 0, 1);
+}
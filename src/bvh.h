@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+#include "worker.h"
+
+#define BVH_BINS 16
+#define BVH_LEAF_SIZE 4
+#define BVH_REFIT_MAX_JOBS 64
+
+// std430 layout, traversed by the software trace path. An interior node has
+// count 0 and its children at left_first and left_first + 1; a leaf covers
+// triangles[left_first, left_first + count).
+struct BvhNode {
+    float min[3];
+    uint32_t left_first;
+    float max[3];
+    uint32_t count;
+};
+
+// Binary BVH over triangles or boxes, built top down with binned SAH.
+struct Bvh {
+    struct BvhNode *nodes; // array with size of nodes_n
+    uint32_t nodes_n;
+    uint32_t *triangles; // triangle or box ids in leaf order, size of triangles_n
+    uint32_t triangles_n;
+    double build_time; // seconds
+};
+
+// positions holds 4 floats per vertex, indices 3 per triangle.
+int bvh_build(struct Bvh *bvh, const float *positions, const uint32_t *indices, uint32_t triangles_n);
+// bounds holds min xyz then max xyz per box.
+int bvh_build_boxes(struct Bvh *bvh, const float *bounds, uint32_t boxes_n);
+void bvh_free(struct Bvh *bvh);
+
+// Refits every node's bounds to moved vertices of the triangles it was
+// built over, bottom up. With workers, subtrees refit in parallel and the
+// nodes above them after. The topology stays, so quality drops as vertices
+// move, see bvh_sah_cost.
+void bvh_refit(struct Bvh *bvh, const float *positions, const uint32_t *indices, struct Workers *workers);
+
+// Surface area heuristic cost of the tree, relative to its root.
+float bvh_sah_cost(const struct Bvh *bvh);
@@ -0,0 +1,276 @@
+#include <vulkan/vulkan.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "util.h"
+#include "gpu_memory.h"
+#include "image.h"
+#include "capture.h"
+
+static const char *capture_extensions[] = {
+    [CaptureFormat_Png] = "png",
+    [CaptureFormat_Ppm] = "ppm",
+    [CaptureFormat_Exr] = "exr",
+};
+
+// Worker job: swizzle the BGRA sRGB copy into the output format and write it.
+static void capture_encode(void *arg) {
+    struct CaptureSlot *slot = arg;
+    struct Capture *capture = slot->capture;
+    double start = time_now();
+
+    uint32_t width = capture->extent.width, height = capture->extent.height;
+    size_t texels = (size_t)width * height;
+    char path[256];
+    snprintf(path, sizeof(path), "%s/frame_%06llu.%s",
+            capture->directory,
+            (unsigned long long)slot->frame,
+            capture_extensions[capture->format]);
+
+    int result = 0;
+    if (capture->video != NULL) {
+        video_submit(capture->video, slot->sequence, slot->mapped);
+    } else if (capture->format == CaptureFormat_Exr) {
+        float lut[256];
+        for (int i = 0; i < 256; i++) {
+            float f = i / 255.0f;
+            lut[i] = f <= 0.04045f ? f / 12.92f : powf((f + 0.055f) / 1.055f, 2.4f);
+        }
+        float *rgb = slot->rgb;
+        for (size_t i = 0; i < texels; i++) {
+            rgb[i * 3 + 0] = lut[slot->mapped[i * 4 + 2]];
+            rgb[i * 3 + 1] = lut[slot->mapped[i * 4 + 1]];
+            rgb[i * 3 + 2] = lut[slot->mapped[i * 4 + 0]];
+        }
+        result = image_write_exr(path, width, height, rgb);
+    } else {
+        uint8_t *rgb = slot->rgb;
+        for (size_t i = 0; i < texels; i++) {
+            rgb[i * 3 + 0] = slot->mapped[i * 4 + 2];
+            rgb[i * 3 + 1] = slot->mapped[i * 4 + 1];
+            rgb[i * 3 + 2] = slot->mapped[i * 4 + 0];
+        }
+        result = capture->format == CaptureFormat_Png
+            ? image_write_png(path, width, height, rgb)
+            : image_write_ppm(path, width, height, rgb);
+    }
+    if (result > 0) printf("[capture] failed to write %s (%i)\n", path, result);
+
+    double end = time_now();
+    pthread_mutex_lock(&capture->lock);
+    if (result > 0) capture->failed_n += 1;
+    else capture->captured_n += 1;
+    capture->encode_sum += end - start;
+    capture->latency_sum += end - slot->recorded_at;
+    slot->state = CaptureState_Free;
+    pthread_cond_broadcast(&capture->freed);
+    pthread_mutex_unlock(&capture->lock);
+}
+
+int capture_init(
+        struct Capture *capture,
+        struct HostMemory *host,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        const struct Timeline *timeline,
+        struct Workers *workers,
+        struct VideoStream *video,
+        VkExtent2D extent,
+        enum CaptureFormat format,
+        const char *directory) {
+#if DEBUG_INPUT_VALIDATION
+    if (capture == NULL) return 1;
+    if (!IS_ZERO_PTR(capture)) return 1;
+    if (host == NULL) return 1;
+    if (device == VK_NULL_HANDLE) return 1;
+    if (physical_device == VK_NULL_HANDLE) return 1;
+    if (timeline == NULL) return 1;
+    if (workers == NULL) return 1;
+    if (extent.width == 0 || extent.height == 0) return 1;
+    if (directory == NULL) return 1;
+#endif
+
+    capture->host = host;
+    capture->device = device;
+    capture->timeline = timeline;
+    capture->workers = workers;
+    capture->video = video;
+    capture->extent = extent;
+    capture->format = format;
+    snprintf(capture->directory, sizeof(capture->directory), "%s", directory);
+    pthread_mutex_init(&capture->lock, NULL);
+    pthread_cond_init(&capture->freed, NULL);
+
+    // Cached memory makes the worker's reads fast, coherent is the fallback.
+    VkDeviceSize size = (VkDeviceSize)extent.width * extent.height * 4;
+    for (uint32_t i = 0; i < CAPTURE_RING_SIZE; i++) {
+        struct CaptureSlot *slot = &capture->slots[i];
+        slot->capture = capture;
+        int result = create_buffer(
+                device,
+                physical_device,
+                size,
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+                GpuMemoryCategory_Staging,
+                &slot->buffer,
+                &slot->memory);
+        if (result == 3) { // No such memory type.
+            vkDestroyBuffer(device, slot->buffer, NULL);
+            slot->buffer = VK_NULL_HANDLE;
+            result = create_buffer(
+                    device,
+                    physical_device,
+                    size,
+                    VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    GpuMemoryCategory_Staging,
+                    &slot->buffer,
+                    &slot->memory);
+        }
+        if (result > 0) return 2;
+
+        void *mapped = NULL;
+        if (vkMapMemory(device, slot->memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS) return 3;
+        slot->mapped = mapped;
+
+        // Encodes then allocate nothing per frame.
+        if (video == NULL) {
+            size_t texel_size = format == CaptureFormat_Exr ? 3 * sizeof(float) : 3;
+            slot->rgb = host_alloc(
+                    host,
+                    (size_t)extent.width * extent.height * texel_size,
+                    _Alignof(float),
+                    VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+            if (slot->rgb == NULL) return 4;
+        }
+    }
+
+    return 0;
+}
+
+void capture_free(struct Capture *capture) {
+    if (capture->device == VK_NULL_HANDLE) return;
+
+    // Encodes hold the mapped pointers.
+    workers_wait_idle(capture->workers);
+
+    for (uint32_t i = 0; i < CAPTURE_RING_SIZE; i++) {
+        struct CaptureSlot *slot = &capture->slots[i];
+        vkDestroyBuffer(capture->device, slot->buffer, NULL);
+        gpu_memory_free(capture->device, slot->memory); // Unmaps implicitly.
+        host_free(capture->host, slot->rgb);
+    }
+    pthread_cond_destroy(&capture->freed);
+    pthread_mutex_destroy(&capture->lock);
+
+    memset(capture, 0, sizeof(*capture));
+}
+
+void capture_update(struct Capture *capture, uint64_t completed_value) {
+    // Oldest first, so the workers see frames in capture order. A video
+    // stream relies on it to never wait on a frame queued behind itself.
+    for (uint32_t i = 0; i < CAPTURE_RING_SIZE; i++) {
+        struct CaptureSlot *slot = &capture->slots[(capture->next_slot + i) % CAPTURE_RING_SIZE];
+        if (slot->state != CaptureState_Copying) continue;
+        if (slot->value > completed_value) break;
+
+        VkMappedMemoryRange range = {
+            .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+            .memory = slot->memory,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE,
+        };
+        vkInvalidateMappedMemoryRanges(capture->device, 1, &range);
+
+        pthread_mutex_lock(&capture->lock);
+        slot->state = CaptureState_Encoding;
+        pthread_mutex_unlock(&capture->lock);
+        workers_push(capture->workers, capture_encode, slot);
+    }
+}
+
+int capture_record(
+        struct Capture *capture,
+        VkCommandBuffer command_buffer,
+        VkImage image,
+        uint64_t value,
+        uint64_t frame) {
+#if DEBUG_INPUT_VALIDATION
+    if (capture == NULL) return 1;
+    if (command_buffer == VK_NULL_HANDLE) return 1;
+    if (image == VK_NULL_HANDLE) return 1;
+#endif
+
+    // Take the next slot in ring order. Drop the frame rather than wait,
+    // unless streaming.
+    struct CaptureSlot *slot = &capture->slots[capture->next_slot];
+    if (capture->video != NULL && slot->state == CaptureState_Copying) {
+        timeline_wait(capture->timeline, capture->device, slot->value, UINT64_MAX);
+        capture_update(capture, timeline_completed(capture->timeline, capture->device));
+    }
+    pthread_mutex_lock(&capture->lock);
+    while (capture->video != NULL && slot->state != CaptureState_Free)
+        pthread_cond_wait(&capture->freed, &capture->lock);
+    int free_slot = slot->state == CaptureState_Free;
+    if (!free_slot) capture->dropped_n += 1;
+    pthread_mutex_unlock(&capture->lock);
+    if (!free_slot) return 2;
+    capture->next_slot = (capture->next_slot + 1) % CAPTURE_RING_SIZE;
+
+    //
+    VkBufferImageCopy region = {
+        .bufferOffset = 0,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+        .imageOffset = { 0, 0, 0 },
+        .imageExtent = { capture->extent.width, capture->extent.height, 1 },
+    };
+    vkCmdCopyImageToBuffer(command_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot->buffer, 1, &region);
+
+    // Make the copy visible to the host once the timeline passes value.
+    VkBufferMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = slot->buffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE,
+    };
+    vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_HOST_BIT,
+            0,
+            0,
+            NULL,
+            1,
+            &barrier,
+            0,
+            NULL);
+
+    slot->state = CaptureState_Copying;
+    slot->value = value;
+    slot->frame = frame;
+    slot->sequence = capture->recorded_n++;
+    slot->recorded_at = time_now();
+
+    return 0;
+}
+
+void capture_report(struct Capture *capture) {
+    pthread_mutex_lock(&capture->lock);
+    uint64_t done_n = capture->captured_n + capture->failed_n;
+    printf("[capture] %llu written, %llu dropped, %llu failed, encode %.2f ms avg, record to disk %.2f ms avg\n",
+            (unsigned long long)capture->captured_n,
+            (unsigned long long)capture->dropped_n,
+            (unsigned long long)capture->failed_n,
+            done_n > 0 ? 1000.0 * capture->encode_sum / done_n : 0.0,
+            done_n > 0 ? 1000.0 * capture->latency_sum / done_n : 0.0);
+    pthread_mutex_unlock(&capture->lock);
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <pthread.h>
+#include <stdint.h>
+#include "host_memory.h"
+#include "timeline.h"
+#include "worker.h"
+#include "video.h"
+
+#define CAPTURE_RING_SIZE 4
+
+enum CaptureFormat {
+    CaptureFormat_Png = 0,
+    CaptureFormat_Ppm,
+    CaptureFormat_Exr,
+};
+
+enum CaptureState {
+    CaptureState_Free = 0,
+    CaptureState_Copying, // GPU copy in flight
+    CaptureState_Encoding, // handed to a worker
+};
+
+struct CaptureSlot {
+    struct Capture *capture;
+    enum CaptureState state; // guarded by capture->lock once Encoding
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    const uint8_t *mapped;
+    void *rgb; // encode scratch, RGB texels of the output format, NULL with a video stream
+    uint64_t value; // graphics timeline value the copy completes with
+    uint64_t frame;
+    uint64_t sequence; // capture order
+    double recorded_at;
+};
+
+// Copies presented frames into a ring of host visible buffers. Finished copies
+// are picked up frames later and encoded on worker threads, so the frame loop
+// never waits on the GPU or the disk.
+//
+// With a video stream attached, every copy goes to the stream instead of a
+// file and a full ring blocks rather than drops, so a slow consumer throttles
+// the frame loop.
+struct Capture {
+    struct HostMemory *host; // of the encode scratch
+    VkDevice device;
+    const struct Timeline *timeline; // the copies are submitted on
+    struct Workers *workers;
+    struct VideoStream *video; // optional
+    pthread_mutex_t lock;
+    pthread_cond_t freed;
+    VkExtent2D extent;
+    enum CaptureFormat format;
+    char directory[192];
+    struct CaptureSlot slots[CAPTURE_RING_SIZE];
+    uint32_t next_slot; // also the oldest slot in flight
+    uint64_t recorded_n;
+    // Stats, guarded by lock.
+    uint64_t captured_n;
+    uint64_t dropped_n; // ring was full
+    uint64_t failed_n;
+    double encode_sum; // seconds
+    double latency_sum; // recorded until written, seconds
+};
+
+int capture_init(
+        struct Capture *capture,
+        struct HostMemory *host,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        const struct Timeline *timeline,
+        struct Workers *workers,
+        struct VideoStream *video,
+        VkExtent2D extent,
+        enum CaptureFormat format,
+        const char *directory);
+// Waits for pending encodes, the device must be idle.
+void capture_free(struct Capture *capture);
+
+// Hands copies that completed by completed_value to the workers.
+void capture_update(struct Capture *capture, uint64_t completed_value);
+// Records a copy of image, in TRANSFER_SRC_OPTIMAL, that is done once the
+// timeline reaches value. Returns 0 when recorded, 2 if the ring is full and
+// the frame is dropped. Never drops with a video stream attached.
+int capture_record(
+        struct Capture *capture,
+        VkCommandBuffer command_buffer,
+        VkImage image,
+        uint64_t value,
+        uint64_t frame);
+
+void capture_report(struct Capture *capture);
@@ -0,0 +1,602 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "trace.h"
+#include "cpu_trace.h"
+
+#define PI 3.14159265f
+#define MISS UINT32_MAX
+
+// Vector helpers.
+
+static void sub(float *out, const float *a, const float *b) {
+    for (int c = 0; c < 3; c++) out[c] = a[c] - b[c];
+}
+
+static float dot(const float *a, const float *b) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static void cross(float *out, const float *a, const float *b) {
+    float x = a[1] * b[2] - a[2] * b[1];
+    float y = a[2] * b[0] - a[0] * b[2];
+    float z = a[0] * b[1] - a[1] * b[0];
+    out[0] = x, out[1] = y, out[2] = z;
+}
+
+static void normalize(float *v) {
+    float inv = 1.0f / sqrtf(dot(v, v));
+    for (int c = 0; c < 3; c++) v[c] *= inv;
+}
+
+// Random numbers, as scene.glsl.
+
+static uint32_t pcg(uint32_t *state) {
+    *state = *state * 747796405u + 2891336453u;
+    uint32_t word = ((*state >> ((*state >> 28u) + 4u)) ^ *state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+static float rand_float(uint32_t *state) {
+    return (float)pcg(state) * (1.0f / 4294967296.0f);
+}
+
+// Random numbers of one path: the sampler's dimensions where it has them,
+// else the pixel's pcg stream in the order they are drawn.
+struct PathRandom {
+    const struct Sampler *sampler; // NULL for pcg only
+    uint32_t px, py;
+    uint32_t sample;
+    uint32_t state;
+};
+
+static float path_rand(struct PathRandom *random, uint32_t dimension) {
+    if (random->sampler != NULL && dimension < SAMPLER_DIMENSIONS)
+        return sampler_get(random->sampler, random->px, random->py, random->sample, dimension);
+    return rand_float(&random->state);
+}
+
+// Traversal, as path.glsl.
+
+static const float *vertex(const struct Scene *scene, uint32_t triangle, int corner) {
+    return scene->positions + scene->indices[triangle * 3 + corner] * 4;
+}
+
+static float intersect_triangle(const struct Scene *scene, const float *ro, const float *rd, uint32_t triangle, float t_max) {
+    const float *a = vertex(scene, triangle, 0), *b = vertex(scene, triangle, 1), *c = vertex(scene, triangle, 2);
+    float e1[3], e2[3], p[3], s[3], q[3];
+    sub(e1, b, a);
+    sub(e2, c, a);
+    cross(p, rd, e2);
+    float det = dot(e1, p);
+    if (fabsf(det) < 1e-9f) return t_max;
+    float inv_det = 1.0f / det;
+    sub(s, ro, a);
+    float u = dot(s, p) * inv_det;
+    if (u < 0.0f || u > 1.0f) return t_max;
+    cross(q, s, e1);
+    float v = dot(rd, q) * inv_det;
+    if (v < 0.0f || u + v > 1.0f) return t_max;
+    float t = dot(e2, q) * inv_det;
+    return t > 1e-3f && t < t_max ? t : t_max;
+}
+
+static float intersect_box(const float *ro, const float *inv_rd, const struct BvhNode *node, float t_max) {
+    float t_near = 0.0f, t_far = t_max;
+    for (int c = 0; c < 3; c++) {
+        float t0 = (node->min[c] - ro[c]) * inv_rd[c];
+        float t1 = (node->max[c] - ro[c]) * inv_rd[c];
+        t_near = fmaxf(t_near, fminf(t0, t1));
+        t_far = fminf(t_far, fmaxf(t0, t1));
+    }
+    return t_near <= t_far ? t_near : 1e30f;
+}
+
+// Nearer child first, hits at or beyond t_max are misses.
+static uint32_t intersect(const struct CpuTracer *tracer, const float *ro, const float *rd, float *t_hit) {
+    const struct BvhNode *nodes = tracer->bvh->nodes;
+    float inv_rd[3] = { 1.0f / rd[0], 1.0f / rd[1], 1.0f / rd[2] };
+    uint32_t hit = MISS;
+    *t_hit = 1e30f;
+
+    uint32_t stack[CPU_TRACE_STACK_SIZE];
+    uint32_t stack_n = 0;
+    uint32_t node = 0;
+    if (intersect_box(ro, inv_rd, &nodes[0], *t_hit) >= 1e30f) return MISS;
+    for (;;) {
+        const struct BvhNode *n = &nodes[node];
+        if (n->count > 0) {
+            for (uint32_t i = 0; i < n->count; i++) {
+                uint32_t triangle = tracer->bvh->triangles[n->left_first + i];
+                float t = intersect_triangle(tracer->scene, ro, rd, triangle, *t_hit);
+                if (t < *t_hit) {
+                    *t_hit = t;
+                    hit = triangle;
+                }
+            }
+        } else {
+            uint32_t near = n->left_first, far = n->left_first + 1;
+            float t_near = intersect_box(ro, inv_rd, &nodes[near], *t_hit);
+            float t_far = intersect_box(ro, inv_rd, &nodes[far], *t_hit);
+            if (t_far < t_near) {
+                uint32_t swap_node = near; near = far; far = swap_node;
+                float swap_t = t_near; t_near = t_far; t_far = swap_t;
+            }
+            if (t_near < 1e30f) {
+                if (t_far < 1e30f && stack_n < CPU_TRACE_STACK_SIZE) stack[stack_n++] = far;
+                node = near;
+                continue;
+            }
+        }
+        if (stack_n == 0) break;
+        node = stack[--stack_n];
+    }
+    return hit;
+}
+
+// Sampling and shading, as path.glsl and trace.comp.
+
+static void camera_ray(const struct CpuTracer *tracer, struct PathRandom *random, float *ro, float *rd) {
+    const struct SceneCamera *camera = &tracer->camera;
+    float jx = path_rand(random, SAMPLER_DIMENSION_CAMERA), jy = path_rand(random, SAMPLER_DIMENSION_CAMERA + 1);
+    float u = ((float)random->px + jx) / (float)tracer->width * 2.0f - 1.0f;
+    float v = ((float)random->py + jy) / (float)tracer->height * 2.0f - 1.0f;
+    u *= (float)tracer->width / (float)tracer->height;
+    float forward[3], right[3], up[3];
+    const float world_up[3] = { 0.0f, 1.0f, 0.0f };
+    sub(forward, camera->target, camera->position);
+    normalize(forward);
+    cross(right, forward, world_up);
+    normalize(right);
+    cross(up, right, forward);
+    float scale = tanf(camera->fov * 0.5f);
+    for (int c = 0; c < 3; c++) {
+        ro[c] = camera->position[c];
+        rd[c] = forward[c] + (right[c] * u - up[c] * v) * scale;
+    }
+    normalize(rd);
+}
+
+static uint32_t pixel_seed(const struct CpuTracer *tracer, uint32_t px, uint32_t py, uint32_t sample) {
+    uint32_t state = (py * tracer->width + px) * 9781u + sample * 6271u;
+    pcg(&state);
+    return state;
+}
+
+static void sky(const float *rd, float *out) {
+    float t = fminf(fmaxf(rd[1] * 0.5f + 0.5f, 0.0f), 1.0f);
+    const float horizon[3] = { 0.9f, 0.9f, 0.9f };
+    const float zenith[3] = { 0.4f, 0.6f, 1.0f };
+    for (int c = 0; c < 3; c++) out[c] = (horizon[c] + (zenith[c] - horizon[c]) * t) * 0.5f;
+}
+
+// Environment, as path.glsl.
+
+static float power_heuristic(float a, float b) {
+    return a * a / (a * a + b * b);
+}
+
+static float environment_pdf(const struct Environment *environment, float texel_pdf, float sin_theta) {
+    float texels_n = (float)(environment->width * environment->height);
+    return sin_theta > 0.0f ? texel_pdf * texels_n / (2.0f * PI * PI * sin_theta) : 0.0f;
+}
+
+static void environment_escape(const struct CpuTracer *tracer, const float *rd, float bsdf_pdf, float *out) {
+    const struct Environment *environment = tracer->environment;
+    if (environment == NULL) {
+        sky(rd, out);
+        return;
+    }
+
+    float u = atan2f(rd[0], -rd[2]) * (0.5f / PI);
+    if (u < 0.0f) u += 1.0f;
+    float cos_theta = fminf(fmaxf(rd[1], -1.0f), 1.0f);
+    float v = acosf(cos_theta) / PI;
+    uint32_t x = (uint32_t)(u * (float)environment->width), y = (uint32_t)(v * (float)environment->height);
+    if (x > environment->width - 1) x = environment->width - 1;
+    if (y > environment->height - 1) y = environment->height - 1;
+    const struct EnvironmentTexel *texel = &environment->texels[y * environment->width + x];
+    float weight = 1.0f;
+    if (environment->sampling == EnvironmentSampling_Mis && bsdf_pdf > 0.0f) {
+        float light_pdf = environment_pdf(environment, texel->pdf, sqrtf(fmaxf(1.0f - cos_theta * cos_theta, 0.0f)));
+        if (light_pdf > 0.0f) weight = power_heuristic(bsdf_pdf, light_pdf);
+    }
+    for (int c = 0; c < 3; c++) out[c] = texel->radiance[c] * weight;
+}
+
+static const struct EnvironmentTexel *environment_sample(
+        const struct Environment *environment,
+        struct PathRandom *random,
+        uint32_t dimension,
+        float *wi,
+        float *pdf) {
+    uint32_t texels_n = environment->width * environment->height;
+    uint32_t index = (uint32_t)(path_rand(random, dimension + SAMPLER_OFFSET_ENVIRONMENT) * (float)texels_n);
+    if (index > texels_n - 1) index = texels_n - 1;
+    const struct EnvironmentTexel *texel = &environment->texels[index];
+    if (path_rand(random, dimension + SAMPLER_OFFSET_ENVIRONMENT + 1) >= texel->probability) {
+        index = texel->alias;
+        texel = &environment->texels[index];
+    }
+    float ju = path_rand(random, dimension + SAMPLER_OFFSET_ENVIRONMENT_UV);
+    float jv = path_rand(random, dimension + SAMPLER_OFFSET_ENVIRONMENT_UV + 1);
+    float u = ((float)(index % environment->width) + ju) / (float)environment->width;
+    float v = ((float)(index / environment->width) + jv) / (float)environment->height;
+    float phi = u * 2.0f * PI, theta = v * PI;
+    wi[0] = sinf(theta) * sinf(phi);
+    wi[1] = cosf(theta);
+    wi[2] = -sinf(theta) * cosf(phi);
+    *pdf = environment_pdf(environment, texel->pdf, sinf(theta));
+    return texel;
+}
+
+// Light tree, as path.glsl.
+
+// Estimated contribution of a node's emitters at p with normal n: power over
+// squared distance, times the cosines at both ends at their most favourable
+// within the node's bounds and cone.
+static float light_importance(const struct LightNode *node, const float *p, const float *n) {
+    float to_light[3], half[3];
+    for (int c = 0; c < 3; c++) {
+        to_light[c] = 0.5f * (node->min[c] + node->max[c]) - p[c];
+        half[c] = 0.5f * (node->max[c] - node->min[c]);
+    }
+    float distance2 = dot(to_light, to_light), radius2 = dot(half, half);
+    float inv_distance = distance2 > 0.0f ? 1.0f / sqrtf(distance2) : 0.0f;
+    for (int c = 0; c < 3; c++) to_light[c] *= inv_distance;
+    float cos_b = distance2 > radius2 ? sqrtf(1.0f - radius2 / distance2) : -1.0f;
+    float sin_b = sqrtf(fmaxf(1.0f - cos_b * cos_b, 0.0f));
+
+    // Emitter side, against the lines of the normals.
+    float cos_w = fabsf(dot(node->axis, to_light));
+    float sin_w = sqrtf(fmaxf(1.0f - cos_w * cos_w, 0.0f));
+    float cos_o = node->cos_theta, sin_o = sqrtf(fmaxf(1.0f - cos_o * cos_o, 0.0f));
+    float cos_x = cos_w > cos_o ? 1.0f : cos_w * cos_o + sin_w * sin_o;
+    float sin_x = cos_w > cos_o ? 0.0f : sin_w * cos_o - cos_w * sin_o;
+    float cos_emitter = cos_x > cos_b ? 1.0f : cos_x * cos_b + sin_x * sin_b;
+    if (cos_emitter <= 0.0f) return 0.0f;
+
+    // Receiver side.
+    float cos_i = dot(n, to_light), sin_i = sqrtf(fmaxf(1.0f - cos_i * cos_i, 0.0f));
+    float cos_receiver = cos_i > cos_b ? 1.0f : cos_i * cos_b + sin_i * sin_b;
+    if (cos_receiver <= 0.0f) return 0.0f;
+
+    return node->power * cos_emitter * cos_receiver / fmaxf(distance2, radius2);
+}
+
+// Walks from the root choosing children in proportion to their importance,
+// reusing u. Returns the emissive triangle and the chance of picking it, MISS
+// when no emitter reaches p.
+static uint32_t light_tree_sample(const struct LightTree *tree, const float *p, const float *n, float u, float *pmf) {
+    const struct LightNode *nodes = tree->nodes;
+    uint32_t node = 0;
+    *pmf = 1.0f;
+    while (!(nodes[node].child_triangle & LIGHT_LEAF)) {
+        uint32_t left = nodes[node].child_triangle;
+        float a = light_importance(&nodes[left], p, n), b = light_importance(&nodes[left + 1], p, n);
+        if (a + b <= 0.0f) return MISS;
+        float p_left = a / (a + b);
+        if (u < p_left) {
+            u = fminf(u / p_left, 0.99999994f);
+            node = left;
+            *pmf *= p_left;
+        } else {
+            u = fminf((u - p_left) / (1.0f - p_left), 0.99999994f);
+            node = left + 1;
+            *pmf *= 1.0f - p_left;
+        }
+    }
+    return nodes[node].child_triangle & ~LIGHT_LEAF;
+}
+
+// Light through a shadow ray from p to a point on a picked emitter, as
+// wavefront_shade.comp.
+static void connect_light(
+        const struct CpuTracer *tracer,
+        const float *p,
+        const float *n,
+        struct PathRandom *random,
+        uint32_t dimension,
+        float *out) {
+    const struct Scene *scene = tracer->scene;
+    const struct LightTree *lights = tracer->lights;
+    out[0] = out[1] = out[2] = 0.0f;
+    float u = path_rand(random, dimension + SAMPLER_OFFSET_LIGHT), pmf;
+    uint32_t light;
+    if (tracer->light_sampling == LightSampling_Uniform) {
+        uint32_t i = (uint32_t)(u * (float)lights->lights_n);
+        light = lights->triangles[i < lights->lights_n - 1 ? i : lights->lights_n - 1];
+        pmf = 1.0f / (float)lights->lights_n;
+    } else {
+        light = light_tree_sample(lights, p, n, u, &pmf);
+        if (light == MISS) return;
+    }
+
+    const float *la = vertex(scene, light, 0), *lb = vertex(scene, light, 1), *lc = vertex(scene, light, 2);
+    float su = sqrtf(path_rand(random, dimension + SAMPLER_OFFSET_LIGHT_POINT));
+    float v = path_rand(random, dimension + SAMPLER_OFFSET_LIGHT_POINT + 1);
+    float q[3], e1[3], e2[3], ln[3], wi[3];
+    for (int c = 0; c < 3; c++) q[c] = la[c] * (1.0f - su) + lb[c] * (su * (1.0f - v)) + lc[c] * (su * v);
+    sub(e1, lb, la);
+    sub(e2, lc, la);
+    cross(ln, e1, e2);
+    float area = 0.5f * sqrtf(dot(ln, ln));
+    sub(wi, q, p);
+    float distance2 = dot(wi, wi);
+    float distance = sqrtf(distance2);
+    for (int c = 0; c < 3; c++) wi[c] /= distance;
+    float cos_surface = dot(n, wi);
+    if (cos_surface <= 0.0f || area <= 0.0f) return;
+    normalize(ln);
+    float cos_light = fabsf(dot(ln, wi));
+    float t;
+    if (cos_light <= 0.0f || (intersect(tracer, p, wi, &t) != MISS && t < distance - 1e-3f)) return;
+
+    const float *emission = scene->materials[scene->triangle_materials[light]].emission;
+    float scale = cos_surface * cos_light / distance2 * area / (PI * pmf);
+    for (int c = 0; c < 3; c++) out[c] = emission[c] * scale;
+}
+
+static void cosine_hemisphere(const float *n, struct PathRandom *random, uint32_t dimension, float *out) {
+    float u = path_rand(random, dimension + SAMPLER_OFFSET_BSDF), v = path_rand(random, dimension + SAMPLER_OFFSET_BSDF + 1);
+    float r = sqrtf(u), phi = 2.0f * PI * v;
+    float t[3], b[3];
+    const float axis[3] = { fabsf(n[0]) > 0.5f ? 0.0f : 1.0f, fabsf(n[0]) > 0.5f ? 1.0f : 0.0f, 0.0f };
+    cross(t, n, axis);
+    normalize(t);
+    cross(b, n, t);
+    float z = sqrtf(1.0f - u);
+    for (int c = 0; c < 3; c++) out[c] = t[c] * r * cosf(phi) + b[c] * r * sinf(phi) + n[c] * z;
+    normalize(out);
+}
+
+static void trace_path(const struct CpuTracer *tracer, struct PathRandom *random, float *radiance) {
+    const struct Scene *scene = tracer->scene;
+    float ro[3], rd[3];
+    camera_ray(tracer, random, ro, rd);
+
+    float throughput[3] = { 1.0f, 1.0f, 1.0f };
+    radiance[0] = radiance[1] = radiance[2] = 0.0f;
+    const struct Environment *environment = tracer->environment;
+    int environment_lights = environment != NULL && environment->sampling == EnvironmentSampling_Mis;
+    int connect_lights = tracer->lights != NULL && tracer->lights->lights_n > 0;
+    float bsdf_pdf = 0.0f;
+    for (uint32_t bounce = 0; bounce < tracer->bounces; bounce++) {
+        uint32_t dimension = SAMPLER_DIMENSION_BOUNCE + bounce * SAMPLER_BOUNCE_DIMENSIONS;
+        float t;
+        uint32_t hit = intersect(tracer, ro, rd, &t);
+        if (hit == MISS) {
+            float background[3];
+            environment_escape(tracer, rd, bsdf_pdf, background);
+            for (int c = 0; c < 3; c++) radiance[c] += throughput[c] * background[c];
+            break;
+        }
+        const struct SceneMaterial *material = &scene->materials[scene->triangle_materials[hit]];
+        if (!connect_lights || bounce == 0)
+            for (int c = 0; c < 3; c++) radiance[c] += throughput[c] * material->emission[c];
+
+        float e1[3], e2[3], n[3];
+        sub(e1, vertex(scene, hit, 1), vertex(scene, hit, 0));
+        sub(e2, vertex(scene, hit, 2), vertex(scene, hit, 0));
+        cross(n, e1, e2);
+        normalize(n);
+        if (dot(n, rd) > 0.0f)
+            for (int c = 0; c < 3; c++) n[c] = -n[c];
+        for (int c = 0; c < 3; c++) ro[c] += rd[c] * t + n[c] * 1e-4f;
+
+        if (environment_lights && bounce + 1 < tracer->bounces) {
+            float wi[3], light_pdf, shadow_t;
+            const struct EnvironmentTexel *light = environment_sample(environment, random, dimension, wi, &light_pdf);
+            float cos_surface = dot(n, wi);
+            if (light_pdf > 0.0f && cos_surface > 0.0f && intersect(tracer, ro, wi, &shadow_t) == MISS) {
+                float scale = cos_surface / PI * power_heuristic(light_pdf, cos_surface / PI) / light_pdf;
+                for (int c = 0; c < 3; c++) radiance[c] += throughput[c] * material->albedo[c] * light->radiance[c] * scale;
+            }
+        }
+        if (connect_lights && bounce + 1 < tracer->bounces) {
+            float light[3];
+            connect_light(tracer, ro, n, random, dimension, light);
+            for (int c = 0; c < 3; c++) radiance[c] += throughput[c] * material->albedo[c] * light[c];
+        }
+        cosine_hemisphere(n, random, dimension, rd);
+        bsdf_pdf = fmaxf(dot(n, rd), 0.0f) / PI;
+        for (int c = 0; c < 3; c++) throughput[c] *= material->albedo[c];
+    }
+}
+
+//
+
+int cpu_tracer_init(
+        struct CpuTracer *tracer,
+        const struct Scene *scene,
+        const struct Bvh *bvh,
+        uint32_t width,
+        uint32_t height,
+        uint32_t bounces) {
+#if DEBUG_INPUT_VALIDATION
+    if (tracer == NULL) return 1;
+    if (!IS_ZERO_PTR(tracer)) return 1;
+    if (scene == NULL || bvh == NULL || bvh->nodes_n == 0) return 1;
+    if (width == 0 || height == 0) return 1;
+#endif
+
+    tracer->scene = scene;
+    tracer->bvh = bvh;
+    tracer->camera = scene->camera;
+    tracer->width = width;
+    tracer->height = height;
+    tracer->bounces = bounces > 0 ? bounces : TRACE_DEFAULT_BOUNCES;
+
+    return 0;
+}
+
+void cpu_tracer_free(struct CpuTracer *tracer) {
+    memset(tracer, 0, sizeof(*tracer));
+}
+
+void cpu_tracer_render(
+        const struct CpuTracer *tracer,
+        uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+        uint32_t first_sample,
+        uint32_t samples_n,
+        float *rgb) {
+#if DEBUG_INPUT_VALIDATION
+    if (tracer == NULL || rgb == NULL) return;
+    if (x + w > tracer->width || y + h > tracer->height) return;
+    if (samples_n == 0) return;
+#endif
+
+    float inv_n = 1.0f / (float)samples_n;
+    for (uint32_t j = 0; j < h; j++) {
+        for (uint32_t i = 0; i < w; i++) {
+            float sum[3] = { 0.0f, 0.0f, 0.0f };
+            for (uint32_t s = first_sample; s < first_sample + samples_n; s++) {
+                struct PathRandom random = {
+                    .sampler = tracer->sampler,
+                    .px = x + i,
+                    .py = y + j,
+                    .sample = s,
+                    .state = pixel_seed(tracer, x + i, y + j, s),
+                };
+                float radiance[3];
+                trace_path(tracer, &random, radiance);
+                for (int c = 0; c < 3; c++) sum[c] += radiance[c];
+            }
+            float *out = rgb + ((size_t)j * w + i) * 3;
+            for (int c = 0; c < 3; c++) out[c] = sum[c] * inv_n;
+        }
+    }
+}
+
+// Sampling comparisons.
+
+int cpu_compare_init(struct CpuCompare *compare, const struct CpuTracer *tracer) {
+#if DEBUG_INPUT_VALIDATION
+    if (compare == NULL || tracer == NULL) return 1;
+    if (!IS_ZERO_PTR(compare)) return 1;
+#endif
+
+    compare->tracer = tracer;
+    compare->values_n = (size_t)tracer->width * tracer->height * 3;
+    if (workers_init(&compare->workers, 0) > 0) return 2;
+    uint32_t bands_n = (tracer->height + CPU_COMPARE_BAND_ROWS - 1) / CPU_COMPARE_BAND_ROWS;
+    compare->bands = malloc(bands_n * sizeof(*compare->bands));
+    compare->pass = malloc(compare->values_n * sizeof(float));
+    if (compare->bands == NULL || compare->pass == NULL) return 2;
+
+    return 0;
+}
+
+void cpu_compare_free(struct CpuCompare *compare) {
+    workers_free(&compare->workers); // Zeroes itself.
+    free(compare->bands);
+    free(compare->pass);
+    memset(compare, 0, sizeof(*compare));
+}
+
+static void band_job(void *arg) {
+    struct CpuCompareBand *band = arg;
+    uint32_t width = band->tracer->width;
+    cpu_tracer_render(
+            band->tracer,
+            0, band->y, width, band->h,
+            band->first_sample, band->samples_n,
+            band->rgb + (size_t)band->y * width * 3);
+    worker_group_done(band->group);
+}
+
+void cpu_compare_render(struct CpuCompare *compare, uint32_t first_sample, uint32_t samples_n, float *rgb) {
+    const struct CpuTracer *tracer = compare->tracer;
+    struct WorkerGroup group;
+    worker_group_init(&group);
+    for (uint32_t y = 0, band = 0; y < tracer->height; y += CPU_COMPARE_BAND_ROWS, band++) {
+        compare->bands[band] = (struct CpuCompareBand) {
+            .tracer = tracer,
+            .rgb = rgb,
+            .y = y,
+            .h = tracer->height - y < CPU_COMPARE_BAND_ROWS ? tracer->height - y : CPU_COMPARE_BAND_ROWS,
+            .first_sample = first_sample,
+            .samples_n = samples_n,
+            .group = &group,
+        };
+        workers_push_group(&compare->workers, &group, band_job, &compare->bands[band]);
+    }
+    worker_group_wait(&group);
+    worker_group_free(&group);
+}
+
+uint32_t cpu_compare_render_for(struct CpuCompare *compare, double seconds, uint32_t first_sample, float *rgb) {
+    memset(rgb, 0, compare->values_n * sizeof(float));
+    double start = time_now();
+    uint32_t samples_n = 0;
+    while (samples_n == 0 || time_now() - start < seconds) {
+        cpu_compare_render(compare, first_sample + samples_n, 1, compare->pass);
+        for (size_t i = 0; i < compare->values_n; i++) rgb[i] += compare->pass[i];
+        samples_n++;
+    }
+    for (size_t i = 0; i < compare->values_n; i++) rgb[i] /= (float)samples_n;
+    return samples_n;
+}
+
+double cpu_compare_rmse(const struct CpuCompare *compare, const float *rgb, const float *reference, int tone_mapped) {
+    double sum = 0.0;
+    for (size_t i = 0; i < compare->values_n; i++) {
+        double d = tone_mapped
+            ? rgb[i] / (1.0 + rgb[i]) - reference[i] / (1.0 + reference[i])
+            : (double)rgb[i] - reference[i];
+        sum += d * d;
+    }
+    return sqrt(sum / compare->values_n);
+}
+
+int cpu_compare_equal_time(struct CpuCompare *compare, const struct CpuCompareEqualTime *settings) {
+#if DEBUG_INPUT_VALIDATION
+    if (compare == NULL || compare->tracer == NULL) return 1;
+    if (settings == NULL || settings->set == NULL) return 1;
+#endif
+
+    float *images[2] = {
+        malloc(compare->values_n * sizeof(float)),
+        malloc(compare->values_n * sizeof(float)),
+    };
+    float *reference = malloc(compare->values_n * sizeof(float));
+    if (images[0] == NULL || images[1] == NULL || reference == NULL) {
+        free(images[0]);
+        free(images[1]);
+        free(reference);
+        return 2;
+    }
+
+    uint32_t samples_n[2];
+    for (uint32_t i = 0; i < 2; i++) {
+        settings->set(settings->user, i);
+        samples_n[i] = cpu_compare_render_for(compare, settings->seconds, 0, images[i]);
+    }
+    uint32_t reference_n = samples_n[1] * settings->reference_factor;
+    printf("[%s] rendering a %u sample reference\n", settings->tag, reference_n);
+    cpu_compare_render(compare, CPU_COMPARE_REFERENCE_SAMPLE, reference_n, reference);
+
+    double errors[2];
+    for (uint32_t i = 0; i < 2; i++)
+        errors[i] = cpu_compare_rmse(compare, images[i], reference, settings->tone_mapped);
+    printf("[%s] %.1f s each at %ux%u: %s %u spp rmse %.4f, %s %u spp rmse %.4f, "
+            "%.1fx less variance at equal time\n",
+            settings->tag,
+            settings->seconds,
+            compare->tracer->width,
+            compare->tracer->height,
+            settings->names[0],
+            samples_n[0],
+            errors[0],
+            settings->names[1],
+            samples_n[1],
+            errors[1],
+            errors[1] > 0.0 ? (errors[0] * errors[0]) / (errors[1] * errors[1]) : 0.0);
+
+    free(images[0]);
+    free(images[1]);
+    free(reference);
+    return 0;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <stdint.h>
+#include "bvh.h"
+#include "environment.h"
+#include "light_tree.h"
+#include "sampler.h"
+#include "scene.h"
+#include "worker.h"
+
+#define CPU_TRACE_STACK_SIZE 32
+#define CPU_COMPARE_BAND_ROWS 8 // per render job
+#define CPU_COMPARE_REFERENCE_SAMPLE (1u << 24) // references start here, past any sample compared
+
+// Path tracer on the host, the megakernel's paths step for step: the same
+// camera, seeds, BVH traversal and shading as trace.comp. Used where there is
+// no device, by headless render workers. Reading the scene and BVH is all it
+// does, so threads may render disjoint rects of one tracer at once.
+//
+// With lights set, paths count emission on camera hits only and every vertex
+// connects to one emitter picked by light_sampling, as wavefront_shade.comp.
+// With a sampler, paths draw their dimensions from its table as trace.comp
+// does with one bound, else from the pixel's pcg stream.
+struct CpuTracer {
+    const struct Scene *scene;
+    const struct Bvh *bvh;
+    struct SceneCamera camera; // the scene's, may be replaced after init
+    const struct Environment *environment; // NULL for the sky, may be set after init
+    const struct LightTree *lights; // NULL to leave emitters to BSDF samples, may be set after init
+    enum LightSampling light_sampling;
+    const struct Sampler *sampler; // NULL for pcg random numbers, may be set after init
+    uint32_t width, height;
+    uint32_t bounces;
+};
+
+// bounces of 0 takes TRACE_DEFAULT_BOUNCES.
+int cpu_tracer_init(
+        struct CpuTracer *tracer,
+        const struct Scene *scene,
+        const struct Bvh *bvh,
+        uint32_t width,
+        uint32_t height,
+        uint32_t bounces);
+void cpu_tracer_free(struct CpuTracer *tracer);
+
+// Samples [first_sample, first_sample + samples_n) of every pixel in the
+// rect, one seed per pixel and sample like a one sample dispatch. Writes the
+// mean radiance into rgb, 3 floats per pixel, rows of width w. A rect renders
+// the same wherever and however often it is traced.
+void cpu_tracer_render(
+        const struct CpuTracer *tracer,
+        uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+        uint32_t first_sample,
+        uint32_t samples_n,
+        float *rgb);
+
+// Sampling comparisons on the host.
+
+struct CpuCompareBand {
+    const struct CpuTracer *tracer;
+    float *rgb;
+    uint32_t y, h;
+    uint32_t first_sample, samples_n;
+    struct WorkerGroup *group;
+};
+
+// Renders tracer's whole image in row bands across worker threads. The
+// tracer's settings may change between renders.
+struct CpuCompare {
+    const struct CpuTracer *tracer;
+    struct Workers workers;
+    struct CpuCompareBand *bands; // one per CPU_COMPARE_BAND_ROWS rows
+    float *pass; // a single sample, scratch of cpu_compare_render_for
+    size_t values_n; // of an image, 3 per pixel
+};
+
+// Returns 2 when out of memory or threads.
+int cpu_compare_init(struct CpuCompare *compare, const struct CpuTracer *tracer);
+void cpu_compare_free(struct CpuCompare *compare);
+
+// As cpu_tracer_render over the whole image.
+void cpu_compare_render(struct CpuCompare *compare, uint32_t first_sample, uint32_t samples_n, float *rgb);
+// Accumulates one sample passes from first_sample on for seconds, at least
+// one, and returns the samples taken.
+uint32_t cpu_compare_render_for(struct CpuCompare *compare, double seconds, uint32_t first_sample, float *rgb);
+// Root mean square error of rgb against reference. tone_mapped compares
+// x / (1 + x) instead, so a few bright pixels do not drown out the rest.
+double cpu_compare_rmse(const struct CpuCompare *compare, const float *rgb, const float *reference, int tone_mapped);
+
+// Two strategies at equal time. set(user, i) switches the tracer to strategy
+// i. Each renders for seconds, then the second renders a reference of
+// reference_factor times its samples, from samples neither used. Prints
+// both errors against it under tag.
+struct CpuCompareEqualTime {
+    const char *tag;
+    const char *names[2];
+    void (*set)(void *user, uint32_t strategy);
+    void *user;
+    double seconds;
+    uint32_t reference_factor;
+    int tone_mapped;
+};
+
+// Returns 2 when out of memory.
+int cpu_compare_equal_time(struct CpuCompare *compare, const struct CpuCompareEqualTime *settings);
@@ -0,0 +1,596 @@
+#include <vulkan/vulkan.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+#include "gpu_memory.h"
+#include "pipeline.h"
+#include "denoise.h"
+
+#define DENOISE_GROUP_SIZE 8
+
+static const uint32_t denoise_eval_samples[DENOISE_EVAL_POINTS] = DENOISE_EVAL_SAMPLES;
+static const enum DenoiseImage denoise_scratch_images[DENOISE_SCRATCH_N] = DENOISE_SCRATCH_IMAGES;
+
+// Must match denoise_temporal.comp.
+struct DenoiseTemporalPush {
+    uint32_t noisy;
+    uint32_t albedo;
+    uint32_t gbuffer;
+    uint32_t gbuffer_previous;
+    uint32_t history_previous;
+    uint32_t history;
+    uint32_t moments_previous;
+    uint32_t moments;
+    uint32_t filter;
+    uint32_t width;
+    uint32_t height;
+    float alpha;
+    uint32_t first; // no history to reproject
+    uint32_t pad[3];
+    float camera_position[4]; // w is the vertical fov
+    float camera_target[4];
+    float previous_position[4];
+    float previous_target[4];
+};
+_Static_assert(sizeof(struct DenoiseTemporalPush) <= BINDLESS_PUSH_CONSTANT_SIZE, "DenoiseTemporalPush too large");
+
+// Must match denoise_atrous.comp.
+struct DenoiseAtrousPush {
+    uint32_t input;
+    uint32_t output;
+    uint32_t history; // feedback of the first pass, BINDLESS_INVALID otherwise
+    uint32_t gbuffer;
+    uint32_t albedo;
+    uint32_t target; // remodulated result of the last pass, BINDLESS_INVALID otherwise
+    uint32_t width;
+    uint32_t height;
+    uint32_t step;
+    float sigma_luminance;
+    float sigma_normal;
+    float sigma_depth;
+};
+
+// Must match denoise_error.comp.
+struct DenoiseErrorPush {
+    uint32_t image;
+    uint32_t reference;
+    uint32_t errors;
+    uint32_t offset;
+    uint32_t width;
+    uint32_t height;
+};
+
+static int create_denoise_image(
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        VkExtent2D extent,
+        VkImageUsageFlags usage,
+        VkImage *image,
+        VkDeviceMemory *memory,
+        VkImageView *view) {
+    int result = create_image(
+            device,
+            physical_device,
+            extent,
+            1,
+            TRACE_FORMAT,
+            usage,
+            GpuMemoryCategory_Frame,
+            image,
+            memory,
+            NULL);
+    if (result > 0) return 2;
+    result = create_image_view(device, *image, TRACE_FORMAT, 1, view);
+    if (result > 0) return 3;
+
+    return 0;
+}
+
+static void denoise_barrier(VkCommandBuffer command_buffer) {
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+    vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            1,
+            &barrier,
+            0,
+            NULL,
+            0,
+            NULL);
+}
+
+static void denoise_dispatch(VkCommandBuffer command_buffer, VkExtent2D extent) {
+    vkCmdDispatch(
+            command_buffer,
+            (extent.width + DENOISE_GROUP_SIZE - 1) / DENOISE_GROUP_SIZE,
+            (extent.height + DENOISE_GROUP_SIZE - 1) / DENOISE_GROUP_SIZE,
+            1);
+}
+
+int denoiser_init(
+        struct Denoiser *denoiser,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        const char *path,
+        struct PipelineBatch *pipelines,
+        struct Bindless *bindless,
+        VkExtent2D extent,
+        const struct DenoiseSettings *settings,
+        const uint32_t *scratch_slots) {
+#if DEBUG_INPUT_VALIDATION
+    if (denoiser == NULL) return 1;
+    if (!IS_ZERO_PTR(denoiser)) return 1;
+    if (device == VK_NULL_HANDLE) return 1;
+    if (physical_device == VK_NULL_HANDLE) return 1;
+    if (path == NULL) return 1;
+    if (bindless == NULL) return 1;
+    if (settings == NULL) return 1;
+    if (settings->iterations > DENOISE_MAX_ITERATIONS) return 1;
+    if (extent.width == 0 || extent.height == 0) return 1;
+#endif
+
+    int result = 0;
+
+    denoiser->device = device;
+    denoiser->bindless = bindless;
+    denoiser->extent = extent;
+    denoiser->render_extent = extent;
+    denoiser->errors_output = -1;
+    for (uint32_t i = 0; i < DenoiseImage_N; i++)
+        denoiser->slots[i] = BINDLESS_INVALID;
+    for (uint32_t i = 0; i < 2 * DENOISE_EVAL_POINTS; i++)
+        denoiser->snapshot_slots[i] = BINDLESS_INVALID;
+    denoiser->errors_slot = BINDLESS_INVALID;
+
+    // Settings.
+    denoiser->settings = *settings;
+    struct DenoiseSettings *s = &denoiser->settings;
+    if (s->iterations == 0) s->iterations = 5;
+    if (s->sigma_luminance <= 0.0f) s->sigma_luminance = 4.0f;
+    if (s->sigma_normal <= 0.0f) s->sigma_normal = 128.0f;
+    if (s->sigma_depth <= 0.0f) s->sigma_depth = 0.1f;
+    if (s->alpha <= 0.0f || s->alpha > 1.0f) s->alpha = 0.1f;
+
+    // Pipelines.
+    result = create_pipeline_layout(device, NULL, bindless->layout, &denoiser->pipeline_layout);
+    if (result > 0) return 2;
+    result = take_compute_pipeline(
+            pipelines,
+            device,
+            path,
+            "denoise_temporal.comp.spv",
+            denoiser->pipeline_layout,
+            &denoiser->temporal_pipeline);
+    if (result > 0) return 3;
+    result = take_compute_pipeline(
+            pipelines,
+            device,
+            path,
+            "denoise_atrous.comp.spv",
+            denoiser->pipeline_layout,
+            &denoiser->atrous_pipeline);
+    if (result > 0) return 3;
+
+    // Images, apart from the scratch ones the caller provides.
+    if (scratch_slots != NULL) {
+        denoiser->scratch_external = 1;
+        for (uint32_t i = 0; i < DENOISE_SCRATCH_N; i++)
+            denoiser->slots[denoise_scratch_images[i]] = scratch_slots[i];
+    }
+    for (uint32_t i = 0; i < DenoiseImage_N; i++) {
+        if (denoiser->slots[i] != BINDLESS_INVALID) continue;
+        result = create_denoise_image(
+                device,
+                physical_device,
+                extent,
+                VK_IMAGE_USAGE_STORAGE_BIT,
+                denoiser->images + i,
+                denoiser->memories + i,
+                denoiser->views + i);
+        if (result > 0) return 4;
+        denoiser->slots[i] = bindless_add_storage_image(bindless, device, denoiser->views[i]);
+        if (denoiser->slots[i] == BINDLESS_INVALID) return 5;
+    }
+
+    // Reference error measurement, only when asked for.
+    if (s->reference_samples == 0) return 0;
+
+    result = take_compute_pipeline(
+            pipelines,
+            device,
+            path,
+            "denoise_error.comp.spv",
+            denoiser->pipeline_layout,
+            &denoiser->error_pipeline);
+    if (result > 0) return 3;
+    for (uint32_t i = 0; i < 2 * DENOISE_EVAL_POINTS; i++) {
+        result = create_denoise_image(
+                device,
+                physical_device,
+                extent,
+                VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                denoiser->snapshots + i,
+                denoiser->snapshot_memories + i,
+                denoiser->snapshot_views + i);
+        if (result > 0) return 4;
+        denoiser->snapshot_slots[i] = bindless_add_storage_image(bindless, device, denoiser->snapshot_views[i]);
+        if (denoiser->snapshot_slots[i] == BINDLESS_INVALID) return 5;
+    }
+
+    denoiser->groups_n = ((extent.width + DENOISE_GROUP_SIZE - 1) / DENOISE_GROUP_SIZE)
+        * ((extent.height + DENOISE_GROUP_SIZE - 1) / DENOISE_GROUP_SIZE);
+    VkDeviceSize errors_size = 2 * DENOISE_EVAL_POINTS * denoiser->groups_n * sizeof(float);
+    result = create_buffer(
+            device,
+            physical_device,
+            errors_size,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            GpuMemoryCategory_Staging,
+            &denoiser->errors,
+            &denoiser->errors_memory);
+    if (result > 0) return 6;
+    void *mapped = NULL;
+    if (vkMapMemory(device, denoiser->errors_memory, 0, errors_size, 0, &mapped) != VK_SUCCESS) return 6;
+    denoiser->errors_mapped = mapped;
+    denoiser->errors_slot = bindless_add_storage_buffer(bindless, device, denoiser->errors, 0, errors_size);
+    if (denoiser->errors_slot == BINDLESS_INVALID) return 5;
+
+    return 0;
+}
+
+void denoiser_free(struct Denoiser *denoiser) {
+    VkDevice device = denoiser->device;
+
+    // Only called once the device is idle, slots can go back immediately.
+    for (uint32_t i = 0; i < DenoiseImage_N; i++) {
+        if (denoiser->bindless != NULL && denoiser->images[i] != VK_NULL_HANDLE)
+            bindless_release(denoiser->bindless, BindlessKind_StorageImage, denoiser->slots[i], 0);
+        vkDestroyImageView(device, denoiser->views[i], NULL);
+        vkDestroyImage(device, denoiser->images[i], NULL);
+        gpu_memory_free(device, denoiser->memories[i]);
+    }
+    for (uint32_t i = 0; i < 2 * DENOISE_EVAL_POINTS; i++) {
+        if (denoiser->bindless != NULL)
+            bindless_release(denoiser->bindless, BindlessKind_StorageImage, denoiser->snapshot_slots[i], 0);
+        vkDestroyImageView(device, denoiser->snapshot_views[i], NULL);
+        vkDestroyImage(device, denoiser->snapshots[i], NULL);
+        gpu_memory_free(device, denoiser->snapshot_memories[i]);
+    }
+    if (denoiser->bindless != NULL)
+        bindless_release(denoiser->bindless, BindlessKind_StorageBuffer, denoiser->errors_slot, 0);
+    vkDestroyBuffer(device, denoiser->errors, NULL);
+    gpu_memory_free(device, denoiser->errors_memory); // Unmaps.
+
+    vkDestroyPipeline(device, denoiser->temporal_pipeline, NULL);
+    vkDestroyPipeline(device, denoiser->atrous_pipeline, NULL);
+    vkDestroyPipeline(device, denoiser->error_pipeline, NULL);
+    vkDestroyPipelineLayout(device, denoiser->pipeline_layout, NULL);
+
+    memset(denoiser, 0, sizeof(*denoiser));
+}
+
+void denoiser_set_render_extent(struct Denoiser *denoiser, VkExtent2D extent) {
+#if DEBUG_INPUT_VALIDATION
+    if (denoiser == NULL) return;
+    if (extent.width == 0 || extent.width > denoiser->extent.width) return;
+    if (extent.height == 0 || extent.height > denoiser->extent.height) return;
+#endif
+
+    if (extent.width == denoiser->render_extent.width && extent.height == denoiser->render_extent.height) return;
+    denoiser->render_extent = extent;
+    denoiser->frame_n = 0;
+
+    // The tracer restarts too, snapshots of the old size are never measured.
+    memset(denoiser->snapshot_taken, 0, sizeof(denoiser->snapshot_taken));
+    denoiser->errors_output = -1;
+}
+
+void denoiser_prepare(struct Denoiser *denoiser, VkCommandBuffer command_buffer, struct TraceGuides *guides) {
+#if DEBUG_INPUT_VALIDATION
+    if (denoiser == NULL) return;
+    if (command_buffer == VK_NULL_HANDLE) return;
+    if (guides == NULL) return;
+#endif
+
+    if (!denoiser->initialized) {
+        // Everything starts out in GENERAL, history is ignored on the first
+        // frame so the contents do not matter.
+        VkImageMemoryBarrier barriers[DenoiseImage_N + 2 * DENOISE_EVAL_POINTS];
+        uint32_t barriers_n = 0;
+        for (uint32_t i = 0; i < DenoiseImage_N + 2 * DENOISE_EVAL_POINTS; i++) {
+            VkImage image = i < DenoiseImage_N ? denoiser->images[i] : denoiser->snapshots[i - DenoiseImage_N];
+            if (image == VK_NULL_HANDLE) continue;
+            barriers[barriers_n++] = (VkImageMemoryBarrier) {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                .srcAccessMask = 0,
+                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .image = image,
+                .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+            };
+        }
+        vkCmdPipelineBarrier(
+                command_buffer,
+                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                0,
+                0,
+                NULL,
+                0,
+                NULL,
+                barriers_n,
+                barriers);
+        denoiser->initialized = 1;
+    } else {
+        // The previous frame's passes read the guides the trace overwrites.
+        denoise_barrier(command_buffer);
+    }
+
+    uint32_t current = denoiser->frame_n & 1;
+    guides->noisy = denoiser->slots[DenoiseImage_Noisy];
+    guides->albedo = denoiser->slots[DenoiseImage_Albedo];
+    guides->gbuffer = denoiser->slots[DenoiseImage_Gbuffer0 + current];
+}
+
+static void denoiser_collect_errors(struct Denoiser *denoiser, uint32_t reference_samples) {
+    char line[256];
+    int length = snprintf(line, sizeof(line), "[denoise] rmse against %u spp:", reference_samples);
+    double pixels_n = (double)denoiser->render_extent.width * denoiser->render_extent.height;
+    for (uint32_t p = 0; p < DENOISE_EVAL_POINTS && length < (int)sizeof(line); p++) {
+        if (!denoiser->snapshot_taken[p]) continue;
+        double sums[2] = { 0.0, 0.0 }; // denoised, raw
+        for (uint32_t k = 0; k < 2; k++) {
+            const float *partials = denoiser->errors_mapped + (2 * p + k) * denoiser->groups_n;
+            for (uint32_t i = 0; i < denoiser->groups_n; i++)
+                sums[k] += partials[i];
+        }
+        length += snprintf(line + length, sizeof(line) - length, " %u spp raw %.4f denoised %.4f,",
+                denoise_eval_samples[p],
+                sqrt(sums[1] / pixels_n),
+                sqrt(sums[0] / pixels_n));
+    }
+    if (length > 0 && line[length - 1] == ',') line[length - 1] = 0;
+    printf("%s\n", line);
+}
+
+static void denoiser_record_eval(
+        struct Denoiser *denoiser,
+        VkCommandBuffer command_buffer,
+        const struct Tracer *tracer,
+        uint32_t output) {
+    uint32_t samples_n = tracer->samples_n;
+    uint32_t step = tracer->settings.samples_per_dispatch; // samples_n moves in these
+    uint32_t reference_samples = denoiser->settings.reference_samples;
+
+    // Snapshot the denoised output and the raw mean at each eval point, or
+    // the first frame past it.
+    for (uint32_t p = 0; p < DENOISE_EVAL_POINTS; p++) {
+        uint32_t point = denoise_eval_samples[p];
+        if (samples_n < point || samples_n - step >= point || samples_n >= reference_samples) continue;
+
+        VkMemoryBarrier to_transfer = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+        };
+        vkCmdPipelineBarrier(
+                command_buffer,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0,
+                1,
+                &to_transfer,
+                0,
+                NULL,
+                0,
+                NULL);
+        VkImageCopy region = {
+            .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+            .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+            .extent = { denoiser->render_extent.width, denoiser->render_extent.height, 1 },
+        };
+        vkCmdCopyImage(
+                command_buffer,
+                tracer->outputs[output].image, VK_IMAGE_LAYOUT_GENERAL,
+                denoiser->snapshots[2 * p], VK_IMAGE_LAYOUT_GENERAL,
+                1, &region);
+        vkCmdCopyImage(
+                command_buffer,
+                tracer->accum_image, VK_IMAGE_LAYOUT_GENERAL,
+                denoiser->snapshots[2 * p + 1], VK_IMAGE_LAYOUT_GENERAL,
+                1, &region);
+        VkMemoryBarrier from_transfer = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        };
+        vkCmdPipelineBarrier(
+                command_buffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                0,
+                1,
+                &from_transfer,
+                0,
+                NULL,
+                0,
+                NULL);
+        denoiser->snapshot_taken[p] = 1;
+    }
+
+    // Measure every snapshot against the accumulation once it is the reference.
+    if (samples_n < reference_samples || samples_n - step >= reference_samples) return;
+
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, denoiser->error_pipeline);
+    for (uint32_t i = 0; i < 2 * DENOISE_EVAL_POINTS; i++) {
+        if (!denoiser->snapshot_taken[i / 2]) continue;
+        struct DenoiseErrorPush push = {
+            .image = denoiser->snapshot_slots[i],
+            .reference = tracer->accum_slot,
+            .errors = denoiser->errors_slot,
+            .offset = i * denoiser->groups_n,
+            .width = denoiser->render_extent.width,
+            .height = denoiser->render_extent.height,
+        };
+        vkCmdPushConstants(command_buffer, denoiser->pipeline_layout, VK_SHADER_STAGE_ALL, 0, sizeof(push), &push);
+        denoise_dispatch(command_buffer, denoiser->extent); // every group, the host sums groups_n of them
+    }
+    VkMemoryBarrier to_host = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+    };
+    vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_HOST_BIT,
+            0,
+            1,
+            &to_host,
+            0,
+            NULL,
+            0,
+            NULL);
+    denoiser->errors_output = output;
+}
+
+void denoiser_record_temporal(
+        struct Denoiser *denoiser,
+        VkCommandBuffer command_buffer,
+        const struct Tracer *tracer) {
+#if DEBUG_INPUT_VALIDATION
+    if (denoiser == NULL) return;
+    if (command_buffer == VK_NULL_HANDLE) return;
+    if (tracer == NULL) return;
+#endif
+
+    const struct DenoiseSettings *s = &denoiser->settings;
+    uint32_t current = denoiser->frame_n & 1;
+    uint32_t previous = current ^ 1;
+    const struct SceneCamera *camera = &tracer->camera;
+    const struct SceneCamera *previous_camera = denoiser->frame_n > 0 ? &denoiser->previous_camera : camera;
+
+    // The trace wrote the guides.
+    denoise_barrier(command_buffer);
+    vkCmdBindDescriptorSets(
+            command_buffer,
+            VK_PIPELINE_BIND_POINT_COMPUTE,
+            denoiser->pipeline_layout,
+            0,
+            1,
+            &denoiser->bindless->set,
+            0,
+            NULL);
+
+    // Temporal reprojection and variance.
+    struct DenoiseTemporalPush temporal_push = {
+        .noisy = denoiser->slots[DenoiseImage_Noisy],
+        .albedo = denoiser->slots[DenoiseImage_Albedo],
+        .gbuffer = denoiser->slots[DenoiseImage_Gbuffer0 + current],
+        .gbuffer_previous = denoiser->slots[DenoiseImage_Gbuffer0 + previous],
+        .history_previous = denoiser->slots[DenoiseImage_History0 + previous],
+        .history = denoiser->slots[DenoiseImage_History0 + current],
+        .moments_previous = denoiser->slots[DenoiseImage_Moments0 + previous],
+        .moments = denoiser->slots[DenoiseImage_Moments0 + current],
+        .filter = denoiser->slots[DenoiseImage_Filter0],
+        .width = denoiser->render_extent.width,
+        .height = denoiser->render_extent.height,
+        .alpha = s->alpha,
+        .first = denoiser->frame_n == 0,
+        .camera_position = { camera->position[0], camera->position[1], camera->position[2], camera->fov },
+        .camera_target = { camera->target[0], camera->target[1], camera->target[2], 0.0f },
+        .previous_position = {
+            previous_camera->position[0],
+            previous_camera->position[1],
+            previous_camera->position[2],
+            previous_camera->fov,
+        },
+        .previous_target = { previous_camera->target[0], previous_camera->target[1], previous_camera->target[2], 0.0f },
+    };
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, denoiser->temporal_pipeline);
+    vkCmdPushConstants(
+            command_buffer,
+            denoiser->pipeline_layout,
+            VK_SHADER_STAGE_ALL,
+            0,
+            sizeof(temporal_push),
+            &temporal_push);
+    denoise_dispatch(command_buffer, denoiser->render_extent);
+}
+
+void denoiser_record_atrous(
+        struct Denoiser *denoiser,
+        VkCommandBuffer command_buffer,
+        const struct Tracer *tracer,
+        uint32_t output) {
+#if DEBUG_INPUT_VALIDATION
+    if (denoiser == NULL) return;
+    if (command_buffer == VK_NULL_HANDLE) return;
+    if (tracer == NULL) return;
+    if (output >= TRACE_OUTPUTS) return;
+#endif
+
+    // Recording into this output again means its previous frame completed.
+    if (denoiser->errors_output == (int)output) {
+        denoiser_collect_errors(denoiser, denoiser->settings.reference_samples);
+        denoiser->errors_output = -1;
+    }
+
+    const struct DenoiseSettings *s = &denoiser->settings;
+    uint32_t current = denoiser->frame_n & 1;
+
+    // À-trous passes, doubling the step each time. The first feeds back into
+    // the color history and the last remodulates into the output.
+    vkCmdBindDescriptorSets(
+            command_buffer,
+            VK_PIPELINE_BIND_POINT_COMPUTE,
+            denoiser->pipeline_layout,
+            0,
+            1,
+            &denoiser->bindless->set,
+            0,
+            NULL);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, denoiser->atrous_pipeline);
+    for (uint32_t i = 0; i < s->iterations; i++) {
+        int last = i + 1 == s->iterations;
+        struct DenoiseAtrousPush atrous_push = {
+            .input = denoiser->slots[DenoiseImage_Filter0 + (i & 1)],
+            .output = denoiser->slots[DenoiseImage_Filter0 + ((i + 1) & 1)],
+            .history = i == 0 ? denoiser->slots[DenoiseImage_History0 + current] : BINDLESS_INVALID,
+            .gbuffer = denoiser->slots[DenoiseImage_Gbuffer0 + current],
+            .albedo = denoiser->slots[DenoiseImage_Albedo],
+            .target = last ? tracer->outputs[output].storage_slot : BINDLESS_INVALID,
+            .width = denoiser->render_extent.width,
+            .height = denoiser->render_extent.height,
+            .step = 1u << i,
+            .sigma_luminance = s->sigma_luminance,
+            .sigma_normal = s->sigma_normal,
+            .sigma_depth = s->sigma_depth,
+        };
+        denoise_barrier(command_buffer);
+        vkCmdPushConstants(
+                command_buffer,
+                denoiser->pipeline_layout,
+                VK_SHADER_STAGE_ALL,
+                0,
+                sizeof(atrous_push),
+                &atrous_push);
+        denoise_dispatch(command_buffer, denoiser->render_extent);
+    }
+
+    if (s->reference_samples > 0) denoiser_record_eval(denoiser, command_buffer, tracer, output);
+
+    denoiser->previous_camera = tracer->camera;
+    denoiser->frame_n += 1;
+}
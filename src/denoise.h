@@ -0,0 +1,120 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include "bindless.h"
+#include "pipeline.h"
+#include "trace.h"
+
+#define DENOISE_MAX_ITERATIONS 8
+// Sample counts the error against the reference is measured at.
+#define DENOISE_EVAL_POINTS 3
+#define DENOISE_EVAL_SAMPLES { 1, 4, 16 }
+
+// Zero fields take the defaults.
+struct DenoiseSettings {
+    uint32_t iterations; // à-trous passes, 5
+    float sigma_luminance; // 4
+    float sigma_normal; // exponent on the normal dot product, 128
+    float sigma_depth; // relative to distance, 0.1
+    float alpha; // floor of the temporal blend factor, 0.1
+    uint32_t reference_samples; // measure error once this many have accumulated, 0 to skip
+};
+
+// Denoiser image, all rgba32f storage images in GENERAL.
+enum DenoiseImage {
+    DenoiseImage_Noisy = 0,
+    DenoiseImage_Albedo,
+    DenoiseImage_Gbuffer0, // ping-pong with the previous frame's
+    DenoiseImage_Gbuffer1,
+    DenoiseImage_History0, // demodulated color and history length
+    DenoiseImage_History1,
+    DenoiseImage_Moments0, // first and second luminance moments
+    DenoiseImage_Moments1,
+    DenoiseImage_Filter0, // à-trous ping-pong, color and variance
+    DenoiseImage_Filter1,
+    DenoiseImage_N,
+};
+
+// Images only used within a frame, which the caller may provide instead,
+// e.g. as transients it aliases with other per-frame memory.
+#define DENOISE_SCRATCH_N 4
+#define DENOISE_SCRATCH_IMAGES { \
+    DenoiseImage_Noisy, DenoiseImage_Albedo, DenoiseImage_Filter0, DenoiseImage_Filter1 }
+
+// Spatiotemporal variance-guided filter over the tracer's per-frame samples.
+// A temporal pass reprojects and integrates color and luminance moments with
+// the previous frame's, then edge-avoiding à-trous passes widen the filter
+// guided by normal, depth and luminance variance. Runs on the trace queue,
+// right after the trace dispatch, and overwrites its output.
+//
+// Noisy is last read by the temporal pass and Filter1 first written by the
+// à-trous passes, so the two can share memory between the passes.
+struct Denoiser {
+    VkDevice device;
+    struct Bindless *bindless;
+    VkExtent2D extent; // allocated
+    VkExtent2D render_extent; // filtered, the top left of extent
+    struct DenoiseSettings settings;
+    VkPipelineLayout pipeline_layout;
+    VkPipeline temporal_pipeline;
+    VkPipeline atrous_pipeline;
+    VkPipeline error_pipeline;
+    //
+    VkImage images[DenoiseImage_N];
+    VkDeviceMemory memories[DenoiseImage_N];
+    VkImageView views[DenoiseImage_N];
+    uint32_t slots[DenoiseImage_N];
+    int scratch_external; // scratch images belong to the caller
+    int initialized; // images have left UNDEFINED
+    uint64_t frame_n;
+    struct SceneCamera previous_camera;
+    // Error against the reference, measured in a single pass once the
+    // tracer's accumulation reaches reference_samples. Snapshots hold the
+    // denoised output and the raw accumulation at each eval point.
+    VkImage snapshots[2 * DENOISE_EVAL_POINTS];
+    VkDeviceMemory snapshot_memories[2 * DENOISE_EVAL_POINTS];
+    VkImageView snapshot_views[2 * DENOISE_EVAL_POINTS];
+    uint32_t snapshot_slots[2 * DENOISE_EVAL_POINTS];
+    int snapshot_taken[DENOISE_EVAL_POINTS];
+    VkBuffer errors; // per workgroup squared error sums, host visible
+    VkDeviceMemory errors_memory;
+    const float *errors_mapped;
+    uint32_t errors_slot;
+    uint32_t groups_n;
+    int errors_output; // output whose frame measured them, -1 when none pending
+};
+
+// scratch_slots holds storage image slots in DENOISE_SCRATCH_IMAGES order,
+// of caller owned images in GENERAL whenever the denoiser runs. NULL creates
+// them.
+int denoiser_init(
+        struct Denoiser *denoiser,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        const char *path,
+        struct PipelineBatch *pipelines,
+        struct Bindless *bindless,
+        VkExtent2D extent,
+        const struct DenoiseSettings *settings,
+        const uint32_t *scratch_slots);
+void denoiser_free(struct Denoiser *denoiser);
+
+// Filters only the top left extent from the next frame on. A change drops
+// the history, which no longer lines up with the pixels.
+void denoiser_set_render_extent(struct Denoiser *denoiser, VkExtent2D extent);
+
+// Call before tracer_record on the same command buffer. Fills the guides the
+// tracer should write this frame.
+void denoiser_prepare(struct Denoiser *denoiser, VkCommandBuffer command_buffer, struct TraceGuides *guides);
+// Filters this frame's sample into tracer->outputs[output], after
+// tracer_record: first the temporal pass, reading the guides, then the
+// à-trous passes, writing the output.
+void denoiser_record_temporal(
+        struct Denoiser *denoiser,
+        VkCommandBuffer command_buffer,
+        const struct Tracer *tracer);
+void denoiser_record_atrous(
+        struct Denoiser *denoiser,
+        VkCommandBuffer command_buffer,
+        const struct Tracer *tracer,
+        uint32_t output);
@@ -0,0 +1,466 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "util.h"
+#include "bvh.h"
+#include "cpu_trace.h"
+#include "image.h"
+#include "net.h"
+#include "scene.h"
+#include "distributed.h"
+
+#define POLL_TIMEOUT_MS 5
+#define MAX_ISSUES 4 // per tile and frame, past that a tile waits for its results
+
+enum Message {
+    Message_Hello = 1, // worker, its pid
+    Message_Frame, // coordinator, struct FrameMessage
+    Message_Ready, // worker, scene loaded for the frame
+    Message_Tile, // coordinator, struct TileMessage
+    Message_Result, // worker, struct TileMessage then 3 floats per pixel
+    Message_Quit, // coordinator
+};
+
+struct FrameMessage {
+    uint32_t width, height;
+    uint32_t bounces;
+    uint32_t pad0;
+    char scene_path[256]; // empty for the built in scene
+};
+
+struct TileMessage {
+    uint32_t frame;
+    uint32_t id;
+    uint32_t x, y, w, h;
+    uint32_t first_sample;
+    uint32_t samples_n;
+};
+
+enum TileState {
+    TileState_Pending = 0,
+    TileState_Issued,
+    TileState_Done,
+};
+
+struct Tile {
+    uint32_t x, y, w, h;
+    enum TileState state;
+    uint32_t issued_n; // this frame
+    double issued_at; // latest issue
+};
+
+struct Peer {
+    uint32_t id; // in connection order, kept when peers before it drop
+    int fd;
+    pid_t pid; // forked here, else 0
+    int ready;
+    uint32_t outstanding[DISTRIBUTED_AHEAD]; // tile ids sent and not answered
+    uint32_t outstanding_n;
+    uint64_t tiles_n; // results that were used, this frame
+};
+
+struct Coordinator {
+    struct DistributedSettings settings; // defaults resolved
+    int listener;
+    struct Peer peers[DISTRIBUTED_MAX_WORKERS];
+    uint32_t peers_n;
+    uint32_t connected_n; // ever, the next peer's id
+    pid_t children[DISTRIBUTED_MAX_WORKERS];
+    uint32_t children_n;
+    //
+    struct Tile *tiles;
+    uint32_t tiles_n;
+    uint32_t done_n;
+    uint32_t frame;
+    float *image; // 3 floats per pixel
+    float *scratch; // one tile's result
+    // Stats, per frame.
+    double tile_time_sum;
+    uint64_t tile_time_n;
+    uint32_t reissued_n;
+    uint32_t dropped_n;
+};
+
+// Coordinator.
+
+static void drop_peer(struct Coordinator *coordinator, uint32_t index) {
+    struct Peer *peer = &coordinator->peers[index];
+    for (uint32_t i = 0; i < peer->outstanding_n; i++) {
+        struct Tile *tile = &coordinator->tiles[peer->outstanding[i]];
+        if (tile->state == TileState_Issued) tile->state = TileState_Pending;
+    }
+    close(peer->fd);
+    printf("[distributed] worker %u dropped, %u tiles back in the queue\n", peer->id, peer->outstanding_n);
+    coordinator->dropped_n++;
+    coordinator->peers[index] = coordinator->peers[--coordinator->peers_n];
+}
+
+static void accept_peer(struct Coordinator *coordinator) {
+    int fd = net_accept(coordinator->listener);
+    if (fd < 0) return;
+    struct NetHeader header;
+    uint32_t pid = 0;
+    if (coordinator->peers_n == DISTRIBUTED_MAX_WORKERS
+            || net_recv(fd, &header, sizeof(header)) > 0
+            || header.type != Message_Hello
+            || header.size != sizeof(pid)
+            || net_recv(fd, &pid, sizeof(pid)) > 0) {
+        close(fd);
+        return;
+    }
+
+    //
+    struct FrameMessage frame = {
+        .width = coordinator->settings.width,
+        .height = coordinator->settings.height,
+        .bounces = coordinator->settings.bounces,
+    };
+    if (coordinator->settings.scene_path != NULL)
+        strlcpy(frame.scene_path, coordinator->settings.scene_path, sizeof(frame.scene_path));
+    if (net_send_message(fd, Message_Frame, &frame, sizeof(frame), NULL, 0) > 0) {
+        close(fd);
+        return;
+    }
+    coordinator->peers[coordinator->peers_n++] = (struct Peer) { .id = coordinator->connected_n++, .fd = fd, .pid = pid };
+}
+
+// Reads one message of peer. Returns 2 when the peer is gone.
+static int receive(struct Coordinator *coordinator, struct Peer *peer) {
+    struct NetHeader header;
+    if (net_recv(peer->fd, &header, sizeof(header)) > 0) return 2;
+    if (header.type == Message_Ready) {
+        peer->ready = 1;
+        return header.size == 0 ? 0 : 2;
+    }
+    if (header.type != Message_Result || header.size < sizeof(struct TileMessage)) return 2;
+
+    struct TileMessage message;
+    if (net_recv(peer->fd, &message, sizeof(message)) > 0) return 2;
+    size_t pixels_size = (size_t)message.w * message.h * 3 * sizeof(float);
+    if (header.size != sizeof(message) + pixels_size || message.id >= coordinator->tiles_n) return 2;
+    uint32_t tile_size = coordinator->settings.tile_size;
+    if (pixels_size > (size_t)tile_size * tile_size * 3 * sizeof(float)) return 2;
+    if (net_recv(peer->fd, coordinator->scratch, pixels_size) > 0) return 2;
+
+    for (uint32_t i = 0; i < peer->outstanding_n; i++) {
+        if (peer->outstanding[i] != message.id) continue;
+        peer->outstanding[i] = peer->outstanding[--peer->outstanding_n];
+        break;
+    }
+
+    // First result wins, late copies of reissued tiles are dropped.
+    struct Tile *tile = &coordinator->tiles[message.id];
+    if (message.frame != coordinator->frame || tile->state == TileState_Done) return 0;
+    uint32_t width = coordinator->settings.width;
+    for (uint32_t j = 0; j < tile->h; j++)
+        memcpy(coordinator->image + ((size_t)(tile->y + j) * width + tile->x) * 3,
+                coordinator->scratch + (size_t)j * tile->w * 3,
+                tile->w * 3 * sizeof(float));
+    tile->state = TileState_Done;
+    coordinator->done_n++;
+    coordinator->tile_time_sum += time_now() - tile->issued_at;
+    coordinator->tile_time_n++;
+    peer->tiles_n++;
+
+    return 0;
+}
+
+// Next tile for a peer with room: pending ones first, then, for an idle
+// peer at the end of the frame, the longest running straggler.
+static uint32_t next_tile(struct Coordinator *coordinator, const struct Peer *peer, double now) {
+    for (uint32_t i = 0; i < coordinator->tiles_n; i++)
+        if (coordinator->tiles[i].state == TileState_Pending) return i;
+    if (peer->outstanding_n > 0 || coordinator->tile_time_n == 0) return UINT32_MAX;
+
+    double limit = DISTRIBUTED_STRAGGLER_FACTOR * coordinator->tile_time_sum / coordinator->tile_time_n;
+    uint32_t oldest = UINT32_MAX;
+    for (uint32_t i = 0; i < coordinator->tiles_n; i++) {
+        const struct Tile *tile = &coordinator->tiles[i];
+        if (tile->state != TileState_Issued || tile->issued_n >= MAX_ISSUES) continue;
+        if (now - tile->issued_at < limit) continue;
+        if (oldest == UINT32_MAX || tile->issued_at < coordinator->tiles[oldest].issued_at) oldest = i;
+    }
+    return oldest;
+}
+
+static int issue(struct Coordinator *coordinator, struct Peer *peer, uint32_t id, double now) {
+    struct Tile *tile = &coordinator->tiles[id];
+    struct TileMessage message = {
+        .frame = coordinator->frame,
+        .id = id,
+        .x = tile->x, .y = tile->y, .w = tile->w, .h = tile->h,
+        .first_sample = 0,
+        .samples_n = coordinator->settings.samples,
+    };
+    if (net_send_message(peer->fd, Message_Tile, &message, sizeof(message), NULL, 0) > 0) return 2;
+
+    if (tile->state == TileState_Issued) coordinator->reissued_n++;
+    tile->state = TileState_Issued;
+    tile->issued_n++;
+    tile->issued_at = now;
+    peer->outstanding[peer->outstanding_n++] = id;
+    return 0;
+}
+
+// Waits up to timeout_ms for results and connections, dropping peers that
+// hung up.
+static void pump(struct Coordinator *coordinator, int timeout_ms) {
+    struct pollfd fds[DISTRIBUTED_MAX_WORKERS + 1];
+    uint32_t peers_n = coordinator->peers_n;
+    for (uint32_t i = 0; i < peers_n; i++)
+        fds[i] = (struct pollfd) { .fd = coordinator->peers[i].fd, .events = POLLIN };
+    fds[peers_n] = (struct pollfd) { .fd = coordinator->listener, .events = POLLIN };
+    if (poll(fds, peers_n + 1, timeout_ms) <= 0) return;
+
+    // Backwards, dropping swaps the last peer in.
+    for (uint32_t i = peers_n; i-- > 0;) {
+        if (fds[i].revents == 0) continue;
+        if (receive(coordinator, &coordinator->peers[i]) > 0) drop_peer(coordinator, i);
+    }
+    if (fds[peers_n].revents & POLLIN) accept_peer(coordinator);
+}
+
+// Renders a frame on the first active_n ready peers, returns seconds or a
+// negative value when every worker is gone.
+static double render(struct Coordinator *coordinator, uint32_t active_n) {
+    coordinator->frame++;
+    coordinator->done_n = 0;
+    coordinator->tile_time_sum = 0.0;
+    coordinator->tile_time_n = 0;
+    coordinator->reissued_n = 0;
+    for (uint32_t i = 0; i < coordinator->tiles_n; i++) {
+        coordinator->tiles[i].state = TileState_Pending;
+        coordinator->tiles[i].issued_n = 0;
+    }
+    for (uint32_t i = 0; i < coordinator->peers_n; i++) {
+        coordinator->peers[i].tiles_n = 0;
+        coordinator->peers[i].outstanding_n = 0; // Answers to the last frame are dropped by frame.
+    }
+
+    double start = time_now();
+    while (coordinator->done_n < coordinator->tiles_n) {
+        double now = time_now();
+        uint32_t used_n = 0;
+        for (uint32_t i = 0; i < coordinator->peers_n && used_n < active_n; i++) {
+            struct Peer *peer = &coordinator->peers[i];
+            if (!peer->ready) continue;
+            used_n++;
+            while (peer->outstanding_n < DISTRIBUTED_AHEAD) {
+                uint32_t id = next_tile(coordinator, peer, now);
+                if (id == UINT32_MAX) break;
+                if (issue(coordinator, peer, id, now) > 0) break; // Dropped on its hang up.
+            }
+        }
+        if (used_n == 0 && coordinator->peers_n == 0) return -1.0;
+        pump(coordinator, POLL_TIMEOUT_MS);
+    }
+
+    return time_now() - start;
+}
+
+static void report_frame(const struct Coordinator *coordinator, uint32_t active_n, double seconds) {
+    printf("[distributed] %u workers: %.3f s, %u tiles, %u reissued, %.2f Mpaths/s\n",
+            active_n,
+            seconds,
+            coordinator->tiles_n,
+            coordinator->reissued_n,
+            (double)coordinator->settings.width * coordinator->settings.height * coordinator->settings.samples
+                / seconds * 1e-6);
+}
+
+int distributed_coordinator(const struct DistributedSettings *settings) {
+#if DEBUG_INPUT_VALIDATION
+    if (settings == NULL || settings->address == NULL) return 1;
+    if (settings->spawn_n > DISTRIBUTED_MAX_WORKERS || settings->workers_n > DISTRIBUTED_MAX_WORKERS) return 1;
+#endif
+
+    struct Coordinator coordinator = { .settings = *settings, .listener = -1 };
+    struct DistributedSettings *s = &coordinator.settings;
+    if (s->tile_size == 0) s->tile_size = DISTRIBUTED_DEFAULT_TILE;
+    if (s->width == 0) s->width = DISTRIBUTED_DEFAULT_WIDTH;
+    if (s->height == 0) s->height = DISTRIBUTED_DEFAULT_HEIGHT;
+    if (s->samples == 0) s->samples = DISTRIBUTED_DEFAULT_SAMPLES;
+    if (s->workers_n == 0) s->workers_n = s->spawn_n > 0 ? s->spawn_n : 1;
+
+    int result = 0;
+    coordinator.listener = net_listen(s->address);
+    if (coordinator.listener < 0) return 2;
+
+    // Row major tiles, the edges take what is left.
+    uint32_t tiles_x = (s->width + s->tile_size - 1) / s->tile_size;
+    uint32_t tiles_y = (s->height + s->tile_size - 1) / s->tile_size;
+    coordinator.tiles_n = tiles_x * tiles_y;
+    coordinator.tiles = calloc(coordinator.tiles_n, sizeof(*coordinator.tiles));
+    coordinator.image = calloc((size_t)s->width * s->height * 3, sizeof(float));
+    coordinator.scratch = malloc((size_t)s->tile_size * s->tile_size * 3 * sizeof(float));
+    for (uint32_t i = 0; i < coordinator.tiles_n; i++) {
+        struct Tile *tile = &coordinator.tiles[i];
+        tile->x = (i % tiles_x) * s->tile_size;
+        tile->y = (i / tiles_x) * s->tile_size;
+        tile->w = s->width - tile->x < s->tile_size ? s->width - tile->x : s->tile_size;
+        tile->h = s->height - tile->y < s->tile_size ? s->height - tile->y : s->tile_size;
+    }
+
+    // Local workers, forked before anything else holds threads.
+    fflush(stdout);
+    for (uint32_t i = 0; i < s->spawn_n; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(coordinator.listener);
+            _exit(distributed_worker(s->address));
+        }
+        if (pid > 0) coordinator.children[coordinator.children_n++] = pid;
+    }
+
+    // Wait for the workers to connect and load the scene.
+    double deadline = time_now() + DISTRIBUTED_CONNECT_TIMEOUT;
+    uint32_t ready_n = 0;
+    while (ready_n < s->workers_n) {
+        uint32_t connected_n = coordinator.peers_n;
+        pump(&coordinator, 50);
+        if (coordinator.peers_n > connected_n) deadline = time_now() + DISTRIBUTED_CONNECT_TIMEOUT;
+        ready_n = 0;
+        for (uint32_t i = 0; i < coordinator.peers_n; i++) ready_n += coordinator.peers[i].ready;
+        if (coordinator.peers_n < s->workers_n && time_now() > deadline) break;
+    }
+    if (ready_n == 0) {
+        result = 3;
+        goto done;
+    }
+    printf("[distributed] %u workers ready, %u tiles of %u px, %ux%u at %u spp\n",
+            ready_n, coordinator.tiles_n, s->tile_size, s->width, s->height, s->samples);
+
+    // Once per worker count with --scaling, else on all of them.
+    double first = 0.0, previous = 0.0;
+    for (uint32_t active_n = s->scaling ? 1 : ready_n; active_n <= ready_n; active_n++) {
+        double seconds = render(&coordinator, active_n);
+        if (seconds < 0.0) {
+            result = 3;
+            goto done;
+        }
+        report_frame(&coordinator, active_n, seconds);
+        if (!s->scaling) continue;
+
+        if (active_n == 1) first = seconds;
+        else
+            printf("[distributed] scaling to %u workers: speedup %.2f, efficiency %.0f%%, worker %u added %.0f%% of one\n",
+                    active_n,
+                    first / seconds,
+                    100.0 * first / seconds / active_n,
+                    active_n,
+                    100.0 * (first / seconds - first / previous));
+        previous = seconds;
+    }
+    for (uint32_t i = 0; i < coordinator.peers_n; i++)
+        printf("[distributed] worker %u: %llu tiles\n",
+                coordinator.peers[i].id,
+                (unsigned long long)coordinator.peers[i].tiles_n);
+
+    //
+    if (s->output_path != NULL && image_write_linear(s->output_path, s->width, s->height, coordinator.image) > 0)
+        result = 4;
+
+done:
+    for (uint32_t i = 0; i < coordinator.peers_n; i++) {
+        net_send_message(coordinator.peers[i].fd, Message_Quit, NULL, 0, NULL, 0);
+        close(coordinator.peers[i].fd);
+    }
+    for (uint32_t i = 0; i < coordinator.children_n; i++) waitpid(coordinator.children[i], NULL, 0);
+    close(coordinator.listener);
+    net_unlink(s->address);
+    free(coordinator.tiles);
+    free(coordinator.image);
+    free(coordinator.scratch);
+
+    return result;
+}
+
+// Worker.
+
+int distributed_worker(const char *address) {
+#if DEBUG_INPUT_VALIDATION
+    if (address == NULL) return 1;
+#endif
+
+    int fd = net_connect_retry(address, DISTRIBUTED_CONNECT_TIMEOUT);
+    if (fd < 0) return 2;
+    uint32_t pid = getpid();
+    if (net_send_message(fd, Message_Hello, &pid, sizeof(pid), NULL, 0) > 0) {
+        close(fd);
+        return 2;
+    }
+
+    int result = 0;
+    struct Scene scene = { 0 };
+    struct Bvh bvh = { 0 };
+    struct CpuTracer tracer = { 0 };
+    char scene_path[256] = { 0 };
+    int scene_loaded = 0;
+    float *pixels = NULL;
+    size_t pixels_cap = 0;
+    for (;;) {
+        struct NetHeader header;
+        if (net_recv(fd, &header, sizeof(header)) > 0) break; // Coordinator is gone.
+
+        if (header.type == Message_Frame && header.size == sizeof(struct FrameMessage)) {
+            struct FrameMessage frame;
+            if (net_recv(fd, &frame, sizeof(frame)) > 0) break;
+            frame.scene_path[sizeof(frame.scene_path) - 1] = 0;
+            if (!scene_loaded || strcmp(scene_path, frame.scene_path) != 0) {
+                bvh_free(&bvh);
+                scene_free(&scene);
+                int loaded = frame.scene_path[0] != 0
+                    ? scene_load_obj(&scene, frame.scene_path)
+                    : scene_init_default(&scene);
+                if (loaded > 0 || bvh_build(&bvh, scene.positions, scene.indices, scene.triangles_n) > 0) {
+                    result = 3;
+                    break;
+                }
+                strlcpy(scene_path, frame.scene_path, sizeof(scene_path));
+                scene_loaded = 1;
+            }
+            cpu_tracer_free(&tracer);
+            if (cpu_tracer_init(&tracer, &scene, &bvh, frame.width, frame.height, frame.bounces) > 0) {
+                result = 3;
+                break;
+            }
+            if (net_send_message(fd, Message_Ready, NULL, 0, NULL, 0) > 0) break;
+        } else if (header.type == Message_Tile && header.size == sizeof(struct TileMessage)) {
+            struct TileMessage tile;
+            if (net_recv(fd, &tile, sizeof(tile)) > 0) break;
+            size_t pixels_n = (size_t)tile.w * tile.h * 3;
+            if (pixels_n > pixels_cap) {
+                free(pixels);
+                pixels = malloc(pixels_n * sizeof(float));
+                pixels_cap = pixels_n;
+            }
+            cpu_tracer_render(&tracer, tile.x, tile.y, tile.w, tile.h, tile.first_sample, tile.samples_n, pixels);
+            if (net_send_message(fd, Message_Result, &tile, sizeof(tile), pixels, pixels_n * sizeof(float)) > 0)
+                break;
+        } else if (header.type == Message_Quit) {
+            break;
+        } else {
+            // Unknown, skip its payload.
+            uint8_t skip[256];
+            uint32_t left = header.size;
+            while (left > 0) {
+                uint32_t n = left < sizeof(skip) ? left : sizeof(skip);
+                if (net_recv(fd, skip, n) > 0) break;
+                left -= n;
+            }
+        }
+    }
+
+    free(pixels);
+    cpu_tracer_free(&tracer);
+    bvh_free(&bvh);
+    scene_free(&scene);
+    close(fd);
+
+    return result;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <stdint.h>
+
+#define DISTRIBUTED_DEFAULT_TILE 64
+#define DISTRIBUTED_DEFAULT_SAMPLES 64
+#define DISTRIBUTED_DEFAULT_WIDTH 800
+#define DISTRIBUTED_DEFAULT_HEIGHT 600
+#define DISTRIBUTED_MAX_WORKERS 64
+#define DISTRIBUTED_AHEAD 2 // tiles queued per worker, hides the round trip
+#define DISTRIBUTED_STRAGGLER_FACTOR 3.0 // times the mean tile time before a tile is issued again
+#define DISTRIBUTED_CONNECT_TIMEOUT 10.0 // seconds
+
+enum DistributedRole {
+    DistributedRole_None = 0, // the interactive app
+    DistributedRole_Coordinator,
+    DistributedRole_Worker,
+};
+
+// Zero fields take the defaults.
+struct DistributedSettings {
+    const char *address; // unix:PATH or HOST:PORT
+    uint32_t spawn_n; // worker processes the coordinator forks on this machine
+    uint32_t workers_n; // connections to wait for before rendering, default spawn_n
+    uint32_t tile_size;
+    uint32_t width, height;
+    uint32_t samples; // per pixel
+    uint32_t bounces;
+    const char *scene_path; // NULL for the built in scene
+    const char *output_path; // NULL to skip writing, see image_write_linear
+    int scaling; // render once with 1, 2, ... workers and report the efficiency
+};
+
+// Splits frames into tiles and hands them out over address as workers ask,
+// without a window or device. A worker that stops answering loses its tiles
+// to the next idle one; once the queue is empty, tiles out for longer than
+// DISTRIBUTED_STRAGGLER_FACTOR times the mean are issued again and the
+// first result wins. Returns 0 on success, 2 when address cannot be
+// listened on, 3 when no worker connects, 4 when the image cannot be written.
+int distributed_coordinator(const struct DistributedSettings *settings);
+
+// Headless worker, renders tiles with the CPU tracer until the coordinator
+// hangs up. Returns 0 when told to quit, 2 when address is unreachable and 3
+// when the scene cannot be loaded.
+int distributed_worker(const char *address);
@@ -0,0 +1,222 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "cpu_trace.h"
+#include "image.h"
+#include "environment.h"
+
+#define PI 3.14159265f
+
+// The sky of path.glsl, with a small sun bright enough to light most of the
+// scene: the case uniform sampling handles worst.
+static float *sun_init(uint32_t width, uint32_t height) {
+    float *rgb = malloc((size_t)width * height * 3 * sizeof(float));
+    if (rgb == NULL) return NULL;
+
+    const float sun[3] = { 0.5f, 0.6f, 0.3f };
+    float length = sqrtf(sun[0] * sun[0] + sun[1] * sun[1] + sun[2] * sun[2]);
+    float cos_radius = cosf(0.02f);
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            float phi = ((float)x + 0.5f) / width * 2.0f * PI, theta = ((float)y + 0.5f) / height * PI;
+            float d[3] = { sinf(theta) * sinf(phi), cosf(theta), -sinf(theta) * cosf(phi) };
+            float t = fminf(fmaxf(d[1] * 0.5f + 0.5f, 0.0f), 1.0f);
+            float *out = rgb + ((size_t)y * width + x) * 3;
+            out[0] = (0.9f + (0.4f - 0.9f) * t) * 0.5f;
+            out[1] = (0.9f + (0.6f - 0.9f) * t) * 0.5f;
+            out[2] = (0.9f + (1.0f - 0.9f) * t) * 0.5f;
+            if ((d[0] * sun[0] + d[1] * sun[1] + d[2] * sun[2]) / length > cos_radius) {
+                out[0] += 2000.0f;
+                out[1] += 1800.0f;
+                out[2] += 1500.0f;
+            }
+        }
+    }
+    return rgb;
+}
+
+// Vose's alias method: texels below the mean probability are topped up from
+// one above it, which becomes their alias.
+static int build_alias(struct EnvironmentTexel *texels, uint32_t n) {
+    uint32_t *small = malloc(n * sizeof(uint32_t));
+    uint32_t *large = malloc(n * sizeof(uint32_t));
+    float *scaled = malloc(n * sizeof(float));
+    if (small == NULL || large == NULL || scaled == NULL) {
+        free(small);
+        free(large);
+        free(scaled);
+        return 2;
+    }
+
+    uint32_t small_n = 0, large_n = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        scaled[i] = texels[i].pdf * (float)n;
+        if (scaled[i] < 1.0f) small[small_n++] = i;
+        else large[large_n++] = i;
+    }
+    while (small_n > 0 && large_n > 0) {
+        uint32_t s = small[--small_n], l = large[large_n - 1];
+        texels[s].probability = scaled[s];
+        texels[s].alias = l;
+        scaled[l] -= 1.0f - scaled[s];
+        if (scaled[l] < 1.0f) {
+            large_n--;
+            small[small_n++] = l;
+        }
+    }
+    // What is left is within rounding of 1.
+    while (large_n > 0) {
+        uint32_t l = large[--large_n];
+        texels[l].probability = 1.0f;
+        texels[l].alias = l;
+    }
+    while (small_n > 0) {
+        uint32_t s = small[--small_n];
+        texels[s].probability = 1.0f;
+        texels[s].alias = s;
+    }
+
+    free(small);
+    free(large);
+    free(scaled);
+    return 0;
+}
+
+//
+
+int environment_init(struct Environment *environment, const char *path, enum EnvironmentSampling sampling) {
+#if DEBUG_INPUT_VALIDATION
+    if (environment == NULL || path == NULL) return 1;
+    if (!IS_ZERO_PTR(environment)) return 1;
+#endif
+
+    uint32_t width = ENVIRONMENT_SUN_WIDTH, height = ENVIRONMENT_SUN_HEIGHT;
+    float *rgb = NULL;
+    if (strcmp(path, ENVIRONMENT_SUN) == 0) rgb = sun_init(width, height);
+    else if (image_load_linear(path, &width, &height, &rgb) > 0) rgb = NULL;
+    if (rgb == NULL) return 2;
+
+    //
+    double start = time_now();
+    uint32_t texels_n = width * height;
+    environment->size = (1 + (size_t)texels_n) * sizeof(struct EnvironmentTexel);
+    environment->data = calloc(1, environment->size);
+    if (environment->data == NULL) {
+        free(rgb);
+        return 2;
+    }
+    environment->width = width;
+    environment->height = height;
+    environment->texels = (struct EnvironmentTexel *)environment->data + 1;
+
+    // Power of each texel, its luminance times its share of the sphere.
+    double sum = 0.0;
+    for (uint32_t y = 0; y < height; y++) {
+        float sin_theta = sinf(((float)y + 0.5f) / height * PI);
+        for (uint32_t x = 0; x < width; x++) {
+            struct EnvironmentTexel *texel = &environment->texels[y * width + x];
+            const float *in = rgb + ((size_t)y * width + x) * 3;
+            for (int c = 0; c < 3; c++) texel->radiance[c] = fmaxf(in[c], 0.0f);
+            float luminance = 0.2126f * texel->radiance[0] + 0.7152f * texel->radiance[1] + 0.0722f * texel->radiance[2];
+            texel->pdf = luminance * sin_theta;
+            sum += texel->pdf;
+        }
+    }
+    free(rgb);
+    if (sum <= 0.0) {
+        environment_free(environment);
+        return 3;
+    }
+    for (uint32_t i = 0; i < texels_n; i++) environment->texels[i].pdf = (float)(environment->texels[i].pdf / sum);
+    if (build_alias(environment->texels, texels_n) > 0) {
+        environment_free(environment);
+        return 2;
+    }
+    environment->build_time = time_now() - start;
+    environment_set_sampling(environment, sampling);
+
+    return 0;
+}
+
+void environment_free(struct Environment *environment) {
+    free(environment->data);
+    memset(environment, 0, sizeof(*environment));
+}
+
+void environment_set_sampling(struct Environment *environment, enum EnvironmentSampling sampling) {
+    environment->sampling = sampling;
+    *(struct EnvironmentHeader *)environment->data = (struct EnvironmentHeader) {
+        .width = environment->width,
+        .height = environment->height,
+        .sampling = sampling,
+    };
+}
+
+static int pdf_descending(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x < y) - (x > y);
+}
+
+void environment_report(const struct Environment *environment) {
+    // How peaked the distribution is: the share of power in the brightest
+    // texels a uniform pick would find one in a hundred times.
+    uint32_t texels_n = environment->width * environment->height;
+    float *pdfs = malloc(texels_n * sizeof(float));
+    double top = 0.0;
+    if (pdfs != NULL) {
+        for (uint32_t i = 0; i < texels_n; i++) pdfs[i] = environment->texels[i].pdf;
+        qsort(pdfs, texels_n, sizeof(float), pdf_descending);
+        for (uint32_t i = 0; i < (texels_n + 99) / 100; i++) top += pdfs[i];
+        free(pdfs);
+    }
+    printf("[environment] %ux%u, alias table built in %.2f ms, %.1f%% of the power in 1%% of the texels, %s sampling\n",
+            environment->width,
+            environment->height,
+            environment->build_time * 1e3,
+            100.0 * top,
+            environment->sampling == EnvironmentSampling_Mis ? "MIS" : "BSDF");
+}
+
+// Equal time comparison.
+
+static void set_sampling(void *user, uint32_t strategy) {
+    environment_set_sampling(user, strategy == 0 ? EnvironmentSampling_Bsdf : EnvironmentSampling_Mis);
+}
+
+int environment_compare(
+        struct Environment *environment,
+        const struct Scene *scene,
+        const struct Bvh *bvh,
+        uint32_t width,
+        uint32_t height,
+        uint32_t bounces) {
+#if DEBUG_INPUT_VALIDATION
+    if (environment == NULL || environment->data == NULL) return 1;
+    if (scene == NULL || bvh == NULL) return 1;
+#endif
+
+    struct CpuTracer tracer = { 0 };
+    if (cpu_tracer_init(&tracer, scene, bvh, width, height, bounces) > 0) return 1;
+    tracer.environment = environment;
+    struct CpuCompare compare = { 0 };
+    int result = cpu_compare_init(&compare, &tracer);
+    if (result == 0) {
+        enum EnvironmentSampling sampling = environment->sampling;
+        struct CpuCompareEqualTime settings = {
+            .tag = "environment",
+            .names = { "BSDF sampling", "MIS" },
+            .set = set_sampling,
+            .user = environment,
+            .seconds = ENVIRONMENT_COMPARE_SECONDS,
+            .reference_factor = ENVIRONMENT_COMPARE_REFERENCE,
+        };
+        result = cpu_compare_equal_time(&compare, &settings);
+        environment_set_sampling(environment, sampling);
+    }
+
+    cpu_compare_free(&compare);
+    cpu_tracer_free(&tracer);
+    return result > 0 ? 2 : 0;
+}
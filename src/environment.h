@@ -0,0 +1,70 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "bvh.h"
+#include "scene.h"
+
+#define ENVIRONMENT_SUN "sun" // path that builds the procedural sky with a sun instead of loading
+#define ENVIRONMENT_SUN_WIDTH 1024
+#define ENVIRONMENT_SUN_HEIGHT 512
+#define ENVIRONMENT_COMPARE_WIDTH 160
+#define ENVIRONMENT_COMPARE_HEIGHT 120
+#define ENVIRONMENT_COMPARE_SECONDS 2.0 // per strategy
+#define ENVIRONMENT_COMPARE_REFERENCE 8 // times the samples MIS managed, for the reference
+
+enum EnvironmentSampling {
+    EnvironmentSampling_Mis = 0, // light samples from the table, MIS weighted with BSDF samples
+    EnvironmentSampling_Bsdf, // only BSDF samples that escape see the environment
+};
+
+// Must match EnvironmentHeader in scene.glsl, the size of one texel.
+struct EnvironmentHeader {
+    uint32_t width, height;
+    uint32_t sampling;
+    uint32_t pad[5];
+};
+
+// Must match EnvironmentTexel in scene.glsl.
+struct EnvironmentTexel {
+    float radiance[3];
+    float pdf; // of picking this texel, luminance times solid angle over the sum
+    float probability; // alias table: stay on this texel below this, else take alias
+    uint32_t alias;
+    uint32_t pad[2];
+};
+
+_Static_assert(sizeof(struct EnvironmentHeader) == sizeof(struct EnvironmentTexel), "header takes one texel's place");
+
+// Latitude-longitude HDR map lighting the scene where rays escape, with an
+// alias table over its texels so the kernels can pick one in proportion to
+// its power in O(1). Texel y runs from +y down to -y, x around from -z
+// through +x. data is the header followed by the texels, the layout the
+// kernels read from one storage buffer.
+struct Environment {
+    uint32_t width, height;
+    enum EnvironmentSampling sampling;
+    void *data;
+    size_t size; // of data, bytes
+    struct EnvironmentTexel *texels; // in data, after the header
+    double build_time; // seconds, distribution and alias table
+};
+
+// path is an .hdr or .pfm file, or ENVIRONMENT_SUN. Returns 2 when the file
+// cannot be loaded and 3 when it holds no light.
+int environment_init(struct Environment *environment, const char *path, enum EnvironmentSampling sampling);
+void environment_free(struct Environment *environment);
+
+// Sets how kernels sample, in data as well; re-upload after changing.
+void environment_set_sampling(struct Environment *environment, enum EnvironmentSampling sampling);
+void environment_report(const struct Environment *environment);
+
+// Renders the scene on the CPU for ENVIRONMENT_COMPARE_SECONDS with BSDF
+// samples only, then as long with MIS, and prints each one's error against
+// a long MIS reference: the noise at equal time.
+int environment_compare(
+        struct Environment *environment,
+        const struct Scene *scene,
+        const struct Bvh *bvh,
+        uint32_t width,
+        uint32_t height,
+        uint32_t bounces);
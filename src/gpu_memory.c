@@ -0,0 +1,591 @@
+#include <vulkan/vulkan.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "gpu_memory.h"
+
+#define TRACKER_INITIAL_CAP 256 // allocation table slots, a power of two
+#define MIB (1.0 / (1024.0 * 1024.0))
+
+static const char *gpu_memory_category_names[GpuMemoryCategory_N] = {
+    "geometry",
+    "bvh",
+    "textures",
+    "frame",
+    "staging",
+};
+
+struct TrackedAllocation {
+    VkDeviceMemory memory; // VK_NULL_HANDLE for an empty slot
+    VkDeviceSize size;
+    uint32_t heap;
+    enum GpuMemoryCategory category;
+};
+
+// Allocations are looked up by handle on free, in an open addressed table
+// with linear probing.
+struct GpuMemoryTracker {
+    int initialized;
+    pthread_mutex_t lock;
+    VkPhysicalDevice physical_device;
+    VkPhysicalDeviceMemoryProperties properties;
+    GpuMemoryPressureFn pressure_fn;
+    void *pressure_user;
+    struct TrackedAllocation *table; // array with size of table_cap
+    uint32_t table_cap;
+    struct GpuMemoryStats stats;
+};
+
+static struct GpuMemoryTracker tracker;
+
+static uint32_t tracker_hash(VkDeviceMemory memory) {
+    uint64_t x = (uint64_t)memory;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return (uint32_t)x & (tracker.table_cap - 1);
+}
+
+static int tracker_insert(const struct TrackedAllocation *allocation) {
+    if (2 * (tracker.stats.allocations_n + 1) > tracker.table_cap) {
+        struct TrackedAllocation *old = tracker.table;
+        uint32_t old_cap = tracker.table_cap;
+        struct TrackedAllocation *table = calloc(2 * old_cap, sizeof(*table));
+        if (table == NULL) return 2;
+        tracker.table = table;
+        tracker.table_cap = 2 * old_cap;
+        for (uint32_t i = 0; i < old_cap; i++) {
+            if (old[i].memory == VK_NULL_HANDLE) continue;
+            uint32_t j = tracker_hash(old[i].memory);
+            while (tracker.table[j].memory != VK_NULL_HANDLE) j = (j + 1) & (tracker.table_cap - 1);
+            tracker.table[j] = old[i];
+        }
+        free(old);
+    }
+
+    uint32_t i = tracker_hash(allocation->memory);
+    while (tracker.table[i].memory != VK_NULL_HANDLE) i = (i + 1) & (tracker.table_cap - 1);
+    tracker.table[i] = *allocation;
+    tracker.stats.allocations_n++;
+
+    return 0;
+}
+
+// Returns 0 and the removed entry in *allocation, 2 when memory is untracked.
+static int tracker_remove(VkDeviceMemory memory, struct TrackedAllocation *allocation) {
+    uint32_t mask = tracker.table_cap - 1;
+    uint32_t i = tracker_hash(memory);
+    while (tracker.table[i].memory != memory) {
+        if (tracker.table[i].memory == VK_NULL_HANDLE) return 2;
+        i = (i + 1) & mask;
+    }
+    *allocation = tracker.table[i];
+
+    // Shift later entries of the probe run back into the hole.
+    uint32_t hole = i;
+    for (uint32_t j = (i + 1) & mask; tracker.table[j].memory != VK_NULL_HANDLE; j = (j + 1) & mask) {
+        uint32_t home = tracker_hash(tracker.table[j].memory);
+        int movable = hole <= j ? (home <= hole || home > j) : (home <= hole && home > j);
+        if (!movable) continue;
+        tracker.table[hole] = tracker.table[j];
+        hole = j;
+    }
+    tracker.table[hole].memory = VK_NULL_HANDLE;
+    tracker.stats.allocations_n--;
+
+    return 0;
+}
+
+int gpu_memory_tracker_init(VkPhysicalDevice physical_device, int budget_supported, float soft_limit) {
+#if DEBUG_INPUT_VALIDATION
+    if (physical_device == VK_NULL_HANDLE) return 1;
+    if (tracker.initialized) return 1;
+    if (soft_limit < 0.0f || soft_limit > 1.0f) return 1;
+#endif
+
+    tracker.table = calloc(TRACKER_INITIAL_CAP, sizeof(*tracker.table));
+    if (tracker.table == NULL) return 2;
+    tracker.table_cap = TRACKER_INITIAL_CAP;
+    if (pthread_mutex_init(&tracker.lock, NULL) != 0) {
+        free(tracker.table);
+        memset(&tracker, 0, sizeof(tracker));
+        return 3;
+    }
+    tracker.physical_device = physical_device;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &tracker.properties);
+    tracker.stats.budget_supported = budget_supported;
+    tracker.stats.soft_limit = soft_limit > 0.0f ? soft_limit : GPU_MEMORY_DEFAULT_SOFT_LIMIT;
+    tracker.stats.heaps_n = tracker.properties.memoryHeapCount;
+    for (uint32_t i = 0; i < tracker.stats.heaps_n; i++) {
+        struct GpuMemoryHeapStats *heap = &tracker.stats.heaps[i];
+        heap->size = tracker.properties.memoryHeaps[i].size;
+        heap->device_local = (tracker.properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+    }
+    tracker.initialized = 1;
+    gpu_memory_update();
+
+    return 0;
+}
+
+void gpu_memory_tracker_free(void) {
+    if (!tracker.initialized) return;
+    if (tracker.stats.allocations_n > 0)
+        printf("[memory] %u allocations still live at shutdown\n", tracker.stats.allocations_n);
+    pthread_mutex_destroy(&tracker.lock);
+    free(tracker.table);
+    memset(&tracker, 0, sizeof(tracker));
+}
+
+void gpu_memory_set_pressure_callback(GpuMemoryPressureFn fn, void *user) {
+    if (!tracker.initialized) return;
+    pthread_mutex_lock(&tracker.lock);
+    tracker.pressure_fn = fn;
+    tracker.pressure_user = user;
+    pthread_mutex_unlock(&tracker.lock);
+}
+
+VkResult gpu_memory_allocate(
+        VkDevice device,
+        const VkMemoryAllocateInfo *memory_ainfo,
+        enum GpuMemoryCategory category,
+        VkDeviceMemory *memory) {
+#if DEBUG_INPUT_VALIDATION
+    if (memory_ainfo == NULL || memory == NULL) return VK_ERROR_INITIALIZATION_FAILED;
+    if (category >= GpuMemoryCategory_N) return VK_ERROR_INITIALIZATION_FAILED;
+#endif
+
+    VkResult result = vkAllocateMemory(device, memory_ainfo, NULL, memory);
+    if (!tracker.initialized) return result;
+
+    pthread_mutex_lock(&tracker.lock);
+    struct GpuMemoryStats *stats = &tracker.stats;
+    uint32_t heap = tracker.properties.memoryTypes[memory_ainfo->memoryTypeIndex].heapIndex;
+    struct GpuMemoryHeapStats *heap_stats = &stats->heaps[heap];
+    if (result != VK_SUCCESS) {
+        stats->failures_n++;
+        printf("[memory] %.1f MiB of %s failed on heap %u: %.1f MiB used of %.1f MiB budget, %.1f MiB tracked\n",
+                memory_ainfo->allocationSize * MIB,
+                gpu_memory_category_names[category],
+                heap,
+                heap_stats->usage * MIB,
+                heap_stats->budget * MIB,
+                heap_stats->tracked * MIB);
+        pthread_mutex_unlock(&tracker.lock);
+        return result;
+    }
+
+    struct TrackedAllocation allocation = {
+        .memory = *memory,
+        .size = memory_ainfo->allocationSize,
+        .heap = heap,
+        .category = category,
+    };
+    if (tracker_insert(&allocation) == 0) {
+        heap_stats->tracked += allocation.size;
+        heap_stats->categories[category] += allocation.size;
+        stats->categories[category] += allocation.size;
+        VkDeviceSize total = 0;
+        for (uint32_t i = 0; i < stats->heaps_n; i++) total += stats->heaps[i].tracked;
+        if (total > stats->peak) stats->peak = total;
+    }
+    pthread_mutex_unlock(&tracker.lock);
+
+    return result;
+}
+
+void gpu_memory_free(VkDevice device, VkDeviceMemory memory) {
+    vkFreeMemory(device, memory, NULL);
+    if (memory == VK_NULL_HANDLE || !tracker.initialized) return;
+
+    pthread_mutex_lock(&tracker.lock);
+    struct TrackedAllocation allocation;
+    if (tracker_remove(memory, &allocation) == 0) {
+        struct GpuMemoryHeapStats *heap = &tracker.stats.heaps[allocation.heap];
+        heap->tracked -= allocation.size;
+        heap->categories[allocation.category] -= allocation.size;
+        tracker.stats.categories[allocation.category] -= allocation.size;
+    }
+    pthread_mutex_unlock(&tracker.lock);
+}
+
+void gpu_memory_update(void) {
+    if (!tracker.initialized) return;
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+    };
+    VkPhysicalDeviceMemoryProperties2 properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+        .pNext = &budget,
+    };
+    if (tracker.stats.budget_supported) vkGetPhysicalDeviceMemoryProperties2(tracker.physical_device, &properties);
+
+    // Callbacks run unlocked, they may well free memory.
+    uint32_t crossed[VK_MAX_MEMORY_HEAPS];
+    uint32_t crossed_n = 0;
+    pthread_mutex_lock(&tracker.lock);
+    for (uint32_t i = 0; i < tracker.stats.heaps_n; i++) {
+        struct GpuMemoryHeapStats *heap = &tracker.stats.heaps[i];
+        heap->budget = tracker.stats.budget_supported ? budget.heapBudget[i] : heap->size;
+        heap->usage = tracker.stats.budget_supported ? budget.heapUsage[i] : heap->tracked;
+        int over = heap->usage > (VkDeviceSize)(tracker.stats.soft_limit * heap->budget);
+        if (over && !heap->over_soft_limit) crossed[crossed_n++] = i;
+        heap->over_soft_limit = over;
+    }
+    GpuMemoryPressureFn fn = tracker.pressure_fn;
+    void *user = tracker.pressure_user;
+    struct GpuMemoryStats stats = tracker.stats;
+    pthread_mutex_unlock(&tracker.lock);
+
+    for (uint32_t i = 0; i < crossed_n; i++) {
+        const struct GpuMemoryHeapStats *heap = &stats.heaps[crossed[i]];
+        printf("[memory] heap %u over the soft limit: %.1f of %.1f MiB budget\n",
+                crossed[i],
+                heap->usage * MIB,
+                heap->budget * MIB);
+        if (fn != NULL) fn(user, crossed[i], heap->usage, heap->budget);
+    }
+}
+
+void gpu_memory_stats(struct GpuMemoryStats *stats) {
+    if (!tracker.initialized) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    pthread_mutex_lock(&tracker.lock);
+    *stats = tracker.stats;
+    pthread_mutex_unlock(&tracker.lock);
+}
+
+void gpu_memory_report(void) {
+    struct GpuMemoryStats stats;
+    gpu_memory_stats(&stats);
+    if (stats.heaps_n == 0) return;
+
+    for (uint32_t i = 0; i < stats.heaps_n; i++) {
+        const struct GpuMemoryHeapStats *heap = &stats.heaps[i];
+        if (heap->tracked == 0 && !heap->device_local) continue;
+        char categories[256];
+        int length = 0;
+        for (int c = 0; c < GpuMemoryCategory_N; c++) {
+            if (heap->categories[c] == 0) continue;
+            length += snprintf(categories + length, sizeof(categories) - length, "%s%s %.1f",
+                    length > 0 ? ", " : "",
+                    gpu_memory_category_names[c],
+                    heap->categories[c] * MIB);
+        }
+        printf("[memory] heap %u%s: %.1f of %.1f MiB budget (%.0f%%), %.1f MiB tracked%s%s\n",
+                i,
+                heap->device_local ? " device local" : "",
+                heap->usage * MIB,
+                heap->budget * MIB,
+                heap->budget > 0 ? 100.0 * heap->usage / heap->budget : 0.0,
+                heap->tracked * MIB,
+                length > 0 ? ": " : "",
+                categories);
+    }
+    printf("[memory] %u allocations, peak %.1f MiB tracked, %llu failed%s\n",
+            stats.allocations_n,
+            stats.peak * MIB,
+            (unsigned long long)stats.failures_n,
+            stats.budget_supported ? "" : ", no VK_EXT_memory_budget so usage is only what is tracked");
+}
+
+int find_memory_type(
+        VkPhysicalDevice physical_device,
+        uint32_t type_bits,
+        VkMemoryPropertyFlags properties,
+        uint32_t *type_index) {
+#if DEBUG_INPUT_VALIDATION
+    if (physical_device == VK_NULL_HANDLE) return 1;
+    if (type_index == NULL) return 1;
+#endif
+
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+
+    for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+        if (!(type_bits & (1u << i))) continue;
+        VkMemoryPropertyFlags flags = memory_properties.memoryTypes[i].propertyFlags;
+        if ((flags & properties) == properties) {
+            *type_index = i;
+            return 0;
+        }
+    }
+
+    return 2; // No matching memory type.
+}
+
+int create_buffer(
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        VkDeviceSize size,
+        VkBufferUsageFlags usage,
+        VkMemoryPropertyFlags properties,
+        enum GpuMemoryCategory category,
+        VkBuffer *buffer,
+        VkDeviceMemory *memory) {
+#if DEBUG_INPUT_VALIDATION
+    if (device == VK_NULL_HANDLE) return 1;
+    if (size == 0) return 1;
+    if (buffer == NULL) return 1;
+    if (*buffer != VK_NULL_HANDLE) return 1;
+    if (memory == NULL) return 1;
+    if (*memory != VK_NULL_HANDLE) return 1;
+#endif
+
+    //
+    VkBufferCreateInfo buffer_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VkResult result = vkCreateBuffer(device, &buffer_cinfo, NULL, buffer);
+    if (result != VK_SUCCESS) return 2;
+
+    //
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device, *buffer, &requirements);
+    uint32_t type_index = 0;
+    if (find_memory_type(physical_device, requirements.memoryTypeBits, properties, &type_index) > 0)
+        return 3;
+
+    // Buffers whose address is taken need memory allocated for it.
+    VkMemoryAllocateFlagsInfo flags_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+        .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+    };
+    VkMemoryAllocateInfo memory_ainfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) ? &flags_info : NULL,
+        .allocationSize = requirements.size,
+        .memoryTypeIndex = type_index,
+    };
+    result = gpu_memory_allocate(device, &memory_ainfo, category, memory);
+    if (result != VK_SUCCESS) return 4;
+
+    result = vkBindBufferMemory(device, *buffer, *memory, 0);
+    if (result != VK_SUCCESS) return 5;
+
+    return 0;
+}
+
+int create_image(
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        VkExtent2D extent,
+        uint32_t mip_levels,
+        VkFormat format,
+        VkImageUsageFlags usage,
+        enum GpuMemoryCategory category,
+        VkImage *image,
+        VkDeviceMemory *memory,
+        VkDeviceSize *allocation_size) {
+#if DEBUG_INPUT_VALIDATION
+    if (device == VK_NULL_HANDLE) return 1;
+    if (extent.width == 0 || extent.height == 0) return 1;
+    if (mip_levels == 0) return 1;
+    if (image == NULL) return 1;
+    if (*image != VK_NULL_HANDLE) return 1;
+    if (memory == NULL) return 1;
+    if (*memory != VK_NULL_HANDLE) return 1;
+#endif
+
+    //
+    VkImageCreateInfo image_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = format,
+        .extent = { extent.width, extent.height, 1 },
+        .mipLevels = mip_levels,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+    VkResult result = vkCreateImage(device, &image_cinfo, NULL, image);
+    if (result != VK_SUCCESS) return 2;
+
+    //
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(device, *image, &requirements);
+    uint32_t type_index = 0;
+    int find_result = find_memory_type(
+            physical_device,
+            requirements.memoryTypeBits,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &type_index);
+    if (find_result > 0) return 3;
+
+    //
+    VkMemoryAllocateInfo memory_ainfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = requirements.size,
+        .memoryTypeIndex = type_index,
+    };
+    result = gpu_memory_allocate(device, &memory_ainfo, category, memory);
+    if (result != VK_SUCCESS) return 4;
+
+    result = vkBindImageMemory(device, *image, *memory, 0);
+    if (result != VK_SUCCESS) return 5;
+
+    if (allocation_size != NULL) *allocation_size = requirements.size;
+
+    return 0;
+}
+
+int create_image_view(
+        VkDevice device,
+        VkImage image,
+        VkFormat format,
+        uint32_t mip_levels,
+        VkImageView *view) {
+#if DEBUG_INPUT_VALIDATION
+    if (device == VK_NULL_HANDLE) return 1;
+    if (image == VK_NULL_HANDLE) return 1;
+    if (view == NULL) return 1;
+    if (*view != VK_NULL_HANDLE) return 1;
+#endif
+
+    VkImageViewCreateInfo view_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = format,
+        .components = {
+            .r = VK_COMPONENT_SWIZZLE_IDENTITY,
+            .g = VK_COMPONENT_SWIZZLE_IDENTITY,
+            .b = VK_COMPONENT_SWIZZLE_IDENTITY,
+            .a = VK_COMPONENT_SWIZZLE_IDENTITY,
+        },
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = mip_levels,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    };
+
+    VkResult result = vkCreateImageView(device, &view_cinfo, NULL, view);
+    if (result != VK_SUCCESS) return 2;
+
+    return 0;
+}
+
+int create_buffer_with_data(
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        VkQueue queue,
+        uint32_t queue_family,
+        VkBufferUsageFlags usage,
+        const void *data,
+        VkDeviceSize size,
+        enum GpuMemoryCategory category,
+        VkBuffer *buffer,
+        VkDeviceMemory *memory) {
+#if DEBUG_INPUT_VALIDATION
+    if (device == VK_NULL_HANDLE) return 1;
+    if (queue == VK_NULL_HANDLE) return 1;
+    if (data == NULL || size == 0) return 1;
+#endif
+
+    int res = 0;
+    VkBuffer staging = VK_NULL_HANDLE;
+    VkDeviceMemory staging_memory = VK_NULL_HANDLE;
+    VkCommandPool pool = VK_NULL_HANDLE;
+
+    //
+    int result = create_buffer(
+            device,
+            physical_device,
+            size,
+            usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            category,
+            buffer,
+            memory);
+    if (result > 0) return 2;
+    result = create_buffer(
+            device,
+            physical_device,
+            size,
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            GpuMemoryCategory_Staging,
+            &staging,
+            &staging_memory);
+    if (result > 0) {
+        res = 3;
+        goto fail;
+    }
+    void *mapped = NULL;
+    if (vkMapMemory(device, staging_memory, 0, size, 0, &mapped) != VK_SUCCESS) {
+        res = 3;
+        goto fail;
+    }
+    memcpy(mapped, data, size);
+    vkUnmapMemory(device, staging_memory);
+
+    //
+    VkCommandPoolCreateInfo pool_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = queue_family,
+    };
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    VkCommandBufferAllocateInfo command_buffer_ainfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    if (vkCreateCommandPool(device, &pool_cinfo, NULL, &pool) != VK_SUCCESS) {
+        res = 4;
+        goto fail;
+    }
+    command_buffer_ainfo.commandPool = pool;
+    if (vkAllocateCommandBuffers(device, &command_buffer_ainfo, &command_buffer) != VK_SUCCESS) {
+        res = 4;
+        goto fail;
+    }
+    vkBeginCommandBuffer(command_buffer, &begin_info);
+    VkBufferCopy region = { .srcOffset = 0, .dstOffset = 0, .size = size };
+    vkCmdCopyBuffer(command_buffer, staging, *buffer, 1, &region);
+    vkEndCommandBuffer(command_buffer);
+
+    // Init time only, so simply drain the queue.
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &command_buffer,
+    };
+    if (vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS
+            || vkQueueWaitIdle(queue) != VK_SUCCESS) {
+        res = 5;
+        goto fail;
+    }
+
+fail:
+    vkDestroyCommandPool(device, pool, NULL);
+    vkDestroyBuffer(device, staging, NULL);
+    gpu_memory_free(device, staging_memory);
+    return res;
+}
+
+VkDeviceAddress buffer_device_address(VkDevice device, VkBuffer buffer) {
+    VkBufferDeviceAddressInfo address_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+        .buffer = buffer,
+    };
+    return vkGetBufferDeviceAddress(device, &address_info);
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+
+#define GPU_MEMORY_DEFAULT_SOFT_LIMIT 0.9f // of a heap's budget
+
+// What an allocation holds, for the per category totals.
+enum GpuMemoryCategory {
+    GpuMemoryCategory_Geometry = 0, // scene buffers
+    GpuMemoryCategory_Bvh, // software BVH nodes and acceleration structures
+    GpuMemoryCategory_Textures,
+    GpuMemoryCategory_Frame, // render targets and per-frame work buffers
+    GpuMemoryCategory_Staging, // uploads and host readbacks
+    GpuMemoryCategory_N,
+};
+
+// Called from gpu_memory_update when a heap's usage rises past the soft limit,
+// once per crossing, so streaming systems can evict before allocations fail.
+typedef void (*GpuMemoryPressureFn)(void *user, uint32_t heap, VkDeviceSize usage, VkDeviceSize budget);
+
+struct GpuMemoryHeapStats {
+    VkDeviceSize size;
+    VkDeviceSize budget; // from VK_EXT_memory_budget, else the heap size
+    VkDeviceSize usage; // whole process per the driver, else what is tracked
+    VkDeviceSize tracked; // allocated through this module
+    VkDeviceSize categories[GpuMemoryCategory_N];
+    int device_local;
+    int over_soft_limit;
+};
+
+struct GpuMemoryStats {
+    int budget_supported;
+    float soft_limit;
+    uint32_t heaps_n;
+    struct GpuMemoryHeapStats heaps[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize categories[GpuMemoryCategory_N]; // over all heaps
+    uint32_t allocations_n; // live
+    uint64_t failures_n;
+    VkDeviceSize peak; // tracked bytes over all heaps
+};
+
+// Every allocation below goes through one process wide tracker, which counts
+// bytes per heap and category. Without gpu_memory_tracker_init allocations
+// still work, untracked. budget_supported means VK_EXT_memory_budget is
+// enabled on the device. soft_limit of 0 takes GPU_MEMORY_DEFAULT_SOFT_LIMIT.
+int gpu_memory_tracker_init(VkPhysicalDevice physical_device, int budget_supported, float soft_limit);
+void gpu_memory_tracker_free(void);
+void gpu_memory_set_pressure_callback(GpuMemoryPressureFn fn, void *user);
+
+// vkAllocateMemory and vkFreeMemory, tracked. A failed allocation is logged
+// with its heap's usage and budget.
+VkResult gpu_memory_allocate(
+        VkDevice device,
+        const VkMemoryAllocateInfo *memory_ainfo,
+        enum GpuMemoryCategory category,
+        VkDeviceMemory *memory);
+void gpu_memory_free(VkDevice device, VkDeviceMemory memory);
+
+// Call once per frame. Refreshes the driver budget and fires the pressure
+// callback on heaps that crossed the soft limit.
+void gpu_memory_update(void);
+void gpu_memory_stats(struct GpuMemoryStats *stats);
+void gpu_memory_report(void);
+
+int find_memory_type(
+        VkPhysicalDevice physical_device,
+        uint32_t type_bits,
+        VkMemoryPropertyFlags properties,
+        uint32_t *type_index);
+
+// Creates a buffer with its own dedicated allocation. Usage with
+// SHADER_DEVICE_ADDRESS allocates memory that can be addressed.
+int create_buffer(
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        VkDeviceSize size,
+        VkBufferUsageFlags usage,
+        VkMemoryPropertyFlags properties,
+        enum GpuMemoryCategory category,
+        VkBuffer *buffer,
+        VkDeviceMemory *memory);
+
+// Creates a single layer, optimally tiled 2D image with its own dedicated
+// allocation. allocation_size is optional.
+int create_image(
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        VkExtent2D extent,
+        uint32_t mip_levels,
+        VkFormat format,
+        VkImageUsageFlags usage,
+        enum GpuMemoryCategory category,
+        VkImage *image,
+        VkDeviceMemory *memory,
+        VkDeviceSize *allocation_size);
+
+int create_image_view(
+        VkDevice device,
+        VkImage image,
+        VkFormat format,
+        uint32_t mip_levels,
+        VkImageView *view);
+
+// Creates a device local buffer holding a copy of data, through a staging
+// buffer. Waits for queue to go idle, for init time uploads only.
+int create_buffer_with_data(
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        VkQueue queue,
+        uint32_t queue_family,
+        VkBufferUsageFlags usage,
+        const void *data,
+        VkDeviceSize size,
+        enum GpuMemoryCategory category,
+        VkBuffer *buffer,
+        VkDeviceMemory *memory);
+
+VkDeviceAddress buffer_device_address(VkDevice device, VkBuffer buffer);
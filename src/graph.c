@@ -0,0 +1,826 @@
+#include <vulkan/vulkan.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+#include "gpu_memory.h"
+#include "graph.h"
+
+#define GRAPH_WRITE_ACCESS ( \
+    VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT \
+    | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT \
+    | VK_ACCESS_2_TRANSFER_WRITE_BIT)
+
+struct GraphUseInfo {
+    VkPipelineStageFlags2 stage;
+    VkAccessFlags2 access;
+    VkImageLayout layout;
+    int read;
+    int write;
+};
+
+static const struct GraphUseInfo graph_uses[GraphUse_N] = {
+    [GraphUse_ComputeRead] = {
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_SHADER_STORAGE_READ_BIT,
+        VK_IMAGE_LAYOUT_GENERAL, 1, 0,
+    },
+    [GraphUse_ComputeWrite] = {
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+        VK_IMAGE_LAYOUT_GENERAL, 0, 1,
+    },
+    [GraphUse_ComputeReadWrite] = {
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+        VK_IMAGE_LAYOUT_GENERAL, 1, 1,
+    },
+    [GraphUse_FragmentSample] = {
+        VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+        VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1, 0,
+    },
+    [GraphUse_ColorAttachment] = {
+        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 0, 1,
+    },
+    [GraphUse_TransferRead] = {
+        VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+        VK_ACCESS_2_TRANSFER_READ_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, 1, 0,
+    },
+    [GraphUse_TransferWrite] = {
+        VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+        VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, 1,
+    },
+    [GraphUse_IndirectRead] = {
+        VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+        VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, 1, 0,
+    },
+};
+
+// Barriers of one vkCmdPipelineBarrier2 call.
+struct GraphBatch {
+    VkImageMemoryBarrier2 images[GRAPH_MAX_RESOURCES];
+    uint32_t images_n;
+    VkBufferMemoryBarrier2 buffers[GRAPH_MAX_RESOURCES];
+    uint32_t buffers_n;
+};
+
+int graph_init(struct FrameGraph *graph, VkDevice device, const uint32_t queue_families[GraphQueue_N]) {
+#if DEBUG_INPUT_VALIDATION
+    if (graph == NULL) return 1;
+    if (!IS_ZERO_PTR(graph)) return 1;
+    if (device == VK_NULL_HANDLE) return 1;
+    if (queue_families == NULL) return 1;
+#endif
+
+    graph->device = device;
+    memcpy(graph->queue_families, queue_families, sizeof(graph->queue_families));
+
+    return 0;
+}
+
+void graph_free(struct FrameGraph *graph) {
+    VkDevice device = graph->device;
+
+    for (uint32_t i = 0; i < graph->resources_n; i++) {
+        struct GraphResource *resource = graph->resources + i;
+        if (!resource->transient) continue;
+        vkDestroyImageView(device, resource->view, NULL);
+        vkDestroyImage(device, resource->image, NULL);
+    }
+    for (uint32_t i = 0; i < graph->blocks_n; i++)
+        gpu_memory_free(device, graph->blocks[i].memory);
+
+    memset(graph, 0, sizeof(*graph));
+}
+
+void graph_state_init(struct GraphState *state, VkPipelineStageFlags2 wait_stage) {
+    *state = (struct GraphState) {
+        .layout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .queue_family = VK_QUEUE_FAMILY_IGNORED,
+        .read_stages = wait_stage,
+        .released_to = VK_QUEUE_FAMILY_IGNORED,
+    };
+}
+
+// Building.
+
+static uint32_t graph_add_resource(struct FrameGraph *graph, const char *name, enum GraphResourceKind kind) {
+    if (graph->compiled || graph->resources_n == GRAPH_MAX_RESOURCES) return GRAPH_INVALID;
+
+    uint32_t index = graph->resources_n++;
+    struct GraphResource *resource = graph->resources + index;
+    resource->name = name;
+    resource->kind = kind;
+    resource->block = GRAPH_INVALID;
+    resource->first_pass = GRAPH_INVALID;
+    resource->last_pass = GRAPH_INVALID;
+    resource->final_family = VK_QUEUE_FAMILY_IGNORED;
+    graph_state_init(&resource->state, VK_PIPELINE_STAGE_2_NONE);
+    return index;
+}
+
+uint32_t graph_import_image(struct FrameGraph *graph, const char *name, int exported) {
+    uint32_t index = graph_add_resource(graph, name, GraphResourceKind_Image);
+    if (index != GRAPH_INVALID) graph->resources[index].exported = exported;
+    return index;
+}
+
+uint32_t graph_import_buffer(struct FrameGraph *graph, const char *name, int exported) {
+    uint32_t index = graph_add_resource(graph, name, GraphResourceKind_Buffer);
+    if (index != GRAPH_INVALID) graph->resources[index].exported = exported;
+    return index;
+}
+
+uint32_t graph_create_image(
+        struct FrameGraph *graph,
+        const char *name,
+        VkExtent2D extent,
+        VkFormat format,
+        VkImageUsageFlags usage) {
+    uint32_t index = graph_add_resource(graph, name, GraphResourceKind_Image);
+    if (index == GRAPH_INVALID) return index;
+
+    struct GraphResource *resource = graph->resources + index;
+    resource->transient = 1;
+    resource->extent = extent;
+    resource->format = format;
+    resource->usage = usage;
+    return index;
+}
+
+uint32_t graph_add_pass(
+        struct FrameGraph *graph,
+        const char *name,
+        enum GraphQueue queue,
+        uint32_t flags,
+        GraphRecordFn record,
+        void *user) {
+    if (graph->compiled || graph->passes_n == GRAPH_MAX_PASSES) return GRAPH_INVALID;
+#if DEBUG_INPUT_VALIDATION
+    if (queue >= GraphQueue_N) return GRAPH_INVALID;
+    if (record == NULL) return GRAPH_INVALID;
+#endif
+
+    uint32_t index = graph->passes_n++;
+    struct GraphPass *pass = graph->passes + index;
+    pass->name = name;
+    pass->queue = queue;
+    pass->flags = flags;
+    pass->record = record;
+    pass->user = user;
+    pass->enabled = 1;
+    return index;
+}
+
+int graph_use(struct FrameGraph *graph, uint32_t pass, uint32_t resource, enum GraphUse use) {
+#if DEBUG_INPUT_VALIDATION
+    if (graph == NULL) return 1;
+    if (graph->compiled) return 1;
+    if (pass >= graph->passes_n) return 1;
+    if (resource >= graph->resources_n) return 1;
+    if (use >= GraphUse_N) return 1;
+    if (use == GraphUse_IndirectRead && graph->resources[resource].kind != GraphResourceKind_Buffer) return 1;
+#endif
+
+    // One use per resource and pass, reading and writing is its own use.
+    struct GraphPass *p = graph->passes + pass;
+    for (uint32_t i = 0; i < p->accesses_n; i++)
+        if (p->accesses[i].resource == resource) return 1;
+    if (p->accesses_n == GRAPH_MAX_ACCESSES) return 1;
+
+    p->accesses[p->accesses_n++] = (struct GraphAccess) { .resource = resource, .use = use };
+    return 0;
+}
+
+void graph_set_final(struct FrameGraph *graph, uint32_t resource, VkImageLayout layout, uint32_t queue_family) {
+#if DEBUG_INPUT_VALIDATION
+    if (graph == NULL) return;
+    if (resource >= graph->resources_n) return;
+#endif
+
+    struct GraphResource *r = graph->resources + resource;
+    r->final_set = 1;
+    r->final_layout = layout;
+    r->final_family = queue_family;
+}
+
+// Compiling.
+
+static void graph_cull(struct FrameGraph *graph) {
+    // Backwards liveness: a pass stays when it has side effects or writes
+    // something a later kept pass reads, or that is read after the graph.
+    int needed[GRAPH_MAX_RESOURCES];
+    for (uint32_t i = 0; i < graph->resources_n; i++)
+        needed[i] = graph->resources[i].exported;
+
+    for (uint32_t p = graph->passes_n; p-- > 0;) {
+        struct GraphPass *pass = graph->passes + p;
+        int kept = (pass->flags & GRAPH_PASS_SIDE_EFFECT) != 0;
+        for (uint32_t i = 0; i < pass->accesses_n; i++) {
+            const struct GraphAccess *access = pass->accesses + i;
+            if (graph_uses[access->use].write && needed[access->resource]) kept = 1;
+        }
+        pass->culled = !kept;
+        if (!kept) continue;
+
+        for (uint32_t i = 0; i < pass->accesses_n; i++) {
+            const struct GraphUseInfo *info = graph_uses + pass->accesses[i].use;
+            if (info->write && !info->read) needed[pass->accesses[i].resource] = 0;
+        }
+        for (uint32_t i = 0; i < pass->accesses_n; i++) {
+            if (graph_uses[pass->accesses[i].use].read) needed[pass->accesses[i].resource] = 1;
+        }
+    }
+}
+
+static int graph_lifetimes_overlap(const struct GraphResource *a, const struct GraphResource *b) {
+    return a->first_pass <= b->last_pass && b->first_pass <= a->last_pass;
+}
+
+// Greedy placement, largest first, into the first block whose occupants are
+// all dead while this image is alive.
+static void graph_place_transients(struct FrameGraph *graph) {
+    uint32_t order[GRAPH_MAX_RESOURCES];
+    uint32_t order_n = 0;
+    for (uint32_t i = 0; i < graph->resources_n; i++) {
+        const struct GraphResource *r = graph->resources + i;
+        if (r->transient && r->first_pass != GRAPH_INVALID) order[order_n++] = i;
+    }
+    for (uint32_t i = 1; i < order_n; i++) {
+        uint32_t index = order[i];
+        VkDeviceSize size = graph->resources[index].requirements.size;
+        uint32_t j = i;
+        for (; j > 0 && graph->resources[order[j - 1]].requirements.size < size; j--)
+            order[j] = order[j - 1];
+        order[j] = index;
+    }
+
+    for (uint32_t i = 0; i < order_n; i++) {
+        struct GraphResource *r = graph->resources + order[i];
+        uint32_t block = GRAPH_INVALID;
+        for (uint32_t b = 0; b < graph->blocks_n && block == GRAPH_INVALID; b++) {
+            if ((graph->blocks[b].type_bits & r->requirements.memoryTypeBits) == 0) continue;
+            int available = 1;
+            for (uint32_t j = 0; j < i && available; j++) {
+                const struct GraphResource *other = graph->resources + order[j];
+                if (other->block == b && graph_lifetimes_overlap(r, other)) available = 0;
+            }
+            if (available) block = b;
+        }
+        if (block == GRAPH_INVALID) {
+            block = graph->blocks_n++;
+            graph->blocks[block].type_bits = r->requirements.memoryTypeBits;
+        }
+
+        struct GraphBlock *b = graph->blocks + block;
+        b->type_bits &= r->requirements.memoryTypeBits;
+        if (r->requirements.size > b->size) b->size = r->requirements.size;
+        r->block = block;
+        graph->transient_size += r->requirements.size;
+    }
+}
+
+int graph_compile(struct FrameGraph *graph, VkPhysicalDevice physical_device) {
+#if DEBUG_INPUT_VALIDATION
+    if (graph == NULL) return 1;
+    if (graph->compiled) return 1;
+    if (physical_device == VK_NULL_HANDLE) return 1;
+#endif
+
+    VkDevice device = graph->device;
+
+    graph_cull(graph);
+
+    // Lifetimes over the kept passes. The graph only orders transients
+    // within one queue.
+    uint32_t queues[GRAPH_MAX_RESOURCES];
+    for (uint32_t i = 0; i < graph->resources_n; i++)
+        queues[i] = GRAPH_INVALID;
+    for (uint32_t p = 0; p < graph->passes_n; p++) {
+        const struct GraphPass *pass = graph->passes + p;
+        if (pass->culled) continue;
+        for (uint32_t i = 0; i < pass->accesses_n; i++) {
+            uint32_t index = pass->accesses[i].resource;
+            struct GraphResource *r = graph->resources + index;
+            if (r->first_pass == GRAPH_INVALID) r->first_pass = p;
+            r->last_pass = p;
+            if (r->transient && queues[index] != GRAPH_INVALID && queues[index] != pass->queue) return 2;
+            queues[index] = pass->queue;
+        }
+    }
+
+    // Transient images, unbound until their blocks are allocated.
+    for (uint32_t i = 0; i < graph->resources_n; i++) {
+        struct GraphResource *r = graph->resources + i;
+        if (!r->transient || r->first_pass == GRAPH_INVALID) continue;
+        VkImageCreateInfo image_cinfo = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = r->format,
+            .extent = { r->extent.width, r->extent.height, 1 },
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = r->usage,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        };
+        if (vkCreateImage(device, &image_cinfo, NULL, &r->image) != VK_SUCCESS) return 3;
+        vkGetImageMemoryRequirements(device, r->image, &r->requirements);
+    }
+
+    graph_place_transients(graph);
+
+    for (uint32_t b = 0; b < graph->blocks_n; b++) {
+        struct GraphBlock *block = graph->blocks + b;
+        int result = find_memory_type(
+                physical_device,
+                block->type_bits,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                &block->type_index);
+        if (result > 0) return 4;
+        VkMemoryAllocateInfo memory_ainfo = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize = block->size,
+            .memoryTypeIndex = block->type_index,
+        };
+        if (gpu_memory_allocate(device, &memory_ainfo, GpuMemoryCategory_Frame, &block->memory) != VK_SUCCESS) return 4;
+    }
+    for (uint32_t i = 0; i < graph->resources_n; i++) {
+        struct GraphResource *r = graph->resources + i;
+        if (r->block == GRAPH_INVALID) continue;
+        if (vkBindImageMemory(device, r->image, graph->blocks[r->block].memory, 0) != VK_SUCCESS) return 4;
+        if (create_image_view(device, r->image, r->format, 1, &r->view) > 0) return 3;
+    }
+
+    graph->compiled = 1;
+    return 0;
+}
+
+VkImage graph_image(const struct FrameGraph *graph, uint32_t resource) {
+    return resource < graph->resources_n ? graph->resources[resource].image : VK_NULL_HANDLE;
+}
+
+VkImageView graph_image_view(const struct FrameGraph *graph, uint32_t resource) {
+    return resource < graph->resources_n ? graph->resources[resource].view : VK_NULL_HANDLE;
+}
+
+// Executing.
+
+void graph_bind_image(struct FrameGraph *graph, uint32_t resource, VkImage image, const struct GraphState *state) {
+#if DEBUG_INPUT_VALIDATION
+    if (graph == NULL) return;
+    if (resource >= graph->resources_n) return;
+    if (graph->resources[resource].transient) return;
+    if (state == NULL) return;
+#endif
+
+    graph->resources[resource].image = image;
+    graph->resources[resource].state = *state;
+}
+
+void graph_bind_buffer(struct FrameGraph *graph, uint32_t resource, VkBuffer buffer, const struct GraphState *state) {
+#if DEBUG_INPUT_VALIDATION
+    if (graph == NULL) return;
+    if (resource >= graph->resources_n) return;
+    if (state == NULL) return;
+#endif
+
+    graph->resources[resource].buffer = buffer;
+    graph->resources[resource].state = *state;
+}
+
+void graph_enable_pass(struct FrameGraph *graph, uint32_t pass, int enabled) {
+    if (pass < graph->passes_n) graph->passes[pass].enabled = enabled;
+}
+
+const struct GraphState *graph_state(const struct FrameGraph *graph, uint32_t resource) {
+    return resource < graph->resources_n ? &graph->resources[resource].state : NULL;
+}
+
+static uint32_t graph_queue_of_family(const struct FrameGraph *graph, uint32_t family) {
+    for (uint32_t q = 0; q < GraphQueue_N; q++)
+        if (graph->queue_families[q] == family) return q;
+    return GRAPH_INVALID;
+}
+
+static void graph_batch_add(
+        struct GraphBatch *batch,
+        const struct GraphResource *resource,
+        VkImageLayout old_layout,
+        VkImageLayout new_layout,
+        VkPipelineStageFlags2 src_stage,
+        VkAccessFlags2 src_access,
+        VkPipelineStageFlags2 dst_stage,
+        VkAccessFlags2 dst_access,
+        uint32_t src_family,
+        uint32_t dst_family) {
+    if (src_family == dst_family) {
+        src_family = VK_QUEUE_FAMILY_IGNORED;
+        dst_family = VK_QUEUE_FAMILY_IGNORED;
+    }
+    if (resource->kind == GraphResourceKind_Image) {
+        batch->images[batch->images_n++] = (VkImageMemoryBarrier2) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .srcStageMask = src_stage,
+            .srcAccessMask = src_access,
+            .dstStageMask = dst_stage,
+            .dstAccessMask = dst_access,
+            .oldLayout = old_layout,
+            .newLayout = new_layout,
+            .srcQueueFamilyIndex = src_family,
+            .dstQueueFamilyIndex = dst_family,
+            .image = resource->image,
+            .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+        };
+    } else {
+        batch->buffers[batch->buffers_n++] = (VkBufferMemoryBarrier2) {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+            .srcStageMask = src_stage,
+            .srcAccessMask = src_access,
+            .dstStageMask = dst_stage,
+            .dstAccessMask = dst_access,
+            .srcQueueFamilyIndex = src_family,
+            .dstQueueFamilyIndex = dst_family,
+            .buffer = resource->buffer,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE,
+        };
+    }
+}
+
+// One call per batch. Returns whether anything was recorded.
+static int graph_batch_flush(VkCommandBuffer command_buffer, struct GraphBatch *batch) {
+    if (batch->images_n == 0 && batch->buffers_n == 0) return 0;
+
+    VkDependencyInfo dependency_info = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .bufferMemoryBarrierCount = batch->buffers_n,
+        .pBufferMemoryBarriers = batch->buffers,
+        .imageMemoryBarrierCount = batch->images_n,
+        .pImageMemoryBarriers = batch->images,
+    };
+    vkCmdPipelineBarrier2(command_buffer, &dependency_info);
+    batch->images_n = 0;
+    batch->buffers_n = 0;
+    return 1;
+}
+
+static void graph_log(
+        struct GraphBarrierLog *log,
+        uint32_t *log_n,
+        uint32_t capacity,
+        uint32_t resource,
+        VkImageLayout old_layout,
+        VkImageLayout new_layout,
+        VkPipelineStageFlags2 src_stage,
+        VkPipelineStageFlags2 dst_stage,
+        uint32_t src_family,
+        uint32_t dst_family) {
+    if (*log_n == capacity) return;
+    log[(*log_n)++] = (struct GraphBarrierLog) {
+        .resource = resource,
+        .old_layout = old_layout,
+        .new_layout = new_layout,
+        .src_stage = src_stage,
+        .dst_stage = dst_stage,
+        .src_family = src_family,
+        .dst_family = dst_family,
+    };
+}
+
+// State after a barrier made the resource ready for info at dst.
+static void graph_state_after_barrier(struct GraphState *state, const struct GraphUseInfo *info, int layout_changed) {
+    if (info->write) {
+        state->write_stage = info->stage;
+        state->write_access = info->access & GRAPH_WRITE_ACCESS;
+        state->read_stages = 0;
+        state->visible_stages = 0;
+        state->visible_access = 0;
+    } else if (layout_changed) {
+        // The transition is a write only info's stage waited for.
+        state->write_stage = info->stage;
+        state->write_access = 0;
+        state->read_stages = info->stage;
+        state->visible_stages = info->stage;
+        state->visible_access = info->access;
+    } else {
+        state->read_stages |= info->stage;
+        state->visible_stages |= info->stage;
+        state->visible_access |= info->access;
+    }
+}
+
+static void graph_execute_pass(
+        struct FrameGraph *graph,
+        uint32_t p,
+        const VkCommandBuffer command_buffers[GraphQueue_N],
+        int touched[GRAPH_MAX_RESOURCES]) {
+    struct GraphPass *pass = graph->passes + p;
+    uint32_t family = graph->queue_families[pass->queue];
+    struct GraphBatch releases[GraphQueue_N];
+    struct GraphBatch acquires; // before barriers that change layout again
+    struct GraphBatch batch;
+    memset(releases, 0, sizeof(releases));
+    acquires.images_n = acquires.buffers_n = 0;
+    batch.images_n = batch.buffers_n = 0;
+
+    for (uint32_t i = 0; i < pass->accesses_n; i++) {
+        uint32_t index = pass->accesses[i].resource;
+        struct GraphResource *resource = graph->resources + index;
+        struct GraphState *state = &resource->state;
+        const struct GraphUseInfo *info = graph_uses + pass->accesses[i].use;
+        int image = resource->kind == GraphResourceKind_Image;
+        VkImageLayout layout = image ? info->layout : VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags2 alias_stages = 0;
+        VkAccessFlags2 alias_access = 0;
+
+        // Transients start over every execution, after whatever last used
+        // their memory.
+        if (resource->transient && !touched[index]) {
+            state->layout = VK_IMAGE_LAYOUT_UNDEFINED;
+            for (uint32_t j = 0; j < graph->resources_n; j++) {
+                const struct GraphResource *other = graph->resources + j;
+                if (j == index || other->block != resource->block) continue;
+                alias_stages |= other->state.write_stage | other->state.read_stages;
+                alias_access |= other->state.write_access;
+            }
+        }
+        touched[index] = 1;
+
+        // Ownership released by an earlier execution.
+        if (state->released_to != VK_QUEUE_FAMILY_IGNORED) {
+            if (state->released_to == family) {
+                int relayout = image && layout != state->layout;
+                graph_batch_add(
+                        relayout ? &acquires : &batch, resource,
+                        state->released_from, state->layout,
+                        VK_PIPELINE_STAGE_2_NONE, 0,
+                        info->stage, info->access,
+                        state->queue_family, family);
+                graph_log(pass->log, &pass->log_n, GRAPH_MAX_LOG, index,
+                        state->released_from, state->layout,
+                        VK_PIPELINE_STAGE_2_NONE, info->stage,
+                        state->queue_family, family);
+                state->queue_family = family;
+                state->write_stage = 0;
+                state->write_access = 0;
+                state->read_stages = relayout ? info->stage : 0;
+                state->visible_stages = info->stage;
+                state->visible_access = info->access;
+            } else {
+                // Released elsewhere, the contents are gone for this queue.
+                state->layout = VK_IMAGE_LAYOUT_UNDEFINED;
+                state->queue_family = VK_QUEUE_FAMILY_IGNORED;
+            }
+            state->released_to = VK_QUEUE_FAMILY_IGNORED;
+        }
+
+        // Ownership held by the other queue this execution: release there
+        // and acquire here, changing layout on the way.
+        int discard = image && state->layout == VK_IMAGE_LAYOUT_UNDEFINED;
+        if (state->queue_family != VK_QUEUE_FAMILY_IGNORED && state->queue_family != family && !discard) {
+            uint32_t owner = graph_queue_of_family(graph, state->queue_family);
+            if (owner != GRAPH_INVALID) {
+                VkPipelineStageFlags2 src_stage = state->write_stage | state->read_stages;
+                graph_batch_add(
+                        releases + owner, resource,
+                        state->layout, layout,
+                        src_stage, state->write_access,
+                        VK_PIPELINE_STAGE_2_NONE, 0,
+                        state->queue_family, family);
+                graph_batch_add(
+                        &batch, resource,
+                        state->layout, layout,
+                        VK_PIPELINE_STAGE_2_NONE, 0,
+                        info->stage, info->access,
+                        state->queue_family, family);
+                graph_log(pass->log, &pass->log_n, GRAPH_MAX_LOG, index,
+                        state->layout, layout,
+                        src_stage, info->stage,
+                        state->queue_family, family);
+                state->layout = layout;
+                state->queue_family = family;
+                graph_state_after_barrier(state, info, 1);
+                continue;
+            }
+        }
+        state->queue_family = family;
+
+        // Same queue. Writes and layout changes wait for everything before,
+        // reads only for a write they cannot see yet.
+        int relayout = image && state->layout != layout;
+        VkPipelineStageFlags2 src_stage = 0;
+        VkAccessFlags2 src_access = 0;
+        int needed = 0;
+        if (info->write || relayout) {
+            src_stage = state->write_stage | state->read_stages | alias_stages;
+            src_access = state->write_access | alias_access;
+            needed = relayout || src_stage != 0;
+        } else if (state->write_stage != 0) {
+            src_stage = state->write_stage;
+            src_access = state->write_access;
+            needed = (info->stage & ~state->visible_stages) != 0 || (info->access & ~state->visible_access) != 0;
+        }
+        if (needed) {
+            graph_batch_add(
+                    &batch, resource,
+                    state->layout, layout,
+                    src_stage, src_access,
+                    info->stage, info->access,
+                    family, family);
+            graph_log(pass->log, &pass->log_n, GRAPH_MAX_LOG, index,
+                    state->layout, layout,
+                    src_stage, info->stage,
+                    family, family);
+            state->layout = layout;
+            graph_state_after_barrier(state, info, relayout);
+        } else if (info->write) {
+            graph_state_after_barrier(state, info, 0);
+        } else {
+            state->read_stages |= info->stage;
+        }
+    }
+
+    for (uint32_t q = 0; q < GraphQueue_N; q++)
+        pass->batches_n += graph_batch_flush(command_buffers[q], releases + q);
+    VkCommandBuffer command_buffer = command_buffers[pass->queue];
+    pass->batches_n += graph_batch_flush(command_buffer, &acquires);
+    pass->batches_n += graph_batch_flush(command_buffer, &batch);
+
+    pass->record(command_buffer, pass->user);
+}
+
+void graph_execute(struct FrameGraph *graph, const VkCommandBuffer command_buffers[GraphQueue_N]) {
+#if DEBUG_INPUT_VALIDATION
+    if (graph == NULL) return;
+    if (!graph->compiled) return;
+    if (command_buffers == NULL) return;
+#endif
+
+    int touched[GRAPH_MAX_RESOURCES] = { 0 };
+    for (uint32_t p = 0; p < graph->passes_n; p++) {
+        struct GraphPass *pass = graph->passes + p;
+        pass->log_n = 0;
+        pass->batches_n = 0;
+        if (pass->culled || !pass->enabled) continue;
+        graph_execute_pass(graph, p, command_buffers, touched);
+    }
+
+    // Leave resources how the caller asked for, in the command buffer of
+    // the queue that owns them. Nothing on this side waits for these, a
+    // semaphore or the acquire does.
+    struct GraphBatch batches[GraphQueue_N];
+    memset(batches, 0, sizeof(batches));
+    graph->final_log_n = 0;
+    for (uint32_t i = 0; i < graph->resources_n; i++) {
+        struct GraphResource *resource = graph->resources + i;
+        struct GraphState *state = &resource->state;
+        if (!resource->final_set || !touched[i]) continue;
+        uint32_t owner = graph_queue_of_family(graph, state->queue_family);
+        if (owner == GRAPH_INVALID) continue;
+        uint32_t family = resource->final_family == VK_QUEUE_FAMILY_IGNORED
+            ? state->queue_family
+            : resource->final_family;
+        VkImageLayout layout = resource->kind == GraphResourceKind_Image ? resource->final_layout : state->layout;
+        if (family == state->queue_family && layout == state->layout) continue;
+
+        VkPipelineStageFlags2 src_stage = state->write_stage | state->read_stages;
+        graph_batch_add(
+                batches + owner, resource,
+                state->layout, layout,
+                src_stage, state->write_access,
+                VK_PIPELINE_STAGE_2_NONE, 0,
+                state->queue_family, family);
+        graph_log(graph->final_log, &graph->final_log_n, GRAPH_MAX_RESOURCES, i,
+                state->layout, layout,
+                src_stage, VK_PIPELINE_STAGE_2_NONE,
+                state->queue_family, family);
+        if (family != state->queue_family) {
+            state->released_to = family;
+            state->released_from = state->layout;
+        }
+        state->layout = layout;
+        state->write_stage = 0;
+        state->write_access = 0;
+        state->read_stages = 0;
+        state->visible_stages = 0;
+        state->visible_access = 0;
+    }
+    for (uint32_t q = 0; q < GraphQueue_N; q++)
+        graph_batch_flush(command_buffers[q], batches + q);
+}
+
+// Debug dump.
+
+static const char *graph_layout_name(VkImageLayout layout) {
+    switch (layout) {
+        case VK_IMAGE_LAYOUT_UNDEFINED: return "UNDEFINED";
+        case VK_IMAGE_LAYOUT_GENERAL: return "GENERAL";
+        case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL: return "COLOR_ATTACHMENT";
+        case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL: return "SHADER_READ_ONLY";
+        case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL: return "TRANSFER_SRC";
+        case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL: return "TRANSFER_DST";
+        case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR: return "PRESENT_SRC";
+        default: return "?";
+    }
+}
+
+static void graph_stage_names(VkPipelineStageFlags2 stages, char *out, size_t size) {
+    static const struct { VkPipelineStageFlags2 bit; const char *name; } names[] = {
+        { VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, "INDIRECT" },
+        { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, "COMPUTE" },
+        { VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, "FRAGMENT" },
+        { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, "COLOR_OUTPUT" },
+        { VK_PIPELINE_STAGE_2_TRANSFER_BIT, "TRANSFER" },
+    };
+    int length = snprintf(out, size, "%s", stages == 0 ? "NONE" : "");
+    for (uint32_t i = 0; i < sizeof(names) / sizeof(*names) && length < (int)size; i++) {
+        if ((stages & names[i].bit) == 0) continue;
+        length += snprintf(out + length, size - length, "%s%s", length > 0 ? "|" : "", names[i].name);
+    }
+}
+
+static void graph_dump_log(const struct FrameGraph *graph, const struct GraphBarrierLog *log) {
+    char src[64], dst[64];
+    graph_stage_names(log->src_stage, src, sizeof(src));
+    graph_stage_names(log->dst_stage, dst, sizeof(dst));
+    const struct GraphResource *resource = graph->resources + log->resource;
+    if (resource->kind == GraphResourceKind_Image) {
+        printf("[graph]     %s %s -> %s, %s -> %s",
+                resource->name,
+                graph_layout_name(log->old_layout),
+                graph_layout_name(log->new_layout),
+                src,
+                dst);
+    } else {
+        printf("[graph]     %s %s -> %s", resource->name, src, dst);
+    }
+    if (log->src_family != log->dst_family) printf(", family %u -> %u", log->src_family, log->dst_family);
+    printf("\n");
+}
+
+void graph_dump(const struct FrameGraph *graph) {
+    static const char *queue_names[GraphQueue_N] = { "graphics", "trace" };
+    static const char *use_names[GraphUse_N] = {
+        "compute read", "compute write", "compute read write", "sample",
+        "color attachment", "transfer read", "transfer write", "indirect read",
+    };
+
+    uint32_t culled_n = 0;
+    for (uint32_t p = 0; p < graph->passes_n; p++)
+        culled_n += graph->passes[p].culled;
+    printf("[graph] %u passes, %u culled, %u resources\n", graph->passes_n, culled_n, graph->resources_n);
+
+    for (uint32_t p = 0; p < graph->passes_n; p++) {
+        const struct GraphPass *pass = graph->passes + p;
+        printf("[graph] pass %u %s, %s queue%s%s\n",
+                p,
+                pass->name,
+                queue_names[pass->queue],
+                pass->culled ? ", culled" : "",
+                pass->flags & GRAPH_PASS_SIDE_EFFECT ? ", side effects" : "");
+        for (uint32_t i = 0; i < pass->accesses_n; i++) {
+            printf("[graph]   %s %s\n",
+                    use_names[pass->accesses[i].use],
+                    graph->resources[pass->accesses[i].resource].name);
+        }
+        if (pass->log_n > 0) printf("[graph]   %u barriers in %u calls\n", pass->log_n, pass->batches_n);
+        for (uint32_t i = 0; i < pass->log_n; i++)
+            graph_dump_log(graph, pass->log + i);
+    }
+    if (graph->final_log_n > 0) printf("[graph] after the last pass\n");
+    for (uint32_t i = 0; i < graph->final_log_n; i++)
+        graph_dump_log(graph, graph->final_log + i);
+
+    VkDeviceSize aliased_size = 0;
+    for (uint32_t b = 0; b < graph->blocks_n; b++)
+        aliased_size += graph->blocks[b].size;
+    for (uint32_t i = 0; i < graph->resources_n; i++) {
+        const struct GraphResource *r = graph->resources + i;
+        if (!r->transient) {
+            printf("[graph] %s imported%s\n", r->name, r->exported ? ", exported" : "");
+        } else if (r->block == GRAPH_INVALID) {
+            printf("[graph] %s transient, unused\n", r->name);
+        } else {
+            printf("[graph] %s transient, %.1f MB, passes %u to %u, block %u\n",
+                    r->name,
+                    r->requirements.size / (1024.0 * 1024.0),
+                    r->first_pass,
+                    r->last_pass,
+                    r->block);
+        }
+    }
+    if (graph->blocks_n > 0) {
+        printf("[graph] transients take %.1f MB in %u blocks, %.1f MB without aliasing\n",
+                aliased_size / (1024.0 * 1024.0),
+                graph->blocks_n,
+                graph->transient_size / (1024.0 * 1024.0));
+    }
+}
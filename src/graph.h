@@ -0,0 +1,185 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+
+#define GRAPH_MAX_RESOURCES 16
+#define GRAPH_MAX_PASSES 16
+#define GRAPH_MAX_ACCESSES 8 // per pass
+#define GRAPH_MAX_LOG 16 // barriers remembered per pass for graph_dump
+#define GRAPH_INVALID UINT32_MAX
+
+#define GRAPH_PASS_SIDE_EFFECT 0x1 // never culled, e.g. host readbacks
+
+// Queues passes are recorded for, each with its own command buffer. Both may
+// be the same queue family and command buffer.
+enum GraphQueue {
+    GraphQueue_Graphics = 0,
+    GraphQueue_Trace,
+    GraphQueue_N,
+};
+
+// How a pass touches a resource. Each maps to the stage, access and layout
+// the graph derives barriers from.
+enum GraphUse {
+    GraphUse_ComputeRead = 0, // storage image or buffer, GENERAL
+    GraphUse_ComputeWrite,
+    GraphUse_ComputeReadWrite,
+    GraphUse_FragmentSample, // SHADER_READ_ONLY_OPTIMAL
+    GraphUse_ColorAttachment, // written, COLOR_ATTACHMENT_OPTIMAL
+    GraphUse_TransferRead, // TRANSFER_SRC_OPTIMAL
+    GraphUse_TransferWrite, // TRANSFER_DST_OPTIMAL
+    GraphUse_IndirectRead, // dispatch arguments, buffers only
+    GraphUse_N,
+};
+
+enum GraphResourceKind {
+    GraphResourceKind_Image = 0,
+    GraphResourceKind_Buffer,
+};
+
+// Synchronization state of one resource, carried between frames for
+// imported resources. Start from graph_state_init.
+struct GraphState {
+    VkImageLayout layout;
+    uint32_t queue_family; // owner, VK_QUEUE_FAMILY_IGNORED before the first use
+    VkPipelineStageFlags2 write_stage; // last write not yet waited on by everything, 0 when none
+    VkAccessFlags2 write_access;
+    VkPipelineStageFlags2 read_stages; // reads since the last write
+    VkPipelineStageFlags2 visible_stages; // the last write is visible to these
+    VkAccessFlags2 visible_access;
+    // Ownership transfer released at the end of a previous execution. The
+    // acquire has to repeat the release's layouts.
+    uint32_t released_to; // VK_QUEUE_FAMILY_IGNORED when none
+    VkImageLayout released_from;
+};
+
+struct GraphResource {
+    const char *name;
+    enum GraphResourceKind kind;
+    int transient; // created and aliased by the graph, images only
+    int exported; // read after the graph, keeps its writers alive
+    VkImage image;
+    VkImageView view;
+    VkBuffer buffer;
+    struct GraphState state;
+    // Layout and owner to leave the resource in after each execution.
+    int final_set;
+    VkImageLayout final_layout;
+    uint32_t final_family; // VK_QUEUE_FAMILY_IGNORED keeps the owner
+    // Transient description and placement.
+    VkExtent2D extent;
+    VkFormat format;
+    VkImageUsageFlags usage;
+    VkMemoryRequirements requirements;
+    uint32_t block;
+    uint32_t first_pass, last_pass; // lifetime over kept passes, GRAPH_INVALID when unused
+};
+
+typedef void (*GraphRecordFn)(VkCommandBuffer command_buffer, void *user);
+
+struct GraphAccess {
+    uint32_t resource;
+    enum GraphUse use;
+};
+
+// One barrier of the last execution, for graph_dump.
+struct GraphBarrierLog {
+    uint32_t resource;
+    VkImageLayout old_layout, new_layout;
+    VkPipelineStageFlags2 src_stage, dst_stage;
+    uint32_t src_family, dst_family; // differ on ownership transfers
+};
+
+struct GraphPass {
+    const char *name;
+    enum GraphQueue queue;
+    uint32_t flags;
+    GraphRecordFn record;
+    void *user;
+    struct GraphAccess accesses[GRAPH_MAX_ACCESSES];
+    uint32_t accesses_n;
+    int culled; // by graph_compile
+    int enabled; // per execution, see graph_enable_pass
+    // Last execution.
+    struct GraphBarrierLog log[GRAPH_MAX_LOG];
+    uint32_t log_n;
+    uint32_t batches_n; // vkCmdPipelineBarrier2 calls before the pass
+};
+
+// Device memory shared by transient images whose lifetimes do not overlap.
+struct GraphBlock {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    uint32_t type_bits;
+    uint32_t type_index;
+};
+
+// Small frame graph. Passes declare which resources they read and write, in
+// execution order. graph_compile culls passes nothing depends on and places
+// transient images into shared memory. graph_execute records the passes and,
+// between them, the barriers their declared uses need, merged into one
+// vkCmdPipelineBarrier2 per pass and command buffer.
+//
+// The graph is built once. Imported resources are rebound every execution
+// together with their state, which graph_state returns afterwards so the
+// caller can carry it into the next frame.
+struct FrameGraph {
+    VkDevice device;
+    uint32_t queue_families[GraphQueue_N];
+    struct GraphResource resources[GRAPH_MAX_RESOURCES];
+    uint32_t resources_n;
+    struct GraphPass passes[GRAPH_MAX_PASSES];
+    uint32_t passes_n;
+    struct GraphBlock blocks[GRAPH_MAX_RESOURCES];
+    uint32_t blocks_n;
+    int compiled;
+    VkDeviceSize transient_size; // without aliasing
+    // Barriers after the last pass.
+    struct GraphBarrierLog final_log[GRAPH_MAX_RESOURCES];
+    uint32_t final_log_n;
+};
+
+int graph_init(struct FrameGraph *graph, VkDevice device, const uint32_t queue_families[GraphQueue_N]);
+void graph_free(struct FrameGraph *graph);
+
+// Building, before graph_compile. Return GRAPH_INVALID when full.
+uint32_t graph_import_image(struct FrameGraph *graph, const char *name, int exported);
+uint32_t graph_import_buffer(struct FrameGraph *graph, const char *name, int exported);
+uint32_t graph_create_image(
+        struct FrameGraph *graph,
+        const char *name,
+        VkExtent2D extent,
+        VkFormat format,
+        VkImageUsageFlags usage);
+uint32_t graph_add_pass(
+        struct FrameGraph *graph,
+        const char *name,
+        enum GraphQueue queue,
+        uint32_t flags,
+        GraphRecordFn record,
+        void *user);
+int graph_use(struct FrameGraph *graph, uint32_t pass, uint32_t resource, enum GraphUse use);
+void graph_set_final(struct FrameGraph *graph, uint32_t resource, VkImageLayout layout, uint32_t queue_family);
+
+// Culls, computes transient lifetimes and creates the transient images.
+// Returns 2 when a transient is used on both queues, 3 when an image could
+// not be created and 4 when memory could not be allocated.
+int graph_compile(struct FrameGraph *graph, VkPhysicalDevice physical_device);
+
+VkImage graph_image(const struct FrameGraph *graph, uint32_t resource);
+VkImageView graph_image_view(const struct FrameGraph *graph, uint32_t resource);
+
+// A resource nothing has touched yet. wait_stage is the stage its first
+// barrier has to wait for, e.g. where a semaphore wait happens.
+void graph_state_init(struct GraphState *state, VkPipelineStageFlags2 wait_stage);
+
+// Per execution.
+void graph_bind_image(struct FrameGraph *graph, uint32_t resource, VkImage image, const struct GraphState *state);
+void graph_bind_buffer(struct FrameGraph *graph, uint32_t resource, VkBuffer buffer, const struct GraphState *state);
+void graph_enable_pass(struct FrameGraph *graph, uint32_t pass, int enabled);
+void graph_execute(struct FrameGraph *graph, const VkCommandBuffer command_buffers[GraphQueue_N]);
+const struct GraphState *graph_state(const struct FrameGraph *graph, uint32_t resource);
+
+// Prints passes, culling, lifetimes, memory blocks and the barriers of the
+// last execution.
+void graph_dump(const struct FrameGraph *graph);
@@ -0,0 +1,280 @@
+#include <vulkan/vulkan.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "host_memory.h"
+
+#define SYSTEM_CLASS HOST_CLASSES // header class of blocks from the system allocator
+#define KIB (1.0 / 1024.0)
+
+static const char *host_scope_names[HOST_SCOPES] = {
+    "command",
+    "object",
+    "cache",
+    "device",
+    "instance",
+};
+
+// Sits right before every block handed out.
+struct HostBlockHeader {
+    uint16_t size_class; // SYSTEM_CLASS for system blocks
+    uint16_t scope;
+    uint32_t offset; // from the system allocation to the block, system blocks only
+    uint64_t size; // requested
+};
+
+_Static_assert(sizeof(struct HostBlockHeader) == HOST_ALIGNMENT, "class blocks stay aligned after the header");
+_Static_assert(sizeof(struct HostArenaChunk) <= HOST_ALIGNMENT, "chunk header fits ahead of the first block");
+
+// Free lists of the calling thread, for the host of one generation.
+struct HostThreadCache {
+    uint64_t generation;
+    void *lists[HOST_CLASSES]; // first word of a free block links to the next
+};
+
+static __thread struct HostThreadCache host_cache;
+static uint64_t host_generation;
+
+static uint32_t scope_index(VkSystemAllocationScope scope) {
+    switch (scope) {
+        case VK_SYSTEM_ALLOCATION_SCOPE_COMMAND: return 0;
+        case VK_SYSTEM_ALLOCATION_SCOPE_OBJECT: return 1;
+        case VK_SYSTEM_ALLOCATION_SCOPE_CACHE: return 2;
+        case VK_SYSTEM_ALLOCATION_SCOPE_DEVICE: return 3;
+        default: return 4;
+    }
+}
+
+static uint32_t size_class(size_t size) {
+    uint32_t c = 0;
+    while (((size_t)16 << c) < size) c++;
+    return c;
+}
+
+static void stats_allocated(struct HostMemory *host, uint32_t scope, uint64_t size) {
+    struct HostScopeStats *stats = &host->scopes[scope];
+    __atomic_fetch_add(&stats->allocations_n, 1, __ATOMIC_RELAXED);
+    uint64_t live = __atomic_add_fetch(&stats->live_bytes, size, __ATOMIC_RELAXED);
+    uint64_t peak = __atomic_load_n(&stats->peak_bytes, __ATOMIC_RELAXED);
+    while (live > peak
+            && !__atomic_compare_exchange_n(&stats->peak_bytes, &peak, live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void stats_freed(struct HostMemory *host, uint32_t scope, uint64_t size) {
+    struct HostScopeStats *stats = &host->scopes[scope];
+    __atomic_fetch_add(&stats->frees_n, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&stats->live_bytes, size, __ATOMIC_RELAXED);
+}
+
+static struct HostThreadCache *thread_cache(const struct HostMemory *host) {
+    if (host_cache.generation != host->generation) {
+        memset(&host_cache, 0, sizeof(host_cache));
+        host_cache.generation = host->generation;
+    }
+    return &host_cache;
+}
+
+// A block of size class c from the thread's list, else carved from a chunk.
+static struct HostBlockHeader *class_block(struct HostMemory *host, uint32_t c) {
+    struct HostThreadCache *cache = thread_cache(host);
+    void *block = cache->lists[c];
+    if (block != NULL) {
+        cache->lists[c] = *(void **)block;
+        __atomic_fetch_add(&host->recycled_n, 1, __ATOMIC_RELAXED);
+        return (struct HostBlockHeader *)block - 1;
+    }
+
+    //
+    size_t stride = sizeof(struct HostBlockHeader) + ((size_t)16 << c);
+    pthread_mutex_lock(&host->lock);
+    struct HostArenaChunk *chunk = host->chunks;
+    if (chunk == NULL || chunk->used + stride > HOST_ARENA_CHUNK) {
+        chunk = malloc(HOST_ARENA_CHUNK);
+        if (chunk == NULL) {
+            pthread_mutex_unlock(&host->lock);
+            return NULL;
+        }
+        chunk->next = host->chunks;
+        chunk->used = HOST_ALIGNMENT;
+        host->chunks = chunk;
+        host->chunk_bytes += HOST_ARENA_CHUNK;
+        __atomic_fetch_add(&host->system_allocations_n, 1, __ATOMIC_RELAXED);
+    }
+    struct HostBlockHeader *header = (struct HostBlockHeader *)((uint8_t *)chunk + chunk->used);
+    chunk->used += stride;
+    host->carved_bytes += stride;
+    pthread_mutex_unlock(&host->lock);
+
+    return header;
+}
+
+// Vulkan callbacks.
+
+static void *VKAPI_PTR callback_allocation(void *user, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    return host_alloc(user, size, alignment, scope);
+}
+
+static void *VKAPI_PTR callback_reallocation(
+        void *user,
+        void *original,
+        size_t size,
+        size_t alignment,
+        VkSystemAllocationScope scope) {
+    return host_realloc(user, original, size, alignment, scope);
+}
+
+static void VKAPI_PTR callback_free(void *user, void *memory) {
+    host_free(user, memory);
+}
+
+static void VKAPI_PTR callback_internal_allocation(
+        void *user,
+        size_t size,
+        VkInternalAllocationType type,
+        VkSystemAllocationScope scope) {
+    (void)type;
+    struct HostMemory *host = user;
+    __atomic_fetch_add(&host->scopes[scope_index(scope)].internal_bytes, size, __ATOMIC_RELAXED);
+}
+
+static void VKAPI_PTR callback_internal_free(
+        void *user,
+        size_t size,
+        VkInternalAllocationType type,
+        VkSystemAllocationScope scope) {
+    (void)type;
+    struct HostMemory *host = user;
+    __atomic_fetch_sub(&host->scopes[scope_index(scope)].internal_bytes, size, __ATOMIC_RELAXED);
+}
+
+//
+
+int host_memory_init(struct HostMemory *host) {
+#if DEBUG_INPUT_VALIDATION
+    if (host == NULL) return 1;
+    if (!IS_ZERO_PTR(host)) return 1;
+#endif
+
+    if (pthread_mutex_init(&host->lock, NULL) != 0) return 2;
+    host->generation = __atomic_add_fetch(&host_generation, 1, __ATOMIC_RELAXED);
+    host->callbacks = (VkAllocationCallbacks) {
+        .pUserData = host,
+        .pfnAllocation = callback_allocation,
+        .pfnReallocation = callback_reallocation,
+        .pfnFree = callback_free,
+        .pfnInternalAllocation = callback_internal_allocation,
+        .pfnInternalFree = callback_internal_free,
+    };
+
+    return 0;
+}
+
+void host_memory_free(struct HostMemory *host) {
+    if (host->generation == 0) return;
+
+    // Blocks on thread lists live in the chunks, the lists go stale with them.
+    for (struct HostArenaChunk *chunk = host->chunks; chunk != NULL;) {
+        struct HostArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    pthread_mutex_destroy(&host->lock);
+    if (host_cache.generation == host->generation) memset(&host_cache, 0, sizeof(host_cache));
+    memset(host, 0, sizeof(*host));
+}
+
+void *host_alloc(struct HostMemory *host, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+#if DEBUG_INPUT_VALIDATION
+    if (host == NULL || host->generation == 0) return NULL;
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) return NULL;
+#endif
+    if (size == 0) return NULL;
+
+    uint32_t scope_i = scope_index(scope);
+    struct HostBlockHeader *header = NULL;
+    if (size <= HOST_MAX_CLASS_SIZE && alignment <= HOST_ALIGNMENT) {
+        uint32_t c = size_class(size);
+        header = class_block(host, c);
+        if (header == NULL) return NULL;
+        header->size_class = c;
+        header->offset = 0;
+    } else {
+        // Room for the header ahead of the aligned block.
+        size_t offset = alignment > HOST_ALIGNMENT ? alignment : HOST_ALIGNMENT;
+        void *system = NULL;
+        if (posix_memalign(&system, offset, offset + size) != 0) return NULL;
+        header = (struct HostBlockHeader *)((uint8_t *)system + offset) - 1;
+        header->size_class = SYSTEM_CLASS;
+        header->offset = offset;
+        __atomic_fetch_add(&host->system_allocations_n, 1, __ATOMIC_RELAXED);
+    }
+    header->scope = scope_i;
+    header->size = size;
+    stats_allocated(host, scope_i, size);
+
+    return header + 1;
+}
+
+void host_free(struct HostMemory *host, void *ptr) {
+    if (ptr == NULL) return;
+
+    struct HostBlockHeader *header = (struct HostBlockHeader *)ptr - 1;
+    stats_freed(host, header->scope, header->size);
+    if (header->size_class == SYSTEM_CLASS) {
+        free((uint8_t *)ptr - header->offset);
+        return;
+    }
+    struct HostThreadCache *cache = thread_cache(host);
+    *(void **)ptr = cache->lists[header->size_class];
+    cache->lists[header->size_class] = ptr;
+}
+
+void *host_realloc(struct HostMemory *host, void *ptr, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    if (ptr == NULL) return host_alloc(host, size, alignment, scope);
+    if (size == 0) {
+        host_free(host, ptr);
+        return NULL;
+    }
+
+    // Still fits its class.
+    struct HostBlockHeader *header = (struct HostBlockHeader *)ptr - 1;
+    if (header->size_class != SYSTEM_CLASS && size <= ((size_t)16 << header->size_class) && alignment <= HOST_ALIGNMENT) {
+        stats_freed(host, header->scope, header->size);
+        header->size = size;
+        header->scope = scope_index(scope);
+        stats_allocated(host, header->scope, size);
+        return ptr;
+    }
+
+    void *moved = host_alloc(host, size, alignment, scope);
+    if (moved == NULL) return NULL;
+    memcpy(moved, ptr, header->size < size ? header->size : size);
+    host_free(host, ptr);
+
+    return moved;
+}
+
+uint64_t host_memory_system_allocations(const struct HostMemory *host) {
+    return __atomic_load_n(&host->system_allocations_n, __ATOMIC_RELAXED);
+}
+
+void host_memory_report(const struct HostMemory *host) {
+    for (uint32_t i = 0; i < HOST_SCOPES; i++) {
+        const struct HostScopeStats *stats = &host->scopes[i];
+        if (stats->allocations_n == 0 && stats->internal_bytes == 0) continue;
+        printf("[host] %s: %llu allocations, %llu live, %.1f KiB live, %.1f KiB peak, %.1f KiB internal\n",
+                host_scope_names[i],
+                (unsigned long long)stats->allocations_n,
+                (unsigned long long)(stats->allocations_n - stats->frees_n),
+                stats->live_bytes * KIB,
+                stats->peak_bytes * KIB,
+                stats->internal_bytes * KIB);
+    }
+    printf("[host] arena %.1f KiB in chunks, %.1f KiB carved, %llu allocations recycled, %llu system allocations\n",
+            host->chunk_bytes * KIB,
+            host->carved_bytes * KIB,
+            (unsigned long long)host->recycled_n,
+            (unsigned long long)host->system_allocations_n);
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HOST_ARENA_CHUNK (256u << 10)
+#define HOST_CLASSES 12 // block sizes 16 bytes to 32 KiB, powers of two
+#define HOST_MAX_CLASS_SIZE (16u << (HOST_CLASSES - 1))
+#define HOST_ALIGNMENT 16 // of every class block, larger alignments go to the system
+#define HOST_SCOPES 5 // one per VkSystemAllocationScope
+
+struct HostScopeStats {
+    uint64_t allocations_n;
+    uint64_t frees_n;
+    uint64_t live_bytes;
+    uint64_t peak_bytes;
+    uint64_t internal_bytes; // reported through pfnInternalAllocation
+};
+
+struct HostArenaChunk {
+    struct HostArenaChunk *next;
+    size_t used;
+};
+
+// Host memory of the app and of the Vulkan objects it creates, behind
+// callbacks. Blocks up to HOST_MAX_CLASS_SIZE are rounded to a size class and
+// carved from arena chunks that live until host_memory_free. A freed block
+// goes onto the freeing thread's free list of its class and the next
+// allocation of that class on the thread takes it back, without locking.
+// Bigger or more aligned blocks go straight to the system allocator.
+//
+// Once every size class a frame needs has blocks on the recording thread's
+// lists, frames make no system allocations at all, which system_allocations_n
+// shows.
+struct HostMemory {
+    VkAllocationCallbacks callbacks; // pUserData is this struct
+    uint64_t generation; // tells thread caches filled for an earlier host apart
+    pthread_mutex_t lock; // chunks
+    struct HostArenaChunk *chunks;
+    uint64_t chunk_bytes;
+    uint64_t carved_bytes; // handed out from chunks, recycled blocks not counted again
+    // Stats, updated atomically.
+    struct HostScopeStats scopes[HOST_SCOPES];
+    uint64_t system_allocations_n; // chunks and oversized blocks
+    uint64_t recycled_n; // allocations served from a free list
+};
+
+int host_memory_init(struct HostMemory *host);
+// Every block must have been freed, or belong to a torn down object.
+void host_memory_free(struct HostMemory *host);
+
+// scope is the lifetime, for the stats. Returns NULL when out of memory.
+void *host_alloc(struct HostMemory *host, size_t size, size_t alignment, VkSystemAllocationScope scope);
+void *host_realloc(struct HostMemory *host, void *ptr, size_t size, size_t alignment, VkSystemAllocationScope scope);
+void host_free(struct HostMemory *host, void *ptr);
+
+uint64_t host_memory_system_allocations(const struct HostMemory *host);
+void host_memory_report(const struct HostMemory *host);
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "util.h"
+#include "idle.h"
+
+// Process CPU time, worker threads included.
+static double cpu_seconds(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6
+        + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+static void window_begin(struct IdleMonitor *idle, double now, double gpu_ms) {
+    idle->window_start = now;
+    idle->window_cpu = cpu_seconds();
+    idle->window_gpu_ms = gpu_ms;
+    idle->window_idle = 0.0;
+    idle->window_frames_n = 0;
+    idle->window_wakeups_n = 0;
+}
+
+int idle_init(struct IdleMonitor *idle, int enabled, uint32_t target_samples) {
+#if DEBUG_INPUT_VALIDATION
+    if (idle == NULL) return 1;
+    if (!IS_ZERO_PTR(idle)) return 1;
+#endif
+
+    idle->enabled = enabled;
+    idle->target_samples = target_samples > 0 ? target_samples : IDLE_DEFAULT_SAMPLES;
+    window_begin(idle, time_now(), 0.0);
+
+    return 0;
+}
+
+void idle_free(struct IdleMonitor *idle) {
+    memset(idle, 0, sizeof(*idle));
+}
+
+void idle_request(struct IdleMonitor *idle, enum IdleWake wake) {
+    if (idle->wake == IdleWake_None) idle->wake = wake;
+}
+
+int idle_should_draw(struct IdleMonitor *idle, int converged, int busy, int animating, double gpu_ms) {
+    if (!idle->enabled) {
+        idle->window_frames_n++;
+        return 1;
+    }
+
+    // Input first, it is what a user waits on.
+    enum IdleWake wake = idle->wake;
+    if (wake == IdleWake_None && animating) wake = IdleWake_Scene;
+    if (wake == IdleWake_None && busy) wake = IdleWake_Async;
+    idle->wake = IdleWake_None;
+
+    double now = time_now();
+    if (idle->idle) {
+        if (wake == IdleWake_None) {
+            idle->window_wakeups_n++;
+            if (now - idle->window_start >= IDLE_REPORT_PERIOD) idle_report(idle, gpu_ms);
+            return 0;
+        }
+        double since = idle->idle_since > idle->window_start ? idle->idle_since : idle->window_start;
+        idle->window_idle += now - since;
+        idle->wakes_n[wake]++;
+        idle->idle = 0;
+    } else if (wake == IdleWake_None && converged) {
+        if (idle->idle_n == 0) printf("[idle] converged, drawing on events only\n");
+        idle->idle = 1;
+        idle->idle_since = now;
+        idle->idle_n++;
+        return 0;
+    }
+
+    idle->window_frames_n++;
+    return 1;
+}
+
+void idle_report(struct IdleMonitor *idle, double gpu_ms) {
+    double now = time_now();
+    double seconds = now - idle->window_start;
+    if (seconds <= 0.0) return;
+
+    double idle_seconds = idle->window_idle;
+    if (idle->idle)
+        idle_seconds += now - (idle->idle_since > idle->window_start ? idle->idle_since : idle->window_start);
+    printf("[idle] last %.1f s: %.0f%% idle, %llu frames, %llu empty wakeups, cpu %.1f%% of a core, gpu %.1f%%\n",
+            seconds,
+            100.0 * idle_seconds / seconds,
+            (unsigned long long)idle->window_frames_n,
+            (unsigned long long)idle->window_wakeups_n,
+            100.0 * (cpu_seconds() - idle->window_cpu) / seconds,
+            0.1 * (gpu_ms - idle->window_gpu_ms) / seconds);
+    if (idle->idle_n > 0) {
+        printf("[idle] %llu idle stretches, woken by input %llu, resize %llu, async work %llu, scene change %llu\n",
+                (unsigned long long)idle->idle_n,
+                (unsigned long long)idle->wakes_n[IdleWake_Input],
+                (unsigned long long)idle->wakes_n[IdleWake_Resize],
+                (unsigned long long)idle->wakes_n[IdleWake_Async],
+                (unsigned long long)idle->wakes_n[IdleWake_Scene]);
+    }
+
+    window_begin(idle, now, gpu_ms);
+}
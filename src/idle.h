@@ -0,0 +1,56 @@
+#pragma once
+#include <stdint.h>
+
+#define IDLE_DEFAULT_SAMPLES 4096 // per pixel, when adaptive sampling does not decide
+#define IDLE_WAIT_TIMEOUT 0.1 // seconds between checks for async work while idle
+#define IDLE_REPORT_PERIOD 10.0 // seconds between utilization lines while idle
+
+// Why the loop drew again after idling.
+enum IdleWake {
+    IdleWake_None = 0,
+    IdleWake_Input,
+    IdleWake_Resize, // or the window needing a repaint
+    IdleWake_Async, // streaming or other work finished in the background
+    IdleWake_Scene,
+};
+
+// Decides whether app_run draws or waits for events. Draws while the image
+// changes, the scene moves, accumulation is still converging, background
+// work wants frames, or input arrived since the last frame. Otherwise the
+// loop waits in glfwWaitEventsTimeout and only wakes for events or the
+// timeout. Utilization is measured per window, process CPU time from
+// getrusage and GPU time from the profiler's spans, and reported for active
+// and idle stretches alike so the two can be compared.
+struct IdleMonitor {
+    int enabled; // else every iteration draws
+    uint32_t target_samples;
+    int idle; // waiting instead of drawing
+    enum IdleWake wake; // pending redraw request, IdleWake_None when there is none
+    double idle_since;
+    uint64_t idle_n; // stretches so far
+    uint64_t wakes_n[IdleWake_Scene + 1]; // redraws after idling, by reason
+    // Utilization window, since the last report.
+    double window_start; // time_now()
+    double window_cpu; // process CPU seconds at window_start
+    double window_gpu_ms; // profiler busy time at window_start
+    double window_idle; // seconds idle in finished stretches
+    uint64_t window_frames_n;
+    uint64_t window_wakeups_n; // loop iterations that found nothing to draw
+};
+
+int idle_init(struct IdleMonitor *idle, int enabled, uint32_t target_samples);
+void idle_free(struct IdleMonitor *idle);
+
+// From input and window callbacks, keeps the first reason until it is served.
+void idle_request(struct IdleMonitor *idle, enum IdleWake wake);
+
+// Once per loop iteration, returns whether to draw. converged is the
+// accumulation's state, busy whether background work needs frames to land,
+// animating whether the scene changes every frame. gpu_ms is the profiler's
+// busy time so far, for the reports.
+int idle_should_draw(struct IdleMonitor *idle, int converged, int busy, int animating, double gpu_ms);
+
+// Utilization since the last report, then starts a new window. Also
+// reported every IDLE_REPORT_PERIOD seconds while idle, when the frame
+// reports stop.
+void idle_report(struct IdleMonitor *idle, double gpu_ms);
@@ -0,0 +1,442 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include "util.h"
+#include "image.h"
+
+// Reads the next whitespace separated header token, skipping comments.
+static int read_token(FILE *file, char *token, size_t size) {
+    int c = fgetc(file);
+    while (1) {
+        while (c != EOF && isspace(c)) c = fgetc(file);
+        if (c != '#') break;
+        while (c != EOF && c != '\n') c = fgetc(file);
+    }
+    if (c == EOF) return 1;
+
+    size_t l = 0;
+    while (c != EOF && !isspace(c) && l + 1 < size) {
+        token[l++] = c;
+        c = fgetc(file);
+    }
+    token[l] = 0;
+
+    return 0;
+}
+
+int image_load_rgba8(const char *path, uint32_t *width, uint32_t *height, uint8_t **pixels) {
+#if DEBUG_INPUT_VALIDATION
+    if (path == NULL) return 1;
+    if (width == NULL || height == NULL) return 1;
+    if (pixels == NULL) return 1;
+#endif
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return 2;
+
+    int res = 0;
+    char token[64];
+    uint32_t w = 0, h = 0, maxval = 0, depth = 3;
+
+    //
+    if (read_token(file, token, sizeof(token)) > 0) {
+        res = 3;
+        goto fail;
+    }
+    if (strcmp(token, "P6") == 0) {
+        char t_w[16], t_h[16], t_m[16];
+        if (read_token(file, t_w, 16) || read_token(file, t_h, 16) || read_token(file, t_m, 16)) {
+            res = 3;
+            goto fail;
+        }
+        w = strtoul(t_w, NULL, 10);
+        h = strtoul(t_h, NULL, 10);
+        maxval = strtoul(t_m, NULL, 10);
+    } else if (strcmp(token, "P7") == 0) {
+        // Key/value header terminated by ENDHDR.
+        while (read_token(file, token, sizeof(token)) == 0 && strcmp(token, "ENDHDR") != 0) {
+            char value[64];
+            if (read_token(file, value, sizeof(value)) > 0) break;
+            if (strcmp(token, "WIDTH") == 0) w = strtoul(value, NULL, 10);
+            else if (strcmp(token, "HEIGHT") == 0) h = strtoul(value, NULL, 10);
+            else if (strcmp(token, "DEPTH") == 0) depth = strtoul(value, NULL, 10);
+            else if (strcmp(token, "MAXVAL") == 0) maxval = strtoul(value, NULL, 10);
+        }
+    } else {
+        res = 4; // Unsupported format.
+        goto fail;
+    }
+    if (w == 0 || h == 0 || maxval != 255 || (depth != 3 && depth != 4)) {
+        res = 4;
+        goto fail;
+    }
+
+    //
+    size_t texels = (size_t)w * h;
+    uint8_t *raw = malloc(texels * depth);
+    if (fread(raw, depth, texels, file) != texels) {
+        free(raw);
+        res = 5; // Truncated.
+        goto fail;
+    }
+
+    // Expand to RGBA in place, back to front.
+    if (depth == 3) {
+        raw = realloc(raw, texels * 4);
+        for (size_t i = texels; i-- > 0;) {
+            raw[i * 4 + 3] = 255;
+            raw[i * 4 + 2] = raw[i * 3 + 2];
+            raw[i * 4 + 1] = raw[i * 3 + 1];
+            raw[i * 4 + 0] = raw[i * 3 + 0];
+        }
+    }
+
+    *width = w;
+    *height = h;
+    *pixels = raw;
+
+fail:
+    fclose(file);
+    return res;
+}
+
+// One RGBE scanline, run length encoded when the file's writer could.
+static int read_rgbe_scanline(FILE *file, uint32_t width, uint8_t *rgbe) {
+    int c0 = fgetc(file), c1 = fgetc(file), c2 = fgetc(file), c3 = fgetc(file);
+    if (c3 == EOF) return 5;
+    if (width < 8 || width > 0x7fff || c0 != 2 || c1 != 2 || (c2 & 0x80) != 0) {
+        // Flat.
+        rgbe[0] = c0, rgbe[1] = c1, rgbe[2] = c2, rgbe[3] = c3;
+        return fread(rgbe + 4, 4, width - 1, file) == width - 1 ? 0 : 5;
+    }
+    if ((uint32_t)(c2 << 8 | c3) != width) return 3;
+
+    // Each channel in turn, runs and literals.
+    for (int channel = 0; channel < 4; channel++) {
+        for (uint32_t x = 0; x < width;) {
+            int count = fgetc(file);
+            if (count == EOF) return 5;
+            if (count > 128) {
+                count -= 128;
+                int value = fgetc(file);
+                if (value == EOF || x + count > width) return 5;
+                for (int i = 0; i < count; i++) rgbe[(x++) * 4 + channel] = value;
+            } else {
+                if (count == 0 || x + count > width) return 5;
+                for (int i = 0; i < count; i++) {
+                    int value = fgetc(file);
+                    if (value == EOF) return 5;
+                    rgbe[(x++) * 4 + channel] = value;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static int load_hdr(FILE *file, uint32_t *width, uint32_t *height, float **rgb) {
+    char line[256];
+    if (fgets(line, sizeof(line), file) == NULL || strncmp(line, "#?", 2) != 0) return 3;
+    int rgbe_format = 1;
+    while (fgets(line, sizeof(line), file) != NULL && line[0] != '\n')
+        if (strncmp(line, "FORMAT=", 7) == 0) rgbe_format = strncmp(line + 7, "32-bit_rle_rgbe", 15) == 0;
+    if (!rgbe_format) return 4;
+    uint32_t w = 0, h = 0;
+    if (fgets(line, sizeof(line), file) == NULL || sscanf(line, "-Y %u +X %u", &h, &w) != 2) return 4;
+    if (w == 0 || h == 0) return 3;
+
+    //
+    float *out = malloc((size_t)w * h * 3 * sizeof(float));
+    uint8_t *rgbe = malloc((size_t)w * 4);
+    int res = out == NULL || rgbe == NULL ? 2 : 0;
+    for (uint32_t y = 0; y < h && res == 0; y++) {
+        res = read_rgbe_scanline(file, w, rgbe);
+        for (uint32_t x = 0; x < w && res == 0; x++) {
+            const uint8_t *texel = rgbe + x * 4;
+            float scale = texel[3] == 0 ? 0.0f : ldexpf(1.0f, (int)texel[3] - 136);
+            for (int c = 0; c < 3; c++) out[((size_t)y * w + x) * 3 + c] = (texel[c] + 0.5f) * scale;
+        }
+    }
+    free(rgbe);
+    if (res > 0) {
+        free(out);
+        return res;
+    }
+    *width = w;
+    *height = h;
+    *rgb = out;
+    return 0;
+}
+
+// Portable float map, rows bottom to top.
+static int load_pfm(FILE *file, uint32_t *width, uint32_t *height, float **rgb) {
+    char t_w[16], t_h[16], t_s[32];
+    if (read_token(file, t_w, 16) || read_token(file, t_h, 16) || read_token(file, t_s, 32)) return 3;
+    uint32_t w = strtoul(t_w, NULL, 10), h = strtoul(t_h, NULL, 10);
+    float scale = strtof(t_s, NULL);
+    if (w == 0 || h == 0 || scale == 0.0f) return 3;
+
+    size_t row = (size_t)w * 3;
+    float *out = malloc(row * h * sizeof(float));
+    if (out == NULL) return 2;
+    int swap = (scale < 0.0f) != (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__); // negative scales are little endian
+    for (uint32_t y = h; y-- > 0;) {
+        float *dst = out + y * row;
+        if (fread(dst, sizeof(float), row, file) != row) {
+            free(out);
+            return 5;
+        }
+        for (size_t i = 0; swap && i < row; i++) {
+            uint32_t bits;
+            memcpy(&bits, dst + i, 4);
+            bits = __builtin_bswap32(bits);
+            memcpy(dst + i, &bits, 4);
+        }
+    }
+    *width = w;
+    *height = h;
+    *rgb = out;
+    return 0;
+}
+
+int image_load_linear(const char *path, uint32_t *width, uint32_t *height, float **rgb) {
+#if DEBUG_INPUT_VALIDATION
+    if (path == NULL) return 1;
+    if (width == NULL || height == NULL) return 1;
+    if (rgb == NULL) return 1;
+#endif
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return 2;
+
+    char magic[3] = { 0 };
+    int res = 4;
+    if (fread(magic, 1, 2, file) == 2 && strcmp(magic, "PF") == 0) {
+        res = load_pfm(file, width, height, rgb);
+    } else if (strcmp(magic, "#?") == 0) {
+        rewind(file);
+        res = load_hdr(file, width, height, rgb);
+    }
+    fclose(file);
+
+    return res;
+}
+
+int image_write_ppm(const char *path, uint32_t width, uint32_t height, const uint8_t *rgb) {
+#if DEBUG_INPUT_VALIDATION
+    if (path == NULL || rgb == NULL) return 1;
+    if (width == 0 || height == 0) return 1;
+#endif
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) return 2;
+    fprintf(file, "P6\n%u %u\n255\n", width, height);
+    size_t texels = (size_t)width * height;
+    size_t written = fwrite(rgb, 3, texels, file);
+    fclose(file);
+
+    return written == texels ? 0 : 2;
+}
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc_update(uint32_t crc, const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++) crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+static void put_be32(uint8_t *dst, uint32_t v) {
+    dst[0] = v >> 24;
+    dst[1] = v >> 16;
+    dst[2] = v >> 8;
+    dst[3] = v;
+}
+
+static void png_chunk(FILE *file, const char *type, const uint8_t *data, uint32_t size) {
+    uint8_t header[8];
+    put_be32(header, size);
+    memcpy(header + 4, type, 4);
+    fwrite(header, 1, 8, file);
+    if (size > 0) fwrite(data, 1, size, file);
+    uint32_t crc = crc_update(0xFFFFFFFFu, (const uint8_t*)type, 4);
+    crc = crc_update(crc, data, size) ^ 0xFFFFFFFFu;
+    uint8_t footer[4];
+    put_be32(footer, crc);
+    fwrite(footer, 1, 4, file);
+}
+
+int image_write_png(const char *path, uint32_t width, uint32_t height, const uint8_t *rgb) {
+#if DEBUG_INPUT_VALIDATION
+    if (path == NULL || rgb == NULL) return 1;
+    if (width == 0 || height == 0) return 1;
+#endif
+
+    pthread_once(&crc_once, crc_init);
+
+    // Filter type 0 in front of every row.
+    size_t row = (size_t)width * 3 + 1;
+    size_t raw_size = row * height;
+    uint8_t *raw = malloc(raw_size);
+    for (uint32_t y = 0; y < height; y++) {
+        raw[y * row] = 0;
+        memcpy(raw + y * row + 1, rgb + (size_t)y * width * 3, row - 1);
+    }
+
+    // zlib stream of stored blocks.
+    size_t blocks_n = (raw_size + 65534) / 65535;
+    size_t zlib_size = 2 + blocks_n * 5 + raw_size + 4;
+    uint8_t *zlib = malloc(zlib_size);
+    uint8_t *z = zlib;
+    *z++ = 0x78;
+    *z++ = 0x01;
+    uint32_t a = 1, b = 0;
+    for (size_t offset = 0; offset < raw_size;) {
+        size_t n = raw_size - offset < 65535 ? raw_size - offset : 65535;
+        *z++ = offset + n == raw_size ? 1 : 0;
+        *z++ = n & 0xFF;
+        *z++ = n >> 8;
+        *z++ = ~n & 0xFF;
+        *z++ = (~n >> 8) & 0xFF;
+        memcpy(z, raw + offset, n);
+        for (size_t i = 0; i < n; i++) {
+            a = (a + raw[offset + i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        z += n;
+        offset += n;
+    }
+    put_be32(z, (b << 16) | a);
+    free(raw);
+
+    //
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        free(zlib);
+        return 2;
+    }
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    fwrite(signature, 1, 8, file);
+    uint8_t ihdr[13];
+    put_be32(ihdr, width);
+    put_be32(ihdr + 4, height);
+    ihdr[8] = 8; // bit depth
+    ihdr[9] = 2; // RGB
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    png_chunk(file, "IHDR", ihdr, 13);
+    png_chunk(file, "IDAT", zlib, zlib_size);
+    png_chunk(file, "IEND", NULL, 0);
+    free(zlib);
+    int res = ferror(file) ? 2 : 0;
+    fclose(file);
+
+    return res;
+}
+
+static void exr_attribute(FILE *file, const char *name, const char *type, const void *data, uint32_t size) {
+    fwrite(name, 1, strlen(name) + 1, file);
+    fwrite(type, 1, strlen(type) + 1, file);
+    fwrite(&size, 4, 1, file); // EXR is little endian, like every host we run on.
+    fwrite(data, 1, size, file);
+}
+
+int image_write_exr(const char *path, uint32_t width, uint32_t height, const float *rgb) {
+#if DEBUG_INPUT_VALIDATION
+    if (path == NULL || rgb == NULL) return 1;
+    if (width == 0 || height == 0) return 1;
+#endif
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) return 2;
+
+    //
+    const uint8_t magic[8] = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };
+    fwrite(magic, 1, 8, file);
+
+    // Channels are stored in alphabetical order.
+    uint8_t chlist[3 * 18 + 1] = { 0 };
+    const char *names = "BGR";
+    for (int c = 0; c < 3; c++) {
+        uint8_t *ch = chlist + c * 18;
+        ch[0] = names[c]; // name, NUL, then pixel type 2 (FLOAT)
+        int32_t type = 2, sampling = 1;
+        memcpy(ch + 2, &type, 4);
+        memcpy(ch + 10, &sampling, 4); // after pLinear and 3 reserved bytes
+        memcpy(ch + 14, &sampling, 4);
+    }
+    int32_t window[4] = { 0, 0, (int32_t)width - 1, (int32_t)height - 1 };
+    uint8_t zero = 0;
+    float one = 1.0f;
+    float center[2] = { 0.0f, 0.0f };
+    exr_attribute(file, "channels", "chlist", chlist, sizeof(chlist));
+    exr_attribute(file, "compression", "compression", &zero, 1);
+    exr_attribute(file, "dataWindow", "box2i", window, sizeof(window));
+    exr_attribute(file, "displayWindow", "box2i", window, sizeof(window));
+    exr_attribute(file, "lineOrder", "lineOrder", &zero, 1);
+    exr_attribute(file, "pixelAspectRatio", "float", &one, 4);
+    exr_attribute(file, "screenWindowCenter", "v2f", center, sizeof(center));
+    exr_attribute(file, "screenWindowWidth", "float", &one, 4);
+    fwrite(&zero, 1, 1, file);
+
+    // Offset table, then one chunk per scanline.
+    uint32_t line_size = width * 3 * 4;
+    uint64_t offset = ftell(file) + (uint64_t)height * 8;
+    for (uint32_t y = 0; y < height; y++) {
+        fwrite(&offset, 8, 1, file);
+        offset += 8 + line_size;
+    }
+    float *line = malloc(line_size);
+    for (uint32_t y = 0; y < height; y++) {
+        const float *src = rgb + (size_t)y * width * 3;
+        for (uint32_t x = 0; x < width; x++) {
+            line[x] = src[x * 3 + 2];
+            line[width + x] = src[x * 3 + 1];
+            line[width * 2 + x] = src[x * 3 + 0];
+        }
+        int32_t chunk[2] = { (int32_t)y, (int32_t)line_size };
+        fwrite(chunk, 4, 2, file);
+        fwrite(line, 1, line_size, file);
+    }
+    free(line);
+    int res = ferror(file) ? 2 : 0;
+    fclose(file);
+
+    return res;
+}
+
+int image_write_linear(const char *path, uint32_t width, uint32_t height, const float *rgb) {
+#if DEBUG_INPUT_VALIDATION
+    if (path == NULL || rgb == NULL) return 1;
+    if (width == 0 || height == 0) return 1;
+#endif
+
+    const char *extension = strrchr(path, '.');
+    if (extension != NULL && strcmp(extension, ".exr") == 0)
+        return image_write_exr(path, width, height, rgb);
+
+    size_t values_n = (size_t)width * height * 3;
+    uint8_t *srgb = malloc(values_n);
+    if (srgb == NULL) return 2;
+    for (size_t i = 0; i < values_n; i++) {
+        float f = fminf(fmaxf(rgb[i], 0.0f), 1.0f);
+        f = f <= 0.0031308f ? f * 12.92f : 1.055f * powf(f, 1.0f / 2.4f) - 0.055f;
+        srgb[i] = (uint8_t)(f * 255.0f + 0.5f);
+    }
+    int result = extension != NULL && strcmp(extension, ".png") == 0
+        ? image_write_png(path, width, height, srgb)
+        : image_write_ppm(path, width, height, srgb);
+    free(srgb);
+
+    return result;
+}
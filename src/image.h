@@ -0,0 +1,21 @@
+#pragma once
+#include <stdint.h>
+
+// Loads a binary PPM (P6) or PAM (P7, RGB or RGB_ALPHA) with 8 bit channels
+// into a tightly packed RGBA8 buffer. The caller frees *pixels.
+int image_load_rgba8(const char *path, uint32_t *width, uint32_t *height, uint8_t **pixels);
+// Loads a Radiance RGBE (.hdr, flat or run length encoded) or a portable float
+// map (PF) into tightly packed linear RGB floats, rows top to bottom. The
+// caller frees *rgb.
+int image_load_linear(const char *path, uint32_t *width, uint32_t *height, float **rgb);
+
+// Writers take tightly packed RGB rows, top to bottom. Return 0 on success and
+// 2 when the file cannot be written.
+int image_write_ppm(const char *path, uint32_t width, uint32_t height, const uint8_t *rgb);
+// Stored (uncompressed) deflate blocks, trading size for encode time.
+int image_write_png(const char *path, uint32_t width, uint32_t height, const uint8_t *rgb);
+// Scanline, uncompressed, 32 bit float channels in linear light.
+int image_write_exr(const char *path, uint32_t width, uint32_t height, const float *rgb);
+// Linear RGB floats to the format path's extension names: .exr as is, .png
+// and anything else as sRGB encoded PPM or PNG, clamped to [0, 1].
+int image_write_linear(const char *path, uint32_t width, uint32_t height, const float *rgb);
@@ -0,0 +1,470 @@
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "cpu_trace.h"
+#include "light_tree.h"
+
+#define PI 3.14159265f
+#define EMPTY_CONE 2.0f // cos_theta of bounds without emitters yet
+#define FIELD_SIZE 12.0f // side of the square the compare scene's emitters spread over, at most
+#define FIELD_MATERIALS 16
+#define FIELD_CLUSTER 100 // emitters around each cluster centre
+
+// Bounds, power and cone of an emitter or a node, while building.
+struct LightBounds {
+    float min[3];
+    float max[3];
+    float power;
+    float axis[3];
+    float cos_theta;
+};
+
+static float dot(const float *a, const float *b) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static void bounds_empty(struct LightBounds *b) {
+    for (int c = 0; c < 3; c++) {
+        b->min[c] = FLT_MAX;
+        b->max[c] = -FLT_MAX;
+        b->axis[c] = 0.0f;
+    }
+    b->power = 0.0f;
+    b->cos_theta = EMPTY_CONE;
+}
+
+static float bounds_area(const struct LightBounds *b) {
+    float e[3];
+    for (int c = 0; c < 3; c++) e[c] = fmaxf(b->max[c] - b->min[c], 0.0f);
+    return 2.0f * (e[0] * e[1] + e[1] * e[2] + e[2] * e[0]);
+}
+
+// Smallest cone around both cones' lines, a cone of half angle pi / 2 holds
+// every line.
+static void cone_union(float *axis, float *cos_theta, const float *other_axis, float other_cos) {
+    if (other_cos > 1.0f) return;
+    if (*cos_theta > 1.0f) {
+        memcpy(axis, other_axis, 3 * sizeof(float));
+        *cos_theta = other_cos;
+        return;
+    }
+
+    float w[3] = { other_axis[0], other_axis[1], other_axis[2] };
+    float d = dot(axis, w);
+    if (d < 0.0f) {
+        for (int c = 0; c < 3; c++) w[c] = -w[c];
+        d = -d;
+    }
+    float theta_a = acosf(fminf(fmaxf(*cos_theta, -1.0f), 1.0f));
+    float theta_b = acosf(fminf(fmaxf(other_cos, -1.0f), 1.0f));
+    float theta_d = acosf(fminf(d, 1.0f));
+    if (theta_d + theta_b <= theta_a) return;
+    if (theta_d + theta_a <= theta_b) {
+        memcpy(axis, w, sizeof(w));
+        *cos_theta = other_cos;
+        return;
+    }
+    float theta_o = 0.5f * (theta_a + theta_d + theta_b);
+    if (theta_o >= 0.5f * PI) {
+        *cos_theta = 0.0f;
+        return;
+    }
+
+    // Turn the axis towards w, by as much as the cone grows past a.
+    float theta_r = theta_o - theta_a;
+    float perpendicular[3];
+    for (int c = 0; c < 3; c++) perpendicular[c] = w[c] - axis[c] * d;
+    float length = sqrtf(dot(perpendicular, perpendicular));
+    if (length > 1e-6f) {
+        for (int c = 0; c < 3; c++)
+            axis[c] = axis[c] * cosf(theta_r) + perpendicular[c] / length * sinf(theta_r);
+        float inv = 1.0f / sqrtf(dot(axis, axis));
+        for (int c = 0; c < 3; c++) axis[c] *= inv;
+    }
+    *cos_theta = cosf(theta_o);
+}
+
+static void bounds_merge(struct LightBounds *b, const struct LightBounds *o) {
+    for (int c = 0; c < 3; c++) {
+        b->min[c] = fminf(b->min[c], o->min[c]);
+        b->max[c] = fmaxf(b->max[c], o->max[c]);
+    }
+    b->power += o->power;
+    cone_union(b->axis, &b->cos_theta, o->axis, o->cos_theta);
+}
+
+// Solid angle measure of what a cone's emitters light, cosine weighted.
+static float cone_measure(float cos_theta) {
+    float theta_o = acosf(fminf(fmaxf(cos_theta, -1.0f), 1.0f));
+    float theta_w = fminf(theta_o + 0.5f * PI, PI);
+    float sin_o = sinf(theta_o);
+    return 2.0f * PI * (1.0f - cos_theta)
+        + 0.5f * PI * (2.0f * theta_w * sin_o - cosf(theta_o - 2.0f * theta_w) - 2.0f * theta_o * sin_o + cos_theta);
+}
+
+static float bounds_cost(const struct LightBounds *b) {
+    return b->power * cone_measure(b->cos_theta) * bounds_area(b);
+}
+
+static void emitter_bounds(const struct Scene *scene, uint32_t triangle, struct LightBounds *b) {
+    const float *v[3];
+    for (int k = 0; k < 3; k++) v[k] = scene->positions + scene->indices[triangle * 3 + k] * 4;
+    float e1[3], e2[3];
+    for (int c = 0; c < 3; c++) {
+        e1[c] = v[1][c] - v[0][c];
+        e2[c] = v[2][c] - v[0][c];
+        b->min[c] = fminf(fminf(v[0][c], v[1][c]), v[2][c]);
+        b->max[c] = fmaxf(fmaxf(v[0][c], v[1][c]), v[2][c]);
+    }
+    b->axis[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    b->axis[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    b->axis[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    float length = sqrtf(dot(b->axis, b->axis));
+    const float *emission = scene->materials[scene->triangle_materials[triangle]].emission;
+    b->power = (0.2126f * emission[0] + 0.7152f * emission[1] + 0.0722f * emission[2]) * 0.5f * length;
+    if (length > 0.0f)
+        for (int c = 0; c < 3; c++) b->axis[c] /= length;
+    else
+        b->axis[1] = 1.0f;
+    b->cos_theta = 1.0f;
+}
+
+static void node_store(struct LightNode *node, const struct LightBounds *b) {
+    memcpy(node->min, b->min, sizeof(b->min));
+    memcpy(node->max, b->max, sizeof(b->max));
+    memcpy(node->axis, b->axis, sizeof(b->axis));
+    node->power = b->power;
+    node->cos_theta = b->cos_theta > 1.0f ? 1.0f : b->cos_theta;
+}
+
+static void node_load(const struct LightNode *node, struct LightBounds *b) {
+    memcpy(b->min, node->min, sizeof(b->min));
+    memcpy(b->max, node->max, sizeof(b->max));
+    memcpy(b->axis, node->axis, sizeof(b->axis));
+    b->power = node->power;
+    b->cos_theta = node->cos_theta;
+}
+
+// Build.
+
+struct LightBuildContext {
+    struct LightTree *tree;
+    struct LightBounds *bounds; // per emitter, in scene order
+    float *centroids; // 3 per emitter
+    uint32_t *emitters; // emitter indices, partitioned into leaf order
+};
+
+// Returns the best split cost, with its axis and plane in *axis, *split.
+static float find_split(struct LightBuildContext *ctx, uint32_t first, uint32_t count, int *axis, float *split) {
+    float best = FLT_MAX;
+    for (int a = 0; a < 3; a++) {
+        float lo = FLT_MAX, hi = -FLT_MAX;
+        for (uint32_t i = first; i < first + count; i++) {
+            float c = ctx->centroids[ctx->emitters[i] * 3 + a];
+            lo = fminf(lo, c);
+            hi = fmaxf(hi, c);
+        }
+        if (hi - lo <= 1e-12f) continue;
+
+        struct LightBounds bins[LIGHT_TREE_BINS];
+        uint32_t counts[LIGHT_TREE_BINS] = { 0 };
+        for (int b = 0; b < LIGHT_TREE_BINS; b++) bounds_empty(&bins[b]);
+        float scale = LIGHT_TREE_BINS / (hi - lo);
+        for (uint32_t i = first; i < first + count; i++) {
+            uint32_t e = ctx->emitters[i];
+            int b = (int)((ctx->centroids[e * 3 + a] - lo) * scale);
+            b = b < LIGHT_TREE_BINS - 1 ? b : LIGHT_TREE_BINS - 1;
+            counts[b] += 1;
+            bounds_merge(&bins[b], &ctx->bounds[e]);
+        }
+
+        // Sweep from both sides.
+        float left_cost[LIGHT_TREE_BINS - 1], right_cost[LIGHT_TREE_BINS - 1];
+        uint32_t left_n[LIGHT_TREE_BINS - 1], right_n[LIGHT_TREE_BINS - 1];
+        struct LightBounds left, right;
+        bounds_empty(&left);
+        bounds_empty(&right);
+        uint32_t ln = 0, rn = 0;
+        for (int i = 0; i < LIGHT_TREE_BINS - 1; i++) {
+            if (counts[i] > 0) bounds_merge(&left, &bins[i]);
+            ln += counts[i];
+            left_n[i] = ln;
+            left_cost[i] = bounds_cost(&left);
+            int j = LIGHT_TREE_BINS - 1 - i;
+            if (counts[j] > 0) bounds_merge(&right, &bins[j]);
+            rn += counts[j];
+            right_n[j - 1] = rn;
+            right_cost[j - 1] = bounds_cost(&right);
+        }
+        for (int i = 0; i < LIGHT_TREE_BINS - 1; i++) {
+            if (left_n[i] == 0 || right_n[i] == 0) continue;
+            float cost = left_cost[i] + right_cost[i];
+            if (cost < best) {
+                best = cost;
+                *axis = a;
+                *split = lo + (i + 1) / scale;
+            }
+        }
+    }
+
+    return best;
+}
+
+static void subdivide(struct LightBuildContext *ctx, uint32_t index, uint32_t first, uint32_t count) {
+    struct LightNode *node = &ctx->tree->nodes[index];
+    struct LightBounds b;
+    bounds_empty(&b);
+    for (uint32_t i = first; i < first + count; i++) bounds_merge(&b, &ctx->bounds[ctx->emitters[i]]);
+    node_store(node, &b);
+    if (count == 1) {
+        node->child_triangle = LIGHT_LEAF | ctx->tree->triangles[ctx->emitters[first]];
+        return;
+    }
+
+    // Partition in place, halves when the emitters cannot be told apart.
+    int axis = 0;
+    float split = 0.0f;
+    uint32_t left_n = count / 2;
+    if (find_split(ctx, first, count, &axis, &split) < FLT_MAX) {
+        uint32_t *emitters = ctx->emitters;
+        uint32_t i = first, j = first + count;
+        while (i < j) {
+            if (ctx->centroids[emitters[i] * 3 + axis] < split) i++;
+            else {
+                uint32_t e = emitters[i];
+                emitters[i] = emitters[--j];
+                emitters[j] = e;
+            }
+        }
+        if (i > first && i < first + count) left_n = i - first;
+    }
+
+    //
+    uint32_t left = ctx->tree->nodes_n;
+    ctx->tree->nodes_n += 2;
+    node->child_triangle = left;
+    subdivide(ctx, left, first, left_n);
+    subdivide(ctx, left + 1, first + left_n, count - left_n);
+}
+
+int light_tree_build(struct LightTree *tree, const struct Scene *scene) {
+#if DEBUG_INPUT_VALIDATION
+    if (tree == NULL || scene == NULL) return 1;
+    if (!IS_ZERO_PTR(tree)) return 1;
+#endif
+
+    double start = time_now();
+    for (uint32_t i = 0; i < scene->triangles_n; i++) {
+        const float *emission = scene->materials[scene->triangle_materials[i]].emission;
+        if (emission[0] + emission[1] + emission[2] > 0.0f) tree->lights_n++;
+    }
+    if (tree->lights_n == 0) {
+        tree->build_time = time_now() - start;
+        return 0;
+    }
+
+    struct LightBuildContext ctx = {
+        .tree = tree,
+        .bounds = malloc(tree->lights_n * sizeof(struct LightBounds)),
+        .centroids = malloc(tree->lights_n * 3 * sizeof(float)),
+        .emitters = malloc(tree->lights_n * sizeof(uint32_t)),
+    };
+    tree->triangles = malloc(tree->lights_n * sizeof(uint32_t));
+    tree->nodes = malloc((2 * tree->lights_n - 1) * sizeof(struct LightNode));
+    if (ctx.bounds == NULL || ctx.centroids == NULL || ctx.emitters == NULL
+            || tree->triangles == NULL || tree->nodes == NULL) {
+        free(ctx.bounds);
+        free(ctx.centroids);
+        free(ctx.emitters);
+        light_tree_free(tree);
+        return 2;
+    }
+    uint32_t e = 0;
+    for (uint32_t i = 0; i < scene->triangles_n; i++) {
+        const float *emission = scene->materials[scene->triangle_materials[i]].emission;
+        if (emission[0] + emission[1] + emission[2] <= 0.0f) continue;
+        tree->triangles[e] = i;
+        ctx.emitters[e] = e;
+        emitter_bounds(scene, i, &ctx.bounds[e]);
+        for (int c = 0; c < 3; c++)
+            ctx.centroids[e * 3 + c] = 0.5f * (ctx.bounds[e].min[c] + ctx.bounds[e].max[c]);
+        e++;
+    }
+
+    //
+    tree->nodes_n = 1;
+    subdivide(&ctx, 0, 0, tree->lights_n);
+    for (uint32_t i = 0; i < tree->lights_n; i++) ctx.emitters[i] = tree->triangles[ctx.emitters[i]];
+    memcpy(tree->triangles, ctx.emitters, tree->lights_n * sizeof(uint32_t));
+    free(ctx.bounds);
+    free(ctx.centroids);
+    free(ctx.emitters);
+    tree->build_time = time_now() - start;
+
+    return 0;
+}
+
+void light_tree_free(struct LightTree *tree) {
+    free(tree->nodes);
+    free(tree->triangles);
+    memset(tree, 0, sizeof(*tree));
+}
+
+void light_tree_refit(struct LightTree *tree, const struct Scene *scene) {
+#if DEBUG_INPUT_VALIDATION
+    if (tree == NULL || scene == NULL) return;
+#endif
+
+    // Children come after their parent.
+    double start = time_now();
+    for (uint32_t i = tree->nodes_n; i-- > 0;) {
+        struct LightNode *node = &tree->nodes[i];
+        struct LightBounds b;
+        if (node->child_triangle & LIGHT_LEAF) {
+            emitter_bounds(scene, node->child_triangle & ~LIGHT_LEAF, &b);
+        } else {
+            node_load(&tree->nodes[node->child_triangle], &b);
+            struct LightBounds right;
+            node_load(&tree->nodes[node->child_triangle + 1], &right);
+            bounds_merge(&b, &right);
+        }
+        node_store(node, &b);
+    }
+    tree->refit_time = time_now() - start;
+}
+
+void light_tree_report(const struct LightTree *tree) {
+    printf("[lights] %u emitters, tree of %u nodes built in %.2f ms", tree->lights_n, tree->nodes_n, tree->build_time * 1e3);
+    if (tree->refit_time > 0.0) printf(", last refit %.2f ms", tree->refit_time * 1e3);
+    printf("\n");
+}
+
+// Equal time comparison.
+
+static float hash(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return (float)(x >> 8) / 16777216.0f;
+}
+
+// Small triangles facing every way over the middle of the scene, a few
+// much brighter than the rest.
+static void add_light_field(struct Scene *scene, uint32_t lights_n) {
+    const float black[3] = { 0.0f, 0.0f, 0.0f };
+    uint32_t materials[FIELD_MATERIALS];
+    for (uint32_t m = 0; m < FIELD_MATERIALS; m++) {
+        float intensity = 25.0f + 5000.0f * powf(hash(m * 4), 6.0f);
+        float color[3] = {
+            intensity * (0.5f + 0.5f * hash(m * 4 + 1)),
+            intensity * (0.5f + 0.5f * hash(m * 4 + 2)),
+            intensity * (0.5f + 0.5f * hash(m * 4 + 3)),
+        };
+        materials[m] = scene_add_material(scene, black, color);
+    }
+
+    float center[3], size[3];
+    for (int c = 0; c < 3; c++) {
+        center[c] = 0.5f * (scene->bounds_min[c] + scene->bounds_max[c]);
+        size[c] = fminf(scene->bounds_max[c] - scene->bounds_min[c], FIELD_SIZE);
+    }
+    float low = scene->bounds_min[1] + 0.3f * size[1];
+    float edge = 0.0003f * (size[0] + size[1] + size[2]);
+    float spread = 0.05f * (size[0] + size[1] + size[2]);
+    for (uint32_t i = 0; i < lights_n; i++) {
+        uint32_t cluster = i / FIELD_CLUSTER;
+        float p[3] = {
+            center[0] + (hash(cluster * 4) - 0.5f) * size[0] + (hash(i * 8) - 0.5f) * spread,
+            low + hash(cluster * 4 + 1) * size[1] + (hash(i * 8 + 1) - 0.5f) * spread,
+            center[2] + (hash(cluster * 4 + 2) - 0.5f) * size[2] + (hash(i * 8 + 2) - 0.5f) * spread,
+        };
+        float z = 1.0f - 0.5f * hash(i * 8 + 3), phi = 2.0f * PI * hash(i * 8 + 4);
+        float r = sqrtf(fmaxf(1.0f - z * z, 0.0f));
+        float n[3] = { r * cosf(phi), z, r * sinf(phi) };
+        float t[3] = { fabsf(n[0]) > 0.5f ? -n[2] : 0.0f, fabsf(n[0]) > 0.5f ? 0.0f : n[2], fabsf(n[0]) > 0.5f ? n[0] : -n[1] };
+        float inv = 1.0f / sqrtf(dot(t, t));
+        float b[3] = { n[1] * t[2] - n[2] * t[1], n[2] * t[0] - n[0] * t[2], n[0] * t[1] - n[1] * t[0] };
+        uint32_t v[3];
+        for (int k = 0; k < 3; k++) {
+            float angle = 2.0f * PI * k / 3.0f;
+            float ct = cosf(angle) * edge * inv, cb = sinf(angle) * edge * inv;
+            v[k] = scene_add_vertex(scene, p[0] + t[0] * ct + b[0] * cb, p[1] + t[1] * ct + b[1] * cb, p[2] + t[2] * ct + b[2] * cb);
+        }
+        scene_add_triangle(scene, v[0], v[1], v[2], materials[cluster % FIELD_MATERIALS]);
+    }
+}
+
+static void set_light_sampling(void *user, uint32_t strategy) {
+    struct CpuTracer *tracer = user;
+    tracer->light_sampling = strategy == 0 ? LightSampling_Uniform : LightSampling_Tree;
+}
+
+int light_tree_compare(struct Scene *scene, uint32_t width, uint32_t height, uint32_t bounces) {
+#if DEBUG_INPUT_VALIDATION
+    if (scene == NULL || scene->triangles_n == 0) return 1;
+#endif
+
+    uint32_t first_vertex = scene->vertices_n;
+    add_light_field(scene, LIGHT_TREE_COMPARE_LIGHTS);
+    struct Bvh bvh = { 0 };
+    struct LightTree tree = { 0 };
+    struct CpuTracer tracer = { 0 };
+    if (bvh_build(&bvh, scene->positions, scene->indices, scene->triangles_n) > 0) return 2;
+    if (light_tree_build(&tree, scene) > 0 || cpu_tracer_init(&tracer, scene, &bvh, width, height, bounces) > 0) {
+        light_tree_free(&tree);
+        bvh_free(&bvh);
+        return 2;
+    }
+    light_tree_report(&tree);
+    tracer.lights = &tree;
+    struct CpuCompare compare = { 0 };
+    int result = cpu_compare_init(&compare, &tracer);
+    if (result == 0) {
+        // Errors of tone mapped values, or the bright emitters seen straight
+        // through partly covered pixels drown out the noise of the
+        // connections.
+        struct CpuCompareEqualTime settings = {
+            .tag = "lights",
+            .names = { "uniform selection", "tree" },
+            .set = set_light_sampling,
+            .user = &tracer,
+            .seconds = LIGHT_TREE_COMPARE_SECONDS,
+            .reference_factor = LIGHT_TREE_COMPARE_REFERENCE,
+            .tone_mapped = 1,
+        };
+        result = cpu_compare_equal_time(&compare, &settings);
+    }
+    cpu_compare_free(&compare);
+    if (result > 0) {
+        cpu_tracer_free(&tracer);
+        light_tree_free(&tree);
+        bvh_free(&bvh);
+        return 2;
+    }
+
+    // Every emitter drifts, then the tree follows by refit or by rebuild.
+    for (uint32_t v = first_vertex; v < scene->vertices_n; v++) {
+        uint32_t light = (v - first_vertex) / 3;
+        for (int c = 0; c < 3; c++) scene->positions[v * 4 + c] += 0.2f * (hash((light * 4 + c) ^ 0x9e3779b9u) - 0.5f);
+    }
+    light_tree_refit(&tree, scene);
+    struct LightTree rebuilt = { 0 };
+    result = light_tree_build(&rebuilt, scene);
+    if (result == 0) {
+        printf("[lights] moved %u emitters: refit %.2f ms, rebuild %.2f ms\n",
+                LIGHT_TREE_COMPARE_LIGHTS,
+                tree.refit_time * 1e3,
+                rebuilt.build_time * 1e3);
+    }
+
+    light_tree_free(&rebuilt);
+    cpu_tracer_free(&tracer);
+    light_tree_free(&tree);
+    bvh_free(&bvh);
+    return result > 0 ? 2 : 0;
+}
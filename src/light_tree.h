@@ -0,0 +1,64 @@
+#pragma once
+#include <stdint.h>
+#include "bvh.h"
+#include "scene.h"
+
+#define LIGHT_TREE_BINS 12
+#define LIGHT_LEAF 0x80000000u // set in child_triangle of leaves, the rest is the triangle
+#define LIGHT_TREE_COMPARE_LIGHTS 10000
+#define LIGHT_TREE_COMPARE_WIDTH 160
+#define LIGHT_TREE_COMPARE_HEIGHT 120
+#define LIGHT_TREE_COMPARE_SECONDS 2.0 // per selection
+#define LIGHT_TREE_COMPARE_REFERENCE 8 // times the samples the tree managed, for the reference
+
+enum LightSampling {
+    LightSampling_Tree = 0, // traverse the tree by estimated contribution
+    LightSampling_Uniform, // every emitter as likely
+};
+
+// std430 layout, read by the wavefront shade stage. Emitters light both of
+// their sides, so the cone bounds the lines of the normals below the node:
+// every normal lies within acos(cos_theta) of axis or of -axis. An interior
+// node has its children at child_triangle and child_triangle + 1.
+struct LightNode {
+    float min[3];
+    float power; // emitted, luminance times area, summed over the subtree
+    float max[3];
+    float cos_theta;
+    float axis[3];
+    uint32_t child_triangle;
+};
+
+// Binary tree over the scene's emissive triangles, one per leaf, built top
+// down with binned SAH weighted by power and by the solid angle the cone
+// emits into. Sampling walks it from the root picking a child by its
+// estimated contribution at the shading point, so the cost is the depth and
+// lights far away, small or facing away are rarely picked.
+struct LightTree {
+    struct LightNode *nodes; // array with size of nodes_n, 2 * lights_n - 1
+    uint32_t nodes_n;
+    uint32_t *triangles; // emissive triangles in leaf order, size of lights_n
+    uint32_t lights_n;
+    double build_time; // seconds
+    double refit_time; // seconds, last light_tree_refit
+};
+
+// A scene without emitters builds an empty tree.
+int light_tree_build(struct LightTree *tree, const struct Scene *scene);
+void light_tree_free(struct LightTree *tree);
+
+// Refits every node's bounds, power and cone to the emitters' current
+// vertices and emission, bottom up. The topology stays, so picks get worse
+// as emitters move far; rebuild then. Nothing in the app moves emitters yet,
+// animation only moves instances the kernels do not trace, so only
+// light_tree_compare calls this; a frame loop that edits the scene's
+// emitters must refit and re-upload the nodes itself.
+void light_tree_refit(struct LightTree *tree, const struct Scene *scene);
+void light_tree_report(const struct LightTree *tree);
+
+// Scatters LIGHT_TREE_COMPARE_LIGHTS small emitters over scene, renders on
+// the CPU for LIGHT_TREE_COMPARE_SECONDS picking lights uniformly, then as
+// long through the tree, and prints each one's error against a long tree
+// reference. Ends timing a refit after moving every emitter against a
+// rebuild. scene is changed.
+int light_tree_compare(struct Scene *scene, uint32_t width, uint32_t height, uint32_t bounces);
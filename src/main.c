@@ -5,6 +5,14 @@
 #include <string.h>
 #include "util.h"
 #include "app.h"
+#include "options.h"
+#include "distributed.h"
+#include "environment.h"
+#include "light_tree.h"
+#include "regress.h"
+#include "sampler.h"
+#include "server.h"
+#include "worker.h"
 
 char *next_dir(char *str) {
     char *last = str + 1;
@@ -15,7 +23,32 @@ char *next_dir(char *str) {
     }
 }
 
+// The scene of a headless comparison, and its BVH unless bvh is NULL.
+int load_compare_scene(const struct Options *options, struct Scene *scene, struct Bvh *bvh) {
+    int result = options->scene_path != NULL ? scene_load_obj(scene, options->scene_path) : scene_init_default(scene);
+    if (result == 0 && bvh != NULL) result = bvh_build(bvh, scene->positions, scene->indices, scene->triangles_n);
+    return result;
+}
+
 int main(int argc, char *argv[]) {
+    // Parse command line.
+    struct Options options = { 0 };
+    if (options_parse(&options, argc, argv) > 0) {
+        options_usage(argv[0]);
+        return -1;
+    }
+
+    // Headless tile rendering, no window or device.
+    if (options.distributed_role == DistributedRole_Worker)
+        return distributed_worker(options.distributed_settings.address) == 0 ? 0 : -1;
+    if (options.distributed_role == DistributedRole_Coordinator) {
+        options.distributed_settings.scene_path = options.scene_path;
+        options.distributed_settings.bounces = options.trace_settings.bounces;
+        int result = distributed_coordinator(&options.distributed_settings);
+        if (result > 0) printf("[distributed] failed with %d\n", result);
+        return result == 0 ? 0 : -1;
+    }
+
     // Get working directory.
     char path[256];
     char *ptr = getcwd(path, 256);
@@ -31,11 +64,104 @@ int main(int argc, char *argv[]) {
     while (last != (last = next_dir(last)));
     *(last + 1) = 0;
 
+    // Golden images and timings, without a window.
+    if (options.regress_settings.directory != NULL) {
+        options.regress_settings.shader_path = path;
+        return regress_run(&options.regress_settings) == 0 ? 0 : -1;
+    }
+
+    // Noise of the environment samplings at equal time, on the CPU.
+    if (options.environment_compare) {
+        struct Scene scene = { 0 };
+        struct Bvh bvh = { 0 };
+        struct Environment environment = { 0 };
+        const char *environment_path = options.environment_path != NULL ? options.environment_path : ENVIRONMENT_SUN;
+        int result = load_compare_scene(&options, &scene, &bvh);
+        if (result == 0) result = environment_init(&environment, environment_path, EnvironmentSampling_Mis);
+        if (result == 0) {
+            environment_report(&environment);
+            result = environment_compare(
+                    &environment,
+                    &scene,
+                    &bvh,
+                    ENVIRONMENT_COMPARE_WIDTH,
+                    ENVIRONMENT_COMPARE_HEIGHT,
+                    options.trace_settings.bounces);
+        }
+        if (result > 0) printf("[environment] failed with %d\n", result);
+        environment_free(&environment);
+        bvh_free(&bvh);
+        scene_free(&scene);
+        return result == 0 ? 0 : -1;
+    }
+
+    // Noise of uniform and tree light selection with many lights, on the CPU.
+    if (options.light_compare) {
+        struct Scene scene = { 0 };
+        int result = load_compare_scene(&options, &scene, NULL);
+        if (result == 0) {
+            result = light_tree_compare(
+                    &scene,
+                    LIGHT_TREE_COMPARE_WIDTH,
+                    LIGHT_TREE_COMPARE_HEIGHT,
+                    options.trace_settings.bounces);
+        }
+        if (result > 0) printf("[lights] failed with %d\n", result);
+        scene_free(&scene);
+        return result == 0 ? 0 : -1;
+    }
+
+    // Error against sample count of both path sequences, on the CPU.
+    if (options.sampler_compare) {
+        struct Scene scene = { 0 };
+        struct Bvh bvh = { 0 };
+        struct Environment environment = { 0 };
+        struct Sampler sampler = { 0 };
+        int result = load_compare_scene(&options, &scene, &bvh);
+        if (result == 0 && options.environment_path != NULL)
+            result = environment_init(&environment, options.environment_path, options.environment_sampling);
+        if (result == 0) result = sampler_init(&sampler);
+        if (result == 0) {
+            sampler_report(&sampler);
+            result = sampler_compare(
+                    &sampler,
+                    &scene,
+                    &bvh,
+                    options.environment_path != NULL ? &environment : NULL,
+                    SAMPLER_COMPARE_WIDTH,
+                    SAMPLER_COMPARE_HEIGHT,
+                    options.trace_settings.bounces);
+        }
+        if (result > 0) printf("[sampler] failed with %d\n", result);
+        sampler_free(&sampler);
+        environment_free(&environment);
+        bvh_free(&bvh);
+        scene_free(&scene);
+        return result == 0 ? 0 : -1;
+    }
+
+    // Render server, scenes stay loaded between jobs.
+    if (options.serve_address != NULL || options.spool_directory != NULL) {
+        struct Workers workers = { 0 };
+        struct Server server = { 0 };
+        if (workers_init(&workers, 0) > 0) return -1;
+        int result = server_init(&server, &workers, options.serve_address, options.spool_directory);
+        if (result > 0) {
+            printf("[server] failed with %d\n", result);
+            workers_free(&workers);
+            return -1;
+        }
+        server_run(&server);
+        server_free(&server);
+        workers_free(&workers);
+        return 0;
+    }
+
     // Start app.
     struct App app = { 0 };
     enum AppErr err;
 
-    err = app_init(&app, path);
+    err = app_init(&app, path, &options);
     if (err != AppErr_None) {
         printf("AppErr: %i\n", err);
         return -1;
@@ -0,0 +1,169 @@
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "util.h"
+#include "net.h"
+
+// Unix path of address, NULL for TCP.
+static const char *unix_path(const char *address) {
+    return strncmp(address, "unix:", 5) == 0 ? address + 5 : NULL;
+}
+
+static int unix_address(const char *path, struct sockaddr_un *sun) {
+    memset(sun, 0, sizeof(*sun));
+    sun->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sun->sun_path)) return 1;
+    strlcpy(sun->sun_path, path, sizeof(sun->sun_path));
+    return 0;
+}
+
+// Resolved TCP addresses of HOST:PORT, freed with freeaddrinfo.
+static struct addrinfo *tcp_addresses(const char *address, int passive) {
+    char host[256];
+    const char *colon = strrchr(address, ':');
+    if (colon == NULL || (size_t)(colon - address) >= sizeof(host)) return NULL;
+    memcpy(host, address, colon - address);
+    host[colon - address] = 0;
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = passive ? AI_PASSIVE : 0,
+    };
+    struct addrinfo *list = NULL;
+    if (getaddrinfo(host[0] != 0 ? host : NULL, colon + 1, &hints, &list) != 0) return NULL;
+    return list;
+}
+
+static void tcp_nodelay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+int net_listen(const char *address) {
+#if DEBUG_INPUT_VALIDATION
+    if (address == NULL) return -1;
+#endif
+
+    const char *path = unix_path(address);
+    if (path != NULL) {
+        struct sockaddr_un sun;
+        if (unix_address(path, &sun) > 0) return -1;
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        unlink(path);
+        if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0 || listen(fd, 64) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    struct addrinfo *list = tcp_addresses(address, 1);
+    int fd = -1;
+    for (struct addrinfo *ai = list; ai != NULL && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, 64) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (list != NULL) freeaddrinfo(list);
+
+    return fd;
+}
+
+int net_connect(const char *address) {
+#if DEBUG_INPUT_VALIDATION
+    if (address == NULL) return -1;
+#endif
+
+    const char *path = unix_path(address);
+    if (path != NULL) {
+        struct sockaddr_un sun;
+        if (unix_address(path, &sun) > 0) return -1;
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    struct addrinfo *list = tcp_addresses(address, 0);
+    int fd = -1;
+    for (struct addrinfo *ai = list; ai != NULL && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (list != NULL) freeaddrinfo(list);
+    if (fd >= 0) tcp_nodelay(fd);
+
+    return fd;
+}
+
+int net_connect_retry(const char *address, double timeout) {
+    double deadline = time_now() + timeout;
+    for (;;) {
+        int fd = net_connect(address);
+        if (fd >= 0 || time_now() > deadline) return fd;
+        usleep(20000);
+    }
+}
+
+int net_accept(int listener) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd >= 0) tcp_nodelay(fd); // Fails harmlessly on Unix sockets.
+    return fd;
+}
+
+void net_unlink(const char *address) {
+    const char *path = unix_path(address);
+    if (path != NULL) unlink(path);
+}
+
+int net_send(int fd, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    while (size > 0) {
+        ssize_t n = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 2;
+        bytes += n;
+        size -= n;
+    }
+    return 0;
+}
+
+int net_recv(int fd, void *data, size_t size) {
+    uint8_t *bytes = data;
+    while (size > 0) {
+        ssize_t n = recv(fd, bytes, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 2;
+        bytes += n;
+        size -= n;
+    }
+    return 0;
+}
+
+int net_send_message(int fd, uint32_t type, const void *a, size_t a_size, const void *b, size_t b_size) {
+    struct NetHeader header = { .type = type, .size = (uint32_t)(a_size + b_size) };
+    if (net_send(fd, &header, sizeof(header)) > 0) return 2;
+    if (a_size > 0 && net_send(fd, a, a_size) > 0) return 2;
+    if (b_size > 0 && net_send(fd, b, b_size) > 0) return 2;
+    return 0;
+}
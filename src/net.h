@@ -0,0 +1,28 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Blocking stream sockets behind one address syntax, "unix:PATH" for a Unix
+// domain socket, else "HOST:PORT" over TCP. Messages are a NetHeader then
+// size bytes of payload, in host byte order: both ends run on machines of
+// the same kind.
+
+struct NetHeader {
+    uint32_t type;
+    uint32_t size; // payload bytes after the header
+};
+
+// Returns the socket, or -1. A stale Unix socket file is replaced.
+int net_listen(const char *address);
+int net_connect(const char *address);
+// Waits up to timeout seconds for the listener to come up.
+int net_connect_retry(const char *address, double timeout);
+int net_accept(int listener);
+// Removes the socket file of a Unix address, nothing for TCP.
+void net_unlink(const char *address);
+
+// Return 0 on success and 2 when the peer is gone or the call failed.
+int net_send(int fd, const void *data, size_t size);
+int net_recv(int fd, void *data, size_t size);
+// Header and up to two payload parts, written as one message.
+int net_send_message(int fd, uint32_t type, const void *a, size_t a_size, const void *b, size_t b_size);
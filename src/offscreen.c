@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "gpu_memory.h"
+#include "trace.h"
+#include "offscreen.h"
+
+int offscreen_init(struct Offscreen *offscreen, const char *path) {
+#if DEBUG_INPUT_VALIDATION
+    if (offscreen == NULL) return 1;
+    if (!IS_ZERO_PTR(offscreen)) return 1;
+    if (path == NULL) return 1;
+#endif
+
+    offscreen->path = path;
+
+    // No window system extensions or layers, nothing here presents.
+    VkApplicationInfo app_info = {
+        .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+        .pApplicationName = "Vulkan Ray Trace",
+        .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
+        .pEngineName = "None",
+        .engineVersion = VK_MAKE_VERSION(1, 0, 0),
+        .apiVersion = VK_API_VERSION_1_3,
+    };
+    VkInstanceCreateInfo instance_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+        .pApplicationInfo = &app_info,
+    };
+    if (vkCreateInstance(&instance_cinfo, NULL, &offscreen->instance) != VK_SUCCESS) return 2;
+
+    // Take first physical device.
+    uint32_t physical_devices_n = 0;
+    vkEnumeratePhysicalDevices(offscreen->instance, &physical_devices_n, NULL);
+    if (physical_devices_n == 0) return 2;
+    physical_devices_n = 1;
+    vkEnumeratePhysicalDevices(offscreen->instance, &physical_devices_n, &offscreen->physical_device);
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(offscreen->physical_device, &properties);
+    if (properties.apiVersion < VK_API_VERSION_1_3) return 2; // The kernels are SPIR-V 1.6.
+
+    // Any compute queue, there is no graphics work.
+    uint32_t queue_family_n = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(offscreen->physical_device, &queue_family_n, NULL);
+    VkQueueFamilyProperties *queue_families = malloc(queue_family_n * sizeof(*queue_families));
+    if (queue_families == NULL) return 4;
+    vkGetPhysicalDeviceQueueFamilyProperties(offscreen->physical_device, &queue_family_n, queue_families);
+    offscreen->queue_family = UINT32_MAX;
+    for (uint32_t i = 0; i < queue_family_n && offscreen->queue_family == UINT32_MAX; i++)
+        if (queue_families[i].queueFlags & VK_QUEUE_COMPUTE_BIT) offscreen->queue_family = i;
+    free(queue_families);
+    if (offscreen->queue_family == UINT32_MAX) return 2;
+
+    // The descriptor indexing of create_vk_device, without the presentation
+    // and graphics features.
+    VkPhysicalDeviceVulkan12Features supported_vulkan12_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+    };
+    VkPhysicalDeviceFeatures2 supported_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &supported_vulkan12_features,
+    };
+    vkGetPhysicalDeviceFeatures2(offscreen->physical_device, &supported_features);
+    if (!supported_vulkan12_features.descriptorIndexing
+            || !supported_vulkan12_features.runtimeDescriptorArray
+            || !supported_vulkan12_features.descriptorBindingPartiallyBound
+            || !supported_vulkan12_features.descriptorBindingUpdateUnusedWhilePending
+            || !supported_vulkan12_features.descriptorBindingStorageBufferUpdateAfterBind
+            || !supported_vulkan12_features.descriptorBindingSampledImageUpdateAfterBind
+            || !supported_vulkan12_features.descriptorBindingStorageImageUpdateAfterBind
+            || !supported_vulkan12_features.shaderSampledImageArrayNonUniformIndexing
+            || !supported_vulkan12_features.shaderStorageBufferArrayNonUniformIndexing)
+        return 3;
+
+    //
+    float queue_priority = 1.0f;
+    VkDeviceQueueCreateInfo queue_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+        .queueFamilyIndex = offscreen->queue_family,
+        .queueCount = 1,
+        .pQueuePriorities = &queue_priority,
+    };
+    VkPhysicalDeviceVulkan12Features vulkan12_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .descriptorIndexing = VK_TRUE,
+        .runtimeDescriptorArray = VK_TRUE,
+        .descriptorBindingPartiallyBound = VK_TRUE,
+        .descriptorBindingUpdateUnusedWhilePending = VK_TRUE,
+        .descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE,
+        .descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+        .descriptorBindingStorageImageUpdateAfterBind = VK_TRUE,
+        .shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
+        .shaderStorageBufferArrayNonUniformIndexing = VK_TRUE,
+        .shaderStorageImageArrayNonUniformIndexing =
+            supported_vulkan12_features.shaderStorageImageArrayNonUniformIndexing,
+    };
+    VkPhysicalDeviceFeatures device_features = { 0 };
+    VkDeviceCreateInfo device_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = &vulkan12_features,
+        .pQueueCreateInfos = &queue_cinfo,
+        .queueCreateInfoCount = 1,
+        .pEnabledFeatures = &device_features,
+    };
+    if (vkCreateDevice(offscreen->physical_device, &device_cinfo, NULL, &offscreen->device) != VK_SUCCESS) return 4;
+    vkGetDeviceQueue(offscreen->device, offscreen->queue_family, 0, &offscreen->queue);
+
+    //
+    VkCommandPoolCreateInfo pool_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = offscreen->queue_family,
+    };
+    if (vkCreateCommandPool(offscreen->device, &pool_cinfo, NULL, &offscreen->command_pool) != VK_SUCCESS) return 4;
+    if (host_memory_init(&offscreen->host) > 0) return 4;
+    if (bindless_init(&offscreen->bindless, &offscreen->host, offscreen->device, offscreen->physical_device, 0) > 0)
+        return 4;
+
+    return 0;
+}
+
+void offscreen_free(struct Offscreen *offscreen) {
+    if (offscreen->device != VK_NULL_HANDLE) {
+        vkDeviceWaitIdle(offscreen->device);
+        if (offscreen->bindless.set != VK_NULL_HANDLE) bindless_free(&offscreen->bindless, offscreen->device);
+        vkDestroyCommandPool(offscreen->device, offscreen->command_pool, NULL);
+        vkDestroyDevice(offscreen->device, NULL);
+    }
+    if (offscreen->instance != VK_NULL_HANDLE) vkDestroyInstance(offscreen->instance, NULL);
+    host_memory_free(&offscreen->host);
+
+    memset(offscreen, 0, sizeof(*offscreen));
+}
+
+int offscreen_render(
+        struct Offscreen *offscreen,
+        const struct Scene *scene,
+        const struct Bvh *bvh,
+        const struct SceneCamera *camera,
+        const struct Environment *environment,
+        uint32_t width,
+        uint32_t height,
+        VkExtent2D allocated,
+        uint32_t samples,
+        uint32_t bounces,
+        float *rgb) {
+#if DEBUG_INPUT_VALIDATION
+    if (offscreen == NULL || offscreen->device == VK_NULL_HANDLE) return 1;
+    if (scene == NULL || bvh == NULL || rgb == NULL) return 1;
+    if (width == 0 || height == 0 || samples == 0) return 1;
+    if (allocated.width != 0 && (allocated.width < width || allocated.height < height)) return 1;
+#endif
+
+    VkDevice device = offscreen->device;
+    if (allocated.width == 0) allocated = (VkExtent2D) { width, height };
+
+    // One sample per dispatch seeds every sample as cpu_tracer_render does.
+    struct Tracer tracer = { 0 };
+    struct TraceSettings settings = {
+        .kernel = TraceKernel_Specialized,
+        .bounces = bounces,
+        .samples_per_dispatch = 1,
+    };
+    int result = tracer_init(
+            &tracer,
+            device,
+            offscreen->physical_device,
+            offscreen->queue,
+            offscreen->queue_family,
+            offscreen->path,
+            NULL,
+            &offscreen->bindless,
+            scene,
+            bvh,
+            environment,
+            NULL,
+            0,
+            allocated,
+            &settings,
+            0);
+    if (camera != NULL) tracer.camera = *camera;
+    if (result == 0) tracer_set_render_extent(&tracer, (VkExtent2D) { width, height });
+
+    VkDeviceSize size = (VkDeviceSize)width * height * 4 * sizeof(float);
+    VkBuffer readback = VK_NULL_HANDLE;
+    VkDeviceMemory readback_memory = VK_NULL_HANDLE;
+    if (result == 0) {
+        result = create_buffer(
+                device,
+                offscreen->physical_device,
+                size,
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                GpuMemoryCategory_Staging,
+                &readback,
+                &readback_memory);
+    }
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    if (result == 0) {
+        VkCommandBufferAllocateInfo command_buffer_ainfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = offscreen->command_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+        if (vkAllocateCommandBuffers(device, &command_buffer_ainfo, &command_buffer) != VK_SUCCESS) result = 2;
+    }
+    if (result > 0) {
+        vkDestroyBuffer(device, readback, NULL);
+        gpu_memory_free(device, readback_memory);
+        tracer_free(&tracer);
+        bindless_retire(&offscreen->bindless, 0);
+        return 2;
+    }
+
+    // Trace into output 0, then copy it out.
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    vkBeginCommandBuffer(command_buffer, &begin_info);
+    VkImageMemoryBarrier output_barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = 0,
+        .dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = tracer.outputs[0].image,
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+    };
+    vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            0,
+            NULL,
+            0,
+            NULL,
+            1,
+            &output_barrier);
+    for (uint32_t s = 0; s < samples; s++) tracer_record(&tracer, command_buffer, 0, NULL, NULL);
+    output_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    output_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    output_barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    output_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0,
+            0,
+            NULL,
+            0,
+            NULL,
+            1,
+            &output_barrier);
+    VkBufferImageCopy region = {
+        .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+        .imageExtent = { width, height, 1 },
+    };
+    vkCmdCopyImageToBuffer(
+            command_buffer,
+            tracer.outputs[0].image,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            readback,
+            1,
+            &region);
+    VkBufferMemoryBarrier readback_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = readback,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE,
+    };
+    vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_HOST_BIT,
+            0,
+            0,
+            NULL,
+            1,
+            &readback_barrier,
+            0,
+            NULL);
+    vkEndCommandBuffer(command_buffer);
+
+    // Nothing else runs on the device, waiting for the queue is enough.
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &command_buffer,
+    };
+    if (vkQueueSubmit(offscreen->queue, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS
+            || vkQueueWaitIdle(offscreen->queue) != VK_SUCCESS)
+        result = 3;
+    void *mapped = NULL;
+    if (result == 0 && vkMapMemory(device, readback_memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS) result = 3;
+    if (result == 0) {
+        const float *rgba = mapped;
+        for (size_t i = 0; i < (size_t)width * height; i++) {
+            rgb[i * 3 + 0] = rgba[i * 4 + 0];
+            rgb[i * 3 + 1] = rgba[i * 4 + 1];
+            rgb[i * 3 + 2] = rgba[i * 4 + 2];
+        }
+    }
+
+    //
+    vkFreeCommandBuffers(device, offscreen->command_pool, 1, &command_buffer);
+    vkDestroyBuffer(device, readback, NULL);
+    gpu_memory_free(device, readback_memory); // Unmaps.
+    tracer_free(&tracer);
+    bindless_retire(&offscreen->bindless, 0); // The device is idle.
+    return result;
+}
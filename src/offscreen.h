@@ -0,0 +1,50 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include "bindless.h"
+#include "bvh.h"
+#include "environment.h"
+#include "host_memory.h"
+#include "scene.h"
+
+// Compute only device without a window or surface, for tracing offscreen,
+// e.g. on lavapipe where there is no display.
+struct Offscreen {
+    VkInstance instance;
+    VkPhysicalDevice physical_device;
+    VkDevice device;
+    VkQueue queue;
+    uint32_t queue_family;
+    VkCommandPool command_pool;
+    struct HostMemory host; // of the bindless slot lists
+    struct Bindless bindless;
+    const char *path; // of the compiled shaders, ending in a slash
+};
+
+// Takes the first physical device and a compute queue of it. Returns 2 when
+// there is no Vulkan 1.3 instance or device, 3 without the descriptor
+// indexing the bindless set relies on and 4 when the device, command pool,
+// host memory or bindless set cannot be created.
+int offscreen_init(struct Offscreen *offscreen, const char *path);
+void offscreen_free(struct Offscreen *offscreen);
+
+// Traces samples one sample dispatches of trace.comp at width by height,
+// the seeds cpu_tracer_render takes, and reads the mean back into rgb, 3
+// floats per pixel. allocated is the extent of the tracer's images, of which
+// the top left width by height is traced as after a resize, or 0 by 0 for
+// exactly width by height. camera NULL takes the scene's, environment NULL
+// leaves the sky, bounces of 0 TRACE_DEFAULT_BOUNCES. Returns 2 when the
+// tracer or readback buffer cannot be created and 3 when the submission
+// fails.
+int offscreen_render(
+        struct Offscreen *offscreen,
+        const struct Scene *scene,
+        const struct Bvh *bvh,
+        const struct SceneCamera *camera,
+        const struct Environment *environment,
+        uint32_t width,
+        uint32_t height,
+        VkExtent2D allocated,
+        uint32_t samples,
+        uint32_t bounces,
+        float *rgb);
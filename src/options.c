@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "gpu_memory.h"
+#include "idle.h"
+#include "options.h"
+
+int options_parse(struct Options *options, int argc, char **argv) {
+#if DEBUG_INPUT_VALIDATION
+    if (options == NULL) return 1;
+    if (argc > 0 && argv == NULL) return 1;
+#endif
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--queue") == 0) {
+            if (++i == argc) return 3;
+            if (strcmp(argv[i], "auto") == 0) options->queue_mode = QueueMode_Auto;
+            else if (strcmp(argv[i], "single") == 0) options->queue_mode = QueueMode_Single;
+            else if (strcmp(argv[i], "async") == 0) options->queue_mode = QueueMode_Async;
+            else return 3;
+        } else if (strcmp(arg, "--traversal") == 0) {
+            if (++i == argc) return 3;
+            if (strcmp(argv[i], "auto") == 0) options->traversal_mode = TraversalMode_Auto;
+            else if (strcmp(argv[i], "software") == 0) options->traversal_mode = TraversalMode_Software;
+            else if (strcmp(argv[i], "hardware") == 0) options->traversal_mode = TraversalMode_Hardware;
+            else return 3;
+        } else if (strcmp(arg, "--scene") == 0) {
+            if (++i == argc) return 3;
+            options->scene_path = argv[i];
+        } else if (strcmp(arg, "--environment") == 0) {
+            if (++i == argc) return 3;
+            options->environment_path = argv[i];
+        } else if (strcmp(arg, "--environment-sampling") == 0) {
+            if (++i == argc) return 3;
+            if (strcmp(argv[i], "mis") == 0) options->environment_sampling = EnvironmentSampling_Mis;
+            else if (strcmp(argv[i], "bsdf") == 0) options->environment_sampling = EnvironmentSampling_Bsdf;
+            else return 3;
+        } else if (strcmp(arg, "--environment-compare") == 0) {
+            options->environment_compare = 1;
+        } else if (strcmp(arg, "--light-compare") == 0) {
+            options->light_compare = 1;
+        } else if (strcmp(arg, "--sequence") == 0) {
+            if (++i == argc) return 3;
+            if (strcmp(argv[i], "sobol") == 0) options->sample_sequence = SamplerSequence_Sobol;
+            else if (strcmp(argv[i], "random") == 0) options->sample_sequence = SamplerSequence_Random;
+            else return 3;
+        } else if (strcmp(arg, "--sampler-compare") == 0) {
+            options->sampler_compare = 1;
+        } else if (strcmp(arg, "--kernel") == 0) {
+            if (++i == argc) return 3;
+            struct TraceSettings *s = &options->trace_settings;
+            if (strcmp(argv[i], "specialized") == 0) s->kernel = TraceKernel_Specialized;
+            else if (strcmp(argv[i], "uniform") == 0) s->kernel = TraceKernel_Uniform;
+            else if (strcmp(argv[i], "compare") == 0) s->kernel = TraceKernel_Compare;
+            else return 3;
+        } else if (strcmp(arg, "--path-mode") == 0) {
+            if (++i == argc) return 3;
+            if (strcmp(argv[i], "megakernel") == 0) options->path_mode = PathMode_Megakernel;
+            else if (strcmp(argv[i], "wavefront") == 0) options->path_mode = PathMode_Wavefront;
+            else if (strcmp(argv[i], "compare") == 0) options->path_mode = PathMode_Compare;
+            else return 3;
+        } else if (strcmp(arg, "--sort") == 0) {
+            if (++i == argc) return 3;
+            if (strcmp(argv[i], "none") == 0) options->wavefront_sort = WavefrontSort_None;
+            else if (strcmp(argv[i], "morton") == 0) options->wavefront_sort = WavefrontSort_Morton;
+            else if (strcmp(argv[i], "material") == 0) options->wavefront_sort = WavefrontSort_Material;
+            else return 3;
+        } else if (strcmp(arg, "--instances") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->animated_instances = strtoul(argv[i], &end, 10);
+            if (*end != 0 || options->animated_instances == 0) return 3;
+        } else if (strcmp(arg, "--bounces") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->trace_settings.bounces = strtoul(argv[i], &end, 10);
+            if (*end != 0 || options->trace_settings.bounces == 0) return 3;
+        } else if (strcmp(arg, "--spp") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->trace_settings.samples_per_dispatch = strtoul(argv[i], &end, 10);
+            if (*end != 0 || options->trace_settings.samples_per_dispatch == 0) return 3;
+            if (options->trace_settings.samples_per_dispatch > TRACE_MAX_SAMPLES_PER_DISPATCH) return 3;
+        } else if (strcmp(arg, "--group-size") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            uint32_t group_size = strtoul(argv[i], &end, 10);
+            if (*end != 0 || (group_size != 4 && group_size != 8 && group_size != 16)) return 3;
+            options->trace_settings.group_size = group_size;
+        } else if (strcmp(arg, "--denoise") == 0) {
+            options->denoise = 1;
+        } else if (strcmp(arg, "--denoise-iterations") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->denoise_settings.iterations = strtoul(argv[i], &end, 10);
+            if (*end != 0) return 3;
+            if (options->denoise_settings.iterations == 0) return 3;
+            if (options->denoise_settings.iterations > DENOISE_MAX_ITERATIONS) return 3;
+            options->denoise = 1;
+        } else if (strcmp(arg, "--denoise-weights") == 0) {
+            if (++i == argc) return 3;
+            struct DenoiseSettings *s = &options->denoise_settings;
+            if (sscanf(argv[i], "%f,%f,%f", &s->sigma_luminance, &s->sigma_normal, &s->sigma_depth) != 3)
+                return 3;
+            options->denoise = 1;
+        } else if (strcmp(arg, "--denoise-alpha") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->denoise_settings.alpha = strtof(argv[i], &end);
+            if (*end != 0) return 3;
+            if (!(options->denoise_settings.alpha > 0.0f && options->denoise_settings.alpha <= 1.0f)) return 3;
+            options->denoise = 1;
+        } else if (strcmp(arg, "--denoise-reference") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->denoise_settings.reference_samples = strtoul(argv[i], &end, 10);
+            if (*end != 0 || options->denoise_settings.reference_samples == 0) return 3;
+            options->denoise = 1;
+        } else if (strcmp(arg, "--sampling") == 0) {
+            if (++i == argc) return 3;
+            if (strcmp(argv[i], "uniform") == 0) options->adaptive_settings.mode = SamplingMode_Uniform;
+            else if (strcmp(argv[i], "adaptive") == 0) options->adaptive_settings.mode = SamplingMode_Adaptive;
+            else return 3;
+            options->sampling = 1;
+        } else if (strcmp(arg, "--target-error") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->adaptive_settings.target_error = strtof(argv[i], &end);
+            if (*end != 0 || !(options->adaptive_settings.target_error > 0.0f)) return 3;
+            options->sampling = 1;
+        } else if (strcmp(arg, "--frame-time") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->resolution_settings.target_ms = strtof(argv[i], &end);
+            if (*end != 0 || !(options->resolution_settings.target_ms > 0.0f)) return 3;
+        } else if (strcmp(arg, "--min-scale") == 0 || strcmp(arg, "--max-scale") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            float scale = strtof(argv[i], &end);
+            if (*end != 0 || !(scale > 0.0f && scale <= 1.0f)) return 3;
+            if (arg[3] == 'i') options->resolution_settings.min_scale = scale;
+            else options->resolution_settings.max_scale = scale;
+        } else if (strcmp(arg, "--upscale") == 0) {
+            if (++i == argc) return 3;
+            if (strcmp(argv[i], "bilinear") == 0) options->resolution_settings.upscale = Upscale_Bilinear;
+            else if (strcmp(argv[i], "edge") == 0) options->resolution_settings.upscale = Upscale_Edge;
+            else return 3;
+        } else if (strcmp(arg, "--capture-every") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->capture_every = strtoul(argv[i], &end, 10);
+            if (*end != 0) return 3;
+        } else if (strcmp(arg, "--capture-format") == 0) {
+            if (++i == argc) return 3;
+            if (strcmp(argv[i], "png") == 0) options->capture_format = CaptureFormat_Png;
+            else if (strcmp(argv[i], "ppm") == 0) options->capture_format = CaptureFormat_Ppm;
+            else if (strcmp(argv[i], "exr") == 0) options->capture_format = CaptureFormat_Exr;
+            else return 3;
+        } else if (strcmp(arg, "--capture-dir") == 0) {
+            if (++i == argc) return 3;
+            options->capture_directory = argv[i];
+        } else if (strcmp(arg, "--video") == 0) {
+            if (++i == argc) return 3;
+            options->video_path = argv[i];
+        } else if (strcmp(arg, "--video-format") == 0) {
+            if (++i == argc) return 3;
+            if (strcmp(argv[i], "y4m") == 0) options->video_format = VideoFormat_Y4m;
+            else if (strcmp(argv[i], "rgb") == 0) options->video_format = VideoFormat_Rgb;
+            else return 3;
+        } else if (strcmp(arg, "--video-fps") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->video_fps = strtoul(argv[i], &end, 10);
+            if (*end != 0 || options->video_fps == 0) return 3;
+        } else if (strcmp(arg, "--memory-limit") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->memory_soft_limit = strtof(argv[i], &end);
+            if (*end != 0 || !(options->memory_soft_limit > 0.0f && options->memory_soft_limit <= 1.0f)) return 3;
+        } else if (strcmp(arg, "--continuous") == 0) {
+            options->continuous = 1;
+        } else if (strcmp(arg, "--idle-samples") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->idle_samples = strtoul(argv[i], &end, 10);
+            if (*end != 0 || options->idle_samples == 0) return 3;
+        } else if (strcmp(arg, "--coordinator") == 0 || strcmp(arg, "--worker") == 0) {
+            if (++i == argc) return 3;
+            options->distributed_role = arg[2] == 'c' ? DistributedRole_Coordinator : DistributedRole_Worker;
+            options->distributed_settings.address = argv[i];
+        } else if (strcmp(arg, "--spawn-workers") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->distributed_settings.spawn_n = strtoul(argv[i], &end, 10);
+            if (*end != 0 || options->distributed_settings.spawn_n > DISTRIBUTED_MAX_WORKERS) return 3;
+        } else if (strcmp(arg, "--wait-workers") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->distributed_settings.workers_n = strtoul(argv[i], &end, 10);
+            if (*end != 0 || options->distributed_settings.workers_n > DISTRIBUTED_MAX_WORKERS) return 3;
+        } else if (strcmp(arg, "--tile") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->distributed_settings.tile_size = strtoul(argv[i], &end, 10);
+            if (*end != 0 || options->distributed_settings.tile_size == 0) return 3;
+        } else if (strcmp(arg, "--size") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->distributed_settings.width = strtoul(argv[i], &end, 10);
+            if (*end != 'x') return 3;
+            options->distributed_settings.height = strtoul(end + 1, &end, 10);
+            if (*end != 0 || options->distributed_settings.width == 0 || options->distributed_settings.height == 0)
+                return 3;
+        } else if (strcmp(arg, "--samples") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->distributed_settings.samples = strtoul(argv[i], &end, 10);
+            if (*end != 0 || options->distributed_settings.samples == 0) return 3;
+        } else if (strcmp(arg, "--output") == 0) {
+            if (++i == argc) return 3;
+            options->distributed_settings.output_path = argv[i];
+        } else if (strcmp(arg, "--scaling") == 0) {
+            options->distributed_settings.scaling = 1;
+        } else if (strcmp(arg, "--serve") == 0) {
+            if (++i == argc) return 3;
+            options->serve_address = argv[i];
+        } else if (strcmp(arg, "--spool") == 0) {
+            if (++i == argc) return 3;
+            options->spool_directory = argv[i];
+        } else if (strcmp(arg, "--regress") == 0) {
+            if (++i == argc) return 3;
+            options->regress_settings.directory = argv[i];
+        } else if (strcmp(arg, "--regress-update") == 0) {
+            options->regress_settings.update = 1;
+        } else if (strcmp(arg, "--regress-gpu") == 0) {
+            options->regress_settings.gpu = 1;
+        } else if (strcmp(arg, "--regress-tolerance") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->regress_settings.tolerance = strtof(argv[i], &end);
+            if (*end != 0 || options->regress_settings.tolerance <= 0.0f) return 3;
+        } else if (strcmp(arg, "--regress-rmse") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->regress_settings.rmse = strtof(argv[i], &end);
+            if (*end != 0 || options->regress_settings.rmse <= 0.0f) return 3;
+        } else if (strcmp(arg, "--regress-gpu-rmse") == 0) {
+            if (++i == argc) return 3;
+            char *end = NULL;
+            options->regress_settings.gpu_rmse = strtof(argv[i], &end);
+            if (*end != 0 || options->regress_settings.gpu_rmse <= 0.0f) return 3;
+        } else if (strcmp(arg, "--dump-graph") == 0) {
+            options->dump_graph = 1;
+        } else {
+            return 2;
+        }
+    }
+
+    return 0;
+}
+
+void options_usage(const char *program) {
+    printf("usage: %s [options]\n", program);
+    printf("  --queue auto|single|async  queue the trace dispatches run on (default auto)\n");
+    printf("  --traversal auto|software|hardware\n");
+    printf("                             BVH in the shader, or ray queries (default auto)\n");
+    printf("  --scene PATH               OBJ file to render instead of the built in scene\n");
+    printf("  --environment PATH|%s     .hdr or .pfm lat-long map lighting the scene instead of the sky,\n",
+            ENVIRONMENT_SUN);
+    printf("                             or a procedural sky with a small sun\n");
+    printf("  --environment-sampling mis|bsdf\n");
+    printf("                             light samples from the map's alias table MIS weighted with BSDF\n");
+    printf("                             samples, or BSDF samples alone (default mis)\n");
+    printf("  --environment-compare      render both on the CPU for equal time, report their noise and exit\n");
+    printf("  --light-compare            add %u small lights to the scene, render on the CPU for equal time\n",
+            LIGHT_TREE_COMPARE_LIGHTS);
+    printf("                             picking them uniformly and through the light tree, report the\n");
+    printf("                             noise of both and exit\n");
+    printf("  --sequence sobol|random    path random numbers from Owen-scrambled Sobol points rotated by\n");
+    printf("                             blue noise per pixel, or hashed per pixel and sample (default sobol)\n");
+    printf("  --sampler-compare          render on the CPU at 1 to %u spp with both, report their error\n",
+            SAMPLER_COMPARE_MAX_SAMPLES);
+    printf("                             against sample count and exit\n");
+    printf("  --kernel specialized|uniform|compare\n");
+    printf("                             trace variant with baked constants, one branching on push\n");
+    printf("                             constants, or alternate and report both (default specialized)\n");
+    printf("  --path-mode megakernel|wavefront|compare\n");
+    printf("                             whole paths per thread, one dispatch per stage and bounce over\n");
+    printf("                             ray queues, or alternate and report both (default megakernel);\n");
+    printf("                             wavefront paths are untextured, compare needs an untextured scene\n");
+    printf("  --sort none|morton|material\n");
+    printf("                             wavefront rays by origin and direction before extension, or\n");
+    printf("                             hits by material before shading, timed against unsorted\n");
+    printf("  --instances N              animate N instances in a CPU two level BVH and report its\n");
+    printf("                             per-frame update time, e.g. 10000\n");
+    printf("  --bounces N                path length (default %d)\n", TRACE_DEFAULT_BOUNCES);
+    printf("  --spp N                    samples per pixel per frame, 1 to %d (default 1)\n",
+            TRACE_MAX_SAMPLES_PER_DISPATCH);
+    printf("  --group-size 4|8|16        trace workgroup width and height, 8 with --sampling (default 8)\n");
+    printf("  --denoise                  filter each frame's sample, guided by normal, depth and albedo\n");
+    printf("  --denoise-iterations N     a-trous passes, 1 to %d (default 5)\n", DENOISE_MAX_ITERATIONS);
+    printf("  --denoise-weights L,N,Z    luminance, normal and depth edge weights (default 4,128,0.1)\n");
+    printf("  --denoise-alpha A          temporal blend floor, lower keeps more history (default 0.1)\n");
+    printf("  --denoise-reference N      log error at 1, 4 and 16 spp against N accumulated spp\n");
+    printf("  --sampling uniform|adaptive\n");
+    printf("                             trace every tile, or only tiles above the target error\n");
+    printf("  --target-error E           relative standard error a tile converges at (default %g)\n",
+            ADAPTIVE_DEFAULT_ERROR);
+    printf("  --frame-time MS            scale the trace and denoise resolution every frame to hold this\n");
+    printf("                             GPU time, restarting accumulation on a resize (default off)\n");
+    printf("  --min-scale S              smallest scale of the swapchain size per axis (default %g)\n",
+            RESOLUTION_DEFAULT_MIN_SCALE);
+    printf("  --max-scale S              largest scale, the size images are allocated at, at most 1\n");
+    printf("                             (default %g)\n", RESOLUTION_DEFAULT_MAX_SCALE);
+    printf("  --upscale bilinear|edge    fill the swapchain bilinearly, or keeping luminance edges sharp\n");
+    printf("  --capture-every N          save every Nth frame, F12 saves one (default 0, F12 only)\n");
+    printf("  --capture-format png|ppm|exr\n");
+    printf("  --capture-dir DIR          where captures go (default .)\n");
+    printf("  --video PATH               stream every frame to a file or named pipe, - for stdout\n");
+    printf("  --video-format y4m|rgb     Y4M 4:2:0, or raw RGB24 frames (default y4m)\n");
+    printf("  --video-fps N              frame rate written to the Y4M header (default 30)\n");
+    printf("  --memory-limit F           fraction of a heap's budget past which textures are evicted\n");
+    printf("                             ahead of need (default %g)\n", GPU_MEMORY_DEFAULT_SOFT_LIMIT);
+    printf("  --continuous               draw every frame, even once the image has converged\n");
+    printf("  --idle-samples N           samples per pixel after which a static image stops drawing until\n");
+    printf("                             input arrives, unless --sampling decides (default %d)\n",
+            IDLE_DEFAULT_SAMPLES);
+    printf("  --dump-graph               print the frame graph's passes, barriers and memory\n");
+    printf("headless tile rendering, unix:PATH or HOST:PORT addresses:\n");
+    printf("  --coordinator ADDRESS      hand out tiles of one frame to workers connecting to ADDRESS\n");
+    printf("  --worker ADDRESS           render tiles on the CPU for the coordinator at ADDRESS\n");
+    printf("  --spawn-workers N          worker processes the coordinator starts itself (default 0)\n");
+    printf("  --wait-workers N           workers to wait for before rendering (default spawned, or 1)\n");
+    printf("  --tile N                   tile width and height (default %d)\n", DISTRIBUTED_DEFAULT_TILE);
+    printf("  --size WxH                 frame size (default %dx%d)\n",
+            DISTRIBUTED_DEFAULT_WIDTH, DISTRIBUTED_DEFAULT_HEIGHT);
+    printf("  --samples N                samples per pixel (default %d)\n", DISTRIBUTED_DEFAULT_SAMPLES);
+    printf("  --output PATH              .exr, .png or .ppm of the frame\n");
+    printf("  --scaling                  render with 1, 2, ... workers and report the scaling efficiency\n");
+    printf("render server, jobs of key=value pairs, see server.h:\n");
+    printf("  --serve ADDRESS            take jobs from clients connecting to ADDRESS\n");
+    printf("  --spool DIR                take jobs from *.job files showing up in DIR\n");
+    printf("regression checks, see regress.sh:\n");
+    printf("  --regress DIR              render the reference scenes and compare with the golden images and\n");
+    printf("                             this machine's timing baselines in DIR, recorded when missing\n");
+    printf("  --regress-update           write the current images and timings to DIR instead\n");
+    printf("  --regress-gpu              also trace each scene with the kernel on an offscreen device, e.g. lavapipe\n");
+    printf("  --regress-tolerance PCT    slowdown past a baseline that fails (default %g)\n", REGRESS_DEFAULT_TOLERANCE);
+    printf("  --regress-rmse E           image error that fails, of full scale (default %g)\n", REGRESS_DEFAULT_RMSE);
+    printf("  --regress-gpu-rmse E       the same for the --regress-gpu images (default %g)\n", REGRESS_DEFAULT_GPU_RMSE);
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <stdint.h>
+#include "adaptive.h"
+#include "capture.h"
+#include "denoise.h"
+#include "distributed.h"
+#include "environment.h"
+#include "regress.h"
+#include "resolution.h"
+#include "sampler.h"
+#include "trace.h"
+#include "video.h"
+#include "wavefront.h"
+
+// Which queue the trace work is submitted to.
+enum QueueMode {
+    QueueMode_Auto = 0, // async when the device has a dedicated compute family
+    QueueMode_Single,
+    QueueMode_Async,
+};
+
+// How trace rays find the nearest triangle.
+enum TraversalMode {
+    TraversalMode_Auto = 0, // hardware when the device supports ray queries
+    TraversalMode_Software,
+    TraversalMode_Hardware,
+};
+
+// Command line settings, all zero is the default configuration.
+struct Options {
+    enum QueueMode queue_mode;
+    enum TraversalMode traversal_mode;
+    const char *scene_path; // OBJ, NULL for the built in scene
+    const char *environment_path; // .hdr, .pfm or ENVIRONMENT_SUN, NULL for the sky
+    enum EnvironmentSampling environment_sampling;
+    int environment_compare; // headless, noise of both samplings at equal time
+    int light_compare; // headless, noise of uniform and tree light selection at equal time
+    enum SamplerSequence sample_sequence; // random numbers of the megakernel's paths
+    int sampler_compare; // headless, error against sample count of both sequences
+    struct TraceSettings trace_settings; // kernel variant
+    enum PathMode path_mode;
+    enum WavefrontSort wavefront_sort;
+    uint32_t animated_instances; // moving instances in the CPU two level structure, 0 for none
+    // Denoiser over the per-frame samples.
+    int denoise;
+    struct DenoiseSettings denoise_settings;
+    // Per-tile sample statistics, adaptive or only measured.
+    int sampling;
+    struct AdaptiveSettings adaptive_settings;
+    // Dynamic resolution, rendering below the swapchain size to hold a frame time.
+    struct ResolutionSettings resolution_settings;
+    // Frame capture, every Nth frame and on F12.
+    uint32_t capture_every; // 0 captures on F12 only
+    enum CaptureFormat capture_format;
+    const char *capture_directory; // NULL for the working directory
+    // Video stream of every frame, "-" for stdout.
+    const char *video_path; // NULL when not streaming
+    enum VideoFormat video_format;
+    uint32_t video_fps; // 0 for 30
+    int dump_graph; // print the compiled frame graph and its first frame's barriers
+    float memory_soft_limit; // fraction of a heap's budget, 0 for the default
+    // Idling once the image stops changing.
+    int continuous; // draw every iteration regardless
+    uint32_t idle_samples; // per pixel that count as converged without --sampling, 0 for the default
+    // Headless tile rendering across processes, instead of the window.
+    enum DistributedRole distributed_role;
+    struct DistributedSettings distributed_settings; // scene and bounces come from the options above
+    // Render server taking jobs, instead of the window.
+    const char *serve_address; // NULL without a socket
+    const char *spool_directory; // NULL without a spool
+    // Golden image and timing checks, instead of the window.
+    struct RegressSettings regress_settings; // directory NULL to skip
+};
+
+// Returns 0 on success, 2 on an unknown flag, 3 on a bad or missing value.
+int options_parse(struct Options *options, int argc, char **argv);
+void options_usage(const char *program);
@@ -0,0 +1,293 @@
+// Camera rays, traversal and sampling shared by the megakernel and the
+// wavefront stages. Include after scene.glsl and a push constant block pc
+// with buffers, width, height, camera_position, camera_target and
+// environment.
+
+#define STACK_SIZE 32
+
+void triangle_vertices(uint triangle, out vec3 a, out vec3 b, out vec3 c) {
+    uint indices = pc.buffers[BUFFER_INDICES];
+    uint positions = pc.buffers[BUFFER_POSITIONS];
+    a = Positions[positions].data[Uints[indices].data[triangle * 3 + 0]].xyz;
+    b = Positions[positions].data[Uints[indices].data[triangle * 3 + 1]].xyz;
+    c = Positions[positions].data[Uints[indices].data[triangle * 3 + 2]].xyz;
+}
+
+Material triangle_material(uint triangle) {
+    return Materials[pc.buffers[BUFFER_MATERIALS]].data[
+        Uints[pc.buffers[BUFFER_TRIANGLE_MATERIALS]].data[triangle]];
+}
+
+#ifdef RAY_QUERY
+bool intersect(vec3 ro, vec3 rd, float t_max, out float t_hit, out uint hit) {
+    rayQueryEXT query;
+    rayQueryInitializeEXT(query, scene_accel, gl_RayFlagsOpaqueEXT, 0xFF, ro, 1e-3, rd, t_max);
+    while (rayQueryProceedEXT(query)) {
+    }
+    if (rayQueryGetIntersectionTypeEXT(query, true) == gl_RayQueryCommittedIntersectionNoneEXT) return false;
+    t_hit = rayQueryGetIntersectionTEXT(query, true);
+    hit = rayQueryGetIntersectionPrimitiveIndexEXT(query, true);
+    return true;
+}
+
+bool occluded(vec3 ro, vec3 rd, float t_max) {
+    rayQueryEXT query;
+    rayQueryInitializeEXT(
+            query,
+            scene_accel,
+            gl_RayFlagsOpaqueEXT | gl_RayFlagsTerminateOnFirstHitEXT,
+            0xFF,
+            ro,
+            1e-3,
+            rd,
+            t_max);
+    while (rayQueryProceedEXT(query)) {
+    }
+    return rayQueryGetIntersectionTypeEXT(query, true) != gl_RayQueryCommittedIntersectionNoneEXT;
+}
+#else
+// Möller-Trumbore, returns the distance or t_max on a miss.
+float intersect_triangle(vec3 ro, vec3 rd, uint triangle, float t_max) {
+    vec3 a, b, c;
+    triangle_vertices(triangle, a, b, c);
+    vec3 e1 = b - a, e2 = c - a;
+    vec3 p = cross(rd, e2);
+    float det = dot(e1, p);
+    if (abs(det) < 1e-9) return t_max;
+    float inv_det = 1.0 / det;
+    vec3 s = ro - a;
+    float u = dot(s, p) * inv_det;
+    if (u < 0.0 || u > 1.0) return t_max;
+    vec3 q = cross(s, e1);
+    float v = dot(rd, q) * inv_det;
+    if (v < 0.0 || u + v > 1.0) return t_max;
+    float t = dot(e2, q) * inv_det;
+    return t > 1e-3 && t < t_max ? t : t_max;
+}
+
+float intersect_box(vec3 ro, vec3 inv_rd, vec3 lo, vec3 hi, float t_max) {
+    vec3 t0 = (lo - ro) * inv_rd;
+    vec3 t1 = (hi - ro) * inv_rd;
+    vec3 near = min(t0, t1), far = max(t0, t1);
+    float t_near = max(max(near.x, near.y), max(near.z, 0.0));
+    float t_far = min(min(far.x, far.y), min(far.z, t_max));
+    return t_near <= t_far ? t_near : 1e30;
+}
+
+// Stack traversal, nearer child first. Hits at or beyond t_max are misses.
+bool intersect(vec3 ro, vec3 rd, float t_max, out float t_hit, out uint hit) {
+    uint nodes = pc.buffers[BUFFER_NODES];
+    uint triangles = pc.buffers[BUFFER_BVH_TRIANGLES];
+    vec3 inv_rd = 1.0 / rd;
+    t_hit = t_max;
+    hit = 0xFFFFFFFFu;
+
+    uint stack[STACK_SIZE];
+    uint stack_n = 0;
+    uint node = 0;
+    if (intersect_box(ro, inv_rd, Nodes[nodes].data[0].min, Nodes[nodes].data[0].max, t_hit) >= 1e30) return false;
+    for (;;) {
+        Node n = Nodes[nodes].data[node];
+        if (n.count > 0) {
+            for (uint i = 0; i < n.count; i++) {
+                uint triangle = Uints[triangles].data[n.left_first + i];
+                float t = intersect_triangle(ro, rd, triangle, t_hit);
+                if (t < t_hit) {
+                    t_hit = t;
+                    hit = triangle;
+                }
+            }
+        } else {
+            uint near = n.left_first, far = n.left_first + 1;
+            float t_near = intersect_box(ro, inv_rd, Nodes[nodes].data[near].min, Nodes[nodes].data[near].max, t_hit);
+            float t_far = intersect_box(ro, inv_rd, Nodes[nodes].data[far].min, Nodes[nodes].data[far].max, t_hit);
+            if (t_far < t_near) {
+                uint swap_node = near; near = far; far = swap_node;
+                float swap_t = t_near; t_near = t_far; t_far = swap_t;
+            }
+            if (t_near < 1e30) {
+                if (t_far < 1e30 && stack_n < STACK_SIZE) stack[stack_n++] = far;
+                node = near;
+                continue;
+            }
+        }
+        if (stack_n == 0) break;
+        node = stack[--stack_n];
+    }
+    return hit != 0xFFFFFFFFu;
+}
+
+// The closest hit search, any hit short of t_max counts.
+bool occluded(vec3 ro, vec3 rd, float t_max) {
+    float t;
+    uint hit;
+    return intersect(ro, rd, t_max, t, hit);
+}
+#endif
+
+// Primary ray through pixel, jittered within it by jitter. The sampling
+// functions take their random numbers explicitly, from the megakernel's
+// sampler, and draw them from state in the overloads the wavefront uses.
+void camera_ray(uvec2 pixel, vec2 jitter, out vec3 ro, out vec3 rd) {
+    vec2 uv = (vec2(pixel) + jitter) / vec2(pc.width, pc.height) * 2.0 - 1.0;
+    uv.x *= float(pc.width) / float(pc.height);
+    vec3 forward = normalize(pc.camera_target.xyz - pc.camera_position.xyz);
+    vec3 right = normalize(cross(forward, vec3(0.0, 1.0, 0.0)));
+    vec3 up = cross(right, forward);
+    float scale = tan(pc.camera_position.w * 0.5);
+    ro = pc.camera_position.xyz;
+    rd = normalize(forward + (right * uv.x - up * uv.y) * scale);
+}
+
+void camera_ray(uvec2 pixel, inout uint state, out vec3 ro, out vec3 rd) {
+    float x = rand(state);
+    camera_ray(pixel, vec2(x, rand(state)), ro, rd);
+}
+
+// Seeds one pixel's samples of an accumulation step.
+uint pixel_seed(uvec2 pixel, uint samples_n) {
+    uint state = (pixel.y * pc.width + pixel.x) * 9781u + samples_n * 6271u;
+    pcg(state);
+    return state;
+}
+
+vec3 sky(vec3 rd) {
+    return mix(vec3(0.9), vec3(0.4, 0.6, 1.0), clamp(rd.y * 0.5 + 0.5, 0.0, 1.0)) * 0.5;
+}
+
+// Environment map, see struct Environment. Without one, escaping rays see the
+// sky and nothing samples it.
+
+float power_heuristic(float a, float b) {
+    return a * a / (a * a + b * b);
+}
+
+vec3 environment_direction(vec2 uv) {
+    float phi = uv.x * 2.0 * PI, theta = uv.y * PI;
+    return vec3(sin(theta) * sin(phi), cos(theta), -sin(theta) * cos(phi));
+}
+
+// Solid angle pdf of a direction in a texel picked with texel_pdf.
+float environment_pdf(EnvironmentHeader header, float texel_pdf, float sin_theta) {
+    return sin_theta > 0.0 ? texel_pdf * float(header.width * header.height) / (2.0 * PI * PI * sin_theta) : 0.0;
+}
+
+bool environment_sampled() {
+    return pc.environment != BINDLESS_INVALID
+        && EnvironmentHeaders[pc.environment].data[0].sampling == ENVIRONMENT_MIS;
+}
+
+// Radiance of a ray that escaped the scene. bsdf_pdf is the solid angle pdf
+// its direction was sampled with, 0 for camera rays, which take it in full.
+// light_fraction is the chance a vertex connects to the environment.
+vec3 environment_escape(vec3 rd, float bsdf_pdf, float light_fraction) {
+    if (pc.environment == BINDLESS_INVALID) return sky(rd);
+
+    EnvironmentHeader header = EnvironmentHeaders[pc.environment].data[0];
+    float u = atan(rd.x, -rd.z) * (0.5 / PI);
+    if (u < 0.0) u += 1.0;
+    float cos_theta = clamp(rd.y, -1.0, 1.0);
+    float v = acos(cos_theta) / PI;
+    uint x = min(uint(u * float(header.width)), header.width - 1);
+    uint y = min(uint(v * float(header.height)), header.height - 1);
+    EnvironmentTexel texel = EnvironmentTexels[pc.environment].data[1 + y * header.width + x];
+    if (header.sampling != ENVIRONMENT_MIS || bsdf_pdf <= 0.0) return texel.radiance;
+
+    float light_pdf = environment_pdf(header, texel.pdf, sqrt(max(1.0 - cos_theta * cos_theta, 0.0)));
+    return light_pdf > 0.0 ? texel.radiance * power_heuristic(bsdf_pdf, light_pdf * light_fraction) : texel.radiance;
+}
+
+// Picks a texel in proportion to its power through the alias table, then a
+// direction in it, u.xy for the texel and alias choice and u.zw within it.
+// Returns the radiance along wi and its solid angle pdf.
+vec3 environment_sample(vec4 u, out vec3 wi, out float pdf) {
+    EnvironmentHeader header = EnvironmentHeaders[pc.environment].data[0];
+    uint texels_n = header.width * header.height;
+    uint index = min(uint(u.x * float(texels_n)), texels_n - 1);
+    EnvironmentTexel texel = EnvironmentTexels[pc.environment].data[1 + index];
+    if (u.y >= texel.probability) {
+        index = texel.alias;
+        texel = EnvironmentTexels[pc.environment].data[1 + index];
+    }
+    vec2 uv = (vec2(index % header.width, index / header.width) + u.zw) / vec2(header.width, header.height);
+    wi = environment_direction(uv);
+    pdf = environment_pdf(header, texel.pdf, sin(uv.y * PI));
+    return texel.radiance;
+}
+
+vec3 environment_sample(inout uint state, out vec3 wi, out float pdf) {
+    vec4 u;
+    u.x = rand(state);
+    u.y = rand(state);
+    u.z = rand(state);
+    u.w = rand(state);
+    return environment_sample(u, wi, pdf);
+}
+
+// Light tree, see struct LightTree.
+
+// Estimated contribution of a node's emitters at p with normal n: power over
+// squared distance, times the cosines at both ends at their most favourable
+// within the node's bounds and cone.
+float light_importance(LightNode node, vec3 p, vec3 n) {
+    vec3 to_light = 0.5 * (node.min + node.max) - p;
+    vec3 half_extent = 0.5 * (node.max - node.min);
+    float distance2 = dot(to_light, to_light), radius2 = dot(half_extent, half_extent);
+    to_light *= distance2 > 0.0 ? inversesqrt(distance2) : 0.0;
+    float cos_b = distance2 > radius2 ? sqrt(1.0 - radius2 / distance2) : -1.0;
+    float sin_b = sqrt(max(1.0 - cos_b * cos_b, 0.0));
+
+    // Emitter side, against the lines of the normals.
+    float cos_w = abs(dot(node.axis, to_light)), sin_w = sqrt(max(1.0 - cos_w * cos_w, 0.0));
+    float cos_o = node.cos_theta, sin_o = sqrt(max(1.0 - cos_o * cos_o, 0.0));
+    float cos_x = cos_w > cos_o ? 1.0 : cos_w * cos_o + sin_w * sin_o;
+    float sin_x = cos_w > cos_o ? 0.0 : sin_w * cos_o - cos_w * sin_o;
+    float cos_emitter = cos_x > cos_b ? 1.0 : cos_x * cos_b + sin_x * sin_b;
+    if (cos_emitter <= 0.0) return 0.0;
+
+    // Receiver side.
+    float cos_i = dot(n, to_light), sin_i = sqrt(max(1.0 - cos_i * cos_i, 0.0));
+    float cos_receiver = cos_i > cos_b ? 1.0 : cos_i * cos_b + sin_i * sin_b;
+    if (cos_receiver <= 0.0) return 0.0;
+
+    return node.power * cos_emitter * cos_receiver / max(distance2, radius2);
+}
+
+// Walks from the root choosing children in proportion to their importance,
+// reusing u. Returns the emissive triangle and the chance of picking it in
+// pmf, 0xFFFFFFFF when no emitter reaches p.
+uint light_tree_sample(uint nodes, vec3 p, vec3 n, float u, out float pmf) {
+    pmf = 1.0;
+    LightNode current = LightNodes[nodes].data[0];
+    while ((current.child_triangle & LIGHT_LEAF) == 0u) {
+        uint left = current.child_triangle;
+        LightNode a = LightNodes[nodes].data[left];
+        LightNode b = LightNodes[nodes].data[left + 1];
+        float importance_a = light_importance(a, p, n), importance_b = light_importance(b, p, n);
+        if (importance_a + importance_b <= 0.0) return 0xFFFFFFFFu;
+        float p_left = importance_a / (importance_a + importance_b);
+        if (u < p_left) {
+            u = min(u / p_left, 0.99999994);
+            current = a;
+            pmf *= p_left;
+        } else {
+            u = min((u - p_left) / (1.0 - p_left), 0.99999994);
+            current = b;
+            pmf *= 1.0 - p_left;
+        }
+    }
+    return current.child_triangle & ~LIGHT_LEAF;
+}
+
+vec3 cosine_hemisphere(vec3 n, vec2 uv) {
+    float u = uv.x, v = uv.y;
+    float r = sqrt(u), phi = 2.0 * PI * v;
+    vec3 t = normalize(abs(n.x) > 0.5 ? cross(n, vec3(0, 1, 0)) : cross(n, vec3(1, 0, 0)));
+    vec3 b = cross(n, t);
+    return normalize(t * r * cos(phi) + b * r * sin(phi) + n * sqrt(1.0 - u));
+}
+
+vec3 cosine_hemisphere(vec3 n, inout uint state) {
+    float u = rand(state);
+    return cosine_hemisphere(n, vec2(u, rand(state)));
+}
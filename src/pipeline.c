@@ -0,0 +1,485 @@
+#include <vulkan/vulkan.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "util.h"
+#include "bindless.h"
+#include "pipeline.h"
+
+// Reads path + name into a malloc'd buffer.
+static int read_spirv(const char *path, const char *name, uint32_t **code, size_t *size) {
+    // Create shader path.
+    char shader_path[256];
+    size_t l = strlen(path);
+    strncpy(shader_path, path, 256);
+    strncat(shader_path, name, 256 - l);
+
+    // Extract shader bytecode from file.
+    FILE *file = fopen(shader_path, "rb");
+    if (file == NULL) return 2;
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    rewind(file);
+    *code = malloc(length > 0 ? length : 1);
+    *size = fread(*code, 1, length > 0 ? length : 0, file);
+    fclose(file);
+    if (*size == 0) {
+        free(*code);
+        *code = NULL;
+        return 2;
+    }
+
+    return 0;
+}
+
+static int create_shader_module_from_code(
+        VkDevice device,
+        const VkAllocationCallbacks *allocator,
+        const uint32_t *code,
+        size_t size,
+        VkShaderModule *shader_module) {
+    VkShaderModuleCreateInfo shader_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = size,
+        .pCode = code,
+    };
+    VkResult result = vkCreateShaderModule(device, &shader_cinfo, allocator, shader_module);
+    if (result != VK_SUCCESS) return 3;
+
+    return 0;
+}
+
+int create_shader_module(
+        VkDevice device,
+        const VkAllocationCallbacks *allocator,
+        const char *path,
+        const char *name,
+        VkShaderModule *shader_module) {
+#if DEBUG_INPUT_VALIDATION
+    if (device == VK_NULL_HANDLE) return 1;
+    if (path == NULL) return 1;
+    if (shader_module == NULL) return 1;
+    if (*shader_module != VK_NULL_HANDLE) return 1;
+#endif
+
+    uint32_t *code = NULL;
+    size_t size = 0;
+    int result = read_spirv(path, name, &code, &size);
+    if (result > 0) return result;
+    result = create_shader_module_from_code(device, allocator, code, size, shader_module);
+    free(code);
+
+    return result;
+}
+
+int create_pipeline_layout(
+        VkDevice device,
+        const VkAllocationCallbacks *allocator,
+        VkDescriptorSetLayout set_layout,
+        VkPipelineLayout *pipeline_layout) {
+#if DEBUG_INPUT_VALIDATION
+    if (device == VK_NULL_HANDLE) return 1;
+    if (set_layout == VK_NULL_HANDLE) return 1;
+    if (pipeline_layout == NULL) return 1;
+    if (*pipeline_layout != VK_NULL_HANDLE) return 1;
+#endif
+
+    VkPushConstantRange push_constant_range = {
+        .stageFlags = VK_SHADER_STAGE_ALL,
+        .offset = 0,
+        .size = BINDLESS_PUSH_CONSTANT_SIZE,
+    };
+    VkPipelineLayoutCreateInfo pipeline_layout_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_constant_range,
+    };
+    VkResult result = vkCreatePipelineLayout(device, &pipeline_layout_cinfo, allocator, pipeline_layout);
+    if (result != VK_SUCCESS) return 2;
+
+    return 0;
+}
+
+// Consumes shader_module.
+static int compile_compute_pipeline(
+        VkDevice device,
+        const char *name,
+        VkShaderModule shader_module,
+        const uint32_t *constants,
+        uint32_t constants_n,
+        VkPipelineLayout pipeline_layout,
+        VkPipeline *pipeline) {
+    VkSpecializationMapEntry map_entries[PIPELINE_MAX_CONSTANTS];
+    for (uint32_t i = 0; i < constants_n; i++) {
+        map_entries[i] = (VkSpecializationMapEntry) {
+            .constantID = i,
+            .offset = i * sizeof(uint32_t),
+            .size = sizeof(uint32_t),
+        };
+    }
+    VkSpecializationInfo specialization_info = {
+        .mapEntryCount = constants_n,
+        .pMapEntries = map_entries,
+        .dataSize = constants_n * sizeof(uint32_t),
+        .pData = constants,
+    };
+
+    VkComputePipelineCreateInfo pipeline_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = shader_module,
+            .pName = "main",
+            .pSpecializationInfo = constants_n > 0 ? &specialization_info : NULL,
+        },
+        .layout = pipeline_layout,
+        .basePipelineIndex = -1,
+    };
+    VkResult make_pipeline_result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipeline_cinfo, NULL, pipeline);
+    vkDestroyShaderModule(device, shader_module, NULL);
+    if (make_pipeline_result != VK_SUCCESS) {
+        printf("%s: %s\n", name, vk_result_to_string(make_pipeline_result));
+        return 3;
+    }
+
+    return 0;
+}
+
+int create_compute_pipeline(
+        VkDevice device,
+        const char *path,
+        const char *name,
+        VkPipelineLayout pipeline_layout,
+        VkPipeline *pipeline) {
+#if DEBUG_INPUT_VALIDATION
+    if (device == VK_NULL_HANDLE) return 1;
+    if (path == NULL || name == NULL) return 1;
+    if (pipeline_layout == VK_NULL_HANDLE) return 1;
+    if (pipeline == NULL) return 1;
+    if (*pipeline != VK_NULL_HANDLE) return 1;
+#endif
+
+    return create_specialized_compute_pipeline(device, path, name, NULL, 0, pipeline_layout, pipeline);
+}
+
+int create_specialized_compute_pipeline(
+        VkDevice device,
+        const char *path,
+        const char *name,
+        const uint32_t *constants,
+        uint32_t constants_n,
+        VkPipelineLayout pipeline_layout,
+        VkPipeline *pipeline) {
+#if DEBUG_INPUT_VALIDATION
+    if (device == VK_NULL_HANDLE) return 1;
+    if (path == NULL || name == NULL) return 1;
+    if (constants_n > PIPELINE_MAX_CONSTANTS) return 1;
+    if (constants_n > 0 && constants == NULL) return 1;
+    if (pipeline_layout == VK_NULL_HANDLE) return 1;
+    if (pipeline == NULL) return 1;
+    if (*pipeline != VK_NULL_HANDLE) return 1;
+#endif
+
+    VkShaderModule shader_module = VK_NULL_HANDLE;
+    int result = create_shader_module(device, NULL, path, name, &shader_module);
+    if (result > 0) return 2;
+
+    return compile_compute_pipeline(
+            device,
+            name,
+            shader_module,
+            constants,
+            constants_n,
+            pipeline_layout,
+            pipeline);
+}
+
+static void pipeline_batch_compile(void *arg) {
+    struct PipelineBatchJob *job = arg;
+    struct PipelineBatch *batch = job->batch;
+
+    job->started_at = time_now();
+    uint32_t *code = NULL;
+    size_t size = 0;
+    VkShaderModule shader_module = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    int result = read_spirv(batch->path, job->name, &code, &size);
+    job->read_at = time_now();
+    if (result == 0) {
+        result = create_shader_module_from_code(batch->device, NULL, code, size, &shader_module);
+        result = result > 0 ? 2 : compile_compute_pipeline(
+                batch->device,
+                job->name,
+                shader_module,
+                job->constants,
+                job->constants_n,
+                batch->layout,
+                &pipeline);
+    } else {
+        result = 2;
+    }
+    free(code);
+
+    pthread_mutex_lock(&batch->lock);
+    job->finished_at = time_now();
+    job->pipeline = pipeline;
+    job->result = result;
+    batch->pending_n -= 1;
+    pthread_cond_broadcast(&batch->done);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+int pipeline_batch_init(
+        struct PipelineBatch *batch,
+        VkDevice device,
+        const char *path,
+        VkDescriptorSetLayout set_layout,
+        struct Workers *workers) {
+#if DEBUG_INPUT_VALIDATION
+    if (batch == NULL) return 1;
+    if (!IS_ZERO_PTR(batch)) return 1;
+    if (device == VK_NULL_HANDLE) return 1;
+    if (path == NULL) return 1;
+    if (set_layout == VK_NULL_HANDLE) return 1;
+    if (workers == NULL) return 1;
+#endif
+
+    batch->device = device;
+    batch->path = path;
+    batch->workers = workers;
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->done, NULL);
+
+    int result = create_pipeline_layout(device, NULL, set_layout, &batch->layout);
+    if (result > 0) return 2;
+
+    return 0;
+}
+
+void pipeline_batch_free(struct PipelineBatch *batch) {
+    if (batch->device == VK_NULL_HANDLE) return; // never initialized
+
+    pipeline_batch_wait(batch);
+    for (uint32_t i = 0; i < batch->jobs_n; i++)
+        if (!batch->jobs[i].taken)
+            vkDestroyPipeline(batch->device, batch->jobs[i].pipeline, NULL);
+    vkDestroyPipelineLayout(batch->device, batch->layout, NULL);
+    pthread_cond_destroy(&batch->done);
+    pthread_mutex_destroy(&batch->lock);
+
+    memset(batch, 0, sizeof(*batch));
+}
+
+int pipeline_batch_push(struct PipelineBatch *batch, const char *name) {
+    return pipeline_batch_push_specialized(batch, name, NULL, 0);
+}
+
+int pipeline_batch_push_specialized(
+        struct PipelineBatch *batch,
+        const char *name,
+        const uint32_t *constants,
+        uint32_t constants_n) {
+#if DEBUG_INPUT_VALIDATION
+    if (batch == NULL || batch->device == VK_NULL_HANDLE) return 1;
+    if (name == NULL || strlen(name) >= PIPELINE_NAME_MAX) return 1;
+    if (constants_n > PIPELINE_MAX_CONSTANTS) return 1;
+    if (constants_n > 0 && constants == NULL) return 1;
+#endif
+
+    if (batch->jobs_n == PIPELINE_BATCH_MAX) return 2;
+    struct PipelineBatchJob *job = &batch->jobs[batch->jobs_n++];
+    job->batch = batch;
+    strlcpy(job->name, name, PIPELINE_NAME_MAX);
+    if (constants_n > 0) memcpy(job->constants, constants, constants_n * sizeof(uint32_t));
+    job->constants_n = constants_n;
+    job->result = -1;
+
+    pthread_mutex_lock(&batch->lock);
+    batch->pending_n += 1;
+    pthread_mutex_unlock(&batch->lock);
+    workers_push(batch->workers, pipeline_batch_compile, job);
+
+    return 0;
+}
+
+void pipeline_batch_wait(struct PipelineBatch *batch) {
+    pthread_mutex_lock(&batch->lock);
+    while (batch->pending_n > 0)
+        pthread_cond_wait(&batch->done, &batch->lock);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+int take_compute_pipeline(
+        struct PipelineBatch *batch,
+        VkDevice device,
+        const char *path,
+        const char *name,
+        VkPipelineLayout pipeline_layout,
+        VkPipeline *pipeline) {
+    return take_specialized_compute_pipeline(batch, device, path, name, NULL, 0, pipeline_layout, pipeline);
+}
+
+int take_specialized_compute_pipeline(
+        struct PipelineBatch *batch,
+        VkDevice device,
+        const char *path,
+        const char *name,
+        const uint32_t *constants,
+        uint32_t constants_n,
+        VkPipelineLayout pipeline_layout,
+        VkPipeline *pipeline) {
+#if DEBUG_INPUT_VALIDATION
+    if (pipeline == NULL) return 1;
+    if (*pipeline != VK_NULL_HANDLE) return 1;
+    if (constants_n > PIPELINE_MAX_CONSTANTS) return 1;
+#endif
+
+    struct PipelineBatchJob *job = NULL;
+    for (uint32_t i = 0; batch != NULL && i < batch->jobs_n && job == NULL; i++) {
+        const struct PipelineBatchJob *candidate = &batch->jobs[i];
+        if (candidate->taken || strcmp(candidate->name, name) != 0) continue;
+        if (candidate->constants_n != constants_n) continue;
+        if (constants_n > 0 && memcmp(candidate->constants, constants, constants_n * sizeof(uint32_t)) != 0) continue;
+        job = &batch->jobs[i];
+    }
+    if (job == NULL) {
+        return create_specialized_compute_pipeline(
+                device,
+                path,
+                name,
+                constants,
+                constants_n,
+                pipeline_layout,
+                pipeline);
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    while (job->result < 0)
+        pthread_cond_wait(&batch->done, &batch->lock);
+    pthread_mutex_unlock(&batch->lock);
+
+    job->taken = 1;
+    *pipeline = job->pipeline;
+    job->pipeline = VK_NULL_HANDLE;
+
+    return job->result;
+}
+
+// FNV-1a over the constants.
+static uint32_t variant_hash(const uint32_t *constants, uint32_t constants_n) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < constants_n; i++) {
+        for (uint32_t b = 0; b < 4; b++) {
+            hash ^= (constants[i] >> (8 * b)) & 0xFF;
+            hash *= 16777619u;
+        }
+    }
+    return hash;
+}
+
+int variant_cache_init(
+        struct VariantCache *cache,
+        VkDevice device,
+        const char *path,
+        const char *name,
+        uint32_t constants_n,
+        VkPipelineLayout pipeline_layout) {
+#if DEBUG_INPUT_VALIDATION
+    if (cache == NULL) return 1;
+    if (!IS_ZERO_PTR(cache)) return 1;
+    if (device == VK_NULL_HANDLE) return 1;
+    if (path == NULL) return 1;
+    if (name == NULL || strlen(name) >= PIPELINE_NAME_MAX) return 1;
+    if (constants_n == 0 || constants_n > PIPELINE_MAX_CONSTANTS) return 1;
+    if (pipeline_layout == VK_NULL_HANDLE) return 1;
+#endif
+
+    cache->device = device;
+    cache->path = path;
+    strlcpy(cache->name, name, PIPELINE_NAME_MAX);
+    cache->constants_n = constants_n;
+    cache->pipeline_layout = pipeline_layout;
+
+    return 0;
+}
+
+void variant_cache_free(struct VariantCache *cache) {
+    for (uint32_t i = 0; i < VARIANT_CACHE_CAPACITY; i++)
+        if (cache->entries[i].used)
+            vkDestroyPipeline(cache->device, cache->entries[i].pipeline, NULL);
+
+    memset(cache, 0, sizeof(*cache));
+}
+
+VkPipeline variant_cache_get(struct VariantCache *cache, struct PipelineBatch *batch, const uint32_t *constants) {
+#if DEBUG_INPUT_VALIDATION
+    if (cache == NULL || cache->device == VK_NULL_HANDLE) return VK_NULL_HANDLE;
+    if (constants == NULL) return VK_NULL_HANDLE;
+#endif
+
+    size_t key_size = cache->constants_n * sizeof(uint32_t);
+    uint32_t slot = variant_hash(constants, cache->constants_n) & (VARIANT_CACHE_CAPACITY - 1);
+    cache->lookups_n += 1;
+    for (uint32_t probe = 0; probe < VARIANT_CACHE_CAPACITY; probe++) {
+        struct VariantEntry *entry = &cache->entries[slot];
+        if (entry->used && memcmp(entry->constants, constants, key_size) == 0) {
+            entry->hits_n += 1;
+            return entry->pipeline;
+        }
+        if (entry->used) {
+            slot = (slot + 1) & (VARIANT_CACHE_CAPACITY - 1);
+            continue;
+        }
+
+        // Miss, fill the empty slot the probe ended on. Without a batch this
+        // compiles on the calling thread.
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        double started_at = time_now();
+        int result = take_specialized_compute_pipeline(
+                batch,
+                cache->device,
+                cache->path,
+                cache->name,
+                constants,
+                cache->constants_n,
+                cache->pipeline_layout,
+                &pipeline);
+        if (result > 0) return VK_NULL_HANDLE;
+        entry->used = 1;
+        memcpy(entry->constants, constants, key_size);
+        entry->pipeline = pipeline;
+        entry->hits_n = 1;
+        entry->lazy = batch == NULL;
+        entry->compile_time = time_now() - started_at;
+        cache->entries_n += 1;
+        if (entry->lazy) cache->compiles_n += 1;
+        return pipeline;
+    }
+
+    return VK_NULL_HANDLE; // full
+}
+
+void variant_cache_report(const struct VariantCache *cache) {
+    printf("[variant] %s: %u variants, %llu lookups, %u compiled while drawing\n",
+            cache->name,
+            cache->entries_n,
+            (unsigned long long)cache->lookups_n,
+            cache->compiles_n);
+    for (uint32_t i = 0; i < VARIANT_CACHE_CAPACITY; i++) {
+        const struct VariantEntry *entry = &cache->entries[i];
+        if (!entry->used) continue;
+        char key[128];
+        int length = 0;
+        for (uint32_t c = 0; c < cache->constants_n && length < (int)sizeof(key); c++)
+            length += snprintf(key + length, sizeof(key) - length, c == 0 ? "%u" : ",%u", entry->constants[c]);
+        printf("[variant]   {%s} %llu uses, %s in %.2f ms\n",
+                key,
+                (unsigned long long)entry->hits_n,
+                entry->lazy ? "compiled" : "taken from the startup batch",
+                entry->compile_time * 1e3);
+    }
+}
@@ -0,0 +1,146 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <pthread.h>
+#include <stdint.h>
+#include "worker.h"
+
+#define PIPELINE_BATCH_MAX 8
+#define PIPELINE_NAME_MAX 64
+#define PIPELINE_MAX_CONSTANTS 8 // specialization constants, ids 0 to n - 1
+#define VARIANT_CACHE_CAPACITY 32 // power of two
+
+// Loads path + name, a SPIR-V binary. allocator may be NULL; destroy the
+// module with the same one.
+int create_shader_module(
+        VkDevice device,
+        const VkAllocationCallbacks *allocator,
+        const char *path,
+        const char *name,
+        VkShaderModule *shader_module);
+
+// Every pipeline sees the same bindless set and receives its handles through
+// push constants, so they all share this layout shape.
+int create_pipeline_layout(
+        VkDevice device,
+        const VkAllocationCallbacks *allocator,
+        VkDescriptorSetLayout set_layout,
+        VkPipelineLayout *pipeline_layout);
+
+int create_compute_pipeline(
+        VkDevice device,
+        const char *path,
+        const char *name,
+        VkPipelineLayout pipeline_layout,
+        VkPipeline *pipeline);
+// Sets specialization constant i to constants[i], all 32 bit.
+int create_specialized_compute_pipeline(
+        VkDevice device,
+        const char *path,
+        const char *name,
+        const uint32_t *constants,
+        uint32_t constants_n,
+        VkPipelineLayout pipeline_layout,
+        VkPipeline *pipeline);
+
+struct PipelineBatch;
+
+struct PipelineBatchJob {
+    struct PipelineBatch *batch;
+    char name[PIPELINE_NAME_MAX];
+    uint32_t constants[PIPELINE_MAX_CONSTANTS];
+    uint32_t constants_n;
+    VkPipeline pipeline;
+    int result; // as create_compute_pipeline, -1 while pending
+    int taken;
+    double started_at, read_at, finished_at; // time_now(), read_at once the file is loaded
+};
+
+// Compute pipelines compiled on the worker pool while the caller carries on
+// with other startup work. They are compiled against one layout from
+// create_pipeline_layout, which is compatible with every module's own.
+struct PipelineBatch {
+    VkDevice device;
+    const char *path;
+    struct Workers *workers;
+    VkPipelineLayout layout;
+    struct PipelineBatchJob jobs[PIPELINE_BATCH_MAX];
+    uint32_t jobs_n;
+    uint32_t pending_n;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+};
+
+int pipeline_batch_init(
+        struct PipelineBatch *batch,
+        VkDevice device,
+        const char *path,
+        VkDescriptorSetLayout set_layout,
+        struct Workers *workers);
+// Waits for pending compiles and destroys the pipelines nobody took.
+void pipeline_batch_free(struct PipelineBatch *batch);
+
+// Queues the SPIR-V binary path + name. Returns 2 when the batch is full.
+int pipeline_batch_push(struct PipelineBatch *batch, const char *name);
+int pipeline_batch_push_specialized(
+        struct PipelineBatch *batch,
+        const char *name,
+        const uint32_t *constants,
+        uint32_t constants_n);
+void pipeline_batch_wait(struct PipelineBatch *batch);
+
+// create_compute_pipeline, but takes the pipeline from batch when it was
+// pushed there, waiting for its compile. batch may be NULL.
+int take_compute_pipeline(
+        struct PipelineBatch *batch,
+        VkDevice device,
+        const char *path,
+        const char *name,
+        VkPipelineLayout pipeline_layout,
+        VkPipeline *pipeline);
+int take_specialized_compute_pipeline(
+        struct PipelineBatch *batch,
+        VkDevice device,
+        const char *path,
+        const char *name,
+        const uint32_t *constants,
+        uint32_t constants_n,
+        VkPipelineLayout pipeline_layout,
+        VkPipeline *pipeline);
+
+struct VariantEntry {
+    int used;
+    uint32_t constants[PIPELINE_MAX_CONSTANTS];
+    VkPipeline pipeline;
+    uint64_t hits_n;
+    int lazy; // compiled on first use, else taken from a batch
+    double compile_time; // seconds, or waiting on the batch
+};
+
+// Specialized variants of one compute shader, keyed by their constants in an
+// open addressing hash map. Variants compile on first use unless a batch
+// already compiled them, e.g. from a precompile list at startup.
+struct VariantCache {
+    VkDevice device;
+    const char *path;
+    char name[PIPELINE_NAME_MAX];
+    VkPipelineLayout pipeline_layout;
+    uint32_t constants_n;
+    struct VariantEntry entries[VARIANT_CACHE_CAPACITY];
+    uint32_t entries_n;
+    uint64_t lookups_n;
+    uint32_t compiles_n; // at draw time, each one a stall
+};
+
+int variant_cache_init(
+        struct VariantCache *cache,
+        VkDevice device,
+        const char *path,
+        const char *name,
+        uint32_t constants_n,
+        VkPipelineLayout pipeline_layout);
+void variant_cache_free(struct VariantCache *cache);
+
+// The variant with constants, from batch when it was pushed there, which may
+// be NULL. VK_NULL_HANDLE when it fails to compile or the cache is full.
+VkPipeline variant_cache_get(struct VariantCache *cache, struct PipelineBatch *batch, const uint32_t *constants);
+void variant_cache_report(const struct VariantCache *cache);
@@ -0,0 +1,144 @@
+#include <vulkan/vulkan.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "profiler.h"
+
+int profiler_init(
+        struct Profiler *profiler,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        uint32_t queue_family,
+        uint32_t slots_n) {
+#if DEBUG_INPUT_VALIDATION
+    if (profiler == NULL) return 1;
+    if (!IS_ZERO_PTR(profiler)) return 1;
+    if (device == VK_NULL_HANDLE) return 1;
+    if (physical_device == VK_NULL_HANDLE) return 1;
+    if (slots_n == 0 || slots_n > PROFILER_SLOTS) return 1;
+#endif
+
+    profiler->device = device;
+    profiler->slots_n = slots_n;
+
+    // Timestamps are optional per queue family.
+    uint32_t families_n = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &families_n, NULL);
+    VkQueueFamilyProperties *families = calloc(families_n, sizeof(*families));
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &families_n, families);
+    uint32_t valid_bits = queue_family < families_n ? families[queue_family].timestampValidBits : 0;
+    free(families);
+    if (valid_bits == 0) {
+        printf("[profiler] queue family %u has no timestamps, GPU times unavailable\n", queue_family);
+        return 0;
+    }
+    profiler->valid_mask = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    profiler->period = properties.limits.timestampPeriod;
+
+    //
+    VkQueryPoolCreateInfo query_pool_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = slots_n * PROFILER_MARKS,
+    };
+    VkResult result = vkCreateQueryPool(device, &query_pool_cinfo, NULL, &profiler->query_pool);
+    if (result != VK_SUCCESS) return 2;
+
+    return 0;
+}
+
+void profiler_free(struct Profiler *profiler) {
+    vkDestroyQueryPool(profiler->device, profiler->query_pool, NULL);
+
+    memset(profiler, 0, sizeof(*profiler));
+}
+
+void profiler_begin(struct Profiler *profiler, VkCommandBuffer command_buffer, uint32_t slot) {
+    if (profiler->query_pool == VK_NULL_HANDLE) return;
+#if DEBUG_INPUT_VALIDATION
+    if (slot >= profiler->slots_n) return;
+#endif
+
+    // Spans of the slot's previous frame.
+    uint32_t marks_n = profiler->marks_n[slot];
+    uint64_t ticks[PROFILER_MARKS];
+    profiler->frame_ms = 0.0;
+    if (marks_n > 1) {
+        VkResult result = vkGetQueryPoolResults(
+                profiler->device,
+                profiler->query_pool,
+                slot * PROFILER_MARKS,
+                marks_n,
+                sizeof(ticks),
+                ticks,
+                sizeof(*ticks),
+                VK_QUERY_RESULT_64_BIT);
+        if (result == VK_SUCCESS) {
+            for (uint32_t i = 1; i < marks_n; i++) {
+                uint64_t delta = (ticks[i] - ticks[i - 1]) & profiler->valid_mask;
+                double ms = delta * profiler->period * 1e-6;
+                profiler->sums[i] += ms;
+                profiler->samples_n[i] += 1;
+                profiler->last[i] = ms;
+                profiler->busy_ms += ms;
+                profiler->frame_ms += ms;
+            }
+        }
+    }
+
+    //
+    vkCmdResetQueryPool(command_buffer, profiler->query_pool, slot * PROFILER_MARKS, PROFILER_MARKS);
+    vkCmdWriteTimestamp(
+            command_buffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            profiler->query_pool,
+            slot * PROFILER_MARKS);
+    profiler->marks_n[slot] = 1;
+}
+
+void profiler_mark(struct Profiler *profiler, VkCommandBuffer command_buffer, uint32_t slot, const char *name) {
+    if (profiler->query_pool == VK_NULL_HANDLE) return;
+#if DEBUG_INPUT_VALIDATION
+    if (slot >= profiler->slots_n) return;
+    if (name == NULL) return;
+#endif
+
+    uint32_t mark = profiler->marks_n[slot];
+    if (mark == 0 || mark >= PROFILER_MARKS) return;
+
+    vkCmdWriteTimestamp(
+            command_buffer,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            profiler->query_pool,
+            slot * PROFILER_MARKS + mark);
+    profiler->names[mark] = name;
+    profiler->marks_n[slot] = mark + 1;
+}
+
+double profiler_average(const struct Profiler *profiler, const char *name) {
+    for (uint32_t i = 1; i < PROFILER_MARKS; i++) {
+        if (profiler->names[i] == NULL || strcmp(profiler->names[i], name) != 0) continue;
+        return profiler->samples_n[i] > 0 ? profiler->sums[i] / profiler->samples_n[i] : 0.0;
+    }
+    return 0.0;
+}
+
+void profiler_report(struct Profiler *profiler) {
+    if (profiler->query_pool == VK_NULL_HANDLE) return;
+
+    char line[256];
+    int length = snprintf(line, sizeof(line), "[gpu]");
+    for (uint32_t i = 1; i < PROFILER_MARKS && length < (int)sizeof(line); i++) {
+        if (profiler->names[i] == NULL || profiler->samples_n[i] == 0) continue;
+        length += snprintf(line + length, sizeof(line) - length, " %s %.3f ms",
+                profiler->names[i],
+                profiler->sums[i] / profiler->samples_n[i]);
+        profiler->sums[i] = 0.0;
+        profiler->samples_n[i] = 0;
+    }
+    printf("%s\n", line);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+
+#define PROFILER_SLOTS 4
+#define PROFILER_MARKS 8 // per slot, the first one only opens the frame
+
+// GPU timestamps around the passes of a frame. Each frame in flight records
+// into its own slot, which is read back the next time the slot is begun, by
+// then its work has completed. Span i is the time between marks i - 1 and i.
+struct Profiler {
+    VkDevice device;
+    VkQueryPool query_pool; // VK_NULL_HANDLE when the queue has no timestamps
+    uint32_t slots_n;
+    double period; // nanoseconds per tick
+    uint64_t valid_mask;
+    uint32_t marks_n[PROFILER_SLOTS]; // written into each slot so far
+    const char *names[PROFILER_MARKS];
+    // Sums since the last report.
+    double sums[PROFILER_MARKS]; // milliseconds
+    uint64_t samples_n[PROFILER_MARKS];
+    double last[PROFILER_MARKS]; // latest span, milliseconds
+    double frame_ms; // spans the latest profiler_begin collected, 0 when it had none
+    double busy_ms; // every span collected so far, never reset
+};
+
+int profiler_init(
+        struct Profiler *profiler,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        uint32_t queue_family,
+        uint32_t slots_n);
+void profiler_free(struct Profiler *profiler);
+
+// Collects the slot's previous spans and opens it again on command_buffer.
+void profiler_begin(struct Profiler *profiler, VkCommandBuffer command_buffer, uint32_t slot);
+// Closes the span named name, started by the previous mark.
+void profiler_mark(struct Profiler *profiler, VkCommandBuffer command_buffer, uint32_t slot, const char *name);
+
+// Average of the span named name since the last report, 0 when unknown.
+double profiler_average(const struct Profiler *profiler, const char *name);
+void profiler_report(struct Profiler *profiler);
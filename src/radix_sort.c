@@ -0,0 +1,212 @@
+#include <vulkan/vulkan.h>
+#include <string.h>
+#include "util.h"
+#include "gpu_memory.h"
+#include "pipeline.h"
+#include "radix_sort.h"
+
+// Must match radix_sort.glsl.
+struct RadixPush {
+    uint32_t counters;
+    uint32_t count_index;
+    uint32_t pairs_in;
+    uint32_t pairs_out;
+    uint32_t histogram;
+    uint32_t shift;
+    uint32_t capacity;
+};
+
+static void radix_barrier(VkCommandBuffer command_buffer) {
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+    vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            1,
+            &barrier,
+            0,
+            NULL,
+            0,
+            NULL);
+}
+
+int radix_sort_precompile(struct PipelineBatch *pipelines) {
+#if DEBUG_INPUT_VALIDATION
+    if (pipelines == NULL) return 1;
+#endif
+
+    int result = pipeline_batch_push(pipelines, "radix_count.comp.spv");
+    result |= pipeline_batch_push(pipelines, "radix_scan.comp.spv");
+    result |= pipeline_batch_push(pipelines, "radix_scatter.comp.spv");
+    if (result > 0) return 2;
+
+    return 0;
+}
+
+int radix_sort_init(
+        struct RadixSort *sort,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        const char *path,
+        struct PipelineBatch *pipelines,
+        struct Bindless *bindless,
+        uint32_t capacity) {
+#if DEBUG_INPUT_VALIDATION
+    if (sort == NULL) return 1;
+    if (!IS_ZERO_PTR(sort)) return 1;
+    if (device == VK_NULL_HANDLE) return 1;
+    if (physical_device == VK_NULL_HANDLE) return 1;
+    if (path == NULL) return 1;
+    if (bindless == NULL) return 1;
+    if (capacity == 0) return 1;
+#endif
+
+    int result = 0;
+
+    sort->device = device;
+    sort->bindless = bindless;
+    sort->capacity = capacity;
+    sort->pair_slots[0] = BINDLESS_INVALID;
+    sort->pair_slots[1] = BINDLESS_INVALID;
+    sort->histogram_slot = BINDLESS_INVALID;
+
+    // Pipelines.
+    result = create_pipeline_layout(device, NULL, bindless->layout, &sort->pipeline_layout);
+    if (result > 0) return 2;
+    result = take_compute_pipeline(
+            pipelines,
+            device,
+            path,
+            "radix_count.comp.spv",
+            sort->pipeline_layout,
+            &sort->count_pipeline);
+    result |= take_compute_pipeline(
+            pipelines,
+            device,
+            path,
+            "radix_scan.comp.spv",
+            sort->pipeline_layout,
+            &sort->scan_pipeline);
+    result |= take_compute_pipeline(
+            pipelines,
+            device,
+            path,
+            "radix_scatter.comp.spv",
+            sort->pipeline_layout,
+            &sort->scatter_pipeline);
+    if (result > 0) return 3;
+
+    // Pairs, ping-ponged between passes, and the per-workgroup digit counts.
+    VkDeviceSize pairs_size = 2 * (VkDeviceSize)capacity * sizeof(uint32_t);
+    for (uint32_t i = 0; i < 2; i++) {
+        result = create_buffer(
+                device,
+                physical_device,
+                pairs_size,
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                GpuMemoryCategory_Frame,
+                sort->pairs + i,
+                sort->pair_memories + i);
+        if (result > 0) return 4;
+        sort->pair_slots[i] = bindless_add_storage_buffer(bindless, device, sort->pairs[i], 0, pairs_size);
+        if (sort->pair_slots[i] == BINDLESS_INVALID) return 5;
+    }
+    uint32_t groups_n = (capacity + RADIX_GROUP_SIZE - 1) / RADIX_GROUP_SIZE;
+    VkDeviceSize histogram_size = (VkDeviceSize)RADIX_BINS * groups_n * sizeof(uint32_t);
+    result = create_buffer(
+            device,
+            physical_device,
+            histogram_size,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            GpuMemoryCategory_Frame,
+            &sort->histogram,
+            &sort->histogram_memory);
+    if (result > 0) return 4;
+    sort->histogram_slot = bindless_add_storage_buffer(bindless, device, sort->histogram, 0, histogram_size);
+    if (sort->histogram_slot == BINDLESS_INVALID) return 5;
+
+    return 0;
+}
+
+void radix_sort_free(struct RadixSort *sort) {
+    VkDevice device = sort->device;
+
+    // Only called once the device is idle, slots can go back immediately.
+    if (sort->bindless != NULL) {
+        bindless_release(sort->bindless, BindlessKind_StorageBuffer, sort->pair_slots[0], 0);
+        bindless_release(sort->bindless, BindlessKind_StorageBuffer, sort->pair_slots[1], 0);
+        bindless_release(sort->bindless, BindlessKind_StorageBuffer, sort->histogram_slot, 0);
+    }
+    for (uint32_t i = 0; i < 2; i++) {
+        vkDestroyBuffer(device, sort->pairs[i], NULL);
+        gpu_memory_free(device, sort->pair_memories[i]);
+    }
+    vkDestroyBuffer(device, sort->histogram, NULL);
+    gpu_memory_free(device, sort->histogram_memory);
+
+    vkDestroyPipeline(device, sort->count_pipeline, NULL);
+    vkDestroyPipeline(device, sort->scan_pipeline, NULL);
+    vkDestroyPipeline(device, sort->scatter_pipeline, NULL);
+    vkDestroyPipelineLayout(device, sort->pipeline_layout, NULL);
+
+    memset(sort, 0, sizeof(*sort));
+}
+
+void radix_sort_record(
+        struct RadixSort *sort,
+        VkCommandBuffer command_buffer,
+        VkBuffer indirect,
+        VkDeviceSize indirect_offset,
+        uint32_t counters_slot,
+        uint32_t count_index,
+        uint32_t key_bits) {
+#if DEBUG_INPUT_VALIDATION
+    if (sort == NULL) return;
+    if (command_buffer == VK_NULL_HANDLE) return;
+    if (indirect == VK_NULL_HANDLE) return;
+    if (key_bits == 0 || key_bits > 32) return;
+#endif
+
+    uint32_t passes_n = (key_bits + RADIX_BITS - 1) / RADIX_BITS;
+    passes_n += passes_n % 2;
+
+    vkCmdBindDescriptorSets(
+            command_buffer,
+            VK_PIPELINE_BIND_POINT_COMPUTE,
+            sort->pipeline_layout,
+            0,
+            1,
+            &sort->bindless->set,
+            0,
+            NULL);
+    for (uint32_t pass = 0; pass < passes_n; pass++) {
+        struct RadixPush push = {
+            .counters = counters_slot,
+            .count_index = count_index,
+            .pairs_in = sort->pair_slots[pass % 2],
+            .pairs_out = sort->pair_slots[(pass + 1) % 2],
+            .histogram = sort->histogram_slot,
+            .shift = pass * RADIX_BITS,
+            .capacity = sort->capacity,
+        };
+        vkCmdPushConstants(command_buffer, sort->pipeline_layout, VK_SHADER_STAGE_ALL, 0, sizeof(push), &push);
+
+        // The previous pass's scatter read the histogram this count writes.
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, sort->count_pipeline);
+        vkCmdDispatchIndirect(command_buffer, indirect, indirect_offset);
+        radix_barrier(command_buffer);
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, sort->scan_pipeline);
+        vkCmdDispatch(command_buffer, 1, 1, 1);
+        radix_barrier(command_buffer);
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, sort->scatter_pipeline);
+        vkCmdDispatchIndirect(command_buffer, indirect, indirect_offset);
+        radix_barrier(command_buffer);
+    }
+}
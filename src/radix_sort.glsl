@@ -0,0 +1,29 @@
+// Shared by the radix sort passes, see struct RadixSort.
+
+#define GROUP_SIZE 64 // must match RADIX_GROUP_SIZE
+#define BINS 16 // must match RADIX_BINS
+
+// Must match struct RadixPush in radix_sort.c.
+layout(push_constant) uniform Push {
+    uint counters;
+    uint count_index;
+    uint pairs_in; // keys, then values at capacity
+    uint pairs_out;
+    uint histogram;
+    uint shift;
+    uint capacity;
+} pc;
+
+BINDLESS_BUFFER(Words, uint);
+
+uint element_count() {
+    return Words[pc.counters].data[pc.count_index];
+}
+
+uint group_count(uint n) {
+    return (n + GROUP_SIZE - 1) / GROUP_SIZE;
+}
+
+uint key_digit(uint key) {
+    return (key >> pc.shift) & uint(BINS - 1);
+}
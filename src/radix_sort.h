@@ -0,0 +1,58 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include "bindless.h"
+#include "pipeline.h"
+
+#define RADIX_BITS 4 // per pass
+#define RADIX_BINS 16
+#define RADIX_GROUP_SIZE 64 // elements per workgroup, must match radix_sort.glsl
+
+// Stable GPU least significant digit radix sort of 32-bit keys with 32-bit
+// values, for element counts only the GPU knows. Each pass counts digits per
+// workgroup, scans the counts in digit major order in one workgroup, and
+// scatters every element to its digit's offset plus its rank in the group.
+//
+// Pairs live in one storage buffer per side: keys in [0, capacity), values
+// in [capacity, 2 * capacity). The caller writes pairs[0] and finds the
+// result there again, passes are rounded up to an even number.
+struct RadixSort {
+    VkDevice device;
+    struct Bindless *bindless;
+    uint32_t capacity;
+    VkPipelineLayout pipeline_layout;
+    VkPipeline count_pipeline;
+    VkPipeline scan_pipeline;
+    VkPipeline scatter_pipeline;
+    VkBuffer pairs[2];
+    VkDeviceMemory pair_memories[2];
+    uint32_t pair_slots[2];
+    VkBuffer histogram; // RADIX_BINS per workgroup
+    VkDeviceMemory histogram_memory;
+    uint32_t histogram_slot;
+};
+
+int radix_sort_precompile(struct PipelineBatch *pipelines);
+int radix_sort_init(
+        struct RadixSort *sort,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        const char *path,
+        struct PipelineBatch *pipelines,
+        struct Bindless *bindless,
+        uint32_t capacity);
+void radix_sort_free(struct RadixSort *sort);
+
+// Sorts the first n pairs of pairs[0] by their low key_bits bits. n is
+// the uint at count_index of the storage buffer in slot counters_slot, and
+// indirect holds the dispatch of ceil(n / RADIX_GROUP_SIZE) workgroups at
+// indirect_offset. The pairs' writes must be visible to compute shaders,
+// and the sorted pairs are visible to them afterwards.
+void radix_sort_record(
+        struct RadixSort *sort,
+        VkCommandBuffer command_buffer,
+        VkBuffer indirect,
+        VkDeviceSize indirect_offset,
+        uint32_t counters_slot,
+        uint32_t count_index,
+        uint32_t key_bits);
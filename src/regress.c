@@ -0,0 +1,396 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "bvh.h"
+#include "cpu_trace.h"
+#include "environment.h"
+#include "image.h"
+#include "offscreen.h"
+#include "scene.h"
+#include "regress.h"
+
+#define BASELINES_MAX 32
+
+enum RegressScene {
+    RegressScene_Default,
+    RegressScene_Terrain,
+    RegressScene_Count,
+};
+
+struct RegressCase {
+    const char *name;
+    enum RegressScene scene;
+    uint32_t width, height;
+    uint32_t samples;
+    uint32_t bounces;
+    int sun; // lit by ENVIRONMENT_SUN with MIS, else the sky
+    int resized; // the kernel traces the top left of images twice the size, as after a resize
+    int has_camera; // else the scene's
+    struct SceneCamera camera;
+};
+
+static const struct RegressCase regress_cases[] = {
+    { "default", RegressScene_Default, 96, 64, 16, 0, 0, 0, 0, { { 0 }, { 0 }, 0.0f } },
+    { "direct", RegressScene_Default, 96, 64, 16, 1, 0, 0, 0, { { 0 }, { 0 }, 0.0f } },
+    { "deep", RegressScene_Default, 96, 64, 16, 8, 0, 0, 0, { { 0 }, { 0 }, 0.0f } },
+    { "close", RegressScene_Default, 96, 64, 16, 0, 0, 0, 1, { { 0.6f, 0.2f, 2.2f }, { 0.6f, -0.4f, 1.0f }, 0.5f } },
+    { "terrain", RegressScene_Terrain, 96, 64, 8, 0, 0, 0, 0, { { 0 }, { 0 }, 0.0f } },
+    { "sun", RegressScene_Terrain, 96, 64, 8, 0, 1, 0, 0, { { 0 }, { 0 }, 0.0f } },
+    { "resized", RegressScene_Default, 64, 48, 16, 0, 0, 1, 0, { { 0 }, { 0 }, 0.0f } },
+};
+
+#define CASES_N (sizeof(regress_cases) / sizeof(regress_cases[0]))
+
+struct Baseline {
+    char name[32];
+    double ms;
+};
+
+struct Regress {
+    const struct RegressSettings *settings;
+    struct Offscreen *offscreen; // NULL without gpu
+    const struct Environment *sun; // of the sun cases
+    struct Baseline baselines[BASELINES_MAX]; // read, then measured when updating or missing
+    uint32_t baselines_n;
+    uint32_t recorded_n; // missing baselines measured this run
+    uint32_t checks_n;
+    uint32_t failed_n;
+};
+
+// Scenes.
+
+// Rolling heightfield under the sky, enough triangles for the BVH build to
+// be worth timing.
+static int terrain_init(struct Scene *scene) {
+    const float black[3] = { 0.0f, 0.0f, 0.0f };
+    uint32_t rock = scene_add_material(scene, (float[3]) { 0.5f, 0.45f, 0.4f }, black);
+    uint32_t n = REGRESS_TERRAIN_SIZE;
+    for (uint32_t z = 0; z <= n; z++) {
+        for (uint32_t x = 0; x <= n; x++) {
+            float u = (float)x / n * 8.0f - 4.0f;
+            float v = (float)z / n * 8.0f - 4.0f;
+            float y = 0.4f * sinf(1.7f * u) * cosf(1.3f * v) + 0.15f * sinf(5.1f * u + 3.7f * v) - 1.0f;
+            scene_add_vertex(scene, u, y, v);
+        }
+    }
+    for (uint32_t z = 0; z < n; z++) {
+        for (uint32_t x = 0; x < n; x++) {
+            uint32_t a = z * (n + 1) + x;
+            uint32_t b = a + n + 1;
+            scene_add_triangle(scene, a, b, a + 1, rock);
+            scene_add_triangle(scene, a + 1, b, b + 1, rock);
+        }
+    }
+    if (scene->triangles_n != 2 * n * n) return 2;
+    scene->camera = (struct SceneCamera) {
+        .position = { 0.0f, 1.2f, 4.5f },
+        .target = { 0.0f, -0.8f, 0.0f },
+        .fov = 0.9f,
+    };
+
+    return 0;
+}
+
+static int scene_create(struct Scene *scene, enum RegressScene which) {
+    return which == RegressScene_Terrain ? terrain_init(scene) : scene_init_default(scene);
+}
+
+static const char *scene_names[RegressScene_Count] = { "default", "terrain" };
+
+// Baselines, one "name milliseconds" per line.
+
+static struct Baseline *baseline_find(struct Regress *regress, const char *name) {
+    for (uint32_t i = 0; i < regress->baselines_n; i++)
+        if (strcmp(regress->baselines[i].name, name) == 0) return &regress->baselines[i];
+    if (regress->baselines_n == BASELINES_MAX) return NULL;
+
+    struct Baseline *baseline = &regress->baselines[regress->baselines_n++];
+    strlcpy(baseline->name, name, sizeof(baseline->name));
+    baseline->ms = 0.0;
+    return baseline;
+}
+
+static void baselines_read(struct Regress *regress, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return;
+
+    char name[32];
+    double ms;
+    while (fscanf(file, "%31s %lf", name, &ms) == 2) {
+        struct Baseline *baseline = baseline_find(regress, name);
+        if (baseline != NULL) baseline->ms = ms;
+    }
+    fclose(file);
+}
+
+static int baselines_write(const struct Regress *regress, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) return 2;
+
+    for (uint32_t i = 0; i < regress->baselines_n; i++)
+        fprintf(file, "%s %.3f\n", regress->baselines[i].name, regress->baselines[i].ms);
+    fclose(file);
+    return 0;
+}
+
+static int ms_ascending(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Of REGRESS_REPEATS runs, sorts ms. Unlike the fastest run, one lucky run
+// does not move it.
+static double median_ms(double *ms) {
+    qsort(ms, REGRESS_REPEATS, sizeof(*ms), ms_ascending);
+    return ms[REGRESS_REPEATS / 2];
+}
+
+// Checks ms against the stored baseline, or takes it as the new one.
+static void check_time(struct Regress *regress, const char *name, double ms) {
+    struct Baseline *baseline = baseline_find(regress, name);
+    if (baseline == NULL) return;
+    if (regress->settings->update || baseline->ms <= 0.0) {
+        printf("[regress] %-24s %9.3f ms%s\n", name, ms, regress->settings->update ? "" : ", no local baseline, recorded");
+        if (!regress->settings->update) regress->recorded_n++;
+        baseline->ms = ms;
+        return;
+    }
+
+    double change = 100.0 * (ms / baseline->ms - 1.0);
+    int ok = change <= regress->settings->tolerance || ms - baseline->ms < REGRESS_MIN_SLOWDOWN_MS;
+    printf("[regress] %-24s %9.3f ms, baseline %.3f ms, %+.1f%% %s\n", name, ms, baseline->ms, change, ok ? "ok" : "FAILED");
+    regress->checks_n++;
+    if (!ok) regress->failed_n++;
+}
+
+// Images.
+
+// 8 bit sRGB, as written, against the golden image.
+static int image_rmse(const char *path, const char *golden_path, double *rmse) {
+    uint32_t width, height, golden_width, golden_height;
+    uint8_t *pixels = NULL, *golden = NULL;
+    int result = 2;
+    if (image_load_rgba8(path, &width, &height, &pixels) == 0
+            && image_load_rgba8(golden_path, &golden_width, &golden_height, &golden) == 0) {
+        result = 3;
+        if (width == golden_width && height == golden_height) {
+            double sum = 0.0;
+            for (size_t i = 0; i < (size_t)width * height * 4; i++) {
+                if (i % 4 == 3) continue;
+                double d = ((double)pixels[i] - golden[i]) / 255.0;
+                sum += d * d;
+            }
+            *rmse = sqrt(sum / ((double)width * height * 3));
+            result = 0;
+        }
+    }
+    free(pixels);
+    free(golden);
+    return result;
+}
+
+// Writes rgb as path, or as the golden image when updating, and compares it
+// against the golden image, failing past max_rmse.
+static int check_image(
+        struct Regress *regress,
+        const char *name,
+        const char *path,
+        const char *golden_path,
+        uint32_t width,
+        uint32_t height,
+        const float *rgb,
+        float max_rmse) {
+    int result = image_write_linear(regress->settings->update ? golden_path : path, width, height, rgb);
+    if (result > 0) return 2;
+    if (regress->settings->update) return 0;
+
+    double rmse = 0.0;
+    result = image_rmse(path, golden_path, &rmse);
+    int ok = result == 0 && rmse <= max_rmse;
+    if (result == 0)
+        printf("[regress] %-24s rmse %.5f of %.5f %s\n", name, rmse, max_rmse, ok ? "ok" : "FAILED");
+    else
+        printf("[regress] %-24s %s FAILED\n", name, result == 2 ? "no golden image" : "golden image size differs");
+    regress->checks_n++;
+    if (!ok) regress->failed_n++;
+    return 0;
+}
+
+static int run_case(struct Regress *regress, const struct RegressCase *test, struct Scene *scenes, struct Bvh *bvhs) {
+    struct CpuTracer tracer = { 0 };
+    float *rgb = malloc((size_t)test->width * test->height * 3 * sizeof(float));
+    if (rgb == NULL) return 2;
+    cpu_tracer_init(&tracer, &scenes[test->scene], &bvhs[test->scene], test->width, test->height, test->bounces);
+    if (test->has_camera) tracer.camera = test->camera;
+    if (test->sun) tracer.environment = regress->sun;
+
+    double ms[REGRESS_REPEATS];
+    for (uint32_t r = 0; r < REGRESS_REPEATS; r++) {
+        double start = time_now();
+        cpu_tracer_render(&tracer, 0, 0, test->width, test->height, 0, test->samples, rgb);
+        ms[r] = 1e3 * (time_now() - start);
+    }
+    cpu_tracer_free(&tracer);
+
+    //
+    const char *directory = regress->settings->directory;
+    char path[512], golden_path[512], name[64];
+    snprintf(path, sizeof(path), "%s/%s.out.ppm", directory, test->name);
+    snprintf(golden_path, sizeof(golden_path), "%s/%s.ppm", directory, test->name);
+    int result = check_image(
+            regress,
+            test->name,
+            path,
+            golden_path,
+            test->width,
+            test->height,
+            rgb,
+            regress->settings->rmse);
+    snprintf(name, sizeof(name), "frame_%s", test->name);
+    if (result == 0) check_time(regress, name, median_ms(ms));
+
+    // The same seeds through the kernel.
+    if (result == 0 && regress->offscreen != NULL) {
+        result = offscreen_render(
+                regress->offscreen,
+                &scenes[test->scene],
+                &bvhs[test->scene],
+                test->has_camera ? &test->camera : NULL,
+                test->sun ? regress->sun : NULL,
+                test->width,
+                test->height,
+                test->resized ? (VkExtent2D) { 2 * test->width, 2 * test->height } : (VkExtent2D) { 0, 0 },
+                test->samples,
+                test->bounces,
+                rgb);
+        snprintf(path, sizeof(path), "%s/%s.gpu.out.ppm", directory, test->name);
+        snprintf(name, sizeof(name), "gpu_%s", test->name);
+        if (result == 0) {
+            result = check_image(
+                    regress,
+                    name,
+                    path,
+                    golden_path,
+                    test->width,
+                    test->height,
+                    rgb,
+                    regress->settings->gpu_rmse);
+        } else {
+            // A kernel that no longer builds or runs is a regression too.
+            printf("[regress] %-24s could not trace, %d FAILED\n", name, result);
+            regress->checks_n++;
+            regress->failed_n++;
+            result = 0;
+        }
+    }
+    free(rgb);
+
+    return result > 0 ? 2 : 0;
+}
+
+//
+
+int regress_run(const struct RegressSettings *settings) {
+#if DEBUG_INPUT_VALIDATION
+    if (settings == NULL || settings->directory == NULL) return 1;
+    if (settings->gpu && settings->shader_path == NULL) return 1;
+#endif
+
+    struct RegressSettings resolved = *settings;
+    if (resolved.tolerance <= 0.0f) resolved.tolerance = REGRESS_DEFAULT_TOLERANCE;
+    if (resolved.rmse <= 0.0f) resolved.rmse = REGRESS_DEFAULT_RMSE;
+    if (resolved.gpu_rmse <= 0.0f) resolved.gpu_rmse = REGRESS_DEFAULT_GPU_RMSE;
+    struct Regress regress = { .settings = &resolved };
+    char baselines_path[512];
+    snprintf(baselines_path, sizeof(baselines_path), "%s/baselines.txt", resolved.directory);
+    if (!resolved.update) baselines_read(&regress, baselines_path);
+    printf("[regress] %s against %s, %.1f%% time tolerance, %.4f rmse\n",
+            resolved.update ? "updating references" : "checking",
+            resolved.directory,
+            resolved.tolerance,
+            resolved.rmse);
+
+    // A device for the kernel's images, the golden ones are the CPU's.
+    struct Offscreen offscreen = { 0 };
+    if (resolved.gpu && !resolved.update) {
+        int offscreen_result = offscreen_init(&offscreen, resolved.shader_path);
+        if (offscreen_result > 0) {
+            printf("[regress] no offscreen Vulkan device for the GPU checks, %d\n", offscreen_result);
+            offscreen_free(&offscreen);
+            return 2;
+        }
+        regress.offscreen = &offscreen;
+        printf("[regress] kernel images too, %.4f rmse\n", resolved.gpu_rmse);
+    }
+
+    // Startup to a traceable scene, then each scene's build alone.
+    struct Scene scenes[RegressScene_Count] = { 0 };
+    struct Bvh bvhs[RegressScene_Count] = { 0 };
+    int result = 0;
+    double startup[REGRESS_REPEATS], builds[RegressScene_Count][REGRESS_REPEATS];
+    for (uint32_t s = 0; s < RegressScene_Count && result == 0; s++) {
+        for (uint32_t r = 0; r < REGRESS_REPEATS && result == 0; r++) {
+            bvh_free(&bvhs[s]);
+            scene_free(&scenes[s]);
+            double start = time_now();
+            if (scene_create(&scenes[s], s) > 0) result = 2;
+            double created = time_now();
+            if (result == 0 && bvh_build(&bvhs[s], scenes[s].positions, scenes[s].indices, scenes[s].triangles_n) > 0)
+                result = 2;
+            double built = time_now();
+            builds[s][r] = 1e3 * (built - created);
+            if (s == RegressScene_Default) startup[r] = 1e3 * (built - start);
+        }
+    }
+    if (result > 0) {
+        printf("[regress] could not build the scenes\n");
+    } else {
+        check_time(&regress, "startup", median_ms(startup));
+        for (uint32_t s = 0; s < RegressScene_Count; s++) {
+            char name[64];
+            snprintf(name, sizeof(name), "bvh_build_%s", scene_names[s]);
+            check_time(&regress, name, median_ms(builds[s]));
+        }
+    }
+
+    // The procedural sky with a sun, through the alias table and MIS.
+    struct Environment sun = { 0 };
+    if (result == 0) {
+        if (environment_init(&sun, ENVIRONMENT_SUN, EnvironmentSampling_Mis) > 0) {
+            printf("[regress] could not build the sun\n");
+            result = 2;
+        }
+        regress.sun = &sun;
+    }
+
+    //
+    for (uint32_t i = 0; i < CASES_N && result == 0; i++) {
+        result = run_case(&regress, &regress_cases[i], scenes, bvhs);
+        if (result > 0) printf("[regress] could not write %s's image\n", regress_cases[i].name);
+    }
+    if (regress.offscreen != NULL) offscreen_free(regress.offscreen);
+    environment_free(&sun);
+    for (uint32_t s = 0; s < RegressScene_Count; s++) {
+        bvh_free(&bvhs[s]);
+        scene_free(&scenes[s]);
+    }
+    if (result > 0) return result;
+
+    if (resolved.update || regress.recorded_n > 0) {
+        if (baselines_write(&regress, baselines_path) > 0) {
+            printf("[regress] could not write %s\n", baselines_path);
+            return 2;
+        }
+    }
+    if (resolved.update) {
+        printf("[regress] wrote %zu images and %u baselines\n", CASES_N, regress.baselines_n);
+        return 0;
+    }
+    if (regress.recorded_n > 0)
+        printf("[regress] recorded %u local baselines, checked from the next run on\n", regress.recorded_n);
+    printf("[regress] %u of %u checks passed\n", regress.checks_n - regress.failed_n, regress.checks_n);
+
+    return regress.failed_n > 0 ? 3 : 0;
+}
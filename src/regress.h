@@ -0,0 +1,35 @@
+#pragma once
+#include <stdint.h>
+
+#define REGRESS_DEFAULT_TOLERANCE 25.0f // percent slower than the baseline that fails
+#define REGRESS_MIN_SLOWDOWN_MS 0.5 // smaller slowdowns are timer noise, whatever the percentage
+#define REGRESS_DEFAULT_RMSE 0.01f // of 8 bit sRGB, as a fraction of full scale
+#define REGRESS_DEFAULT_GPU_RMSE 0.02f // looser, the kernel's float math lets some paths drift from the CPU's
+#define REGRESS_REPEATS 9 // timings take the median run, odd
+#define REGRESS_TERRAIN_SIZE 192 // quads per side of the procedural terrain
+
+// Zero fields take the defaults.
+struct RegressSettings {
+    const char *directory; // golden NAME.ppm images, and this machine's baselines.txt
+    int update; // write the current images and timings as the new references
+    float tolerance; // percent
+    float rmse;
+    int gpu; // also trace every case with trace.comp on an offscreen device
+    float gpu_rmse; // of those images against the CPU's golden ones
+    const char *shader_path; // of the compiled shaders, for gpu
+};
+
+// Renders the reference scenes headless with the CPU tracer, fixed seeds and
+// a single thread, so images only change with the tracer or the scenes. Each
+// is compared against its golden image by RMSE, and its frame time, the BVH
+// builds and the startup to a traceable scene against baselines.txt. Timings
+// only compare on the machine that took them, so baselines.txt is local:
+// timings without a baseline there are recorded into it instead of checked.
+// The current images are left as NAME.out.ppm for inspection. With gpu,
+// each case is also traced by trace.comp on a compute only device with no
+// surface, e.g. lavapipe, read back and compared against the same golden
+// image, left as NAME.gpu.out.ppm, within gpu_rmse. Its timings are not
+// checked, and updating takes the golden images from the CPU only. Returns 0 when every check
+// passes, 2 when the references cannot be read or written or there is no
+// device for gpu and 3 on a regression.
+int regress_run(const struct RegressSettings *settings);
@@ -0,0 +1,115 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+#include "resolution.h"
+
+static VkExtent2D scaled_extent(VkExtent2D output, float scale) {
+    VkExtent2D extent = {
+        .width = (uint32_t)(output.width * scale + 0.5f),
+        .height = (uint32_t)(output.height * scale + 0.5f),
+    };
+    if (extent.width == 0) extent.width = 1;
+    if (extent.height == 0) extent.height = 1;
+    return extent;
+}
+
+int resolution_init(struct Resolution *resolution, VkExtent2D output, const struct ResolutionSettings *settings) {
+#if DEBUG_INPUT_VALIDATION
+    if (resolution == NULL) return 1;
+    if (!IS_ZERO_PTR(resolution)) return 1;
+    if (settings == NULL) return 1;
+    if (output.width == 0 || output.height == 0) return 1;
+#endif
+
+    // Settings.
+    resolution->settings = *settings;
+    struct ResolutionSettings *s = &resolution->settings;
+    if (s->max_scale == 0.0f) s->max_scale = RESOLUTION_DEFAULT_MAX_SCALE;
+    if (s->min_scale == 0.0f)
+        s->min_scale = RESOLUTION_DEFAULT_MIN_SCALE < s->max_scale ? RESOLUTION_DEFAULT_MIN_SCALE : s->max_scale;
+    if (!(s->max_scale > 0.0f && s->max_scale <= 1.0f)) return 1;
+    if (!(s->min_scale > 0.0f && s->min_scale <= s->max_scale)) return 1;
+    if (s->target_ms < 0.0f) return 1;
+
+    //
+    resolution->output = output;
+    resolution->scale = s->max_scale;
+    resolution->max_extent = scaled_extent(output, s->max_scale);
+    resolution->extent = resolution->max_extent;
+
+    return 0;
+}
+
+void resolution_free(struct Resolution *resolution) {
+    memset(resolution, 0, sizeof(*resolution));
+}
+
+int resolution_update(struct Resolution *resolution, uint32_t slot, double frame_ms) {
+#if DEBUG_INPUT_VALIDATION
+    if (resolution == NULL) return 0;
+    if (slot >= PROFILER_SLOTS) return 0;
+#endif
+
+    const struct ResolutionSettings *s = &resolution->settings;
+    resolution->frames_n += 1;
+    resolution->scale_sum += resolution->scale;
+    if (s->target_ms <= 0.0f) return 0;
+
+    // Cost per pixel at the size the slot's previous frame rendered.
+    uint32_t pixels_n = resolution->slot_pixels[slot];
+    if (pixels_n > 0 && frame_ms > 0.0) {
+        double ms_per_pixel = frame_ms / pixels_n;
+        resolution->ms_per_pixel = resolution->ms_per_pixel > 0.0
+            ? resolution->ms_per_pixel + RESOLUTION_SMOOTHING * (ms_per_pixel - resolution->ms_per_pixel)
+            : ms_per_pixel;
+        resolution->frame_ms = frame_ms;
+    }
+
+    // Scale whose pixels fit the target, kept unless it moved past the
+    // deadband or to a bound.
+    int changed = 0;
+    if (resolution->ms_per_pixel > 0.0) {
+        double output_pixels = (double)resolution->output.width * resolution->output.height;
+        double wanted = sqrt(s->target_ms / (resolution->ms_per_pixel * output_pixels));
+        if (wanted > s->max_scale) wanted = s->max_scale;
+        if (wanted < s->min_scale) wanted = s->min_scale;
+        int bound = wanted == s->max_scale || wanted == s->min_scale;
+        if (bound || fabs(wanted - resolution->scale) > RESOLUTION_DEADBAND * resolution->scale) {
+            // Down the ladder, so it errs under the target.
+            float scale = floorf((float)wanted * RESOLUTION_SCALE_STEPS) / RESOLUTION_SCALE_STEPS;
+            if (bound) scale = (float)wanted;
+            if (scale < s->min_scale) scale = s->min_scale;
+            if (scale != resolution->scale) {
+                resolution->scale = scale;
+                VkExtent2D extent = scaled_extent(resolution->output, scale);
+                if (extent.width > resolution->max_extent.width) extent.width = resolution->max_extent.width;
+                if (extent.height > resolution->max_extent.height) extent.height = resolution->max_extent.height;
+                changed = extent.width != resolution->extent.width || extent.height != resolution->extent.height;
+                resolution->extent = extent;
+                resolution->resizes_n += changed;
+            }
+        }
+    }
+    resolution->slot_pixels[slot] = resolution->extent.width * resolution->extent.height;
+
+    return changed;
+}
+
+void resolution_report(struct Resolution *resolution) {
+    if (resolution->settings.target_ms <= 0.0f || resolution->frames_n == 0) return;
+
+    printf("[resolution] %ux%u of %ux%u, scale %.2f (average %.2f), gpu %.2f ms for a %.2f ms target, %u resizes\n",
+            resolution->extent.width,
+            resolution->extent.height,
+            resolution->output.width,
+            resolution->output.height,
+            resolution->scale,
+            resolution->scale_sum / resolution->frames_n,
+            resolution->frame_ms,
+            resolution->settings.target_ms,
+            resolution->resizes_n);
+    resolution->resizes_n = 0;
+    resolution->scale_sum = 0.0;
+    resolution->frames_n = 0;
+}
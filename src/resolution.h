@@ -0,0 +1,58 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include "profiler.h"
+
+#define RESOLUTION_DEFAULT_MIN_SCALE 0.5f
+#define RESOLUTION_DEFAULT_MAX_SCALE 1.0f
+#define RESOLUTION_SCALE_STEPS 32 // scales are multiples of 1 / this, a fixed ladder of sizes
+#define RESOLUTION_SMOOTHING 0.2 // weight of the newest frame in the time per pixel
+#define RESOLUTION_DEADBAND 0.1 // relative scale change below which the size stays
+
+// How the composite fills the swapchain from the rendered rectangle.
+enum Upscale {
+    Upscale_Bilinear = 0,
+    Upscale_Edge, // bilinear weights scaled down across luminance edges
+};
+
+// Zero fields take the defaults.
+struct ResolutionSettings {
+    float target_ms; // GPU time per frame to hold, 0 renders at max_scale throughout
+    float min_scale; // per axis, of the swapchain extent
+    float max_scale; // per axis, also the size the images are allocated at, at most 1
+    enum Upscale upscale;
+};
+
+// Dynamic resolution. The trace and denoise images are allocated once at
+// max_extent and every frame renders into its top left extent, so a resize
+// only changes push constants and dispatch sizes; it restarts accumulation
+// and the denoiser's history like a camera move. The controller divides each
+// frame's measured GPU time by the pixels that frame rendered, smooths that
+// cost per pixel, and picks the scale whose pixels fit target_ms. Frames in
+// flight measure the size they rendered at, so the lag does not make it
+// overshoot, and changes within RESOLUTION_DEADBAND are ignored so it
+// settles instead of restarting accumulation every frame.
+struct Resolution {
+    struct ResolutionSettings settings; // defaults resolved
+    VkExtent2D output; // swapchain, what the composite fills
+    VkExtent2D max_extent; // allocated
+    VkExtent2D extent; // rendered, the top left of max_extent
+    float scale;
+    uint32_t slot_pixels[PROFILER_SLOTS]; // rendered by each frame slot's latest frame, 0 before one
+    double ms_per_pixel; // smoothed, 0 until measured
+    double frame_ms; // latest measurement
+    // Since the last report.
+    uint32_t resizes_n;
+    double scale_sum;
+    uint64_t frames_n;
+};
+
+// Returns 1 on scales outside (0, 1] or min_scale above max_scale.
+int resolution_init(struct Resolution *resolution, VkExtent2D output, const struct ResolutionSettings *settings);
+void resolution_free(struct Resolution *resolution);
+
+// Once per frame before recording it, with the profiler slot it records
+// into and the GPU time that slot's previous frame took, 0 when unknown.
+// Returns whether extent changed.
+int resolution_update(struct Resolution *resolution, uint32_t slot, double frame_ms);
+void resolution_report(struct Resolution *resolution);
@@ -0,0 +1,309 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "cpu_trace.h"
+#include "sampler.h"
+
+#define MASK_TEXELS (SAMPLER_MASK_SIZE * SAMPLER_MASK_SIZE)
+
+// sampler.glsl spells these out and finds the mask at SAMPLER_SAMPLES *
+// SAMPLER_PAIRS words, past the points.
+_Static_assert(SAMPLER_SAMPLES == 4096 && SAMPLER_PAIRS == 16 && SAMPLER_DIMENSIONS == 32, "sampler.glsl's table");
+_Static_assert(SAMPLER_MASK_SIZE == 64, "sampler.glsl's mask");
+_Static_assert(65536 % MASK_TEXELS == 0, "mask ranks scale to whole 16 bit rotations");
+
+// Integer hash, as sampler.glsl.
+static uint32_t hash(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Sobol points.
+
+static uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Second Sobol dimension, direction numbers of the polynomial x + 1. The
+// first is the bit reversal.
+static uint32_t sobol_second(uint32_t index) {
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+        if (index & 1) result ^= v;
+    return result;
+}
+
+// Nested uniform scramble, Burley's hash based Owen scrambling: every bit
+// flips depending only on the bits above it, so a prefix of 2^k points stays
+// a net, and applied to the index it shuffles within aligned blocks of every
+// power of two.
+static uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+}
+
+static void build_points(uint32_t *points) {
+    for (uint32_t pair = 0; pair < SAMPLER_PAIRS; pair++) {
+        uint32_t seed = hash(pair + 1);
+        uint32_t seed_x = hash(seed ^ 0x1u), seed_y = hash(seed ^ 0x2u);
+        for (uint32_t i = 0; i < SAMPLER_SAMPLES; i++) {
+            uint32_t index = owen_scramble(i, seed);
+            uint32_t x = owen_scramble(reverse_bits(index), seed_x);
+            uint32_t y = owen_scramble(sobol_second(index), seed_y);
+            points[i * SAMPLER_PAIRS + pair] = (x >> 16) | (y & 0xffff0000u);
+        }
+    }
+}
+
+// Blue noise mask, Ulichney's void-and-cluster on the torus.
+
+static void toggle(double *energy, const double *kernel, uint32_t texel, double sign) {
+    uint32_t tx = texel % SAMPLER_MASK_SIZE, ty = texel / SAMPLER_MASK_SIZE;
+    for (uint32_t y = 0; y < SAMPLER_MASK_SIZE; y++) {
+        const double *row = kernel + ((y - ty) & (SAMPLER_MASK_SIZE - 1)) * SAMPLER_MASK_SIZE;
+        for (uint32_t x = 0; x < SAMPLER_MASK_SIZE; x++)
+            energy[y * SAMPLER_MASK_SIZE + x] += sign * row[(x - tx) & (SAMPLER_MASK_SIZE - 1)];
+    }
+}
+
+// Set texel with the most energy, the tightest cluster.
+static uint32_t tightest_cluster(const double *energy, const uint8_t *set) {
+    uint32_t best = 0;
+    double best_energy = -1.0;
+    for (uint32_t i = 0; i < MASK_TEXELS; i++)
+        if (set[i] && energy[i] > best_energy) best = i, best_energy = energy[i];
+    return best;
+}
+
+// Unset texel with the least energy, the largest void.
+static uint32_t largest_void(const double *energy, const uint8_t *set) {
+    uint32_t best = 0;
+    double best_energy = 1e30;
+    for (uint32_t i = 0; i < MASK_TEXELS; i++)
+        if (!set[i] && energy[i] < best_energy) best = i, best_energy = energy[i];
+    return best;
+}
+
+static int build_mask(uint32_t *ranks) {
+    double *kernel = malloc(MASK_TEXELS * sizeof(double));
+    double *energy = malloc(MASK_TEXELS * sizeof(double));
+    double *initial_energy = malloc(MASK_TEXELS * sizeof(double));
+    uint8_t *set = calloc(MASK_TEXELS, 1);
+    uint8_t *initial = malloc(MASK_TEXELS);
+    if (kernel == NULL || energy == NULL || initial_energy == NULL || set == NULL || initial == NULL) {
+        free(kernel);
+        free(energy);
+        free(initial_energy);
+        free(set);
+        free(initial);
+        return 2;
+    }
+
+    // Gaussian over toroidal distances.
+    for (uint32_t y = 0; y < SAMPLER_MASK_SIZE; y++) {
+        for (uint32_t x = 0; x < SAMPLER_MASK_SIZE; x++) {
+            double dx = x < SAMPLER_MASK_SIZE / 2 ? x : SAMPLER_MASK_SIZE - x;
+            double dy = y < SAMPLER_MASK_SIZE / 2 ? y : SAMPLER_MASK_SIZE - y;
+            kernel[y * SAMPLER_MASK_SIZE + x] = exp(-(dx * dx + dy * dy) / (2.0 * SAMPLER_MASK_SIGMA * SAMPLER_MASK_SIGMA));
+        }
+    }
+
+    // Initial pattern: a tenth of the texels at random, relaxed by moving
+    // the tightest cluster into the largest void until it moves back.
+    memset(energy, 0, MASK_TEXELS * sizeof(double));
+    uint32_t set_n = 0;
+    for (uint32_t i = 0; set_n < MASK_TEXELS / 10; i++) {
+        uint32_t texel = hash(i) % MASK_TEXELS;
+        if (set[texel]) continue;
+        set[texel] = 1;
+        toggle(energy, kernel, texel, 1.0);
+        set_n++;
+    }
+    for (uint32_t i = 0; i < MASK_TEXELS; i++) {
+        uint32_t cluster = tightest_cluster(energy, set);
+        set[cluster] = 0;
+        toggle(energy, kernel, cluster, -1.0);
+        uint32_t hole = largest_void(energy, set);
+        set[hole] = 1;
+        toggle(energy, kernel, hole, 1.0);
+        if (hole == cluster) break;
+    }
+    memcpy(initial, set, MASK_TEXELS);
+    memcpy(initial_energy, energy, MASK_TEXELS * sizeof(double));
+
+    // Ranks below the initial pattern's size, removing clusters.
+    for (uint32_t rank = set_n; rank > 0; rank--) {
+        uint32_t cluster = tightest_cluster(energy, set);
+        set[cluster] = 0;
+        toggle(energy, kernel, cluster, -1.0);
+        ranks[cluster] = rank - 1;
+    }
+
+    // The rest, filling voids. Past half the texels the largest void of the
+    // set ones is the tightest cluster of the unset ones, since the energies
+    // of both sum to the same everywhere on the torus.
+    memcpy(set, initial, MASK_TEXELS);
+    memcpy(energy, initial_energy, MASK_TEXELS * sizeof(double));
+    for (uint32_t rank = set_n; rank < MASK_TEXELS; rank++) {
+        uint32_t hole = largest_void(energy, set);
+        set[hole] = 1;
+        toggle(energy, kernel, hole, 1.0);
+        ranks[hole] = rank;
+    }
+
+    free(kernel);
+    free(energy);
+    free(initial_energy);
+    free(set);
+    free(initial);
+    return 0;
+}
+
+//
+
+int sampler_init(struct Sampler *sampler) {
+#if DEBUG_INPUT_VALIDATION
+    if (sampler == NULL) return 1;
+    if (!IS_ZERO_PTR(sampler)) return 1;
+#endif
+
+    double start = time_now();
+    size_t points_n = (size_t)SAMPLER_SAMPLES * SAMPLER_PAIRS;
+    sampler->size = (points_n + MASK_TEXELS) * sizeof(uint32_t);
+    sampler->data = malloc(sampler->size);
+    if (sampler->data == NULL) return 2;
+    sampler->points = sampler->data;
+    sampler->mask = sampler->data + points_n;
+    build_points(sampler->data);
+    if (build_mask(sampler->data + points_n) > 0) return 2;
+    sampler->build_time = time_now() - start;
+
+    return 0;
+}
+
+void sampler_free(struct Sampler *sampler) {
+    free(sampler->data);
+    memset(sampler, 0, sizeof(*sampler));
+}
+
+void sampler_report(const struct Sampler *sampler) {
+    printf("[sampler] %u samples of %u Owen-scrambled Sobol dimensions, %ux%u blue noise mask, %zu KiB, built in %.2f ms\n",
+            SAMPLER_SAMPLES,
+            SAMPLER_DIMENSIONS,
+            SAMPLER_MASK_SIZE,
+            SAMPLER_MASK_SIZE,
+            sampler->size / 1024,
+            sampler->build_time * 1e3);
+}
+
+float sampler_get(const struct Sampler *sampler, uint32_t x, uint32_t y, uint32_t index, uint32_t dimension) {
+    uint32_t point = sampler->points[(index % SAMPLER_SAMPLES) * SAMPLER_PAIRS + dimension / 2];
+    uint32_t value = dimension & 1 ? point >> 16 : point & 0xffffu;
+
+    // Rotated by the mask, at an offset per dimension, and past the table
+    // once more per pass through it.
+    uint32_t offset = hash(dimension);
+    uint32_t mx = (x + offset) & (SAMPLER_MASK_SIZE - 1), my = (y + (offset >> 16)) & (SAMPLER_MASK_SIZE - 1);
+    uint32_t rotation = sampler->mask[my * SAMPLER_MASK_SIZE + mx] * (65536u / MASK_TEXELS);
+    uint32_t pass = index / SAMPLER_SAMPLES;
+    if (pass > 0) rotation += hash(pass * SAMPLER_DIMENSIONS + dimension) >> 16;
+    return ((float)((value + rotation) & 0xffffu) + 0.5f) * (1.0f / 65536.0f);
+}
+
+// Error against sample count.
+
+int sampler_compare(
+        const struct Sampler *sampler,
+        const struct Scene *scene,
+        const struct Bvh *bvh,
+        const struct Environment *environment,
+        uint32_t width,
+        uint32_t height,
+        uint32_t bounces) {
+#if DEBUG_INPUT_VALIDATION
+    if (sampler == NULL || sampler->data == NULL) return 1;
+    if (scene == NULL || bvh == NULL) return 1;
+#endif
+
+    struct CpuTracer tracer = { 0 };
+    if (cpu_tracer_init(&tracer, scene, bvh, width, height, bounces) > 0) return 1;
+    tracer.environment = environment;
+    struct CpuCompare compare = { 0 };
+    float *image = malloc((size_t)width * height * 3 * sizeof(float));
+    float *reference = malloc((size_t)width * height * 3 * sizeof(float));
+    if (cpu_compare_init(&compare, &tracer) > 0 || image == NULL || reference == NULL) {
+        free(image);
+        free(reference);
+        cpu_compare_free(&compare);
+        cpu_tracer_free(&tracer);
+        return 2;
+    }
+
+    // The reference from independent pcg samples past any compared, so it
+    // carries none of the table's structure into the errors it judges.
+    printf("[sampler] rendering a %u sample reference\n", SAMPLER_COMPARE_REFERENCE);
+    tracer.sampler = NULL;
+    cpu_compare_render(&compare, CPU_COMPARE_REFERENCE_SAMPLE, SAMPLER_COMPARE_REFERENCE, reference);
+
+    // Both sequences at every count, from the first sample on.
+    enum { COUNTS_N = 16 };
+    uint32_t counts[COUNTS_N];
+    double errors[2][COUNTS_N];
+    uint32_t counts_n = 0;
+    for (uint32_t n = 1; n <= SAMPLER_COMPARE_MAX_SAMPLES && counts_n < COUNTS_N; n *= 4) counts[counts_n++] = n;
+    printf("[sampler] %ux%u, rmse per pixel sample count:\n", width, height);
+    for (uint32_t i = 0; i < counts_n; i++) {
+        tracer.sampler = NULL;
+        cpu_compare_render(&compare, 0, counts[i], image);
+        errors[0][i] = cpu_compare_rmse(&compare, image, reference, 0);
+        tracer.sampler = sampler;
+        cpu_compare_render(&compare, 0, counts[i], image);
+        errors[1][i] = cpu_compare_rmse(&compare, image, reference, 0);
+        printf("[sampler]   %4u spp: random %.4f, sobol %.4f, %.2fx less variance\n",
+                counts[i],
+                errors[0][i],
+                errors[1][i],
+                errors[1][i] > 0.0 ? (errors[0][i] * errors[0][i]) / (errors[1][i] * errors[1][i]) : 0.0);
+    }
+
+    // Where the sobol curve crosses random's error at the most samples,
+    // interpolated in log-log.
+    uint32_t last = counts_n - 1;
+    double target = errors[0][last], matched = counts[last];
+    for (uint32_t i = 0; i < counts_n; i++) {
+        if (errors[1][i] > target) continue;
+        if (i == 0) {
+            matched = counts[0];
+        } else {
+            double t = log(errors[1][i - 1] / target) / log(errors[1][i - 1] / errors[1][i]);
+            matched = counts[i - 1] * pow((double)counts[i] / counts[i - 1], t);
+        }
+        break;
+    }
+    printf("[sampler] random at %u spp is matched by sobol at about %.0f spp, %.1fx fewer samples\n",
+            counts[last],
+            matched,
+            counts[last] / matched);
+
+    free(image);
+    free(reference);
+    cpu_compare_free(&compare);
+    cpu_tracer_free(&tracer);
+    return 0;
+}
@@ -0,0 +1,46 @@
+// Low-discrepancy samples from the sampler's buffer, see struct Sampler.
+// Include after scene.glsl.
+
+// Must match sampler.h.
+#define SAMPLER_SAMPLES 4096u
+#define SAMPLER_PAIRS 16u
+#define SAMPLER_DIMENSIONS 32u
+#define SAMPLER_MASK_SIZE 64u
+#define SAMPLER_DIMENSION_CAMERA 0u
+#define SAMPLER_DIMENSION_BOUNCE 2u
+#define SAMPLER_BOUNCE_DIMENSIONS 10u
+#define SAMPLER_OFFSET_ENVIRONMENT 0u
+#define SAMPLER_OFFSET_ENVIRONMENT_UV 2u
+#define SAMPLER_OFFSET_BSDF 8u
+
+uint sampler_hash(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// One dimension's rotation at pixel: the blue noise mask at an offset per
+// dimension, and past the table a fresh one per pass through it.
+uint sampler_rotation(uint table, uvec2 pixel, uint index, uint dimension) {
+    uint offset = sampler_hash(dimension);
+    uvec2 texel = (pixel + uvec2(offset, offset >> 16)) & (SAMPLER_MASK_SIZE - 1u);
+    uint rank = Uints[table].data[SAMPLER_SAMPLES * SAMPLER_PAIRS + texel.y * SAMPLER_MASK_SIZE + texel.x];
+    uint rotation = rank * (65536u / (SAMPLER_MASK_SIZE * SAMPLER_MASK_SIZE));
+    uint pass = index / SAMPLER_SAMPLES;
+    if (pass > 0u) rotation += sampler_hash(pass * SAMPLER_DIMENSIONS + dimension) >> 16;
+    return rotation;
+}
+
+// Dimensions dimension and dimension + 1 of sample index at pixel, in
+// (0, 1). dimension is even and below SAMPLER_DIMENSIONS. As sampler_get.
+vec2 sampler_2d(uint table, uvec2 pixel, uint index, uint dimension) {
+    uint point = Uints[table].data[(index % SAMPLER_SAMPLES) * SAMPLER_PAIRS + dimension / 2u];
+    uvec2 value = uvec2(point & 0xffffu, point >> 16);
+    value += uvec2(
+            sampler_rotation(table, pixel, index, dimension),
+            sampler_rotation(table, pixel, index, dimension + 1u));
+    return (vec2(value & 0xffffu) + 0.5) * (1.0 / 65536.0);
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "bvh.h"
+#include "environment.h"
+#include "scene.h"
+
+#define SAMPLER_SAMPLES 4096 // per pixel before the table repeats under a fresh rotation
+#define SAMPLER_PAIRS 16 // 2D points per sample
+#define SAMPLER_DIMENSIONS (2 * SAMPLER_PAIRS) // past these paths fall back to hashing
+#define SAMPLER_MASK_SIZE 64 // blue noise tile width and height, a power of two
+#define SAMPLER_MASK_SIGMA 1.5 // of the void-and-cluster energy, in texels
+#define SAMPLER_COMPARE_WIDTH 160
+#define SAMPLER_COMPARE_HEIGHT 120
+#define SAMPLER_COMPARE_MAX_SAMPLES 256 // compared at powers of 4 up to this
+#define SAMPLER_COMPARE_REFERENCE 4096 // samples of the reference
+
+// Dimensions of a path, must match sampler.glsl. Each bounce takes
+// SAMPLER_BOUNCE_DIMENSIONS from SAMPLER_DIMENSION_BOUNCE on, at these
+// offsets, whether or not the path uses them, so a dimension means the same
+// decision in every sample of a pixel. The table covers the camera and the
+// first three bounces, all the default path length draws.
+#define SAMPLER_DIMENSION_CAMERA 0 // pixel jitter
+#define SAMPLER_DIMENSION_BOUNCE 2
+#define SAMPLER_BOUNCE_DIMENSIONS 10
+#define SAMPLER_OFFSET_ENVIRONMENT 0 // texel, then the alias choice
+#define SAMPLER_OFFSET_ENVIRONMENT_UV 2 // direction within the texel
+#define SAMPLER_OFFSET_LIGHT 4 // emitter pick, the pair's second is unused
+#define SAMPLER_OFFSET_LIGHT_POINT 6 // point on the emitter
+#define SAMPLER_OFFSET_BSDF 8
+
+// Random numbers of the kernels' paths.
+enum SamplerSequence {
+    SamplerSequence_Sobol = 0, // the table below
+    SamplerSequence_Random, // pcg hashed from pixel and sample
+};
+
+// Low-discrepancy samples, precomputed at load. points holds
+// SAMPLER_SAMPLES 2D points for each of SAMPLER_PAIRS pairs of dimensions,
+// each pair its own Owen-scrambled and shuffled Sobol (0, 2)-sequence, so
+// every power of two prefix stratifies the square and pairs do not
+// correlate. A point is one word, x in the low 16 bits and y in the high.
+// mask is a tileable blue noise texture of ranks, built by void-and-cluster.
+// A pixel's sample rotates the point toroidally by the mask at the pixel,
+// offset per dimension: every pixel keeps the sequence's stratification,
+// while neighbours' errors decorrelate into blue noise, which reads as less
+// noise at low sample counts and denoises better. data is the points
+// followed by the mask, the layout the kernels read from one storage buffer.
+struct Sampler {
+    uint32_t *data;
+    size_t size; // of data, bytes
+    const uint32_t *points; // in data, SAMPLER_PAIRS per sample
+    const uint32_t *mask; // in data, ranks below SAMPLER_MASK_SIZE squared, row by row
+    double build_time; // seconds
+};
+
+// Returns 2 when out of memory.
+int sampler_init(struct Sampler *sampler);
+void sampler_free(struct Sampler *sampler);
+void sampler_report(const struct Sampler *sampler);
+
+// Dimension of sample index at pixel (x, y), in (0, 1). dimension must be
+// below SAMPLER_DIMENSIONS. As sampler_2d in sampler.glsl.
+float sampler_get(const struct Sampler *sampler, uint32_t x, uint32_t y, uint32_t index, uint32_t dimension);
+
+// Renders the scene on the CPU at 1, 4, 16 and on to
+// SAMPLER_COMPARE_MAX_SAMPLES per pixel with pcg random numbers and then with
+// sampler, and prints each one's error against a SAMPLER_COMPARE_REFERENCE
+// sample pcg reference, and the samples sampler takes to match random's
+// error at the most. environment may be NULL for the sky.
+int sampler_compare(
+        const struct Sampler *sampler,
+        const struct Scene *scene,
+        const struct Bvh *bvh,
+        const struct Environment *environment,
+        uint32_t width,
+        uint32_t height,
+        uint32_t bounces);
@@ -0,0 +1,460 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "util.h"
+#include "scene.h"
+
+#define PI 3.14159265f
+
+uint32_t scene_add_material(struct Scene *scene, const float albedo[3], const float emission[3]) {
+    if (scene->materials_n == scene->materials_cap) {
+        scene->materials_cap = scene->materials_cap > 0 ? scene->materials_cap * 2 : 16;
+        scene->materials = realloc(scene->materials, scene->materials_cap * sizeof(*scene->materials));
+    }
+    struct SceneMaterial *material = &scene->materials[scene->materials_n];
+    for (int c = 0; c < 3; c++) {
+        material->albedo[c] = albedo[c];
+        material->emission[c] = emission[c];
+    }
+    material->albedo_texture = SCENE_NO_TEXTURE;
+    material->emission[3] = 0.0f;
+
+    return scene->materials_n++;
+}
+
+uint32_t scene_add_texture(struct Scene *scene, const char *path) {
+    for (uint32_t i = 0; i < scene->textures_n; i++)
+        if (strcmp(scene->textures[i].path, path) == 0) return i;
+    if (scene->textures_n == scene->textures_cap) {
+        scene->textures_cap = scene->textures_cap > 0 ? scene->textures_cap * 2 : 16;
+        scene->textures = realloc(scene->textures, scene->textures_cap * sizeof(*scene->textures));
+    }
+    struct SceneTexture *texture = &scene->textures[scene->textures_n];
+    memset(texture, 0, sizeof(*texture));
+    strlcpy(texture->path, path, sizeof(texture->path));
+    texture->uv_extent = 1.0f;
+
+    return scene->textures_n++;
+}
+
+uint32_t scene_add_vertex(struct Scene *scene, float x, float y, float z) {
+    if (scene->vertices_n == scene->vertices_cap) {
+        scene->vertices_cap = scene->vertices_cap > 0 ? scene->vertices_cap * 2 : 1024;
+        scene->positions = realloc(scene->positions, scene->vertices_cap * 4 * sizeof(float));
+        scene->texcoords = realloc(scene->texcoords, scene->vertices_cap * 2 * sizeof(float));
+    }
+    float *p = scene->positions + scene->vertices_n * 4;
+    p[0] = x;
+    p[1] = y;
+    p[2] = z;
+    p[3] = 1.0f;
+    scene->texcoords[scene->vertices_n * 2 + 0] = 0.0f;
+    scene->texcoords[scene->vertices_n * 2 + 1] = 0.0f;
+    if (scene->vertices_n == 0 && scene->triangles_n == 0) {
+        for (int c = 0; c < 3; c++) scene->bounds_min[c] = scene->bounds_max[c] = p[c];
+    }
+    for (int c = 0; c < 3; c++) {
+        scene->bounds_min[c] = fminf(scene->bounds_min[c], p[c]);
+        scene->bounds_max[c] = fmaxf(scene->bounds_max[c], p[c]);
+    }
+
+    return scene->vertices_n++;
+}
+
+void scene_add_triangle(struct Scene *scene, uint32_t a, uint32_t b, uint32_t c, uint32_t material) {
+    if (scene->triangles_n == scene->triangles_cap) {
+        scene->triangles_cap = scene->triangles_cap > 0 ? scene->triangles_cap * 2 : 1024;
+        scene->indices = realloc(scene->indices, scene->triangles_cap * 3 * sizeof(uint32_t));
+        scene->triangle_materials = realloc(scene->triangle_materials, scene->triangles_cap * sizeof(uint32_t));
+    }
+    uint32_t *t = scene->indices + scene->triangles_n * 3;
+    t[0] = a;
+    t[1] = b;
+    t[2] = c;
+    scene->triangle_materials[scene->triangles_n] = material;
+    scene->triangles_n += 1;
+}
+
+static void add_quad(struct Scene *scene, const float corners[4][3], uint32_t material) {
+    uint32_t v[4];
+    for (int i = 0; i < 4; i++) v[i] = scene_add_vertex(scene, corners[i][0], corners[i][1], corners[i][2]);
+    scene_add_triangle(scene, v[0], v[1], v[2], material);
+    scene_add_triangle(scene, v[0], v[2], v[3], material);
+}
+
+static void add_sphere(struct Scene *scene, float cx, float cy, float cz, float r, uint32_t material) {
+    const uint32_t rings = 24, segments = 48;
+    uint32_t first = scene->vertices_n;
+    for (uint32_t i = 0; i <= rings; i++) {
+        float theta = PI * i / rings;
+        for (uint32_t j = 0; j < segments; j++) {
+            float phi = 2.0f * PI * j / segments;
+            scene_add_vertex(
+                    scene,
+                    cx + r * sinf(theta) * cosf(phi),
+                    cy + r * cosf(theta),
+                    cz + r * sinf(theta) * sinf(phi));
+        }
+    }
+    for (uint32_t i = 0; i < rings; i++) {
+        for (uint32_t j = 0; j < segments; j++) {
+            uint32_t a = first + i * segments + j;
+            uint32_t b = first + i * segments + (j + 1) % segments;
+            uint32_t c = a + segments, d = b + segments;
+            if (i > 0) scene_add_triangle(scene, a, b, c, material);
+            if (i + 1 < rings) scene_add_triangle(scene, b, d, c, material);
+        }
+    }
+}
+
+static void add_box(struct Scene *scene, const float lo[3], const float hi[3], uint32_t material) {
+    float c[8][3];
+    for (int i = 0; i < 8; i++) {
+        c[i][0] = i & 1 ? hi[0] : lo[0];
+        c[i][1] = i & 2 ? hi[1] : lo[1];
+        c[i][2] = i & 4 ? hi[2] : lo[2];
+    }
+    static const int faces[6][4] = {
+        { 0, 2, 3, 1 }, { 4, 5, 7, 6 }, { 0, 1, 5, 4 },
+        { 2, 6, 7, 3 }, { 0, 4, 6, 2 }, { 1, 3, 7, 5 },
+    };
+    for (int f = 0; f < 6; f++) {
+        const float quad[4][3] = {
+            { c[faces[f][0]][0], c[faces[f][0]][1], c[faces[f][0]][2] },
+            { c[faces[f][1]][0], c[faces[f][1]][1], c[faces[f][1]][2] },
+            { c[faces[f][2]][0], c[faces[f][2]][1], c[faces[f][2]][2] },
+            { c[faces[f][3]][0], c[faces[f][3]][1], c[faces[f][3]][2] },
+        };
+        add_quad(scene, quad, material);
+    }
+}
+
+static void frame_bounds(struct Scene *scene) {
+    float center[3], extent = 0.0f;
+    for (int c = 0; c < 3; c++) {
+        center[c] = 0.5f * (scene->bounds_min[c] + scene->bounds_max[c]);
+        extent = fmaxf(extent, scene->bounds_max[c] - scene->bounds_min[c]);
+    }
+    scene->camera = (struct SceneCamera) {
+        .position = { center[0], center[1] + 0.2f * extent, center[2] + 1.5f * extent },
+        .target = { center[0], center[1], center[2] },
+        .fov = 0.8f,
+    };
+}
+
+int scene_init_default(struct Scene *scene) {
+#if DEBUG_INPUT_VALIDATION
+    if (scene == NULL) return 1;
+    if (!IS_ZERO_PTR(scene)) return 1;
+#endif
+
+    const float black[3] = { 0.0f, 0.0f, 0.0f };
+    uint32_t grey = scene_add_material(scene, (float[3]) { 0.6f, 0.6f, 0.6f }, black);
+    uint32_t red = scene_add_material(scene, (float[3]) { 0.8f, 0.3f, 0.2f }, black);
+    uint32_t blue = scene_add_material(scene, (float[3]) { 0.2f, 0.4f, 0.8f }, black);
+    uint32_t light = scene_add_material(scene, black, (float[3]) { 12.0f, 12.0f, 12.0f });
+
+    const float ground[4][3] = { { -20, -1, -20 }, { -20, -1, 20 }, { 20, -1, 20 }, { 20, -1, -20 } };
+    add_quad(scene, ground, grey);
+    add_sphere(scene, -1.1f, 0.0f, 0.0f, 1.0f, red);
+    add_sphere(scene, 1.1f, 0.0f, 0.0f, 1.0f, blue);
+    add_box(scene, (float[3]) { -0.4f, -1.0f, 1.0f }, (float[3]) { 0.4f, -0.2f, 1.8f }, grey);
+    const float lamp[4][3] = { { -0.5f, 3, 0.5f }, { 0.5f, 3, 0.5f }, { 0.5f, 3, 1.5f }, { -0.5f, 3, 1.5f } };
+    add_quad(scene, lamp, light);
+
+    scene->camera = (struct SceneCamera) {
+        .position = { 0.0f, 0.5f, 4.0f },
+        .target = { 0.0f, 0.0f, 0.0f },
+        .fov = 0.9f,
+    };
+
+    return 0;
+}
+
+// name resolved against the directory of base, into out.
+static void sibling_path(char *out, size_t size, const char *base, const char *name) {
+    const char *slash = strrchr(base, '/');
+    out[0] = 0;
+    if (name[0] != '/' && slash != NULL) {
+        size_t n = (size_t)(slash - base) + 1;
+        if (n >= size) n = size - 1;
+        memcpy(out, base, n);
+        out[n] = 0;
+    }
+    strlcat(out, name, size);
+}
+
+// Line with the keyword and its separating whitespace cut off, and trailing
+// whitespace stripped, or NULL when line does not start with keyword.
+static char *obj_statement(char *line, const char *keyword) {
+    size_t n = strlen(keyword);
+    if (strncmp(line, keyword, n) != 0 || (line[n] != ' ' && line[n] != '\t')) return NULL;
+    char *value = line + n;
+    while (*value == ' ' || *value == '\t') value++;
+    size_t len = strlen(value);
+    while (len > 0 && (value[len - 1] == '\n' || value[len - 1] == '\r' || value[len - 1] == ' ')) value[--len] = 0;
+    return value;
+}
+
+struct ObjMaterial {
+    char name[64];
+    uint32_t material;
+};
+
+struct ObjMaterials {
+    struct ObjMaterial *items;
+    uint32_t n;
+    uint32_t cap;
+};
+
+// Adds the materials of an MTL file, skipping it when it cannot be opened.
+// Texture options before map_Kd's file name are ignored.
+static void load_mtl(struct Scene *scene, struct ObjMaterials *materials, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        printf("[scene] no material library %s\n", path);
+        return;
+    }
+
+    struct SceneMaterial *material = NULL;
+    char line[1024];
+    char *value;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if ((value = obj_statement(line, "newmtl")) != NULL) {
+            if (materials->n == materials->cap) {
+                materials->cap = materials->cap > 0 ? materials->cap * 2 : 16;
+                materials->items = realloc(materials->items, materials->cap * sizeof(*materials->items));
+            }
+            struct ObjMaterial *named = &materials->items[materials->n++];
+            strlcpy(named->name, value, sizeof(named->name));
+            const float black[3] = { 0.0f, 0.0f, 0.0f };
+            named->material = scene_add_material(scene, (float[3]) { 0.7f, 0.7f, 0.7f }, black);
+            material = &scene->materials[named->material];
+        } else if (material == NULL) {
+            continue;
+        } else if ((value = obj_statement(line, "Kd")) != NULL) {
+            sscanf(value, "%f %f %f", &material->albedo[0], &material->albedo[1], &material->albedo[2]);
+        } else if ((value = obj_statement(line, "Ke")) != NULL) {
+            sscanf(value, "%f %f %f", &material->emission[0], &material->emission[1], &material->emission[2]);
+        } else if ((value = obj_statement(line, "map_Kd")) != NULL) {
+            const char *name = strrchr(value, ' ');
+            name = name != NULL ? name + 1 : value;
+            char texture_path[256];
+            sibling_path(texture_path, sizeof(texture_path), path, name);
+            material->albedo_texture = scene_add_texture(scene, texture_path);
+        }
+    }
+    fclose(file);
+}
+
+// Scene vertex of each distinct position and texture coordinate pair faces
+// use, open addressed. Keys are the OBJ's 1-based position index in the high
+// half and texture coordinate index, 0 for none, in the low.
+struct ObjVertices {
+    uint64_t *keys; // 0 marks an empty entry
+    uint32_t *vertices;
+    uint32_t n;
+    uint32_t cap; // a power of two
+};
+
+static uint32_t *obj_vertex_entry(struct ObjVertices *map, uint64_t key) {
+    if (2 * (map->n + 1) > map->cap) {
+        struct ObjVertices grown = { .cap = map->cap > 0 ? map->cap * 2 : 4096 };
+        grown.keys = calloc(grown.cap, sizeof(*grown.keys));
+        grown.vertices = malloc(grown.cap * sizeof(*grown.vertices));
+        for (uint32_t i = 0; i < map->cap; i++)
+            if (map->keys[i] != 0) *obj_vertex_entry(&grown, map->keys[i]) = map->vertices[i];
+        grown.n = map->n;
+        free(map->keys);
+        free(map->vertices);
+        *map = grown;
+    }
+    uint32_t mask = map->cap - 1;
+    uint32_t i = (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+    while (map->keys[i] != 0 && map->keys[i] != key) i = (i + 1) & mask;
+    if (map->keys[i] == 0) {
+        map->keys[i] = key;
+        map->vertices[i] = UINT32_MAX;
+        map->n += 1;
+    }
+    return &map->vertices[i];
+}
+
+// Bounds and texture coordinate extent of every texture's triangles.
+static void bound_textures(struct Scene *scene) {
+    for (uint32_t t = 0; t < scene->textures_n; t++) {
+        struct SceneTexture *texture = &scene->textures[t];
+        float uv_min[2] = { INFINITY, INFINITY }, uv_max[2] = { -INFINITY, -INFINITY };
+        for (int c = 0; c < 3; c++) {
+            texture->bounds_min[c] = INFINITY;
+            texture->bounds_max[c] = -INFINITY;
+        }
+        for (uint32_t i = 0; i < scene->triangles_n; i++) {
+            if (scene->materials[scene->triangle_materials[i]].albedo_texture != t) continue;
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = scene->indices[i * 3 + k];
+                for (int c = 0; c < 3; c++) {
+                    texture->bounds_min[c] = fminf(texture->bounds_min[c], scene->positions[v * 4 + c]);
+                    texture->bounds_max[c] = fmaxf(texture->bounds_max[c], scene->positions[v * 4 + c]);
+                }
+                for (int c = 0; c < 2; c++) {
+                    uv_min[c] = fminf(uv_min[c], scene->texcoords[v * 2 + c]);
+                    uv_max[c] = fmaxf(uv_max[c], scene->texcoords[v * 2 + c]);
+                }
+            }
+        }
+        if (uv_max[0] < uv_min[0]) {
+            // Mapped by no triangle, never requested.
+            for (int c = 0; c < 3; c++) texture->bounds_min[c] = texture->bounds_max[c] = 0.0f;
+            continue;
+        }
+        texture->uv_extent = fmaxf(fmaxf(uv_max[0] - uv_min[0], uv_max[1] - uv_min[1]), 1e-3f);
+    }
+}
+
+int scene_load_obj(struct Scene *scene, const char *path) {
+#if DEBUG_INPUT_VALIDATION
+    if (scene == NULL || path == NULL) return 1;
+    if (!IS_ZERO_PTR(scene)) return 1;
+#endif
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return 2;
+
+    const float black[3] = { 0.0f, 0.0f, 0.0f };
+    uint32_t grey = scene_add_material(scene, (float[3]) { 0.7f, 0.7f, 0.7f }, black);
+    uint32_t material = grey;
+
+    // Faces index positions and texture coordinates separately, scene
+    // vertices are made on first use of each pair.
+    float *positions = NULL;
+    uint32_t positions_n = 0, positions_cap = 0;
+    float *texcoords = NULL;
+    uint32_t texcoords_n = 0, texcoords_cap = 0;
+    struct ObjVertices vertices = { 0 };
+    struct ObjMaterials materials = { 0 };
+
+    int result = 0;
+    char line[1024];
+    char *value;
+    while (result == 0 && fgets(line, sizeof(line), file) != NULL) {
+        if ((value = obj_statement(line, "v")) != NULL) {
+            if (positions_n == positions_cap) {
+                positions_cap = positions_cap > 0 ? positions_cap * 2 : 1024;
+                positions = realloc(positions, positions_cap * 3 * sizeof(float));
+            }
+            float *p = positions + positions_n++ * 3;
+            p[0] = p[1] = p[2] = 0.0f;
+            sscanf(value, "%f %f %f", &p[0], &p[1], &p[2]);
+        } else if ((value = obj_statement(line, "vt")) != NULL) {
+            if (texcoords_n == texcoords_cap) {
+                texcoords_cap = texcoords_cap > 0 ? texcoords_cap * 2 : 1024;
+                texcoords = realloc(texcoords, texcoords_cap * 2 * sizeof(float));
+            }
+            float *t = texcoords + texcoords_n++ * 2;
+            t[0] = t[1] = 0.0f;
+            sscanf(value, "%f %f", &t[0], &t[1]);
+            t[1] = 1.0f - t[1]; // OBJ's v runs up the image, rows run down
+        } else if ((value = obj_statement(line, "mtllib")) != NULL) {
+            char mtl_path[256];
+            sibling_path(mtl_path, sizeof(mtl_path), path, value);
+            load_mtl(scene, &materials, mtl_path);
+        } else if ((value = obj_statement(line, "usemtl")) != NULL) {
+            material = grey;
+            for (uint32_t i = 0; i < materials.n; i++)
+                if (strcmp(materials.items[i].name, value) == 0) material = materials.items[i].material;
+        } else if ((value = obj_statement(line, "f")) != NULL) {
+            // Fan triangulate, ignoring normal references.
+            uint32_t polygon[64];
+            uint32_t polygon_n = 0;
+            char *token = strtok(value, " \t");
+            while (token != NULL && polygon_n < 64) {
+                char *end = NULL;
+                long index = strtol(token, &end, 10);
+                long texcoord = 0;
+                if (*end == '/' && end[1] != '/') texcoord = strtol(end + 1, NULL, 10);
+                if (index < 0) index += positions_n + 1;
+                if (texcoord < 0) texcoord += texcoords_n + 1;
+                if (index < 1 || index > positions_n || texcoord < 0 || texcoord > texcoords_n) {
+                    result = 3; // Bad index.
+                    break;
+                }
+
+                uint32_t *vertex = obj_vertex_entry(&vertices, (uint64_t)index << 32 | (uint64_t)texcoord);
+                if (*vertex == UINT32_MAX) {
+                    const float *p = positions + (index - 1) * 3;
+                    *vertex = scene_add_vertex(scene, p[0], p[1], p[2]);
+                    if (texcoord > 0) memcpy(scene->texcoords + *vertex * 2, texcoords + (texcoord - 1) * 2, 2 * sizeof(float));
+                }
+                polygon[polygon_n++] = *vertex;
+                token = strtok(NULL, " \t");
+            }
+            for (uint32_t i = 2; result == 0 && i < polygon_n; i++)
+                scene_add_triangle(scene, polygon[0], polygon[i - 1], polygon[i], material);
+        }
+    }
+    fclose(file);
+    free(positions);
+    free(texcoords);
+    free(vertices.keys);
+    free(vertices.vertices);
+    free(materials.items);
+    if (result > 0) return result;
+    if (scene->triangles_n == 0) return 4;
+
+    frame_bounds(scene);
+    bound_textures(scene);
+
+    return 0;
+}
+
+void scene_texture_footprints(
+        const struct Scene *scene,
+        const struct SceneCamera *camera,
+        uint32_t height,
+        float *footprints) {
+    float forward[3], forward_len = 0.0f;
+    for (int c = 0; c < 3; c++) {
+        forward[c] = camera->target[c] - camera->position[c];
+        forward_len += forward[c] * forward[c];
+    }
+    forward_len = sqrtf(forward_len);
+    float pixels_per_slope = height / (2.0f * tanf(0.5f * camera->fov)); // at unit distance
+
+    for (uint32_t t = 0; t < scene->textures_n; t++) {
+        const struct SceneTexture *texture = &scene->textures[t];
+        footprints[t] = 0.0f;
+
+        // Any corner in front of the camera keeps it.
+        int in_front = 0;
+        for (int corner = 0; corner < 8; corner++) {
+            float depth = 0.0f;
+            for (int c = 0; c < 3; c++) {
+                float p = (corner >> c) & 1 ? texture->bounds_max[c] : texture->bounds_min[c];
+                depth += (p - camera->position[c]) * forward[c];
+            }
+            if (depth > 0.0f) in_front = 1;
+        }
+        if (!in_front || forward_len == 0.0f) continue;
+
+        float distance = 0.0f, size = 0.0f;
+        for (int c = 0; c < 3; c++) {
+            float p = fminf(fmaxf(camera->position[c], texture->bounds_min[c]), texture->bounds_max[c]);
+            distance += (p - camera->position[c]) * (p - camera->position[c]);
+            size = fmaxf(size, texture->bounds_max[c] - texture->bounds_min[c]);
+        }
+        distance = fmaxf(sqrtf(distance), 1e-3f * size + 1e-6f);
+        footprints[t] = size / texture->uv_extent / distance * pixels_per_slope;
+    }
+}
+
+void scene_free(struct Scene *scene) {
+    free(scene->positions);
+    free(scene->texcoords);
+    free(scene->indices);
+    free(scene->triangle_materials);
+    free(scene->materials);
+    free(scene->textures);
+    memset(scene, 0, sizeof(*scene));
+}
@@ -0,0 +1,90 @@
+// Scene data the path tracing kernels read, see enum TraceBuffer. Include
+// after bindless.glsl; the kernel's push constants then list the buffer slots
+// in a uint buffers[BUFFERS_N] and include path.glsl.
+#ifdef RAY_QUERY
+#extension GL_EXT_ray_query : require
+#endif
+
+#define PI 3.14159265
+
+// Must match enum TraceBuffer.
+#define BUFFER_POSITIONS 0
+#define BUFFER_INDICES 1
+#define BUFFER_TRIANGLE_MATERIALS 2
+#define BUFFER_MATERIALS 3
+#define BUFFER_NODES 4
+#define BUFFER_BVH_TRIANGLES 5
+#define BUFFERS_N 6
+
+#define NO_TEXTURE 0xFFFFFFFFu // must match SCENE_NO_TEXTURE
+
+// Must match struct SceneMaterial in scene.h.
+struct Material {
+    vec3 albedo;
+    uint albedo_texture; // into the kernel's texture table, NO_TEXTURE for none
+    vec4 emission;
+};
+
+// Must match struct BvhNode in bvh.h.
+struct Node {
+    vec3 min;
+    uint left_first;
+    vec3 max;
+    uint count;
+};
+
+// Must match struct EnvironmentHeader and EnvironmentTexel in environment.h.
+// The environment buffer holds the header, then the texels from index 1.
+struct EnvironmentHeader {
+    uint width;
+    uint height;
+    uint sampling;
+    uint pad0;
+    uvec4 pad1;
+};
+
+struct EnvironmentTexel {
+    vec3 radiance;
+    float pdf; // of picking the texel
+    float probability; // stay on the texel below this, else take alias
+    uint alias;
+    uint pad0;
+    uint pad1;
+};
+
+#define ENVIRONMENT_MIS 0u // must match enum EnvironmentSampling
+
+// Must match struct LightNode in light_tree.h.
+struct LightNode {
+    vec3 min;
+    float power;
+    vec3 max;
+    float cos_theta; // cone about axis holding the lines of the normals
+    vec3 axis;
+    uint child_triangle; // first child, or LIGHT_LEAF and the triangle
+};
+
+#define LIGHT_LEAF 0x80000000u
+
+BINDLESS_BUFFER_RO(Positions, vec4);
+BINDLESS_BUFFER_RO(Texcoords, vec2);
+BINDLESS_BUFFER_RO(Uints, uint);
+BINDLESS_BUFFER_RO(Materials, Material);
+BINDLESS_BUFFER_RO(Nodes, Node);
+BINDLESS_BUFFER_RO(EnvironmentHeaders, EnvironmentHeader);
+BINDLESS_BUFFER_RO(EnvironmentTexels, EnvironmentTexel);
+BINDLESS_BUFFER_RO(LightNodes, LightNode);
+
+#ifdef RAY_QUERY
+layout(set = 0, binding = BINDLESS_ACCEL) uniform accelerationStructureEXT scene_accel;
+#endif
+
+uint pcg(inout uint state) {
+    state = state * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+float rand(inout uint state) {
+    return float(pcg(state)) * (1.0 / 4294967296.0);
+}
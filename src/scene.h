@@ -0,0 +1,71 @@
+#pragma once
+#include <stdint.h>
+
+#define SCENE_NO_TEXTURE 0xFFFFFFFFu
+
+// std430 layout, read by the trace kernels.
+struct SceneMaterial {
+    float albedo[3];
+    uint32_t albedo_texture; // index into Scene.textures scaling albedo, SCENE_NO_TEXTURE for none
+    float emission[4];
+};
+
+// An image some materials' albedo maps, and the extent of the triangles
+// mapping it, where its footprint on screen is estimated from.
+struct SceneTexture {
+    char path[256];
+    float bounds_min[3];
+    float bounds_max[3];
+    float uv_extent; // larger side of the texture coordinates' bounds, 1 for one repeat
+};
+
+struct SceneCamera {
+    float position[3];
+    float target[3];
+    float fov; // vertical, radians
+};
+
+// Indexed triangle soup with one material per triangle.
+struct Scene {
+    float *positions; // xyz plus padding, 4 floats per vertex
+    float *texcoords; // uv with v down the image, 2 floats per vertex
+    uint32_t vertices_n;
+    uint32_t vertices_cap;
+    uint32_t *indices; // 3 per triangle
+    uint32_t *triangle_materials; // per triangle
+    uint32_t triangles_n;
+    uint32_t triangles_cap;
+    struct SceneMaterial *materials;
+    uint32_t materials_n;
+    uint32_t materials_cap;
+    struct SceneTexture *textures;
+    uint32_t textures_n;
+    uint32_t textures_cap;
+    struct SceneCamera camera;
+    float bounds_min[3];
+    float bounds_max[3];
+};
+
+// Ground, two spheres, a box and an area light.
+int scene_init_default(struct Scene *scene);
+// Wavefront OBJ, positions, texture coordinates and faces, with Kd, Ke and
+// map_Kd of the materials its mtllib names. Faces without a material get a
+// neutral grey and the camera frames the bounds. Returns 2 when path cannot
+// be opened, 3 on a bad index and 4 without faces.
+int scene_load_obj(struct Scene *scene, const char *path);
+void scene_free(struct Scene *scene);
+
+// Pixels one repeat of each texture covers along its larger axis, seen from
+// camera in an image height pixels tall, at the nearest point of its bounds.
+// 0 for textures behind the camera. footprints holds textures_n.
+void scene_texture_footprints(
+        const struct Scene *scene,
+        const struct SceneCamera *camera,
+        uint32_t height,
+        float *footprints);
+
+uint32_t scene_add_material(struct Scene *scene, const float albedo[3], const float emission[3]);
+uint32_t scene_add_texture(struct Scene *scene, const char *path);
+// Texture coordinates start at zero.
+uint32_t scene_add_vertex(struct Scene *scene, float x, float y, float z);
+void scene_add_triangle(struct Scene *scene, uint32_t a, uint32_t b, uint32_t c, uint32_t material);
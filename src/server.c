@@ -0,0 +1,549 @@
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "util.h"
+#include "cpu_trace.h"
+#include "image.h"
+#include "net.h"
+#include "server.h"
+
+#define DEG_TO_RAD 0.017453293f
+
+struct ServerBand {
+    const struct CpuTracer *tracer;
+    float *image;
+    uint32_t y, h;
+    uint32_t samples;
+    struct WorkerGroup *group;
+};
+
+// Queue, under the lock.
+
+static int job_before(const struct ServerJob *a, const struct ServerJob *b) {
+    return a->priority != b->priority ? a->priority > b->priority : a->id < b->id;
+}
+
+static void sift_down(struct ServerJob *heap, uint32_t n, uint32_t i) {
+    for (;;) {
+        uint32_t best = i, l = 2 * i + 1, r = 2 * i + 2;
+        if (l < n && job_before(&heap[l], &heap[best])) best = l;
+        if (r < n && job_before(&heap[r], &heap[best])) best = r;
+        if (best == i) return;
+        struct ServerJob swap = heap[i];
+        heap[i] = heap[best];
+        heap[best] = swap;
+        i = best;
+    }
+}
+
+static int queue_push(struct Server *server, struct ServerJob *job) {
+    if (server->heap_n == server->heap_cap) {
+        uint32_t cap = server->heap_cap > 0 ? server->heap_cap * 2 : 64;
+        struct ServerJob *heap = realloc(server->heap, cap * sizeof(*heap));
+        if (heap == NULL) return 2;
+        server->heap = heap;
+        server->heap_cap = cap;
+    }
+
+    job->id = ++server->next_id;
+    uint32_t i = server->heap_n++;
+    server->heap[i] = *job;
+    while (i > 0 && job_before(&server->heap[i], &server->heap[(i - 1) / 2])) {
+        struct ServerJob swap = server->heap[i];
+        server->heap[i] = server->heap[(i - 1) / 2];
+        server->heap[(i - 1) / 2] = swap;
+        i = (i - 1) / 2;
+    }
+
+    server->stats.submitted_n++;
+    uint32_t depth = server->heap_n + server->batch_n;
+    if (depth > server->stats.depth_max) server->stats.depth_max = depth;
+    pthread_cond_signal(&server->wake);
+    return 0;
+}
+
+static int compatible(const struct ServerJob *a, const struct ServerJob *b) {
+    return strcmp(a->scene_path, b->scene_path) == 0
+        && a->width == b->width
+        && a->height == b->height
+        && a->bounces == b->bounces;
+}
+
+// The top job and the queued ones that share its scene, size and path length.
+static uint32_t queue_take_batch(struct Server *server, struct ServerJob *batch) {
+    batch[0] = server->heap[0];
+    server->heap[0] = server->heap[--server->heap_n];
+    sift_down(server->heap, server->heap_n, 0);
+
+    uint32_t batch_n = 1, kept = 0;
+    for (uint32_t i = 0; i < server->heap_n; i++) {
+        if (batch_n < SERVER_BATCH_MAX && compatible(&batch[0], &server->heap[i]))
+            batch[batch_n++] = server->heap[i];
+        else
+            server->heap[kept++] = server->heap[i];
+    }
+    server->heap_n = kept;
+    for (uint32_t i = kept / 2; i-- > 0;) sift_down(server->heap, kept, i);
+
+    return batch_n;
+}
+
+// Render thread.
+
+static struct ServerScene *scene_acquire(struct Server *server, const char *path) {
+    server->clock++;
+    struct ServerScene *victim = &server->scenes[0];
+    for (uint32_t i = 0; i < SERVER_SCENE_CACHE; i++) {
+        struct ServerScene *cached = &server->scenes[i];
+        if (cached->loaded && strcmp(cached->path, path) == 0) {
+            cached->used = server->clock;
+            server->stats.cache_hits_n++;
+            return cached;
+        }
+        if (!cached->loaded || (victim->loaded && cached->used < victim->used)) victim = cached;
+    }
+
+    //
+    server->stats.cache_misses_n++;
+    bvh_free(&victim->bvh);
+    scene_free(&victim->scene);
+    victim->loaded = 0;
+    int result = path[0] != 0 ? scene_load_obj(&victim->scene, path) : scene_init_default(&victim->scene);
+    if (result > 0 || bvh_build(&victim->bvh, victim->scene.positions, victim->scene.indices, victim->scene.triangles_n) > 0) {
+        bvh_free(&victim->bvh);
+        scene_free(&victim->scene);
+        return NULL;
+    }
+    strlcpy(victim->path, path, sizeof(victim->path));
+    victim->used = server->clock;
+    victim->loaded = 1;
+
+    return victim;
+}
+
+static void band_job(void *arg) {
+    struct ServerBand *band = arg;
+    uint32_t width = band->tracer->width;
+    cpu_tracer_render(
+            band->tracer,
+            0, band->y, width, band->h,
+            0, band->samples,
+            band->image + (size_t)band->y * width * 3);
+    worker_group_done(band->group);
+}
+
+// Tells whoever submitted job how it went.
+static void job_finish(const struct ServerJob *job, int ok, double latency) {
+    char line[SERVER_LINE_MAX];
+    int length = ok
+        ? snprintf(line, sizeof(line), "done %llu %.1f ms\n", (unsigned long long)job->id, latency * 1e3)
+        : snprintf(line, sizeof(line), "failed %llu\n", (unsigned long long)job->id);
+    if (job->client >= 0) {
+        net_send(job->client, line, length);
+        close(job->client);
+    }
+    if (job->spool_path[0] != 0) {
+        char from[300], to[300];
+        snprintf(from, sizeof(from), "%s.running", job->spool_path);
+        snprintf(to, sizeof(to), "%s.%s", job->spool_path, ok ? "done" : "failed");
+        FILE *file = fopen(from, "a");
+        if (file != NULL) {
+            fputs(line, file);
+            fclose(file);
+        }
+        rename(from, to);
+    }
+}
+
+static void render_batch(struct Server *server, struct ServerJob *batch, uint32_t batch_n) {
+    double start = time_now();
+    struct ServerScene *scene = scene_acquire(server, batch[0].scene_path);
+
+    // A tracer and image per job, then every job's bands in one group.
+    struct CpuTracer tracers[SERVER_BATCH_MAX] = { 0 };
+    float *images[SERVER_BATCH_MAX] = { NULL };
+    int ok[SERVER_BATCH_MAX] = { 0 };
+    uint32_t bands_n = 0;
+    for (uint32_t i = 0; i < batch_n && scene != NULL; i++) {
+        const struct ServerJob *job = &batch[i];
+        images[i] = malloc((size_t)job->width * job->height * 3 * sizeof(float));
+        if (images[i] == NULL) continue;
+        if (cpu_tracer_init(&tracers[i], &scene->scene, &scene->bvh, job->width, job->height, job->bounces) > 0)
+            continue;
+        if (job->has_camera) tracers[i].camera = job->camera;
+        ok[i] = 1;
+        bands_n += (job->height + SERVER_BAND_ROWS - 1) / SERVER_BAND_ROWS;
+    }
+    struct ServerBand *bands = malloc(bands_n * sizeof(*bands));
+    struct WorkerGroup group;
+    worker_group_init(&group);
+    uint32_t band = 0;
+    for (uint32_t i = 0; i < batch_n && bands != NULL; i++) {
+        if (!ok[i]) continue;
+        for (uint32_t y = 0; y < batch[i].height; y += SERVER_BAND_ROWS) {
+            bands[band] = (struct ServerBand) {
+                .tracer = &tracers[i],
+                .image = images[i],
+                .y = y,
+                .h = batch[i].height - y < SERVER_BAND_ROWS ? batch[i].height - y : SERVER_BAND_ROWS,
+                .samples = batch[i].samples,
+                .group = &group,
+            };
+            workers_push_group(server->workers, &group, band_job, &bands[band]);
+            band++;
+        }
+    }
+    worker_group_wait(&group);
+    worker_group_free(&group);
+    free(bands);
+    double rendered = time_now();
+
+    //
+    uint64_t paths_n = 0;
+    for (uint32_t i = 0; i < batch_n; i++) {
+        const struct ServerJob *job = &batch[i];
+        ok[i] = ok[i] && bands != NULL && image_write_linear(job->output_path, job->width, job->height, images[i]) == 0;
+        if (ok[i]) paths_n += (uint64_t)job->width * job->height * job->samples;
+        double latency = time_now() - job->submitted_at;
+        job_finish(job, ok[i], latency);
+        free(images[i]);
+        cpu_tracer_free(&tracers[i]);
+
+        pthread_mutex_lock(&server->lock);
+        if (ok[i]) {
+            server->stats.finished_n++;
+            server->stats.wait_sum += start - job->submitted_at;
+            server->stats.latency_sum += latency;
+            if (latency > server->stats.latency_max) server->stats.latency_max = latency;
+        } else {
+            server->stats.failed_n++;
+        }
+        pthread_mutex_unlock(&server->lock);
+    }
+
+    pthread_mutex_lock(&server->lock);
+    server->stats.batches_n++;
+    server->stats.busy_seconds += rendered - start;
+    server->stats.paths_n += paths_n;
+    pthread_mutex_unlock(&server->lock);
+}
+
+static void *render_thread(void *arg) {
+    struct Server *server = arg;
+    struct ServerJob batch[SERVER_BATCH_MAX];
+
+    pthread_mutex_lock(&server->lock);
+    for (;;) {
+        while (server->heap_n == 0 && !server->quit) pthread_cond_wait(&server->wake, &server->lock);
+        if (server->heap_n == 0) break; // Quit with the queue drained.
+
+        uint32_t batch_n = queue_take_batch(server, batch);
+        server->batch_n = batch_n;
+        pthread_mutex_unlock(&server->lock);
+        render_batch(server, batch, batch_n);
+        pthread_mutex_lock(&server->lock);
+        server->batch_n = 0;
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    return NULL;
+}
+
+// Requests.
+
+// Fills job from the key=value pairs after "render". Returns 0 when it names
+// an output.
+static int parse_job(char *args, struct ServerJob *job) {
+    memset(job, 0, sizeof(*job));
+    job->client = -1;
+    job->width = job->height = SERVER_DEFAULT_SIZE;
+    job->samples = SERVER_DEFAULT_SAMPLES;
+
+    char *save = NULL;
+    for (char *pair = strtok_r(args, " \t\r\n", &save); pair != NULL; pair = strtok_r(NULL, " \t\r\n", &save)) {
+        char *value = strchr(pair, '=');
+        if (value == NULL) return 3;
+        *value++ = 0;
+        char *end = value + strlen(value); // numbers move it back to where they stop
+        if (strcmp(pair, "scene") == 0) {
+            strlcpy(job->scene_path, value, sizeof(job->scene_path));
+        } else if (strcmp(pair, "output") == 0) {
+            strlcpy(job->output_path, value, sizeof(job->output_path));
+        } else if (strcmp(pair, "width") == 0) {
+            job->width = strtoul(value, &end, 10);
+        } else if (strcmp(pair, "height") == 0) {
+            job->height = strtoul(value, &end, 10);
+        } else if (strcmp(pair, "samples") == 0) {
+            job->samples = strtoul(value, &end, 10);
+        } else if (strcmp(pair, "bounces") == 0) {
+            job->bounces = strtoul(value, &end, 10);
+        } else if (strcmp(pair, "priority") == 0) {
+            job->priority = strtol(value, &end, 10);
+        } else if (strcmp(pair, "wait") == 0) {
+            job->client = strtol(value, &end, 10) != 0 ? 0 : -1; // The caller puts the socket in.
+        } else if (strcmp(pair, "camera") == 0) {
+            float v[7];
+            end = value;
+            for (int i = 0; i < 7; i++) {
+                v[i] = strtof(end, &end);
+                if (i < 6 && *end++ != ',') return 3;
+            }
+            job->camera = (struct SceneCamera) {
+                .position = { v[0], v[1], v[2] },
+                .target = { v[3], v[4], v[5] },
+                .fov = v[6] * DEG_TO_RAD,
+            };
+            job->has_camera = 1;
+        } else {
+            return 3;
+        }
+        if (*end != 0) return 3;
+    }
+    if (job->output_path[0] == 0) return 3;
+    if (job->width == 0 || job->height == 0 || job->samples == 0) return 3;
+
+    return 0;
+}
+
+// Handles the single line a client sends. Returns 1 when fd was handed to a
+// job, which closes it.
+static int handle_line(struct Server *server, char *line, int fd) {
+    char reply[SERVER_LINE_MAX];
+    if (strncmp(line, "stats", 5) == 0) {
+        server_metrics(server, reply, sizeof(reply) - 1);
+        strlcat(reply, "\n", sizeof(reply));
+    } else if (strncmp(line, "quit", 4) == 0) {
+        pthread_mutex_lock(&server->lock);
+        server->quit = 1;
+        pthread_mutex_unlock(&server->lock);
+        snprintf(reply, sizeof(reply), "bye\n");
+    } else if (strncmp(line, "render ", 7) == 0) {
+        struct ServerJob job;
+        if (parse_job(line + 7, &job) > 0) {
+            snprintf(reply, sizeof(reply), "error bad job\n");
+        } else {
+            int wait = job.client == 0;
+            job.client = wait ? fd : -1;
+            job.submitted_at = time_now();
+            // The reply goes out under the lock, before the render thread can
+            // take the job and answer on the same socket.
+            pthread_mutex_lock(&server->lock);
+            if (queue_push(server, &job) > 0) {
+                snprintf(reply, sizeof(reply), "error queue full\n");
+                wait = 0;
+            } else {
+                snprintf(reply, sizeof(reply), "queued %llu\n", (unsigned long long)job.id);
+            }
+            net_send(fd, reply, strlen(reply));
+            pthread_mutex_unlock(&server->lock);
+            return wait;
+        }
+    } else {
+        snprintf(reply, sizeof(reply), "error unknown command\n");
+    }
+
+    net_send(fd, reply, strlen(reply));
+    return 0;
+}
+
+// Reads a client's line. Returns 0 once it has one, 1 while incomplete and
+// 2 when the client hung up or sent too much.
+static int read_line(int fd, char *line, size_t size) {
+    size_t n = 0;
+    for (;;) {
+        ssize_t got = recv(fd, line + n, size - 1 - n, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return 2;
+        n += got;
+        line[n] = 0;
+        if (memchr(line, '\n', n) != NULL) return 0;
+        if (n == size - 1) return 2;
+    }
+}
+
+static void scan_spool(struct Server *server) {
+    DIR *dir = opendir(server->spool);
+    if (dir == NULL) return;
+
+    for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+        size_t length = strlen(entry->d_name);
+        if (length < 5 || strcmp(entry->d_name + length - 4, ".job") != 0) continue;
+
+        char path[256], running[300], line[SERVER_LINE_MAX] = { 0 };
+        snprintf(path, sizeof(path), "%s/%s", server->spool, entry->d_name);
+        snprintf(running, sizeof(running), "%s.running", path);
+        FILE *file = fopen(path, "r");
+        if (file == NULL) continue;
+        char *read = fgets(line, sizeof(line), file);
+        fclose(file);
+        if (rename(path, running) != 0) continue;
+
+        // Files hold the arguments, with or without the command.
+        char *args = strncmp(line, "render ", 7) == 0 ? line + 7 : line;
+        struct ServerJob job = { 0 };
+        if (read == NULL || parse_job(args, &job) > 0) {
+            job.client = -1;
+            strlcpy(job.spool_path, path, sizeof(job.spool_path));
+            job_finish(&job, 0, 0.0);
+            continue;
+        }
+        job.client = -1; // Nobody to wait on a file.
+        strlcpy(job.spool_path, path, sizeof(job.spool_path));
+        job.submitted_at = time_now();
+        pthread_mutex_lock(&server->lock);
+        queue_push(server, &job);
+        pthread_mutex_unlock(&server->lock);
+    }
+    closedir(dir);
+}
+
+//
+
+int server_init(struct Server *server, struct Workers *workers, const char *address, const char *spool) {
+#if DEBUG_INPUT_VALIDATION
+    if (server == NULL) return 1;
+    if (!IS_ZERO_PTR(server)) return 1;
+    if (workers == NULL) return 1;
+    if (address == NULL && spool == NULL) return 1;
+#endif
+
+    server->workers = workers;
+    server->address = address;
+    server->spool = spool;
+    server->listener = -1;
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->wake, NULL);
+    server->started_at = server->reported_at = time_now();
+
+    if (address != NULL) {
+        server->listener = net_listen(address);
+        if (server->listener < 0) {
+            server_free(server);
+            return 2;
+        }
+    }
+    if (pthread_create(&server->thread, NULL, render_thread, server) != 0) {
+        server_free(server);
+        return 3;
+    }
+    server->thread_started = 1;
+
+    return 0;
+}
+
+void server_free(struct Server *server) {
+    if (server->thread_started) {
+        pthread_mutex_lock(&server->lock);
+        server->quit = 1;
+        pthread_cond_signal(&server->wake);
+        pthread_mutex_unlock(&server->lock);
+        pthread_join(server->thread, NULL);
+    }
+
+    for (uint32_t i = 0; i < server->clients_n; i++) close(server->clients[i]);
+    if (server->listener >= 0) {
+        close(server->listener);
+        net_unlink(server->address);
+    }
+    for (uint32_t i = 0; i < SERVER_SCENE_CACHE; i++) {
+        bvh_free(&server->scenes[i].bvh);
+        scene_free(&server->scenes[i].scene);
+    }
+    free(server->heap);
+    pthread_cond_destroy(&server->wake);
+    pthread_mutex_destroy(&server->lock);
+    memset(server, 0, sizeof(*server));
+}
+
+int server_run(struct Server *server) {
+#if DEBUG_INPUT_VALIDATION
+    if (server == NULL) return 1;
+#endif
+
+    printf("[server] serving%s%s%s%s\n",
+            server->address != NULL ? " on " : "",
+            server->address != NULL ? server->address : "",
+            server->spool != NULL ? " spool " : "",
+            server->spool != NULL ? server->spool : "");
+    uint64_t reported_n = 0;
+    for (;;) {
+        pthread_mutex_lock(&server->lock);
+        int quit = server->quit;
+        pthread_mutex_unlock(&server->lock);
+        if (quit) break;
+
+        // Clients first, then new connections.
+        struct pollfd fds[SERVER_MAX_CLIENTS + 1];
+        uint32_t clients_n = server->clients_n;
+        for (uint32_t i = 0; i < clients_n; i++)
+            fds[i] = (struct pollfd) { .fd = server->clients[i], .events = POLLIN };
+        fds[clients_n] = (struct pollfd) { .fd = server->listener, .events = POLLIN };
+        int ready = poll(fds, clients_n + (server->listener >= 0), (int)(SERVER_POLL_PERIOD * 1e3));
+        for (uint32_t i = clients_n; ready > 0 && i-- > 0;) {
+            if (fds[i].revents == 0) continue;
+            char line[SERVER_LINE_MAX];
+            int fd = server->clients[i];
+            int result = read_line(fd, line, sizeof(line));
+            if (result == 1) continue;
+            if (result > 0 || !handle_line(server, line, fd)) close(fd);
+            server->clients[i] = server->clients[--server->clients_n];
+        }
+        if (ready > 0 && server->listener >= 0 && (fds[clients_n].revents & POLLIN)) {
+            int fd = net_accept(server->listener);
+            if (fd >= 0 && server->clients_n < SERVER_MAX_CLIENTS) server->clients[server->clients_n++] = fd;
+            else if (fd >= 0) close(fd);
+        }
+
+        //
+        if (server->spool != NULL) scan_spool(server);
+        if (time_now() - server->reported_at >= SERVER_REPORT_PERIOD) {
+            pthread_mutex_lock(&server->lock);
+            uint64_t done_n = server->stats.finished_n + server->stats.failed_n;
+            pthread_mutex_unlock(&server->lock);
+            if (done_n != reported_n) server_report(server);
+            reported_n = done_n;
+            server->reported_at = time_now();
+        }
+    }
+    server_report(server);
+
+    return 0;
+}
+
+void server_metrics(struct Server *server, char *text, size_t size) {
+    pthread_mutex_lock(&server->lock);
+    const struct ServerStats *stats = &server->stats;
+    double seconds = time_now() - server->started_at;
+    uint64_t done_n = stats->finished_n;
+    snprintf(text, size,
+            "queue %u (max %u), %llu submitted, %llu done, %llu failed, %llu batches of %.1f, "
+            "latency %.1f ms avg %.1f ms max, queued %.1f ms avg, %.2f jobs/s, %.2f Mpaths/s, %.0f%% busy, "
+            "scene cache %llu hits %llu loads",
+            server->heap_n + server->batch_n,
+            stats->depth_max,
+            (unsigned long long)stats->submitted_n,
+            (unsigned long long)done_n,
+            (unsigned long long)stats->failed_n,
+            (unsigned long long)stats->batches_n,
+            stats->batches_n > 0 ? (double)(done_n + stats->failed_n) / stats->batches_n : 0.0,
+            done_n > 0 ? 1e3 * stats->latency_sum / done_n : 0.0,
+            1e3 * stats->latency_max,
+            done_n > 0 ? 1e3 * stats->wait_sum / done_n : 0.0,
+            done_n / seconds,
+            stats->paths_n / seconds * 1e-6,
+            100.0 * stats->busy_seconds / seconds,
+            (unsigned long long)stats->cache_hits_n,
+            (unsigned long long)stats->cache_misses_n);
+    pthread_mutex_unlock(&server->lock);
+}
+
+void server_report(struct Server *server) {
+    char text[SERVER_LINE_MAX];
+    server_metrics(server, text, sizeof(text));
+    printf("[server] %s\n", text);
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <pthread.h>
+#include <stdint.h>
+#include "bvh.h"
+#include "scene.h"
+#include "worker.h"
+
+#define SERVER_SCENE_CACHE 4 // scenes kept loaded with their BVH, least recently used goes
+#define SERVER_BATCH_MAX 16
+#define SERVER_BAND_ROWS 16 // rows per worker job
+#define SERVER_MAX_CLIENTS 64
+#define SERVER_LINE_MAX 1024
+#define SERVER_DEFAULT_SIZE 256
+#define SERVER_DEFAULT_SAMPLES 64
+#define SERVER_POLL_PERIOD 0.25 // seconds between spool scans
+#define SERVER_REPORT_PERIOD 10.0
+
+struct ServerJob {
+    uint64_t id;
+    int32_t priority; // higher first, then in submission order
+    char scene_path[256]; // empty for the built in scene
+    struct SceneCamera camera;
+    int has_camera; // else the scene's
+    uint32_t width, height;
+    uint32_t samples;
+    uint32_t bounces;
+    char output_path[256];
+    int client; // socket told when the job finishes, -1 for none
+    char spool_path[256]; // job file it came from, empty for none
+    double submitted_at;
+};
+
+struct ServerScene {
+    char path[256];
+    struct Scene scene;
+    struct Bvh bvh;
+    uint64_t used; // clock of the last batch
+    int loaded;
+};
+
+// Since the server started.
+struct ServerStats {
+    uint64_t submitted_n;
+    uint64_t finished_n;
+    uint64_t failed_n;
+    uint64_t batches_n;
+    uint32_t depth_max;
+    double wait_sum; // submitted until started, seconds
+    double latency_sum; // submitted until written
+    double latency_max;
+    double busy_seconds; // rendering
+    uint64_t paths_n;
+    uint64_t cache_hits_n;
+    uint64_t cache_misses_n;
+};
+
+// Long running renderer that keeps scenes and their BVHs loaded between
+// jobs. Jobs come as one line of key=value pairs, over a Unix socket or as
+// *.job files in a spool directory, and wait in a priority queue. A render
+// thread takes the top job together with every queued job of the same
+// scene, size and path length, and traces their row bands as one batch on
+// the worker pool, so small jobs still fill every thread.
+//
+//   render scene=PATH width=W height=H samples=N bounces=N priority=P
+//          camera=PX,PY,PZ,TX,TY,TZ,FOV_DEGREES output=PATH [wait=1]
+//   stats
+//   quit
+struct Server {
+    struct Workers *workers;
+    const char *address; // NULL without a socket
+    const char *spool; // NULL without a spool directory
+    int listener;
+    int clients[SERVER_MAX_CLIENTS]; // connections that have not sent their line yet
+    uint32_t clients_n;
+    pthread_t thread;
+    int thread_started;
+    pthread_mutex_t lock; // queue, stats and quit
+    pthread_cond_t wake;
+    int quit;
+    // Max heap on priority, then id.
+    struct ServerJob *heap;
+    uint32_t heap_n;
+    uint32_t heap_cap;
+    uint64_t next_id;
+    uint32_t batch_n; // jobs the render thread is on
+    // Render thread only.
+    struct ServerScene scenes[SERVER_SCENE_CACHE];
+    uint64_t clock;
+    //
+    struct ServerStats stats;
+    double started_at;
+    double reported_at;
+};
+
+// workers render the bands. Returns 2 when address cannot be listened on,
+// 3 when the render thread cannot start.
+int server_init(struct Server *server, struct Workers *workers, const char *address, const char *spool);
+// Finishes the jobs already queued first.
+void server_free(struct Server *server);
+
+// Serves until a quit command arrives.
+int server_run(struct Server *server);
+// Queue depth, latency and throughput, as text.
+void server_metrics(struct Server *server, char *text, size_t size);
+void server_report(struct Server *server);
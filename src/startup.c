@@ -0,0 +1,104 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+#include "startup.h"
+
+#define STARTUP_BAR_WIDTH 40
+
+int startup_init(struct StartupTimeline *startup) {
+#if DEBUG_INPUT_VALIDATION
+    if (startup == NULL) return 1;
+    if (!IS_ZERO_PTR(startup)) return 1;
+#endif
+
+    pthread_mutex_init(&startup->lock, NULL);
+    startup->origin = time_now();
+
+    return 0;
+}
+
+void startup_free(struct StartupTimeline *startup) {
+    if (startup->origin != 0.0)
+        pthread_mutex_destroy(&startup->lock);
+
+    memset(startup, 0, sizeof(*startup));
+}
+
+uint32_t startup_begin(struct StartupTimeline *startup, const char *name, int worker) {
+    double now = time_now() - startup->origin;
+
+    pthread_mutex_lock(&startup->lock);
+    uint32_t stage = UINT32_MAX;
+    if (startup->stages_n < STARTUP_MAX_STAGES) {
+        stage = startup->stages_n++;
+        struct StartupStage *entry = &startup->stages[stage];
+        strlcpy(entry->name, name, STARTUP_NAME_MAX);
+        entry->begin = now;
+        entry->end = now;
+        entry->worker = worker;
+    }
+    pthread_mutex_unlock(&startup->lock);
+
+    return stage;
+}
+
+void startup_end(struct StartupTimeline *startup, uint32_t stage) {
+    double now = time_now() - startup->origin;
+
+    pthread_mutex_lock(&startup->lock);
+    if (stage < startup->stages_n) startup->stages[stage].end = now;
+    pthread_mutex_unlock(&startup->lock);
+}
+
+void startup_record(struct StartupTimeline *startup, const char *name, int worker, double begin, double end) {
+    uint32_t stage = startup_begin(startup, name, worker);
+
+    pthread_mutex_lock(&startup->lock);
+    if (stage < startup->stages_n) {
+        startup->stages[stage].begin = begin - startup->origin;
+        startup->stages[stage].end = end - startup->origin;
+    }
+    pthread_mutex_unlock(&startup->lock);
+}
+
+void startup_first_frame(struct StartupTimeline *startup) {
+    startup->first_frame = time_now() - startup->origin;
+}
+
+void startup_report(const struct StartupTimeline *startup) {
+    // Stages are recorded as they open, except the ones timed elsewhere, so
+    // print them sorted by start.
+    uint32_t order[STARTUP_MAX_STAGES];
+    for (uint32_t i = 0; i < startup->stages_n; i++) {
+        uint32_t j = i;
+        for (; j > 0 && startup->stages[order[j - 1]].begin > startup->stages[i].begin; j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+
+    double span = startup->first_frame;
+    for (uint32_t i = 0; i < startup->stages_n; i++)
+        if (startup->stages[i].end > span) span = startup->stages[i].end;
+    if (span <= 0.0) span = 1.0;
+
+    printf("[startup] %-32s %9s %9s  %s\n", "stage", "start ms", "ms", "thread");
+    for (uint32_t i = 0; i < startup->stages_n; i++) {
+        const struct StartupStage *stage = &startup->stages[order[i]];
+        char bar[STARTUP_BAR_WIDTH + 1];
+        uint32_t from = (uint32_t)(stage->begin / span * STARTUP_BAR_WIDTH);
+        uint32_t to = (uint32_t)(stage->end / span * STARTUP_BAR_WIDTH);
+        if (to >= STARTUP_BAR_WIDTH) to = STARTUP_BAR_WIDTH - 1;
+        for (uint32_t c = 0; c < STARTUP_BAR_WIDTH; c++)
+            bar[c] = c >= from && c <= to ? '#' : '.';
+        bar[STARTUP_BAR_WIDTH] = 0;
+        printf("[startup] %-32s %9.2f %9.2f  %-6s |%s|\n",
+                stage->name,
+                stage->begin * 1e3,
+                (stage->end - stage->begin) * 1e3,
+                stage->worker ? "worker" : "main",
+                bar);
+    }
+    if (startup->first_frame > 0.0)
+        printf("[startup] first frame after %.2f ms\n", startup->first_frame * 1e3);
+}
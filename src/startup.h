@@ -0,0 +1,36 @@
+#pragma once
+#include <pthread.h>
+#include <stdint.h>
+
+#define STARTUP_MAX_STAGES 48
+#define STARTUP_NAME_MAX 48
+
+struct StartupStage {
+    char name[STARTUP_NAME_MAX];
+    double begin, end; // seconds since the timeline's origin
+    int worker; // ran on the worker pool, else on the main thread
+};
+
+// Wall clock spans of the startup stages, recorded from any thread, and the
+// time to the first submitted frame.
+struct StartupTimeline {
+    pthread_mutex_t lock;
+    double origin;
+    struct StartupStage stages[STARTUP_MAX_STAGES];
+    uint32_t stages_n;
+    double first_frame; // 0 until startup_first_frame
+};
+
+int startup_init(struct StartupTimeline *startup);
+void startup_free(struct StartupTimeline *startup);
+
+// Opens a stage now, returns its index for startup_end. Stages past
+// STARTUP_MAX_STAGES are dropped and return UINT32_MAX.
+uint32_t startup_begin(struct StartupTimeline *startup, const char *name, int worker);
+void startup_end(struct StartupTimeline *startup, uint32_t stage);
+// A stage timed elsewhere, with time_now() stamps.
+void startup_record(struct StartupTimeline *startup, const char *name, int worker, double begin, double end);
+
+void startup_first_frame(struct StartupTimeline *startup);
+// Prints the stages in start order, with a bar each on a shared time axis.
+void startup_report(const struct StartupTimeline *startup);
@@ -0,0 +1,727 @@
+#include <vulkan/vulkan.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "util.h"
+#include "gpu_memory.h"
+#include "image.h"
+#include "texture.h"
+
+static float srgb_to_linear(uint8_t c) {
+    float f = c / 255.0f;
+    return f <= 0.04045f ? f / 12.92f : powf((f + 0.055f) / 1.055f, 2.4f);
+}
+
+static uint8_t linear_to_srgb(float f) {
+    f = f <= 0.0031308f ? f * 12.92f : 1.055f * powf(f, 1.0f / 2.4f) - 0.055f;
+    int c = (int)(f * 255.0f + 0.5f);
+    return c < 0 ? 0 : c > 255 ? 255 : c;
+}
+
+static uint32_t mip_dim(uint32_t d, uint32_t mip) {
+    d >>= mip;
+    return d > 0 ? d : 1;
+}
+
+// Worker job: decode and build the mip chain with a gamma correct box filter.
+static void texture_decode(void *arg) {
+    struct Texture *texture = arg;
+    struct TextureStreamer *streamer = texture->streamer;
+
+    uint32_t width = 0, height = 0;
+    uint8_t *base = NULL;
+    int result = image_load_rgba8(texture->path, &width, &height, &base);
+    if (result > 0) {
+        printf("[texture] failed to load %s (%i)\n", texture->path, result);
+        pthread_mutex_lock(&streamer->lock);
+        texture->state = TextureState_Failed;
+        pthread_mutex_unlock(&streamer->lock);
+        return;
+    }
+
+    // Lay out the full chain.
+    uint32_t mips_n = 1;
+    while (mips_n < TEXTURE_MAX_MIPS && ((width >> mips_n) | (height >> mips_n)) > 0) mips_n++;
+    size_t offsets[TEXTURE_MAX_MIPS];
+    size_t size = 0;
+    for (uint32_t m = 0; m < mips_n; m++) {
+        offsets[m] = size;
+        size += (size_t)mip_dim(width, m) * mip_dim(height, m) * 4;
+    }
+    uint8_t *texels = host_alloc(streamer->host, size, HOST_ALIGNMENT, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    if (texels == NULL) {
+        free(base);
+        printf("[texture] out of memory for %s\n", texture->path);
+        pthread_mutex_lock(&streamer->lock);
+        texture->state = TextureState_Failed;
+        pthread_mutex_unlock(&streamer->lock);
+        return;
+    }
+    memcpy(texels, base, (size_t)width * height * 4);
+    free(base);
+
+    //
+    float lut[256];
+    for (int i = 0; i < 256; i++) lut[i] = srgb_to_linear(i);
+    for (uint32_t m = 1; m < mips_n; m++) {
+        uint32_t sw = mip_dim(width, m - 1), sh = mip_dim(height, m - 1);
+        uint32_t dw = mip_dim(width, m), dh = mip_dim(height, m);
+        const uint8_t *src = texels + offsets[m - 1];
+        uint8_t *dst = texels + offsets[m];
+        for (uint32_t y = 0; y < dh; y++) {
+            uint32_t y0 = y * 2, y1 = y * 2 + 1 < sh ? y * 2 + 1 : y * 2;
+            for (uint32_t x = 0; x < dw; x++) {
+                uint32_t x0 = x * 2, x1 = x * 2 + 1 < sw ? x * 2 + 1 : x * 2;
+                const uint8_t *t[4] = {
+                    src + ((size_t)y0 * sw + x0) * 4, src + ((size_t)y0 * sw + x1) * 4,
+                    src + ((size_t)y1 * sw + x0) * 4, src + ((size_t)y1 * sw + x1) * 4,
+                };
+                uint8_t *d = dst + ((size_t)y * dw + x) * 4;
+                for (int c = 0; c < 3; c++)
+                    d[c] = linear_to_srgb(0.25f * (lut[t[0][c]] + lut[t[1][c]] + lut[t[2][c]] + lut[t[3][c]]));
+                d[3] = (t[0][3] + t[1][3] + t[2][3] + t[3][3] + 2) / 4;
+            }
+        }
+    }
+
+    // Mip tail: every mip that fits in TEXTURE_TAIL_SIZE.
+    uint32_t tail_mip = mips_n - 1;
+    while (tail_mip > 0
+            && mip_dim(width, tail_mip - 1) <= TEXTURE_TAIL_SIZE
+            && mip_dim(height, tail_mip - 1) <= TEXTURE_TAIL_SIZE)
+        tail_mip--;
+
+    //
+    pthread_mutex_lock(&streamer->lock);
+    texture->width = width;
+    texture->height = height;
+    texture->mips_n = mips_n;
+    texture->tail_mip = tail_mip;
+    texture->texels = texels;
+    memcpy(texture->mip_offsets, offsets, sizeof(offsets));
+    texture->resident_mip = mips_n;
+    if (texture->wanted_mip > mips_n - 1) texture->wanted_mip = mips_n - 1;
+    texture->state = TextureState_Decoded;
+    pthread_mutex_unlock(&streamer->lock);
+}
+
+int texture_streamer_init(
+        struct TextureStreamer *streamer,
+        struct HostMemory *host,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        uint32_t queue_family,
+        VkQueue queue,
+        struct Timeline *timeline,
+        struct Bindless *bindless,
+        struct Workers *workers,
+        VkDeviceSize budget) {
+#if DEBUG_INPUT_VALIDATION
+    if (streamer == NULL) return 1;
+    if (!IS_ZERO_PTR(streamer)) return 1;
+    if (host == NULL) return 1;
+    if (device == VK_NULL_HANDLE) return 1;
+    if (queue == VK_NULL_HANDLE) return 1;
+    if (timeline == NULL) return 1;
+    if (bindless == NULL || workers == NULL) return 1;
+#endif
+
+    streamer->host = host;
+    streamer->device = device;
+    streamer->physical_device = physical_device;
+    streamer->queue = queue;
+    streamer->timeline = timeline;
+    streamer->bindless = bindless;
+    streamer->workers = workers;
+    streamer->budget = budget;
+    pthread_mutex_init(&streamer->lock, NULL);
+
+    //
+    VkCommandPoolCreateInfo pool_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = queue_family,
+    };
+    if (vkCreateCommandPool(device, &pool_cinfo, NULL, &streamer->command_pool) != VK_SUCCESS)
+        return 2;
+
+    //
+    for (int i = 0; i < TEXTURE_UPLOADS_IN_FLIGHT; i++) {
+        struct TextureUpload *upload = &streamer->uploads[i];
+        VkCommandBufferAllocateInfo buffer_ainfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = streamer->command_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+        if (vkAllocateCommandBuffers(device, &buffer_ainfo, &upload->command_buffer) != VK_SUCCESS)
+            return 3;
+        upload->staging_offset = (VkDeviceSize)i * TEXTURE_STAGING_SIZE;
+    }
+
+    // One persistently mapped staging buffer, split between the upload batches.
+    int result = create_buffer(
+            device,
+            physical_device,
+            (VkDeviceSize)TEXTURE_STAGING_SIZE * TEXTURE_UPLOADS_IN_FLIGHT,
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            GpuMemoryCategory_Staging,
+            &streamer->staging,
+            &streamer->staging_memory);
+    if (result > 0) return 4;
+    void *mapped = NULL;
+    if (vkMapMemory(device, streamer->staging_memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+        return 4;
+    streamer->staging_mapped = mapped;
+
+    return 0;
+}
+
+static void texture_destroy_device(VkDevice device, VkImage image, VkDeviceMemory memory, VkImageView view) {
+    vkDestroyImageView(device, view, NULL);
+    vkDestroyImage(device, image, NULL);
+    gpu_memory_free(device, memory);
+}
+
+void texture_streamer_free(struct TextureStreamer *streamer) {
+    // Decode jobs hold pointers into textures.
+    if (streamer->workers != NULL)
+        workers_wait_idle(streamer->workers);
+
+    VkDevice device = streamer->device;
+    for (uint32_t i = 0; i < streamer->textures_n; i++) {
+        struct Texture *texture = streamer->textures[i];
+        texture_destroy_device(device, texture->image, texture->memory, texture->view);
+        host_free(streamer->host, texture->texels);
+        host_free(streamer->host, texture);
+    }
+    host_free(streamer->host, streamer->textures);
+    host_free(streamer->host, streamer->promote);
+    host_free(streamer->host, streamer->demote);
+
+    for (int i = 0; i < TEXTURE_UPLOADS_IN_FLIGHT; i++) {
+        struct TextureUpload *upload = &streamer->uploads[i];
+        for (uint32_t j = 0; j < upload->items_n; j++)
+            texture_destroy_device(device, upload->items[j].image, upload->items[j].memory, upload->items[j].view);
+    }
+    for (uint32_t i = 0; i < streamer->garbage_n; i++) {
+        struct TextureGarbage *g = &streamer->garbage[i];
+        texture_destroy_device(device, g->image, g->memory, g->view);
+    }
+    host_free(streamer->host, streamer->garbage);
+
+    vkDestroyCommandPool(device, streamer->command_pool, NULL);
+    vkDestroyBuffer(device, streamer->staging, NULL);
+    gpu_memory_free(device, streamer->staging_memory); // Unmaps.
+    pthread_mutex_destroy(&streamer->lock);
+
+    memset(streamer, 0, sizeof(*streamer));
+}
+
+uint32_t texture_streamer_load(struct TextureStreamer *streamer, const char *path) {
+#if DEBUG_INPUT_VALIDATION
+    if (streamer == NULL || path == NULL) return UINT32_MAX;
+#endif
+
+    struct Texture *texture = host_alloc(
+            streamer->host,
+            sizeof(struct Texture),
+            _Alignof(struct Texture),
+            VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    if (texture == NULL) return UINT32_MAX;
+    memset(texture, 0, sizeof(*texture));
+    snprintf(texture->path, sizeof(texture->path), "%s", path);
+    texture->streamer = streamer;
+    texture->state = TextureState_Decoding;
+    texture->slot = BINDLESS_INVALID;
+    texture->wanted_mip = TEXTURE_MAX_MIPS;
+    texture->loaded_at = time_now();
+
+    if (streamer->textures_n == streamer->textures_cap) {
+        streamer->textures_cap = streamer->textures_cap ? streamer->textures_cap * 2 : 64;
+        streamer->textures = host_realloc(
+                streamer->host,
+                streamer->textures,
+                streamer->textures_cap * sizeof(*streamer->textures),
+                _Alignof(struct Texture *),
+                VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+        streamer->promote = host_realloc(
+                streamer->host,
+                streamer->promote,
+                streamer->textures_cap * sizeof(*streamer->promote),
+                _Alignof(struct TextureCandidate),
+                VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+        streamer->demote = host_realloc(
+                streamer->host,
+                streamer->demote,
+                streamer->textures_cap * sizeof(*streamer->demote),
+                _Alignof(struct TextureCandidate),
+                VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    }
+    uint32_t id = streamer->textures_n++;
+    streamer->textures[id] = texture;
+
+    workers_push(streamer->workers, texture_decode, texture);
+
+    return id;
+}
+
+void texture_streamer_request(struct TextureStreamer *streamer, uint32_t id, float footprint) {
+#if DEBUG_INPUT_VALIDATION
+    if (streamer == NULL || id >= streamer->textures_n) return;
+#endif
+
+    struct Texture *texture = streamer->textures[id];
+    texture->last_used = streamer->frame;
+
+    // Only meaningful once the dimensions are known.
+    pthread_mutex_lock(&streamer->lock);
+    enum TextureState state = texture->state;
+    pthread_mutex_unlock(&streamer->lock);
+    if (state != TextureState_Decoded) return;
+
+    // Texels per pixel along the larger axis picks the mip.
+    uint32_t size = texture->width > texture->height ? texture->width : texture->height;
+    float ratio = footprint > 1.0f ? size / footprint : size;
+    uint32_t mip = ratio > 1.0f ? (uint32_t)floorf(log2f(ratio)) : 0;
+    if (mip > texture->mips_n - 1) mip = texture->mips_n - 1;
+
+    if (texture->wanted_frame != streamer->frame) {
+        texture->wanted_frame = streamer->frame;
+        texture->wanted_mip = mip;
+    } else if (mip < texture->wanted_mip) {
+        texture->wanted_mip = mip;
+    }
+
+    if (texture->wanted_mip < texture->resident_mip && texture->wanted_at == 0.0)
+        texture->wanted_at = time_now();
+}
+
+uint32_t texture_streamer_slot(const struct TextureStreamer *streamer, uint32_t id) {
+    if (streamer == NULL || id >= streamer->textures_n) return BINDLESS_INVALID;
+    return streamer->textures[id]->slot;
+}
+
+static void image_barrier(
+        VkCommandBuffer command_buffer,
+        VkImage image,
+        uint32_t mips_n,
+        VkImageLayout old_layout,
+        VkImageLayout new_layout,
+        VkAccessFlags src_access,
+        VkAccessFlags dst_access) {
+    VkImageMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = src_access,
+        .dstAccessMask = dst_access,
+        .oldLayout = old_layout,
+        .newLayout = new_layout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = mips_n,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    };
+
+    // Textures are sampled from any stage, so order against all of them.
+    vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+            VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+            0,
+            0,
+            NULL,
+            0,
+            NULL,
+            1,
+            &barrier);
+}
+
+// Records the rebuild of texture id with mips [new_mip, mips_n). Mips already
+// resident are copied over on the GPU, the rest come from staging.
+static int texture_record_rebuild(
+        struct TextureStreamer *streamer,
+        struct TextureUpload *upload,
+        uint32_t id,
+        uint32_t new_mip,
+        VkDeviceSize *staging_used) {
+    struct Texture *texture = streamer->textures[id];
+    uint32_t levels = texture->mips_n - new_mip;
+    VkExtent2D extent = {
+        mip_dim(texture->width, new_mip),
+        mip_dim(texture->height, new_mip),
+    };
+
+    // Does the new data fit in this batch's staging region?
+    VkDeviceSize staging_needed = 0;
+    for (uint32_t m = new_mip; m < texture->resident_mip && m < texture->mips_n; m++)
+        staging_needed += ((VkDeviceSize)mip_dim(texture->width, m) * mip_dim(texture->height, m) * 4 + 15) & ~15ull;
+    if (*staging_used + staging_needed > TEXTURE_STAGING_SIZE) return 1;
+
+    //
+    struct TextureUploadItem item = {
+        .texture = id,
+        .new_mip = new_mip,
+    };
+    int result = create_image(
+            streamer->device,
+            streamer->physical_device,
+            extent,
+            levels,
+            VK_FORMAT_R8G8B8A8_SRGB,
+            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            GpuMemoryCategory_Textures,
+            &item.image,
+            &item.memory,
+            &item.bytes);
+    if (result > 0) {
+        texture_destroy_device(streamer->device, item.image, item.memory, VK_NULL_HANDLE);
+        return 2;
+    }
+    result = create_image_view(streamer->device, item.image, VK_FORMAT_R8G8B8A8_SRGB, levels, &item.view);
+    if (result > 0) {
+        texture_destroy_device(streamer->device, item.image, item.memory, item.view);
+        return 2;
+    }
+
+    //
+    VkCommandBuffer cb = upload->command_buffer;
+    image_barrier(cb, item.image, levels,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            0, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+    // New mips from staging.
+    for (uint32_t m = new_mip; m < texture->resident_mip && m < texture->mips_n; m++) {
+        uint32_t w = mip_dim(texture->width, m), h = mip_dim(texture->height, m);
+        VkDeviceSize size = (VkDeviceSize)w * h * 4;
+        VkDeviceSize offset = upload->staging_offset + *staging_used;
+        memcpy(streamer->staging_mapped + offset, texture->texels + texture->mip_offsets[m], size);
+        *staging_used += (size + 15) & ~15ull;
+
+        VkBufferImageCopy region = {
+            .bufferOffset = offset,
+            .imageSubresource = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = m - new_mip,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+            .imageExtent = { w, h, 1 },
+        };
+        vkCmdCopyBufferToImage(cb, streamer->staging, item.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    }
+
+    // Mips already resident, copied image to image.
+    if (texture->image != VK_NULL_HANDLE) {
+        uint32_t old_levels = texture->mips_n - texture->resident_mip;
+        uint32_t first = new_mip > texture->resident_mip ? new_mip : texture->resident_mip;
+        VkImageCopy regions[TEXTURE_MAX_MIPS];
+        uint32_t regions_n = 0;
+        for (uint32_t m = first; m < texture->mips_n; m++) {
+            uint32_t w = mip_dim(texture->width, m), h = mip_dim(texture->height, m);
+            regions[regions_n++] = (VkImageCopy) {
+                .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, m - texture->resident_mip, 0, 1 },
+                .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, m - new_mip, 0, 1 },
+                .extent = { w, h, 1 },
+            };
+        }
+
+        image_barrier(cb, texture->image, old_levels,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+        vkCmdCopyImage(
+                cb,
+                texture->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                item.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                regions_n, regions);
+        // Frames keep sampling the old image until the batch completes.
+        image_barrier(cb, texture->image, old_levels,
+                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT);
+    }
+
+    image_barrier(cb, item.image, levels,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+    //
+    upload->items[upload->items_n++] = item;
+    texture->pending = 1;
+    // Account for the swap now, so eviction within this batch sees it.
+    streamer->resident_bytes += item.bytes;
+    streamer->resident_bytes -= texture->bytes;
+
+    return 0;
+}
+
+static void texture_push_garbage(
+        struct TextureStreamer *streamer,
+        VkImage image,
+        VkDeviceMemory memory,
+        VkImageView view) {
+    if (image == VK_NULL_HANDLE) return;
+
+    if (streamer->garbage_n == streamer->garbage_cap) {
+        streamer->garbage_cap = streamer->garbage_cap ? streamer->garbage_cap * 2 : 64;
+        streamer->garbage = host_realloc(
+                streamer->host,
+                streamer->garbage,
+                streamer->garbage_cap * sizeof(*streamer->garbage),
+                _Alignof(struct TextureGarbage),
+                VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    }
+    // Work submitted from here on samples the replacement.
+    streamer->garbage[streamer->garbage_n++] = (struct TextureGarbage) {
+        .value = streamer->timeline->value,
+        .image = image,
+        .memory = memory,
+        .view = view,
+    };
+}
+
+// Swaps finished rebuilds in.
+static void texture_complete_upload(struct TextureStreamer *streamer, struct TextureUpload *upload) {
+    double now = time_now();
+
+    for (uint32_t i = 0; i < upload->items_n; i++) {
+        struct TextureUploadItem *item = &upload->items[i];
+        struct Texture *texture = streamer->textures[item->texture];
+
+        texture_push_garbage(streamer, texture->image, texture->memory, texture->view);
+
+        int first = texture->image == VK_NULL_HANDLE;
+        if (item->new_mip > texture->resident_mip) streamer->evictions_n += 1;
+        texture->image = item->image;
+        texture->memory = item->memory;
+        texture->view = item->view;
+        texture->bytes = item->bytes;
+        texture->resident_mip = item->new_mip;
+        texture->pending = 0;
+
+        //
+        if (texture->slot == BINDLESS_INVALID) {
+            texture->slot = bindless_add_sampled_image(
+                    streamer->bindless,
+                    streamer->device,
+                    texture->view,
+                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        } else {
+            bindless_write_sampled_image(
+                    streamer->bindless,
+                    streamer->device,
+                    texture->slot,
+                    texture->view,
+                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        }
+
+        //
+        if (first) {
+            streamer->first_latency_sum += (now - texture->loaded_at) * 1000.0;
+            streamer->first_latency_n += 1;
+        }
+        if (texture->wanted_at != 0.0 && texture->resident_mip <= texture->wanted_mip) {
+            double latency = (now - texture->wanted_at) * 1000.0;
+            streamer->stream_latency_sum += latency;
+            streamer->stream_latency_n += 1;
+            if (latency > streamer->stream_latency_max) streamer->stream_latency_max = latency;
+            texture->wanted_at = 0.0;
+        }
+    }
+
+    streamer->uploads_n += upload->items_n;
+    upload->items_n = 0;
+    upload->busy = 0;
+}
+
+// Coarser mips first.
+static int texture_candidate_cmp(const void *a, const void *b) {
+    const struct TextureCandidate *ca = a, *cb = b;
+    return (int)cb->mip - (int)ca->mip;
+}
+
+// Least recently used first.
+static int texture_lru_cmp(const void *a, const void *b) {
+    const struct TextureCandidate *ca = a, *cb = b;
+    return ca->last_used < cb->last_used ? -1 : ca->last_used > cb->last_used;
+}
+
+int texture_streamer_update(struct TextureStreamer *streamer, uint64_t completed_value) {
+#if DEBUG_INPUT_VALIDATION
+    if (streamer == NULL) return 1;
+#endif
+
+    VkDevice device = streamer->device;
+    streamer->frame += 1;
+
+    // Retire finished batches.
+    for (int i = 0; i < TEXTURE_UPLOADS_IN_FLIGHT; i++) {
+        struct TextureUpload *upload = &streamer->uploads[i];
+        if (upload->busy && upload->value <= completed_value)
+            texture_complete_upload(streamer, upload);
+    }
+
+    // Destroy replaced images nobody samples anymore.
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < streamer->garbage_n; i++) {
+        struct TextureGarbage *g = &streamer->garbage[i];
+        if (g->value <= completed_value)
+            texture_destroy_device(device, g->image, g->memory, g->view);
+        else
+            streamer->garbage[kept++] = *g;
+    }
+    streamer->garbage_n = kept;
+
+    // Find a free batch.
+    struct TextureUpload *upload = NULL;
+    for (int i = 0; i < TEXTURE_UPLOADS_IN_FLIGHT && upload == NULL; i++)
+        if (!streamer->uploads[i].busy) upload = &streamer->uploads[i];
+    if (upload == NULL) return 0;
+
+    // Collect what wants to move, the tail for fresh textures and one finer
+    // mip at a time otherwise.
+    struct TextureCandidate *promote = streamer->promote;
+    struct TextureCandidate *demote = streamer->demote;
+    uint32_t promote_n = 0, demote_n = 0;
+    pthread_mutex_lock(&streamer->lock);
+    for (uint32_t i = 0; i < streamer->textures_n; i++) {
+        struct Texture *texture = streamer->textures[i];
+        if (texture->state != TextureState_Decoded || texture->pending) continue;
+
+        if (texture->resident_mip == texture->mips_n) {
+            promote[promote_n++] = (struct TextureCandidate) { i, texture->tail_mip, texture->last_used };
+            continue;
+        }
+        if (texture->wanted_mip < texture->resident_mip)
+            promote[promote_n++] = (struct TextureCandidate) { i, texture->resident_mip - 1, texture->last_used };
+
+        // Anything finer than the tail that the last frame did not request, or
+        // is finer than wanted, can be evicted.
+        int stale = texture->last_used + 1 < streamer->frame || texture->resident_mip < texture->wanted_mip;
+        if (stale && texture->resident_mip < texture->tail_mip)
+            demote[demote_n++] = (struct TextureCandidate) { i, texture->resident_mip + 1, texture->last_used };
+    }
+    pthread_mutex_unlock(&streamer->lock);
+    qsort(promote, promote_n, sizeof(*promote), texture_candidate_cmp);
+    qsort(demote, demote_n, sizeof(*demote), texture_lru_cmp);
+
+    //
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    vkResetCommandBuffer(upload->command_buffer, 0);
+    vkBeginCommandBuffer(upload->command_buffer, &begin_info);
+
+    VkDeviceSize staging_used = 0;
+    uint32_t d = 0;
+    for (uint32_t i = 0; i < promote_n && upload->items_n < TEXTURE_UPLOAD_ITEMS; i++) {
+        struct Texture *texture = streamer->textures[promote[i].texture];
+        if (texture->pending) continue; // Picked for eviction above.
+        VkDeviceSize grow = (VkDeviceSize)mip_dim(texture->width, promote[i].mip)
+            * mip_dim(texture->height, promote[i].mip) * 4 * 4 / 3;
+
+        // Make room by dropping the finest mip of the least recently used.
+        while (streamer->resident_bytes + grow > streamer->budget
+                && d < demote_n
+                && upload->items_n < TEXTURE_UPLOAD_ITEMS) {
+            struct Texture *victim = streamer->textures[demote[d].texture];
+            if (!victim->pending)
+                texture_record_rebuild(streamer, upload, demote[d].texture, demote[d].mip, &staging_used);
+            d++;
+        }
+        if (streamer->resident_bytes + grow > streamer->budget && texture->resident_mip != texture->mips_n)
+            continue; // Over budget, only mip tails may still come in.
+        if (upload->items_n == TEXTURE_UPLOAD_ITEMS) break;
+
+        texture_record_rebuild(streamer, upload, promote[i].texture, promote[i].mip, &staging_used);
+    }
+    // Shed what a lowered budget no longer covers.
+    for (; streamer->resident_bytes > streamer->budget && d < demote_n && upload->items_n < TEXTURE_UPLOAD_ITEMS; d++) {
+        if (!streamer->textures[demote[d].texture]->pending)
+            texture_record_rebuild(streamer, upload, demote[d].texture, demote[d].mip, &staging_used);
+    }
+    vkEndCommandBuffer(upload->command_buffer);
+    if (upload->items_n == 0) return 0;
+
+    //
+    int result = timeline_submit(
+            streamer->queue,
+            upload->command_buffer,
+            0,
+            NULL,
+            streamer->timeline,
+            &upload->value);
+    if (result > 0) return 2;
+    upload->busy = 1;
+
+    return 0;
+}
+
+void texture_streamer_set_budget(struct TextureStreamer *streamer, VkDeviceSize budget) {
+    streamer->budget = budget;
+}
+
+int texture_streamer_busy(struct TextureStreamer *streamer) {
+    if (streamer->garbage_n > 0 || streamer->resident_bytes > streamer->budget) return 1;
+    for (int i = 0; i < TEXTURE_UPLOADS_IN_FLIGHT; i++)
+        if (streamer->uploads[i].busy) return 1;
+
+    int busy = 0;
+    pthread_mutex_lock(&streamer->lock);
+    for (uint32_t i = 0; i < streamer->textures_n && !busy; i++) {
+        struct Texture *texture = streamer->textures[i];
+        busy = texture->state == TextureState_Decoding
+            || (texture->state == TextureState_Decoded && texture->resident_mip == texture->mips_n);
+    }
+    pthread_mutex_unlock(&streamer->lock);
+
+    return busy;
+}
+
+void texture_streamer_stats(struct TextureStreamer *streamer, struct TextureStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&streamer->lock);
+    for (uint32_t i = 0; i < streamer->textures_n; i++) {
+        struct Texture *texture = streamer->textures[i];
+        if (texture->state == TextureState_Decoding) stats->decoding_n += 1;
+        if (texture->image != VK_NULL_HANDLE) stats->resident_n += 1;
+    }
+    pthread_mutex_unlock(&streamer->lock);
+
+    stats->textures_n = streamer->textures_n;
+    stats->resident_bytes = streamer->resident_bytes;
+    stats->budget = streamer->budget;
+    stats->uploads = streamer->uploads_n;
+    stats->evictions = streamer->evictions_n;
+    if (streamer->first_latency_n > 0)
+        stats->first_latency_avg = streamer->first_latency_sum / streamer->first_latency_n;
+    if (streamer->stream_latency_n > 0)
+        stats->stream_latency_avg = streamer->stream_latency_sum / streamer->stream_latency_n;
+    stats->stream_latency_max = streamer->stream_latency_max;
+}
+
+void texture_streamer_report(struct TextureStreamer *streamer) {
+    struct TextureStats stats;
+    texture_streamer_stats(streamer, &stats);
+    printf("[texture] resident %u/%u (%u decoding), %.1f/%.1f MiB, %llu uploads, %llu evictions, "
+            "first mips %.1f ms avg, stream-in %.1f ms avg %.1f ms max\n",
+            stats.resident_n,
+            stats.textures_n,
+            stats.decoding_n,
+            stats.resident_bytes / 1048576.0,
+            stats.budget / 1048576.0,
+            (unsigned long long)stats.uploads,
+            (unsigned long long)stats.evictions,
+            stats.first_latency_avg,
+            stats.stream_latency_avg,
+            stats.stream_latency_max);
+}
@@ -0,0 +1,169 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <pthread.h>
+#include <stdint.h>
+#include "bindless.h"
+#include "host_memory.h"
+#include "timeline.h"
+#include "worker.h"
+
+#define TEXTURE_MAX_MIPS 16
+// Every mip at or below this size streams in together, ahead of finer mips,
+// and is never evicted.
+#define TEXTURE_TAIL_SIZE 64
+#define TEXTURE_UPLOADS_IN_FLIGHT 4
+#define TEXTURE_UPLOAD_ITEMS 32
+#define TEXTURE_STAGING_SIZE (32u << 20) // per upload batch
+#define TEXTURE_DEFAULT_BUDGET (512ull << 20)
+
+enum TextureState {
+    TextureState_Decoding = 0,
+    TextureState_Decoded,
+    TextureState_Failed,
+};
+
+struct Texture {
+    char path[256];
+    struct TextureStreamer *streamer;
+    enum TextureState state; // written by workers, guarded by streamer->lock
+    // Host copy of the whole RGBA8 mip chain, built by a worker.
+    uint32_t width, height;
+    uint32_t mips_n;
+    uint32_t tail_mip; // coarsest mip that is still larger than TEXTURE_TAIL_SIZE, plus one
+    uint8_t *texels;
+    size_t mip_offsets[TEXTURE_MAX_MIPS];
+    // Device residency. Mips [resident_mip, mips_n) live in image.
+    uint32_t resident_mip; // mips_n when nothing is resident
+    uint32_t wanted_mip;
+    uint64_t wanted_frame;
+    uint64_t last_used;
+    int pending; // an upload batch is rebuilding this texture
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view;
+    VkDeviceSize bytes;
+    uint32_t slot; // bindless sampled image, BINDLESS_INVALID until the tail lands
+    // Latency tracking.
+    double loaded_at;
+    double wanted_at; // first frame wanted_mip dropped below resident_mip
+};
+
+struct TextureUploadItem {
+    uint32_t texture;
+    uint32_t new_mip;
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view;
+    VkDeviceSize bytes;
+};
+
+struct TextureUpload {
+    int busy;
+    VkCommandBuffer command_buffer;
+    uint64_t value; // graphics timeline value signaled on completion
+    VkDeviceSize staging_offset;
+    uint32_t items_n;
+    struct TextureUploadItem items[TEXTURE_UPLOAD_ITEMS];
+};
+
+// Device objects waiting for the work that might sample them to retire.
+struct TextureGarbage {
+    uint64_t value;
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view;
+};
+
+struct TextureStats {
+    uint32_t textures_n;
+    uint32_t resident_n;
+    uint32_t decoding_n;
+    VkDeviceSize resident_bytes;
+    VkDeviceSize budget;
+    uint64_t uploads;
+    uint64_t evictions;
+    double first_latency_avg; // load() until the mip tail is sampleable, in ms
+    double stream_latency_avg; // wanted mip requested until resident, in ms
+    double stream_latency_max;
+};
+
+// A texture and the mip it should move to.
+struct TextureCandidate {
+    uint32_t texture;
+    uint32_t mip;
+    uint64_t last_used;
+};
+
+// Decodes on worker threads, uploads coarse mips first and refines them from
+// per-frame footprint requests, and evicts the least recently used mips once
+// device memory exceeds budget.
+struct TextureStreamer {
+    struct HostMemory *host; // of the tables, textures and their texels
+    VkDevice device;
+    VkPhysicalDevice physical_device;
+    VkQueue queue;
+    struct Timeline *timeline; // of queue
+    struct Bindless *bindless;
+    struct Workers *workers;
+    pthread_mutex_t lock;
+    //
+    struct Texture **textures; // array with size of textures_n
+    uint32_t textures_n;
+    uint32_t textures_cap;
+    struct TextureCandidate *promote; // update scratch, textures_cap long so frames do not allocate
+    struct TextureCandidate *demote;
+    uint64_t frame; // updates so far, drives LRU
+    // Uploads.
+    VkCommandPool command_pool;
+    VkBuffer staging;
+    VkDeviceMemory staging_memory;
+    uint8_t *staging_mapped;
+    struct TextureUpload uploads[TEXTURE_UPLOADS_IN_FLIGHT];
+    uint32_t garbage_n;
+    uint32_t garbage_cap;
+    struct TextureGarbage *garbage;
+    // Budget and stats.
+    VkDeviceSize budget;
+    VkDeviceSize resident_bytes;
+    uint64_t uploads_n;
+    uint64_t evictions_n;
+    uint64_t first_latency_n;
+    double first_latency_sum;
+    uint64_t stream_latency_n;
+    double stream_latency_sum;
+    double stream_latency_max;
+};
+
+int texture_streamer_init(
+        struct TextureStreamer *streamer,
+        struct HostMemory *host,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        uint32_t queue_family,
+        VkQueue queue,
+        struct Timeline *timeline,
+        struct Bindless *bindless,
+        struct Workers *workers,
+        VkDeviceSize budget);
+void texture_streamer_free(struct TextureStreamer *streamer);
+
+// Queues path for decoding and returns its texture id, UINT32_MAX when out of
+// memory.
+uint32_t texture_streamer_load(struct TextureStreamer *streamer, const char *path);
+// Marks id as used this frame, covering footprint pixels on screen along its
+// larger axis. Picks the finest mip needed over all requests in a frame.
+void texture_streamer_request(struct TextureStreamer *streamer, uint32_t id, float footprint);
+// Bindless sampled image slot of id, BINDLESS_INVALID while nothing is resident.
+uint32_t texture_streamer_slot(const struct TextureStreamer *streamer, uint32_t id);
+
+// Call once per frame before recording, with the value timeline has reached.
+// Upload batches are submitted to queue here, ahead of the frame.
+int texture_streamer_update(struct TextureStreamer *streamer, uint64_t completed_value);
+
+// Takes effect on the next update, which evicts stale mips down to budget.
+void texture_streamer_set_budget(struct TextureStreamer *streamer, VkDeviceSize budget);
+// Whether updates still have work to land: decodes, uploads in flight,
+// textures without their tail, garbage or an exceeded budget.
+int texture_streamer_busy(struct TextureStreamer *streamer);
+void texture_streamer_stats(struct TextureStreamer *streamer, struct TextureStats *stats);
+void texture_streamer_report(struct TextureStreamer *streamer);
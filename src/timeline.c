@@ -0,0 +1,110 @@
+#include <vulkan/vulkan.h>
+#include <string.h>
+#include "util.h"
+#include "timeline.h"
+
+#define TIMELINE_MAX_WAITS 8
+
+int timeline_init(struct Timeline *timeline, VkDevice device) {
+#if DEBUG_INPUT_VALIDATION
+    if (timeline == NULL) return 1;
+    if (!IS_ZERO_PTR(timeline)) return 1;
+    if (device == VK_NULL_HANDLE) return 1;
+#endif
+
+    VkSemaphoreTypeCreateInfo type_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+    VkSemaphoreCreateInfo semaphore_cinfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &type_cinfo,
+    };
+    VkResult result = vkCreateSemaphore(device, &semaphore_cinfo, NULL, &timeline->semaphore);
+    if (result != VK_SUCCESS) return 2;
+
+    return 0;
+}
+
+void timeline_free(struct Timeline *timeline, VkDevice device) {
+    vkDestroySemaphore(device, timeline->semaphore, NULL);
+    timeline->semaphore = VK_NULL_HANDLE;
+    timeline->value = 0;
+}
+
+uint64_t timeline_next(struct Timeline *timeline) {
+    return ++timeline->value;
+}
+
+uint64_t timeline_completed(const struct Timeline *timeline, VkDevice device) {
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(device, timeline->semaphore, &value);
+    return value;
+}
+
+int timeline_wait(const struct Timeline *timeline, VkDevice device, uint64_t value, uint64_t timeout) {
+    VkSemaphoreWaitInfo wait_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &timeline->semaphore,
+        .pValues = &value,
+    };
+    VkResult result = vkWaitSemaphores(device, &wait_info, timeout);
+    if (result == VK_TIMEOUT) return 2;
+    if (result != VK_SUCCESS) return 3;
+
+    return 0;
+}
+
+int timeline_submit(
+        VkQueue queue,
+        VkCommandBuffer command_buffer,
+        uint32_t waits_n,
+        const struct TimelineWait *waits,
+        struct Timeline *signal,
+        uint64_t *signaled) {
+#if DEBUG_INPUT_VALIDATION
+    if (queue == VK_NULL_HANDLE) return 1;
+    if (waits_n > TIMELINE_MAX_WAITS) return 1;
+    if (waits_n > 0 && waits == NULL) return 1;
+    if (signal == NULL) return 1;
+#endif
+
+    //
+    VkSemaphore wait_semaphores[TIMELINE_MAX_WAITS];
+    uint64_t wait_values[TIMELINE_MAX_WAITS];
+    VkPipelineStageFlags wait_stages[TIMELINE_MAX_WAITS];
+    for (uint32_t i = 0; i < waits_n; i++) {
+        wait_semaphores[i] = waits[i].timeline->semaphore;
+        wait_values[i] = waits[i].value;
+        wait_stages[i] = waits[i].stage;
+    }
+    uint64_t signal_value = timeline_next(signal);
+
+    //
+    VkTimelineSemaphoreSubmitInfo timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount = waits_n,
+        .pWaitSemaphoreValues = wait_values,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &signal_value,
+    };
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timeline_info,
+        .waitSemaphoreCount = waits_n,
+        .pWaitSemaphores = wait_semaphores,
+        .pWaitDstStageMask = wait_stages,
+        .commandBufferCount = command_buffer != VK_NULL_HANDLE ? 1 : 0,
+        .pCommandBuffers = &command_buffer,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &signal->semaphore,
+    };
+    VkResult result = vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE);
+    if (result != VK_SUCCESS) return 2;
+
+    if (signaled != NULL) *signaled = signal_value;
+
+    return 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+
+// Monotonic timeline semaphore, one per queue. Every submission to the queue
+// signals the next value, so "is this work done" is a single comparison
+// against timeline_completed().
+struct Timeline {
+    VkSemaphore semaphore;
+    uint64_t value; // last value handed to a submission
+};
+
+struct TimelineWait {
+    const struct Timeline *timeline;
+    uint64_t value;
+    VkPipelineStageFlags stage;
+};
+
+int timeline_init(struct Timeline *timeline, VkDevice device);
+void timeline_free(struct Timeline *timeline, VkDevice device);
+
+// Reserves the value the next submission on this timeline's queue signals.
+uint64_t timeline_next(struct Timeline *timeline);
+uint64_t timeline_completed(const struct Timeline *timeline, VkDevice device);
+// Returns 0 once value is reached, 2 on timeout.
+int timeline_wait(const struct Timeline *timeline, VkDevice device, uint64_t value, uint64_t timeout);
+
+// Submits command_buffer after every wait is reached, signaling the next
+// value of signal. Written to *signaled when not NULL.
+int timeline_submit(
+        VkQueue queue,
+        VkCommandBuffer command_buffer,
+        uint32_t waits_n,
+        const struct TimelineWait *waits,
+        struct Timeline *signal,
+        uint64_t *signaled);
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "util.h"
+#include "tlas.h"
+
+#define BOUNDS_MAX_JOBS 64
+
+int tlas_init(struct Tlas *tlas, struct Workers *workers, float rebuild_ratio) {
+#if DEBUG_INPUT_VALIDATION
+    if (tlas == NULL) return 1;
+    if (!IS_ZERO_PTR(tlas)) return 1;
+    if (rebuild_ratio < 0.0f) return 1;
+#endif
+
+    tlas->workers = workers;
+    tlas->rebuild_ratio = rebuild_ratio > 0.0f ? rebuild_ratio : TLAS_DEFAULT_REBUILD_RATIO;
+
+    return 0;
+}
+
+void tlas_free(struct Tlas *tlas) {
+    for (uint32_t i = 0; i < tlas->meshes_n; i++) bvh_free(&tlas->meshes[i].bvh);
+    free(tlas->meshes);
+    free(tlas->instances);
+    free(tlas->bounds);
+    bvh_free(&tlas->top);
+    memset(tlas, 0, sizeof(*tlas));
+}
+
+uint32_t tlas_add_mesh(
+        struct Tlas *tlas,
+        const float *positions,
+        const uint32_t *indices,
+        uint32_t triangles_n,
+        int deforming) {
+#if DEBUG_INPUT_VALIDATION
+    if (tlas == NULL) return UINT32_MAX;
+    if (positions == NULL || indices == NULL || triangles_n == 0) return UINT32_MAX;
+#endif
+
+    if (tlas->meshes_n == tlas->meshes_cap) {
+        uint32_t cap = tlas->meshes_cap > 0 ? tlas->meshes_cap * 2 : 4;
+        struct TlasMesh *meshes = realloc(tlas->meshes, cap * sizeof(*meshes));
+        if (meshes == NULL) return UINT32_MAX;
+        tlas->meshes = meshes;
+        tlas->meshes_cap = cap;
+    }
+
+    struct TlasMesh *mesh = &tlas->meshes[tlas->meshes_n];
+    memset(mesh, 0, sizeof(*mesh));
+    mesh->positions = positions;
+    mesh->indices = indices;
+    mesh->triangles_n = triangles_n;
+    mesh->deforming = deforming;
+    if (bvh_build(&mesh->bvh, positions, indices, triangles_n) > 0) return UINT32_MAX;
+    mesh->built_cost = bvh_sah_cost(&mesh->bvh);
+
+    return tlas->meshes_n++;
+}
+
+uint32_t tlas_add_instance(struct Tlas *tlas, uint32_t mesh, const float transform[12]) {
+#if DEBUG_INPUT_VALIDATION
+    if (tlas == NULL || transform == NULL) return UINT32_MAX;
+    if (mesh >= tlas->meshes_n) return UINT32_MAX;
+#endif
+
+    if (tlas->instances_n == tlas->instances_cap) {
+        uint32_t cap = tlas->instances_cap > 0 ? tlas->instances_cap * 2 : 1024;
+        struct TlasInstance *instances = realloc(tlas->instances, cap * sizeof(*instances));
+        if (instances == NULL) return UINT32_MAX;
+        tlas->instances = instances;
+        float *bounds = realloc(tlas->bounds, cap * 6 * sizeof(float));
+        if (bounds == NULL) return UINT32_MAX;
+        tlas->bounds = bounds;
+        tlas->instances_cap = cap;
+    }
+
+    struct TlasInstance *instance = &tlas->instances[tlas->instances_n];
+    instance->mesh = mesh;
+    memcpy(instance->transform, transform, sizeof(instance->transform));
+
+    return tlas->instances_n++;
+}
+
+// World bounds.
+
+struct BoundsJob {
+    struct Tlas *tlas;
+    uint32_t first;
+    uint32_t count;
+    struct WorkerGroup *group;
+};
+
+// Transforms the mesh's root box, per output axis the extremes of each row
+// times the box (Arvo).
+static void instance_bounds(const struct Tlas *tlas, uint32_t index) {
+    const struct TlasInstance *instance = &tlas->instances[index];
+    const struct BvhNode *root = &tlas->meshes[instance->mesh].bvh.nodes[0];
+    float *out = tlas->bounds + index * 6;
+    for (int r = 0; r < 3; r++) {
+        const float *row = instance->transform + r * 4;
+        float lo = row[3], hi = row[3];
+        for (int c = 0; c < 3; c++) {
+            float a = row[c] * root->min[c];
+            float b = row[c] * root->max[c];
+            lo += fminf(a, b);
+            hi += fmaxf(a, b);
+        }
+        out[r] = lo;
+        out[3 + r] = hi;
+    }
+}
+
+static void bounds_job(void *arg) {
+    struct BoundsJob *job = arg;
+    for (uint32_t i = job->first; i < job->first + job->count; i++) instance_bounds(job->tlas, i);
+    worker_group_done(job->group);
+}
+
+static void update_bounds(struct Tlas *tlas) {
+    if (tlas->workers == NULL || tlas->workers->threads_n < 2) {
+        for (uint32_t i = 0; i < tlas->instances_n; i++) instance_bounds(tlas, i);
+        return;
+    }
+
+    uint32_t jobs_n = tlas->workers->threads_n * 4 < BOUNDS_MAX_JOBS ? tlas->workers->threads_n * 4 : BOUNDS_MAX_JOBS;
+    uint32_t chunk = (tlas->instances_n + jobs_n - 1) / jobs_n;
+    struct BoundsJob jobs[BOUNDS_MAX_JOBS];
+    struct WorkerGroup group;
+    worker_group_init(&group);
+    for (uint32_t j = 0; j < jobs_n && j * chunk < tlas->instances_n; j++) {
+        uint32_t first = j * chunk;
+        uint32_t count = tlas->instances_n - first < chunk ? tlas->instances_n - first : chunk;
+        jobs[j] = (struct BoundsJob) { .tlas = tlas, .first = first, .count = count, .group = &group };
+        workers_push_group(tlas->workers, &group, bounds_job, jobs + j);
+    }
+    worker_group_wait(&group);
+    worker_group_free(&group);
+}
+
+int tlas_update(struct Tlas *tlas) {
+#if DEBUG_INPUT_VALIDATION
+    if (tlas == NULL) return 1;
+    if (tlas->instances_n == 0) return 1;
+#endif
+
+    // Bottom levels of deforming meshes.
+    double start = time_now();
+    for (uint32_t i = 0; i < tlas->meshes_n; i++) {
+        struct TlasMesh *mesh = &tlas->meshes[i];
+        if (!mesh->deforming) continue;
+        bvh_refit(&mesh->bvh, mesh->positions, mesh->indices, tlas->workers);
+        mesh->refits_n++;
+        if (bvh_sah_cost(&mesh->bvh) <= mesh->built_cost * tlas->rebuild_ratio) continue;
+
+        bvh_free(&mesh->bvh);
+        if (bvh_build(&mesh->bvh, mesh->positions, mesh->indices, mesh->triangles_n) > 0) return 2;
+        mesh->built_cost = bvh_sah_cost(&mesh->bvh);
+        mesh->rebuilds_n++;
+    }
+    double refitted = time_now();
+
+    //
+    update_bounds(tlas);
+    double bounded = time_now();
+
+    // Top level, from scratch since instances move freely.
+    bvh_free(&tlas->top);
+    if (bvh_build_boxes(&tlas->top, tlas->bounds, tlas->instances_n) > 0) return 2;
+    double built = time_now();
+
+    tlas->refit_time = refitted - start;
+    tlas->bounds_time = bounded - refitted;
+    tlas->build_time = built - bounded;
+    tlas->refit_sum += tlas->refit_time;
+    tlas->bounds_sum += tlas->bounds_time;
+    tlas->build_sum += tlas->build_time;
+    tlas->updates_n++;
+
+    return 0;
+}
+
+void tlas_report(const struct Tlas *tlas) {
+    if (tlas->updates_n == 0) return;
+
+    double n = (double)tlas->updates_n;
+    printf("[tlas] %u instances of %u meshes, %llu updates: refit %.3f ms, bounds %.3f ms, top build %.3f ms, total %.3f ms/update\n",
+            tlas->instances_n,
+            tlas->meshes_n,
+            (unsigned long long)tlas->updates_n,
+            1e3 * tlas->refit_sum / n,
+            1e3 * tlas->bounds_sum / n,
+            1e3 * tlas->build_sum / n,
+            1e3 * (tlas->refit_sum + tlas->bounds_sum + tlas->build_sum) / n);
+    for (uint32_t i = 0; i < tlas->meshes_n; i++) {
+        const struct TlasMesh *mesh = &tlas->meshes[i];
+        if (!mesh->deforming) continue;
+        printf("[tlas] mesh %u: %u triangles, sah %.1f of %.1f built, %llu refits, %llu rebuilds\n",
+                i,
+                mesh->triangles_n,
+                bvh_sah_cost(&mesh->bvh),
+                mesh->built_cost,
+                (unsigned long long)mesh->refits_n,
+                (unsigned long long)mesh->rebuilds_n);
+    }
+}
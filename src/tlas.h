@@ -0,0 +1,69 @@
+#pragma once
+#include <stdint.h>
+#include "bvh.h"
+#include "worker.h"
+
+#define TLAS_DEFAULT_REBUILD_RATIO 1.3f // SAH cost over the built cost that triggers a rebuild
+
+// Mesh with its own bottom level BVH, built once. A deforming mesh's vertices
+// may change between updates, its BVH is refit instead of rebuilt.
+struct TlasMesh {
+    const float *positions; // 4 floats per vertex, owned by the caller
+    const uint32_t *indices;
+    uint32_t triangles_n;
+    int deforming;
+    struct Bvh bvh;
+    float built_cost; // bvh_sah_cost after the last full build
+    uint64_t refits_n;
+    uint64_t rebuilds_n;
+};
+
+// 3x4 row major object to world transform of one mesh.
+struct TlasInstance {
+    uint32_t mesh;
+    float transform[12];
+};
+
+// Two level acceleration structure over instances of meshes. Every update
+// refits the deforming meshes, rebuilding those whose SAH cost degraded past
+// rebuild_ratio, then builds the top level over the instances' world bounds
+// from scratch.
+struct Tlas {
+    struct Workers *workers; // NULL updates on the calling thread
+    float rebuild_ratio;
+    struct TlasMesh *meshes; // array with size of meshes_n
+    uint32_t meshes_n;
+    uint32_t meshes_cap;
+    struct TlasInstance *instances; // array with size of instances_n
+    uint32_t instances_n;
+    uint32_t instances_cap;
+    float *bounds; // world space, min xyz then max xyz per instance
+    struct Bvh top;
+    // Stats, seconds.
+    double refit_time;
+    double bounds_time;
+    double build_time;
+    double refit_sum;
+    double bounds_sum;
+    double build_sum;
+    uint64_t updates_n;
+};
+
+// rebuild_ratio of 0 takes TLAS_DEFAULT_REBUILD_RATIO.
+int tlas_init(struct Tlas *tlas, struct Workers *workers, float rebuild_ratio);
+void tlas_free(struct Tlas *tlas);
+
+// Builds the mesh's BVH. Returns the mesh index, UINT32_MAX on failure.
+uint32_t tlas_add_mesh(
+        struct Tlas *tlas,
+        const float *positions,
+        const uint32_t *indices,
+        uint32_t triangles_n,
+        int deforming);
+// Returns the instance index, UINT32_MAX on failure.
+uint32_t tlas_add_instance(struct Tlas *tlas, uint32_t mesh, const float transform[12]);
+
+// Call after moving vertices of deforming meshes or instance transforms.
+// Returns 2 when a build failed.
+int tlas_update(struct Tlas *tlas);
+void tlas_report(const struct Tlas *tlas);
@@ -0,0 +1,570 @@
+#include <vulkan/vulkan.h>
+#include <string.h>
+#include "util.h"
+#include "gpu_memory.h"
+#include "pipeline.h"
+#include "trace.h"
+
+// Must match trace.comp.
+struct TracePush {
+    uint32_t accum;
+    uint32_t target;
+    uint32_t samples_n;
+    uint32_t width;
+    uint32_t height;
+    uint32_t buffers[TraceBuffer_N];
+    uint32_t triangles_n;
+    struct TraceGuides guides; // BINDLESS_INVALID when not written
+    uint32_t moments; // BINDLESS_INVALID when not written
+    uint32_t tiles; // tile list when dispatched indirectly, else BINDLESS_INVALID
+    uint32_t bounces; // read by the uniform variant only
+    uint32_t samples; // per dispatch, likewise
+    uint32_t sequence; // sampler buffer, BINDLESS_INVALID for pcg random numbers
+    float camera_position[4]; // w is the vertical fov
+    float camera_target[3];
+    uint32_t environment; // BINDLESS_INVALID for the sky
+    uint32_t textures; // table of sampled image slots, BINDLESS_INVALID without textures
+    uint32_t texcoords;
+};
+_Static_assert(sizeof(struct TracePush) <= BINDLESS_PUSH_CONSTANT_SIZE, "TracePush too large");
+
+static struct TraceSettings trace_settings_resolve(const struct TraceSettings *settings) {
+    struct TraceSettings resolved = *settings;
+    if (resolved.bounces == 0) resolved.bounces = TRACE_DEFAULT_BOUNCES;
+    if (resolved.samples_per_dispatch == 0) resolved.samples_per_dispatch = 1;
+    if (resolved.group_size == 0) resolved.group_size = TRACE_GROUP_SIZE;
+    return resolved;
+}
+
+// The uniform variant only specializes what cannot be dynamic, so one
+// pipeline covers every dispatch.
+static void trace_constants(
+        const struct TraceSettings *settings,
+        int uniform,
+        uint32_t features,
+        uint32_t constants[TraceConstant_N]) {
+    constants[TraceConstant_Bounces] = uniform ? 0 : settings->bounces;
+    constants[TraceConstant_Samples] = uniform ? 0 : settings->samples_per_dispatch;
+    constants[TraceConstant_GroupWidth] = settings->group_size;
+    constants[TraceConstant_GroupHeight] = settings->group_size;
+    constants[TraceConstant_Features] = uniform ? TRACE_FEATURE_DYNAMIC : features;
+}
+
+// Every variant a session dispatches. Tiled sessions also trace every tile
+// until the first classification and after each restart.
+static uint32_t trace_variants(
+        const struct TraceSettings *settings,
+        uint32_t features,
+        uint32_t constants[TRACE_MAX_VARIANTS][TraceConstant_N]) {
+    uint32_t variants_n = 0;
+    if (settings->kernel != TraceKernel_Uniform) {
+        trace_constants(settings, 0, features, constants[variants_n++]);
+        if (features & TRACE_FEATURE_TILES)
+            trace_constants(settings, 0, features & ~TRACE_FEATURE_TILES, constants[variants_n++]);
+    }
+    if (settings->kernel != TraceKernel_Specialized)
+        trace_constants(settings, 1, features, constants[variants_n++]);
+    return variants_n;
+}
+
+static const char *trace_kernel_name(int ray_query) {
+    return ray_query ? "trace_rq.comp.spv" : "trace.comp.spv";
+}
+
+int tracer_precompile(
+        struct PipelineBatch *pipelines,
+        int ray_query,
+        const struct TraceSettings *settings,
+        uint32_t features) {
+#if DEBUG_INPUT_VALIDATION
+    if (pipelines == NULL) return 1;
+    if (settings == NULL) return 1;
+#endif
+
+    struct TraceSettings resolved = trace_settings_resolve(settings);
+    uint32_t constants[TRACE_MAX_VARIANTS][TraceConstant_N];
+    uint32_t variants_n = trace_variants(&resolved, features, constants);
+    for (uint32_t i = 0; i < variants_n; i++) {
+        int result = pipeline_batch_push_specialized(
+                pipelines,
+                trace_kernel_name(ray_query),
+                constants[i],
+                TraceConstant_N);
+        if (result > 0) return 2;
+    }
+
+    return 0;
+}
+
+static int create_trace_image(
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        VkExtent2D extent,
+        VkImageUsageFlags usage,
+        VkImage *image,
+        VkDeviceMemory *memory,
+        VkImageView *view) {
+    int result = create_image(
+            device,
+            physical_device,
+            extent,
+            1,
+            TRACE_FORMAT,
+            usage,
+            GpuMemoryCategory_Frame,
+            image,
+            memory,
+            NULL);
+    if (result > 0) return 2;
+    result = create_image_view(device, *image, TRACE_FORMAT, 1, view);
+    if (result > 0) return 3;
+
+    return 0;
+}
+
+int tracer_init(
+        struct Tracer *tracer,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        VkQueue queue,
+        uint32_t queue_family,
+        const char *path,
+        struct PipelineBatch *pipelines,
+        struct Bindless *bindless,
+        const struct Scene *scene,
+        const struct Bvh *bvh,
+        const struct Environment *environment,
+        const struct Sampler *sampler,
+        int ray_query,
+        VkExtent2D extent,
+        const struct TraceSettings *settings,
+        uint32_t features) {
+#if DEBUG_INPUT_VALIDATION
+    if (tracer == NULL) return 1;
+    if (!IS_ZERO_PTR(tracer)) return 1;
+    if (device == VK_NULL_HANDLE) return 1;
+    if (physical_device == VK_NULL_HANDLE) return 1;
+    if (queue == VK_NULL_HANDLE) return 1;
+    if (path == NULL) return 1;
+    if (bindless == NULL) return 1;
+    if (scene == NULL || scene->triangles_n == 0) return 1;
+    if (bvh == NULL || bvh->nodes_n == 0) return 1;
+    if (ray_query && !bindless->acceleration_structure) return 1;
+    if (extent.width == 0 || extent.height == 0) return 1;
+    if (settings == NULL) return 1;
+    if (settings->samples_per_dispatch > TRACE_MAX_SAMPLES_PER_DISPATCH) return 1;
+#endif
+
+    int result = 0;
+
+    tracer->device = device;
+    tracer->settings = trace_settings_resolve(settings);
+    tracer->uniform = tracer->settings.kernel == TraceKernel_Uniform;
+    tracer->bindless = bindless;
+    tracer->extent = extent;
+    tracer->render_extent = extent;
+    tracer->camera = scene->camera;
+    tracer->triangles_n = scene->triangles_n;
+    tracer->ray_query = ray_query;
+    tracer->accum_slot = BINDLESS_INVALID;
+    tracer->environment_slot = BINDLESS_INVALID;
+    tracer->sampler_slot = BINDLESS_INVALID;
+    tracer->texcoord_slot = BINDLESS_INVALID;
+    for (uint32_t i = 0; i < TRACE_OUTPUTS; i++)
+        tracer->texture_table_slots[i] = BINDLESS_INVALID;
+    for (uint32_t i = 0; i < TraceBuffer_N; i++)
+        tracer->buffer_slots[i] = BINDLESS_INVALID;
+    for (uint32_t i = 0; i < TRACE_OUTPUTS; i++) {
+        tracer->outputs[i].storage_slot = BINDLESS_INVALID;
+        tracer->outputs[i].sampled_slot = BINDLESS_INVALID;
+    }
+
+    // Pipeline.
+    result = create_pipeline_layout(device, NULL, bindless->layout, &tracer->pipeline_layout);
+    if (result > 0) return 2;
+    result = variant_cache_init(
+            &tracer->variants,
+            device,
+            path,
+            trace_kernel_name(ray_query),
+            TraceConstant_N,
+            tracer->pipeline_layout);
+    if (result > 0) return 3;
+    uint32_t constants[TRACE_MAX_VARIANTS][TraceConstant_N];
+    uint32_t variants_n = trace_variants(&tracer->settings, features, constants);
+    for (uint32_t i = 0; i < variants_n; i++)
+        if (variant_cache_get(&tracer->variants, pipelines, constants[i]) == VK_NULL_HANDLE) return 3;
+
+    // Scene buffers. Geometry doubles as acceleration structure build input.
+    const void *buffer_data[TraceBuffer_N] = {
+        [TraceBuffer_Positions] = scene->positions,
+        [TraceBuffer_Indices] = scene->indices,
+        [TraceBuffer_TriangleMaterials] = scene->triangle_materials,
+        [TraceBuffer_Materials] = scene->materials,
+        [TraceBuffer_Nodes] = bvh->nodes,
+        [TraceBuffer_BvhTriangles] = bvh->triangles,
+    };
+    VkDeviceSize buffer_sizes[TraceBuffer_N] = {
+        [TraceBuffer_Positions] = scene->vertices_n * 4 * sizeof(float),
+        [TraceBuffer_Indices] = scene->triangles_n * 3 * sizeof(uint32_t),
+        [TraceBuffer_TriangleMaterials] = scene->triangles_n * sizeof(uint32_t),
+        [TraceBuffer_Materials] = scene->materials_n * sizeof(struct SceneMaterial),
+        [TraceBuffer_Nodes] = bvh->nodes_n * sizeof(struct BvhNode),
+        [TraceBuffer_BvhTriangles] = bvh->triangles_n * sizeof(uint32_t),
+    };
+    for (uint32_t i = 0; i < TraceBuffer_N; i++) {
+        VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        if (ray_query && (i == TraceBuffer_Positions || i == TraceBuffer_Indices))
+            usage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+                | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+        enum GpuMemoryCategory category = i == TraceBuffer_Nodes || i == TraceBuffer_BvhTriangles
+            ? GpuMemoryCategory_Bvh
+            : GpuMemoryCategory_Geometry;
+        result = create_buffer_with_data(
+                device,
+                physical_device,
+                queue,
+                queue_family,
+                usage,
+                buffer_data[i],
+                buffer_sizes[i],
+                category,
+                tracer->buffers + i,
+                tracer->buffer_memories + i);
+        if (result > 0) return 6;
+        tracer->buffer_slots[i] = bindless_add_storage_buffer(
+                bindless,
+                device,
+                tracer->buffers[i],
+                0,
+                VK_WHOLE_SIZE);
+        if (tracer->buffer_slots[i] == BINDLESS_INVALID) return 5;
+    }
+
+    if (environment != NULL) {
+        result = create_buffer_with_data(
+                device,
+                physical_device,
+                queue,
+                queue_family,
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                environment->data,
+                environment->size,
+                GpuMemoryCategory_Textures,
+                &tracer->environment_buffer,
+                &tracer->environment_memory);
+        if (result > 0) return 6;
+        tracer->environment_slot = bindless_add_storage_buffer(
+                bindless,
+                device,
+                tracer->environment_buffer,
+                0,
+                VK_WHOLE_SIZE);
+        if (tracer->environment_slot == BINDLESS_INVALID) return 5;
+    }
+
+    if (sampler != NULL) {
+        result = create_buffer_with_data(
+                device,
+                physical_device,
+                queue,
+                queue_family,
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                sampler->data,
+                sampler->size,
+                GpuMemoryCategory_Textures,
+                &tracer->sampler_buffer,
+                &tracer->sampler_memory);
+        if (result > 0) return 6;
+        tracer->sampler_slot = bindless_add_storage_buffer(
+                bindless,
+                device,
+                tracer->sampler_buffer,
+                0,
+                VK_WHOLE_SIZE);
+        if (tracer->sampler_slot == BINDLESS_INVALID) return 5;
+    }
+
+    if (scene->textures_n > 0) {
+        result = create_buffer_with_data(
+                device,
+                physical_device,
+                queue,
+                queue_family,
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                scene->texcoords,
+                scene->vertices_n * 2 * sizeof(float),
+                GpuMemoryCategory_Geometry,
+                &tracer->texcoord_buffer,
+                &tracer->texcoord_memory);
+        if (result > 0) return 6;
+        tracer->texcoord_slot = bindless_add_storage_buffer(
+                bindless,
+                device,
+                tracer->texcoord_buffer,
+                0,
+                VK_WHOLE_SIZE);
+        if (tracer->texcoord_slot == BINDLESS_INVALID) return 5;
+
+        // Tables at offsets any storage buffer alignment divides.
+        tracer->textures_n = scene->textures_n;
+        VkDeviceSize table_size = (scene->textures_n * sizeof(uint32_t) + 255) & ~(VkDeviceSize)255;
+        result = create_buffer(
+                device,
+                physical_device,
+                TRACE_OUTPUTS * table_size,
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                GpuMemoryCategory_Frame,
+                &tracer->texture_table_buffer,
+                &tracer->texture_table_memory);
+        if (result > 0) return 6;
+        void *mapped = NULL;
+        if (vkMapMemory(device, tracer->texture_table_memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS) return 6;
+        for (uint32_t i = 0; i < TRACE_OUTPUTS; i++) {
+            tracer->texture_tables[i] = (uint32_t *)((char *)mapped + i * table_size);
+            for (uint32_t t = 0; t < scene->textures_n; t++) tracer->texture_tables[i][t] = BINDLESS_INVALID;
+            tracer->texture_table_slots[i] = bindless_add_storage_buffer(
+                    bindless,
+                    device,
+                    tracer->texture_table_buffer,
+                    i * table_size,
+                    table_size);
+            if (tracer->texture_table_slots[i] == BINDLESS_INVALID) return 5;
+        }
+    }
+
+    if (ray_query) {
+        result = accel_init(
+                &tracer->accel,
+                device,
+                physical_device,
+                queue,
+                queue_family,
+                tracer->buffers[TraceBuffer_Positions],
+                scene->vertices_n,
+                tracer->buffers[TraceBuffer_Indices],
+                scene->triangles_n);
+        if (result > 0) return 7;
+        bindless_write_acceleration_structure(bindless, device, tracer->accel.tlas.handle);
+    }
+
+    // Accumulation.
+    result = create_trace_image(
+            device,
+            physical_device,
+            extent,
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            &tracer->accum_image,
+            &tracer->accum_memory,
+            &tracer->accum_view);
+    if (result > 0) return 4;
+    tracer->accum_slot = bindless_add_storage_image(bindless, device, tracer->accum_view);
+    if (tracer->accum_slot == BINDLESS_INVALID) return 5;
+
+    // Outputs.
+    for (uint32_t i = 0; i < TRACE_OUTPUTS; i++) {
+        struct TraceOutput *output = &tracer->outputs[i];
+        result = create_trace_image(
+                device,
+                physical_device,
+                extent,
+                VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                &output->image,
+                &output->memory,
+                &output->view);
+        if (result > 0) return 4;
+        output->storage_slot = bindless_add_storage_image(bindless, device, output->view);
+        output->sampled_slot = bindless_add_sampled_image(
+                bindless,
+                device,
+                output->view,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        if (output->storage_slot == BINDLESS_INVALID || output->sampled_slot == BINDLESS_INVALID) return 5;
+    }
+
+    return 0;
+}
+
+void tracer_free(struct Tracer *tracer) {
+    VkDevice device = tracer->device;
+
+    // Only called once the device is idle, slots can go back immediately.
+    for (uint32_t i = 0; i < TRACE_OUTPUTS; i++) {
+        struct TraceOutput *output = &tracer->outputs[i];
+        if (tracer->bindless != NULL && output->storage_slot != BINDLESS_INVALID) {
+            bindless_release(tracer->bindless, BindlessKind_StorageImage, output->storage_slot, 0);
+            bindless_release(tracer->bindless, BindlessKind_SampledImage, output->sampled_slot, 0);
+        }
+        vkDestroyImageView(device, output->view, NULL);
+        vkDestroyImage(device, output->image, NULL);
+        gpu_memory_free(device, output->memory);
+    }
+    if (tracer->bindless != NULL && tracer->accum_slot != BINDLESS_INVALID)
+        bindless_release(tracer->bindless, BindlessKind_StorageImage, tracer->accum_slot, 0);
+    vkDestroyImageView(device, tracer->accum_view, NULL);
+    vkDestroyImage(device, tracer->accum_image, NULL);
+    gpu_memory_free(device, tracer->accum_memory);
+
+    if (tracer->ray_query) accel_free(&tracer->accel);
+    for (uint32_t i = 0; i < TraceBuffer_N; i++) {
+        if (tracer->bindless != NULL)
+            bindless_release(tracer->bindless, BindlessKind_StorageBuffer, tracer->buffer_slots[i], 0);
+        vkDestroyBuffer(device, tracer->buffers[i], NULL);
+        gpu_memory_free(device, tracer->buffer_memories[i]);
+    }
+    if (tracer->bindless != NULL && tracer->environment_slot != BINDLESS_INVALID)
+        bindless_release(tracer->bindless, BindlessKind_StorageBuffer, tracer->environment_slot, 0);
+    vkDestroyBuffer(device, tracer->environment_buffer, NULL);
+    gpu_memory_free(device, tracer->environment_memory);
+    if (tracer->bindless != NULL && tracer->sampler_slot != BINDLESS_INVALID)
+        bindless_release(tracer->bindless, BindlessKind_StorageBuffer, tracer->sampler_slot, 0);
+    vkDestroyBuffer(device, tracer->sampler_buffer, NULL);
+    gpu_memory_free(device, tracer->sampler_memory);
+    if (tracer->bindless != NULL && tracer->texcoord_slot != BINDLESS_INVALID)
+        bindless_release(tracer->bindless, BindlessKind_StorageBuffer, tracer->texcoord_slot, 0);
+    vkDestroyBuffer(device, tracer->texcoord_buffer, NULL);
+    gpu_memory_free(device, tracer->texcoord_memory);
+    for (uint32_t i = 0; i < TRACE_OUTPUTS; i++) {
+        if (tracer->bindless != NULL && tracer->texture_table_slots[i] != BINDLESS_INVALID)
+            bindless_release(tracer->bindless, BindlessKind_StorageBuffer, tracer->texture_table_slots[i], 0);
+    }
+    vkDestroyBuffer(device, tracer->texture_table_buffer, NULL);
+    gpu_memory_free(device, tracer->texture_table_memory); // Unmaps.
+
+    variant_cache_free(&tracer->variants); // Zeroes itself.
+    vkDestroyPipelineLayout(device, tracer->pipeline_layout, NULL);
+
+    memset(tracer, 0, sizeof(*tracer));
+}
+
+void tracer_set_render_extent(struct Tracer *tracer, VkExtent2D extent) {
+#if DEBUG_INPUT_VALIDATION
+    if (tracer == NULL) return;
+    if (extent.width == 0 || extent.width > tracer->extent.width) return;
+    if (extent.height == 0 || extent.height > tracer->extent.height) return;
+#endif
+
+    if (extent.width == tracer->render_extent.width && extent.height == tracer->render_extent.height) return;
+    tracer->render_extent = extent;
+    tracer->samples_n = 0;
+}
+
+void tracer_set_texture_slots(struct Tracer *tracer, uint32_t output, const uint32_t *slots) {
+#if DEBUG_INPUT_VALIDATION
+    if (tracer == NULL || slots == NULL) return;
+    if (output >= TRACE_OUTPUTS) return;
+#endif
+
+    if (tracer->textures_n == 0) return;
+    memcpy(tracer->texture_tables[output], slots, tracer->textures_n * sizeof(uint32_t));
+}
+
+void tracer_record(
+        struct Tracer *tracer,
+        VkCommandBuffer command_buffer,
+        uint32_t output,
+        const struct TraceGuides *guides,
+        const struct TraceTiles *tiles) {
+#if DEBUG_INPUT_VALIDATION
+    if (tracer == NULL) return;
+    if (command_buffer == VK_NULL_HANDLE) return;
+    if (output >= TRACE_OUTPUTS) return;
+#endif
+
+    // The previous dispatch's accumulation writes, on this same queue, must
+    // land first. Restarting throws the old contents away.
+    VkImageMemoryBarrier accum_barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        .oldLayout = tracer->samples_n == 0 ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_GENERAL,
+        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = tracer->accum_image,
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+    };
+    vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            0,
+            NULL,
+            0,
+            NULL,
+            1,
+            &accum_barrier);
+
+    //
+    struct TracePush push = {
+        .accum = tracer->accum_slot,
+        .target = tracer->outputs[output].storage_slot,
+        .samples_n = tracer->samples_n,
+        .width = tracer->render_extent.width,
+        .height = tracer->render_extent.height,
+        .triangles_n = tracer->triangles_n,
+        .camera_position = {
+            tracer->camera.position[0],
+            tracer->camera.position[1],
+            tracer->camera.position[2],
+            tracer->camera.fov,
+        },
+        .camera_target = {
+            tracer->camera.target[0],
+            tracer->camera.target[1],
+            tracer->camera.target[2],
+        },
+        .environment = tracer->environment_slot,
+        .sequence = tracer->sampler_slot,
+        .textures = tracer->texture_table_slots[output],
+        .texcoords = tracer->texcoord_slot,
+    };
+    memcpy(push.buffers, tracer->buffer_slots, sizeof(push.buffers));
+    if (guides != NULL) {
+        push.guides = *guides;
+    } else {
+        push.guides.noisy = BINDLESS_INVALID;
+        push.guides.albedo = BINDLESS_INVALID;
+        push.guides.gbuffer = BINDLESS_INVALID;
+    }
+    int indirect = tiles != NULL && tiles->indirect;
+    push.moments = tiles != NULL ? tiles->moments : BINDLESS_INVALID;
+    push.tiles = indirect ? tiles->list : BINDLESS_INVALID;
+    push.bounces = tracer->settings.bounces;
+    push.samples = tracer->settings.samples_per_dispatch;
+
+    // Variant for this dispatch, compiled here if it missed the precompile
+    // list.
+    uint32_t features = (guides != NULL ? TRACE_FEATURE_GUIDES : 0)
+        | (tiles != NULL ? TRACE_FEATURE_MOMENTS : 0)
+        | (indirect ? TRACE_FEATURE_TILES : 0);
+    uint32_t constants[TraceConstant_N];
+    trace_constants(&tracer->settings, tracer->uniform, features, constants);
+    VkPipeline pipeline = variant_cache_get(&tracer->variants, NULL, constants);
+    if (pipeline == VK_NULL_HANDLE) return;
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(
+            command_buffer,
+            VK_PIPELINE_BIND_POINT_COMPUTE,
+            tracer->pipeline_layout,
+            0,
+            1,
+            &tracer->bindless->set,
+            0,
+            NULL);
+    vkCmdPushConstants(command_buffer, tracer->pipeline_layout, VK_SHADER_STAGE_ALL, 0, sizeof(push), &push);
+    if (indirect) {
+        vkCmdDispatchIndirect(command_buffer, tiles->list_buffer, 0);
+    } else {
+        uint32_t group_size = tracer->settings.group_size;
+        vkCmdDispatch(
+                command_buffer,
+                (tracer->render_extent.width + group_size - 1) / group_size,
+                (tracer->render_extent.height + group_size - 1) / group_size,
+                1);
+    }
+
+    tracer->samples_n += tracer->settings.samples_per_dispatch;
+}
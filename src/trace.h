@@ -0,0 +1,186 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include "accel.h"
+#include "bindless.h"
+#include "bvh.h"
+#include "environment.h"
+#include "pipeline.h"
+#include "sampler.h"
+#include "scene.h"
+
+#define TRACE_OUTPUTS 2 // one per frame in flight
+#define TRACE_GROUP_SIZE 8
+#define TRACE_FORMAT VK_FORMAT_R32G32B32A32_SFLOAT
+#define TRACE_DEFAULT_BOUNCES 4
+#define TRACE_MAX_SAMPLES_PER_DISPATCH 64
+#define TRACE_MAX_VARIANTS 3 // precompiled per session
+
+// Feature bits of a kernel variant, must match trace.comp.
+#define TRACE_FEATURE_GUIDES 0x1u
+#define TRACE_FEATURE_MOMENTS 0x2u
+#define TRACE_FEATURE_TILES 0x4u // dispatched indirectly over a tile list
+#define TRACE_FEATURE_DYNAMIC 0x80000000u // branches on push constants instead
+
+enum TraceKernel {
+    TraceKernel_Specialized = 0, // path length, samples and features are specialization constants
+    TraceKernel_Uniform, // a single variant branching on push constants
+    TraceKernel_Compare, // alternates between both, see Tracer.uniform
+};
+
+// Specialization constant ids of trace.comp.
+enum TraceConstant {
+    TraceConstant_Bounces = 0,
+    TraceConstant_Samples, // per dispatch
+    TraceConstant_GroupWidth,
+    TraceConstant_GroupHeight,
+    TraceConstant_Features,
+    TraceConstant_N,
+};
+
+// Zero fields take the defaults.
+struct TraceSettings {
+    enum TraceKernel kernel;
+    uint32_t bounces;
+    uint32_t samples_per_dispatch;
+    uint32_t group_size; // workgroup width and height, default TRACE_GROUP_SIZE
+};
+
+// Resolved image a frame's trace writes and the composite pass samples. This
+// is the only image shared between the compute and graphics queues.
+struct TraceOutput {
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view;
+    uint32_t storage_slot;
+    uint32_t sampled_slot;
+};
+
+// Scene data the trace kernels read, one bindless storage buffer each.
+enum TraceBuffer {
+    TraceBuffer_Positions = 0,
+    TraceBuffer_Indices,
+    TraceBuffer_TriangleMaterials,
+    TraceBuffer_Materials,
+    TraceBuffer_Nodes,
+    TraceBuffer_BvhTriangles,
+    TraceBuffer_N,
+};
+
+// Optional per-frame feature images for a denoiser, as bindless storage
+// image slots in GENERAL.
+struct TraceGuides {
+    uint32_t noisy; // this frame's sample
+    uint32_t albedo; // primary hit albedo, 1 for lights and sky
+    uint32_t gbuffer; // primary hit normal, and distance along the ray or -1 on a miss
+};
+
+// Optional per-pixel sample statistics and tile list for adaptive sampling.
+struct TraceTiles {
+    uint32_t moments; // storage image slot, luminance sum and sum of squares
+    uint32_t list; // storage buffer slot of the tile list
+    VkBuffer list_buffer; // holds the indirect dispatch arguments at offset 0
+    int indirect; // trace only the listed tiles, and leave resolving to the caller
+};
+
+// Progressive path tracer. Accumulates into an image private to the trace
+// dispatches and resolves every frame into one of the outputs.
+struct Tracer {
+    VkDevice device;
+    struct Bindless *bindless;
+    VkExtent2D extent; // allocated
+    VkExtent2D render_extent; // traced, the top left of extent
+    struct TraceSettings settings; // defaults resolved
+    VkPipelineLayout pipeline_layout;
+    struct VariantCache variants; // keyed by enum TraceConstant
+    int uniform; // dispatch the uniform branching variant
+    // Scene.
+    struct SceneCamera camera;
+    uint32_t triangles_n;
+    VkBuffer buffers[TraceBuffer_N];
+    VkDeviceMemory buffer_memories[TraceBuffer_N];
+    uint32_t buffer_slots[TraceBuffer_N];
+    VkBuffer environment_buffer; // header and texels, see struct Environment
+    VkDeviceMemory environment_memory;
+    uint32_t environment_slot; // BINDLESS_INVALID for the sky
+    VkBuffer sampler_buffer; // points and mask, see struct Sampler
+    VkDeviceMemory sampler_memory;
+    uint32_t sampler_slot; // BINDLESS_INVALID for pcg random numbers
+    VkBuffer texcoord_buffer; // per vertex uv, only with scene textures
+    VkDeviceMemory texcoord_memory;
+    uint32_t texcoord_slot; // BINDLESS_INVALID without scene textures
+    // Sampled image slot of every scene texture, one table per output so a
+    // frame in flight keeps reading its own. Host visible, see
+    // tracer_set_texture_slots.
+    uint32_t textures_n;
+    VkBuffer texture_table_buffer;
+    VkDeviceMemory texture_table_memory;
+    uint32_t *texture_tables[TRACE_OUTPUTS]; // mapped
+    uint32_t texture_table_slots[TRACE_OUTPUTS];
+    int ray_query; // traverses accel with ray queries instead of the BVH
+    struct Accel accel;
+    //
+    VkImage accum_image;
+    VkDeviceMemory accum_memory;
+    VkImageView accum_view;
+    uint32_t accum_slot;
+    uint32_t samples_n; // per pixel accumulated so far, 0 restarts accumulation
+    struct TraceOutput outputs[TRACE_OUTPUTS];
+};
+
+// Uploads scene and bvh through queue, and environment unless it is NULL,
+// which leaves escaping rays the sky, and sampler unless it is NULL, which
+// leaves paths pcg random numbers. Materials with albedo textures sample
+// them once tracer_set_texture_slots has slots for them. With ray_query,
+// builds acceleration structures over the scene and binds them instead of
+// tracing the BVH.
+// pipelines, which may be NULL, holds pipelines compiled ahead of time, see
+// tracer_precompile. features are the TRACE_FEATURE bits the session's
+// dispatches use, so their variants can be taken from pipelines.
+int tracer_init(
+        struct Tracer *tracer,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        VkQueue queue,
+        uint32_t queue_family,
+        const char *path,
+        struct PipelineBatch *pipelines,
+        struct Bindless *bindless,
+        const struct Scene *scene,
+        const struct Bvh *bvh,
+        const struct Environment *environment,
+        const struct Sampler *sampler,
+        int ray_query,
+        VkExtent2D extent,
+        const struct TraceSettings *settings,
+        uint32_t features);
+void tracer_free(struct Tracer *tracer);
+
+// The sampled image slots the next record into output reads each scene
+// texture from, BINDLESS_INVALID for those with no resident mip yet, which
+// shade with the material's albedo alone. slots holds the scene's textures_n.
+void tracer_set_texture_slots(struct Tracer *tracer, uint32_t output, const uint32_t *slots);
+
+// Traces only the top left extent of the images from the next record on,
+// restarting accumulation when it changes. At most the allocated extent.
+void tracer_set_render_extent(struct Tracer *tracer, VkExtent2D extent);
+
+// Queues the kernel variants a session with features dispatches onto
+// pipelines, the precompile list. Variants missing there compile on first
+// use, stalling that frame.
+int tracer_precompile(
+        struct PipelineBatch *pipelines,
+        int ray_query,
+        const struct TraceSettings *settings,
+        uint32_t features);
+
+// Records settings.samples_per_dispatch samples per pixel into
+// outputs[output], their mean and the first primary hit into guides when not
+// NULL, and sample moments when tiles is not NULL. The caller owns the
+// output's layout and queue family transitions; it must be in GENERAL.
+void tracer_record(
+        struct Tracer *tracer,
+        VkCommandBuffer command_buffer,
+        uint32_t output,
+        const struct TraceGuides *guides,
+        const struct TraceTiles *tiles);
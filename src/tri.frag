@@ -1,9 +1,56 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
+#include "bindless.glsl"
 
-layout(location = 0) in vec3 frag_color;
+#define UPSCALE_EDGE 1 // must match Upscale_Edge
+#define EDGE_SHARPNESS 8.0 // weight falloff with luminance difference, relative to the nearest texel
+
+layout(location = 0) in vec2 frag_uv;
 
 layout(location = 0) out vec4 out_color;
 
+// Must match struct CompositePush in app.c.
+layout(push_constant) uniform Push {
+    uint image;
+    uint upscale;
+    uint width; // rendered rectangle, the top left of the image
+    uint height;
+} pc;
+
+float luminance(vec3 c) {
+    return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Bilinear over the four rendered texels around p, fetched by hand since
+// rgba32f need not support linear filtering. With sharpness, each weight is
+// scaled down by how far the texel's luminance is from the nearest texel's,
+// so edges stay sharp instead of blurring across.
+vec3 upscale(vec2 p, float sharpness) {
+    ivec2 last = ivec2(pc.width, pc.height) - 1;
+    vec2 q = p - 0.5;
+    ivec2 base = ivec2(floor(q));
+    vec2 f = q - vec2(base);
+    vec3 nearest = texelFetch(bindless_texture(pc.image, SAMPLER_NEAREST_CLAMP), min(ivec2(p), last), 0).rgb;
+    float center = luminance(nearest);
+
+    vec3 sum = vec3(0.0);
+    float weights = 0.0;
+    for (int i = 0; i < 4; i++) {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 texel = clamp(base + offset, ivec2(0), last);
+        vec3 c = texelFetch(bindless_texture(pc.image, SAMPLER_NEAREST_CLAMP), texel, 0).rgb;
+        vec2 w2 = mix(1.0 - f, f, vec2(offset));
+        float range = abs(luminance(c) - center) / (center + 0.05);
+        float w = w2.x * w2.y / (1.0 + sharpness * range);
+        sum += w * c;
+        weights += w;
+    }
+    return weights > 0.0 ? sum / weights : nearest;
+}
+
 void main() {
-    out_color = vec4(frag_color, 1.0);
+    // Swapchain pixel centers land on rendered pixel centers at full scale.
+    vec2 p = frag_uv * vec2(pc.width, pc.height);
+    vec3 color = upscale(p, pc.upscale == UPSCALE_EDGE ? EDGE_SHARPNESS : 0.0);
+    out_color = vec4(color, 1.0);
 }
@@ -1,11 +1,9 @@
 #version 450
 
-layout(location = 0) out vec3 frag_color;
-
-layout(location = 0) in vec2 vert_pos;
-layout(location = 1) in vec3 vert_color;
+layout(location = 0) out vec2 frag_uv;
 
+// Fullscreen triangle, no vertex buffers.
 void main() {
-    gl_Position = vec4(vert_pos, 0.0, 1.0);
-    frag_color = vert_color;
+    frag_uv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+    gl_Position = vec4(frag_uv * 2.0 - 1.0, 0.0, 1.0);
 }
@@ -1,3 +1,4 @@
+#include <time.h>
 #include "util.h"
 
 int memcheck(void *ptr, uint8_t val, size_t len) { 
@@ -7,6 +8,24 @@ int memcheck(void *ptr, uint8_t val, size_t len) {
     return 1;
 }
 
+// Copies or appends at most size - 1 bytes and always terminates, returning
+// the length of the string it tried to create.
+size_t strlcpy(char *dst, const char *src, size_t size) {
+    size_t len = strlen(src);
+    if (size > 0) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = 0;
+    }
+    return len;
+}
+
+size_t strlcat(char *dst, const char *src, size_t size) {
+    size_t dst_len = strnlen(dst, size);
+    if (dst_len == size) return size + strlen(src);
+    return dst_len + strlcpy(dst + dst_len, src, size - dst_len);
+}
+
 const char *vk_result_to_string(VkResult res) {
 	switch (res) {
 #define CASE(x) case VK_##x: return #x;
@@ -43,3 +62,9 @@ const char *vk_result_to_string(VkResult res) {
 	}
 #undef CASE
 }
+
+double time_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
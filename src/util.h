@@ -14,3 +14,4 @@ int memcheck(void *ptr, uint8_t val, size_t size);
 size_t strlcpy(char *dst, const char *src, size_t size);
 size_t strlcat(char *dst, const char *src, size_t size);
 const char *vk_result_to_string(VkResult result);
+double time_now(void); // Monotonic, in seconds.
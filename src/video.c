@@ -0,0 +1,229 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "util.h"
+#include "video.h"
+
+// BT.709 limited range in 8.8 fixed point.
+#define Y_R 47
+#define Y_G 157
+#define Y_B 16
+#define U_R -26
+#define U_G -86
+#define U_B 112
+#define V_R 112
+#define V_G -102
+#define V_B -10
+
+static void convert_luma_row(const uint8_t *bgra, uint8_t *y, uint32_t width) {
+    uint32_t x = 0;
+#ifdef __SSE2__
+    // Eight pixels at a time: widen to 16 bit, multiply-add B,G and R,A pairs,
+    // then fold the pairs.
+    const __m128i coeffs = _mm_setr_epi16(Y_B, Y_G, Y_R, 0, Y_B, Y_G, Y_R, 0);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi32((16 << 8) + 128);
+    for (; x + 8 <= width; x += 8) {
+        __m128i p0 = _mm_loadu_si128((const __m128i*)(bgra + x * 4));
+        __m128i p1 = _mm_loadu_si128((const __m128i*)(bgra + x * 4 + 16));
+        __m128i s0 = _mm_madd_epi16(_mm_unpacklo_epi8(p0, zero), coeffs);
+        __m128i s1 = _mm_madd_epi16(_mm_unpackhi_epi8(p0, zero), coeffs);
+        __m128i s2 = _mm_madd_epi16(_mm_unpacklo_epi8(p1, zero), coeffs);
+        __m128i s3 = _mm_madd_epi16(_mm_unpackhi_epi8(p1, zero), coeffs);
+        s0 = _mm_shuffle_epi32(_mm_add_epi32(s0, _mm_srli_epi64(s0, 32)), 0xD8);
+        s1 = _mm_shuffle_epi32(_mm_add_epi32(s1, _mm_srli_epi64(s1, 32)), 0xD8);
+        s2 = _mm_shuffle_epi32(_mm_add_epi32(s2, _mm_srli_epi64(s2, 32)), 0xD8);
+        s3 = _mm_shuffle_epi32(_mm_add_epi32(s3, _mm_srli_epi64(s3, 32)), 0xD8);
+        __m128i a = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi64(s0, s1), bias), 8);
+        __m128i b = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi64(s2, s3), bias), 8);
+        __m128i y16 = _mm_packs_epi32(a, b);
+        _mm_storel_epi64((__m128i*)(y + x), _mm_packus_epi16(y16, y16));
+    }
+#endif
+    for (; x < width; x++) {
+        const uint8_t *p = bgra + x * 4;
+        y[x] = (Y_R * p[2] + Y_G * p[1] + Y_B * p[0] + (16 << 8) + 128) >> 8;
+    }
+}
+
+static void convert_chroma_row(
+        const uint8_t *row0,
+        const uint8_t *row1,
+        uint8_t *u,
+        uint8_t *v,
+        uint32_t width) {
+    for (uint32_t x = 0; x < (width + 1) / 2; x++) {
+        uint32_t x0 = x * 2, x1 = x * 2 + 1 < width ? x * 2 + 1 : x * 2;
+        const uint8_t *p[4] = { row0 + x0 * 4, row0 + x1 * 4, row1 + x0 * 4, row1 + x1 * 4 };
+        int b = (p[0][0] + p[1][0] + p[2][0] + p[3][0] + 2) >> 2;
+        int g = (p[0][1] + p[1][1] + p[2][1] + p[3][1] + 2) >> 2;
+        int r = (p[0][2] + p[1][2] + p[2][2] + p[3][2] + 2) >> 2;
+        u[x] = (U_R * r + U_G * g + U_B * b + (128 << 8) + 128) >> 8;
+        v[x] = (V_R * r + V_G * g + V_B * b + (128 << 8) + 128) >> 8;
+    }
+}
+
+static void convert_i420(const uint8_t *bgra, uint32_t width, uint32_t height, uint8_t *dst) {
+    uint32_t cw = (width + 1) / 2, ch = (height + 1) / 2;
+    uint8_t *y = dst, *u = dst + (size_t)width * height, *v = u + (size_t)cw * ch;
+    size_t stride = (size_t)width * 4;
+    for (uint32_t row = 0; row < height; row++)
+        convert_luma_row(bgra + row * stride, y + (size_t)row * width, width);
+    for (uint32_t row = 0; row < ch; row++) {
+        uint32_t r0 = row * 2, r1 = row * 2 + 1 < height ? row * 2 + 1 : row * 2;
+        convert_chroma_row(bgra + r0 * stride, bgra + r1 * stride, u + (size_t)row * cw, v + (size_t)row * cw, width);
+    }
+}
+
+static void convert_rgb(const uint8_t *bgra, uint32_t width, uint32_t height, uint8_t *dst) {
+    size_t texels = (size_t)width * height;
+    for (size_t i = 0; i < texels; i++) {
+        dst[i * 3 + 0] = bgra[i * 4 + 2];
+        dst[i * 3 + 1] = bgra[i * 4 + 1];
+        dst[i * 3 + 2] = bgra[i * 4 + 0];
+    }
+}
+
+static void *video_writer(void *arg) {
+    struct VideoStream *video = arg;
+
+    pthread_mutex_lock(&video->lock);
+    while (1) {
+        struct VideoFrame *frame = &video->frames[video->written_n % VIDEO_QUEUE_SIZE];
+        while (!(frame->ready && frame->sequence == video->written_n) && !video->quit)
+            pthread_cond_wait(&video->changed, &video->lock);
+        if (!(frame->ready && frame->sequence == video->written_n)) break; // quit, drained
+
+        // Write outside the lock, producers keep converting meanwhile.
+        int failed = video->failed;
+        pthread_mutex_unlock(&video->lock);
+        if (!failed) {
+            if (video->format == VideoFormat_Y4m) fputs("FRAME\n", video->file);
+            failed = fwrite(frame->data, 1, video->frame_size, video->file) != video->frame_size;
+            fflush(video->file);
+        }
+        pthread_mutex_lock(&video->lock);
+
+        if (failed && !video->failed) {
+            fprintf(stderr, "[video] consumer closed the stream, discarding frames\n");
+            video->failed = 1;
+        }
+        frame->ready = 0;
+        video->written_n += 1;
+        pthread_cond_broadcast(&video->changed);
+    }
+    pthread_mutex_unlock(&video->lock);
+
+    return NULL;
+}
+
+int video_init(
+        struct VideoStream *video,
+        const char *path,
+        enum VideoFormat format,
+        uint32_t width,
+        uint32_t height,
+        uint32_t fps) {
+#if DEBUG_INPUT_VALIDATION
+    if (video == NULL) return 1;
+    if (!IS_ZERO_PTR(video)) return 1;
+    if (path == NULL) return 1;
+    if (width == 0 || height == 0) return 1;
+    if (fps == 0) return 1;
+#endif
+
+    // Opening a named pipe blocks here until the consumer attaches.
+    if (strcmp(path, "-") == 0) {
+        int fd = dup(STDOUT_FILENO);
+        if (fd < 0) return 2;
+        fflush(stdout);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        video->file = fdopen(fd, "wb");
+    } else {
+        video->file = fopen(path, "wb");
+    }
+    if (video->file == NULL) return 2;
+
+    video->format = format;
+    video->width = width;
+    video->height = height;
+    video->fps = fps;
+    video->frame_size = format == VideoFormat_Y4m
+        ? (size_t)width * height + 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2)
+        : (size_t)width * height * 3;
+    for (uint32_t i = 0; i < VIDEO_QUEUE_SIZE; i++)
+        video->frames[i].data = malloc(video->frame_size);
+    pthread_mutex_init(&video->lock, NULL);
+    pthread_cond_init(&video->changed, NULL);
+    video->started_at = time_now();
+
+    if (format == VideoFormat_Y4m)
+        fprintf(video->file, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n", width, height, fps);
+
+    if (pthread_create(&video->writer, NULL, video_writer, video) != 0) return 3;
+
+    return 0;
+}
+
+void video_free(struct VideoStream *video) {
+    if (video->file == NULL) return;
+
+    pthread_mutex_lock(&video->lock);
+    video->quit = 1;
+    pthread_cond_broadcast(&video->changed);
+    pthread_mutex_unlock(&video->lock);
+    pthread_join(video->writer, NULL);
+
+    fclose(video->file);
+    for (uint32_t i = 0; i < VIDEO_QUEUE_SIZE; i++) free(video->frames[i].data);
+    pthread_cond_destroy(&video->changed);
+    pthread_mutex_destroy(&video->lock);
+
+    memset(video, 0, sizeof(*video));
+}
+
+void video_submit(struct VideoStream *video, uint64_t sequence, const uint8_t *bgra) {
+#if DEBUG_INPUT_VALIDATION
+    if (video == NULL || bgra == NULL) return;
+#endif
+
+    // Wait for the frame VIDEO_QUEUE_SIZE ahead of this one to be written.
+    double start = time_now();
+    pthread_mutex_lock(&video->lock);
+    while (sequence >= video->written_n + VIDEO_QUEUE_SIZE)
+        pthread_cond_wait(&video->changed, &video->lock);
+    pthread_mutex_unlock(&video->lock);
+    double converting = time_now();
+
+    struct VideoFrame *frame = &video->frames[sequence % VIDEO_QUEUE_SIZE];
+    if (video->format == VideoFormat_Y4m) convert_i420(bgra, video->width, video->height, frame->data);
+    else convert_rgb(bgra, video->width, video->height, frame->data);
+    double end = time_now();
+
+    pthread_mutex_lock(&video->lock);
+    frame->sequence = sequence;
+    frame->ready = 1;
+    video->stall_sum += converting - start;
+    video->convert_sum += end - converting;
+    pthread_cond_broadcast(&video->changed);
+    pthread_mutex_unlock(&video->lock);
+}
+
+void video_report(struct VideoStream *video) {
+    pthread_mutex_lock(&video->lock);
+    double elapsed = time_now() - video->started_at;
+    uint64_t n = video->written_n;
+    fprintf(stderr, "[video] %ux%u, %llu frames, %.1f fps sustained, convert %.2f ms avg, stalled on consumer %.2f ms avg\n",
+            video->width,
+            video->height,
+            (unsigned long long)n,
+            elapsed > 0.0 ? n / elapsed : 0.0,
+            n > 0 ? 1000.0 * video->convert_sum / n : 0.0,
+            n > 0 ? 1000.0 * video->stall_sum / n : 0.0);
+    pthread_mutex_unlock(&video->lock);
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+
+// Frames converted but not yet written, bounds memory when the consumer is
+// slow. Producers block once it is full.
+#define VIDEO_QUEUE_SIZE 8
+
+enum VideoFormat {
+    VideoFormat_Y4m = 0, // YUV 4:2:0, BT.709 limited range
+    VideoFormat_Rgb, // headerless RGB24, for rawvideo consumers
+};
+
+struct VideoFrame {
+    uint8_t *data; // frame_size bytes
+    uint64_t sequence;
+    int ready;
+};
+
+// Ordered, bounded frame stream to a file, a named pipe or stdout. Frames are
+// converted by whichever thread submits them and written by a dedicated
+// writer thread in sequence order.
+struct VideoStream {
+    FILE *file;
+    enum VideoFormat format;
+    uint32_t width, height;
+    uint32_t fps;
+    size_t frame_size;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    struct VideoFrame frames[VIDEO_QUEUE_SIZE]; // sequence s lives in frames[s % VIDEO_QUEUE_SIZE]
+    uint64_t written_n; // next sequence the writer expects
+    int quit;
+    int failed; // the consumer went away, frames are discarded
+    // Stats, guarded by lock.
+    double started_at;
+    double stall_sum; // seconds producers waited on the consumer
+    double convert_sum;
+};
+
+// path "-" streams to stdout, and moves stdout to stderr so logging cannot
+// corrupt the stream.
+int video_init(
+        struct VideoStream *video,
+        const char *path,
+        enum VideoFormat format,
+        uint32_t width,
+        uint32_t height,
+        uint32_t fps);
+// Writes every submitted frame, then closes the stream.
+void video_free(struct VideoStream *video);
+
+// Converts a tightly packed BGRA8 frame and queues it. Sequences start at 0
+// and must all be submitted; blocks while the queue is full.
+void video_submit(struct VideoStream *video, uint64_t sequence, const uint8_t *bgra);
+
+void video_report(struct VideoStream *video);
@@ -0,0 +1,672 @@
+#include <vulkan/vulkan.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "gpu_memory.h"
+#include "pipeline.h"
+#include "wavefront.h"
+
+// Must match wavefront.glsl.
+struct WavefrontPush {
+    uint32_t buffers[TraceBuffer_N];
+    uint32_t queues[WavefrontQueue_N];
+    uint32_t counters;
+    uint32_t radiance;
+    uint32_t lights;
+    uint32_t lights_n;
+    uint32_t capacity;
+    uint32_t rays_in;
+    uint32_t bounce;
+    uint32_t bounces;
+    uint32_t accum;
+    uint32_t target;
+    uint32_t samples_n;
+    uint32_t width;
+    uint32_t height;
+    uint32_t order; // BINDLESS_INVALID for queue order
+    float camera_position[4]; // w is the vertical fov
+    float camera_target[3];
+    uint32_t environment; // BINDLESS_INVALID for the sky
+};
+_Static_assert(sizeof(struct WavefrontPush) <= BINDLESS_PUSH_CONSTANT_SIZE, "WavefrontPush too large");
+_Static_assert(offsetof(struct WavefrontPush, camera_position) % 16 == 0, "the block aligns vec4 to 16 bytes");
+
+// Bytes per queue entry, over all of its field arrays.
+static const VkDeviceSize queue_entry_sizes[WavefrontQueue_N] = {
+    [WavefrontQueue_Rays0] = 3 * 16 + 2 * 4,
+    [WavefrontQueue_Rays1] = 3 * 16 + 2 * 4,
+    [WavefrontQueue_Hits] = 3 * 4,
+    [WavefrontQueue_Shadows] = 3 * 16 + 4,
+};
+
+#define COUNTERS_N (WavefrontQueue_N * 4 + WavefrontStat_N)
+#define MORTON_KEY_BITS (3 + 3 * 7) // octant over 7 bits per axis, see wavefront_sort_rays.comp
+#define STAMPS_PER_BOUNCE 4 // after the ray sort, extension, hit sort and shading
+#define STAMPS_N (1 + STAMPS_PER_BOUNCE * WAVEFRONT_TIMED_BOUNCES) // per frame slot
+
+static const char *stage_name(enum WavefrontStage stage, int ray_query) {
+    switch (stage) {
+    case WavefrontStage_Generate: return "wavefront_generate.comp.spv";
+    case WavefrontStage_Extend: return ray_query ? "wavefront_extend_rq.comp.spv" : "wavefront_extend.comp.spv";
+    case WavefrontStage_Shade: return "wavefront_shade.comp.spv";
+    case WavefrontStage_Connect: return ray_query ? "wavefront_connect_rq.comp.spv" : "wavefront_connect.comp.spv";
+    case WavefrontStage_Accumulate: return "wavefront_accumulate.comp.spv";
+    case WavefrontStage_SortRays: return "wavefront_sort_rays.comp.spv";
+    case WavefrontStage_SortHits: return "wavefront_sort_hits.comp.spv";
+    default: return NULL;
+    }
+}
+
+static int stage_used(enum WavefrontStage stage, enum WavefrontSort sort) {
+    if (stage == WavefrontStage_SortRays) return sort == WavefrontSort_Morton;
+    if (stage == WavefrontStage_SortHits) return sort == WavefrontSort_Material;
+    return 1;
+}
+
+static void wavefront_barrier(
+        VkCommandBuffer command_buffer,
+        VkPipelineStageFlags src_stage,
+        VkAccessFlags src_access,
+        VkPipelineStageFlags dst_stage,
+        VkAccessFlags dst_access) {
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = src_access,
+        .dstAccessMask = dst_access,
+    };
+    vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+int wavefront_precompile(struct PipelineBatch *pipelines, int ray_query, enum WavefrontSort sort) {
+#if DEBUG_INPUT_VALIDATION
+    if (pipelines == NULL) return 1;
+#endif
+
+    for (uint32_t i = 0; i < WavefrontStage_N; i++)
+        if (stage_used(i, sort) && pipeline_batch_push(pipelines, stage_name(i, ray_query)) > 0) return 2;
+    if (sort != WavefrontSort_None && radix_sort_precompile(pipelines) > 0) return 2;
+
+    return 0;
+}
+
+int wavefront_init(
+        struct Wavefront *wavefront,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        VkQueue queue,
+        uint32_t queue_family,
+        const char *path,
+        struct PipelineBatch *pipelines,
+        struct Bindless *bindless,
+        const struct Scene *scene,
+        const struct LightTree *lights,
+        const struct Tracer *tracer,
+        enum WavefrontSort sort) {
+#if DEBUG_INPUT_VALIDATION
+    if (wavefront == NULL) return 1;
+    if (!IS_ZERO_PTR(wavefront)) return 1;
+    if (device == VK_NULL_HANDLE) return 1;
+    if (physical_device == VK_NULL_HANDLE) return 1;
+    if (queue == VK_NULL_HANDLE) return 1;
+    if (path == NULL) return 1;
+    if (bindless == NULL) return 1;
+    if (scene == NULL || lights == NULL) return 1;
+    if (tracer == NULL || tracer->device == VK_NULL_HANDLE) return 1;
+#endif
+
+    int result = 0;
+
+    wavefront->device = device;
+    wavefront->bindless = bindless;
+    wavefront->extent = tracer->extent;
+    wavefront->capacity = tracer->extent.width * tracer->extent.height;
+    wavefront->radiance_slot = BINDLESS_INVALID;
+    wavefront->counters_slot = BINDLESS_INVALID;
+    wavefront->lights_slot = BINDLESS_INVALID;
+    for (uint32_t i = 0; i < WavefrontQueue_N; i++)
+        wavefront->queue_slots[i] = BINDLESS_INVALID;
+
+    // Pipelines.
+    result = create_pipeline_layout(device, NULL, bindless->layout, &wavefront->pipeline_layout);
+    if (result > 0) return 2;
+    for (uint32_t i = 0; i < WavefrontStage_N; i++) {
+        if (!stage_used(i, sort)) continue;
+        result = take_compute_pipeline(
+                pipelines,
+                device,
+                path,
+                stage_name(i, tracer->ray_query),
+                wavefront->pipeline_layout,
+                wavefront->pipelines + i);
+        if (result > 0) return 3;
+    }
+
+    // Queues, one storage buffer each holding every field array.
+    for (uint32_t i = 0; i < WavefrontQueue_N; i++) {
+        VkDeviceSize size = queue_entry_sizes[i] * wavefront->capacity;
+        result = create_buffer(
+                device,
+                physical_device,
+                size,
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                GpuMemoryCategory_Frame,
+                wavefront->queues + i,
+                wavefront->queue_memories + i);
+        if (result > 0) return 4;
+        wavefront->queue_slots[i] = bindless_add_storage_buffer(bindless, device, wavefront->queues[i], 0, size);
+        if (wavefront->queue_slots[i] == BINDLESS_INVALID) return 5;
+    }
+    VkDeviceSize radiance_size = 4 * sizeof(float) * wavefront->capacity;
+    result = create_buffer(
+            device,
+            physical_device,
+            radiance_size,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            GpuMemoryCategory_Frame,
+            &wavefront->radiance,
+            &wavefront->radiance_memory);
+    if (result > 0) return 4;
+    wavefront->radiance_slot = bindless_add_storage_buffer(bindless, device, wavefront->radiance, 0, radiance_size);
+    if (wavefront->radiance_slot == BINDLESS_INVALID) return 5;
+
+    // Queue counters, also the indirect dispatch arguments.
+    VkDeviceSize counters_size = COUNTERS_N * sizeof(uint32_t);
+    result = create_buffer(
+            device,
+            physical_device,
+            counters_size,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+                | VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+                | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            GpuMemoryCategory_Frame,
+            &wavefront->counters,
+            &wavefront->counters_memory);
+    if (result > 0) return 4;
+    wavefront->counters_slot = bindless_add_storage_buffer(bindless, device, wavefront->counters, 0, counters_size);
+    if (wavefront->counters_slot == BINDLESS_INVALID) return 5;
+
+    // Light tree over the emissive triangles. Never empty, so the buffer
+    // exists without lights.
+    const struct LightNode empty_node = { 0 };
+    wavefront->lights_n = lights->lights_n;
+    result = create_buffer_with_data(
+            device,
+            physical_device,
+            queue,
+            queue_family,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            lights->nodes_n > 0 ? (const void *)lights->nodes : &empty_node,
+            (lights->nodes_n > 0 ? lights->nodes_n : 1) * sizeof(struct LightNode),
+            GpuMemoryCategory_Geometry,
+            &wavefront->lights,
+            &wavefront->lights_memory);
+    if (result > 0) return 4;
+    wavefront->lights_slot = bindless_add_storage_buffer(bindless, device, wavefront->lights, 0, VK_WHOLE_SIZE);
+    if (wavefront->lights_slot == BINDLESS_INVALID) return 5;
+
+    // Sort keys and permutations. Material ids take as many bits as the
+    // largest one needs.
+    wavefront->sort = sort;
+    wavefront->sorting = sort != WavefrontSort_None;
+    if (sort != WavefrontSort_None) {
+        result = radix_sort_init(
+                &wavefront->radix,
+                device,
+                physical_device,
+                path,
+                pipelines,
+                bindless,
+                wavefront->capacity);
+        if (result > 0) return 7;
+        wavefront->key_bits = MORTON_KEY_BITS;
+        if (sort == WavefrontSort_Material) {
+            wavefront->key_bits = 1;
+            while (wavefront->key_bits < 32 && (scene->materials_n - 1) >> wavefront->key_bits) wavefront->key_bits++;
+        }
+    }
+
+    // Stage timestamps, optional per queue family.
+    uint32_t families_n = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &families_n, NULL);
+    VkQueueFamilyProperties *families = calloc(families_n, sizeof(*families));
+    if (families == NULL) return 8;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &families_n, families);
+    uint32_t valid_bits = queue_family < families_n ? families[queue_family].timestampValidBits : 0;
+    free(families);
+    wavefront->timed_bounces_n = tracer->settings.bounces < WAVEFRONT_TIMED_BOUNCES
+        ? tracer->settings.bounces
+        : WAVEFRONT_TIMED_BOUNCES;
+    if (valid_bits > 0) {
+        wavefront->valid_mask = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physical_device, &properties);
+        wavefront->timestamp_period = properties.limits.timestampPeriod;
+        VkQueryPoolCreateInfo query_pool_cinfo = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = TRACE_OUTPUTS * STAMPS_N,
+        };
+        if (vkCreateQueryPool(device, &query_pool_cinfo, NULL, &wavefront->query_pool) != VK_SUCCESS) return 8;
+    }
+
+    // Ray counts for the host.
+    VkDeviceSize status_size = TRACE_OUTPUTS * WavefrontStat_N * sizeof(uint32_t);
+    result = create_buffer(
+            device,
+            physical_device,
+            status_size,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            GpuMemoryCategory_Staging,
+            &wavefront->status,
+            &wavefront->status_memory);
+    if (result > 0) return 6;
+    void *mapped = NULL;
+    if (vkMapMemory(device, wavefront->status_memory, 0, status_size, 0, &mapped) != VK_SUCCESS) return 6;
+    wavefront->status_mapped = mapped;
+
+    return 0;
+}
+
+void wavefront_free(struct Wavefront *wavefront) {
+    VkDevice device = wavefront->device;
+
+    // Only called once the device is idle, slots can go back immediately.
+    if (wavefront->bindless != NULL) {
+        for (uint32_t i = 0; i < WavefrontQueue_N; i++)
+            bindless_release(wavefront->bindless, BindlessKind_StorageBuffer, wavefront->queue_slots[i], 0);
+        bindless_release(wavefront->bindless, BindlessKind_StorageBuffer, wavefront->radiance_slot, 0);
+        bindless_release(wavefront->bindless, BindlessKind_StorageBuffer, wavefront->counters_slot, 0);
+        bindless_release(wavefront->bindless, BindlessKind_StorageBuffer, wavefront->lights_slot, 0);
+    }
+    for (uint32_t i = 0; i < WavefrontQueue_N; i++) {
+        vkDestroyBuffer(device, wavefront->queues[i], NULL);
+        gpu_memory_free(device, wavefront->queue_memories[i]);
+    }
+    vkDestroyBuffer(device, wavefront->radiance, NULL);
+    gpu_memory_free(device, wavefront->radiance_memory);
+    vkDestroyBuffer(device, wavefront->counters, NULL);
+    gpu_memory_free(device, wavefront->counters_memory);
+    vkDestroyBuffer(device, wavefront->lights, NULL);
+    gpu_memory_free(device, wavefront->lights_memory);
+    vkDestroyBuffer(device, wavefront->status, NULL);
+    gpu_memory_free(device, wavefront->status_memory); // Unmaps.
+
+    radix_sort_free(&wavefront->radix); // Zeroes itself.
+    vkDestroyQueryPool(device, wavefront->query_pool, NULL);
+    for (uint32_t i = 0; i < WavefrontStage_N; i++)
+        vkDestroyPipeline(device, wavefront->pipelines[i], NULL);
+    vkDestroyPipelineLayout(device, wavefront->pipeline_layout, NULL);
+
+    memset(wavefront, 0, sizeof(*wavefront));
+}
+
+// Stage times of the output's previous frame, by bounce depth. Unsorted
+// frames are only kept while sorting is off, so each report period
+// measures one of both.
+static void wavefront_collect_timings(struct Wavefront *wavefront, uint32_t output) {
+    if (!wavefront->timed_pending[output]) return;
+    wavefront->timed_pending[output] = 0;
+    if (wavefront->timed_sorting[output] != wavefront->sorting) return;
+
+    uint32_t stamps_n = 1 + STAMPS_PER_BOUNCE * wavefront->timed_bounces_n;
+    uint64_t ticks[STAMPS_N];
+    VkResult result = vkGetQueryPoolResults(
+            wavefront->device,
+            wavefront->query_pool,
+            output * STAMPS_N,
+            stamps_n,
+            sizeof(ticks),
+            ticks,
+            sizeof(*ticks),
+            VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS) return;
+
+    for (uint32_t bounce = 0; bounce < wavefront->timed_bounces_n; bounce++) {
+        double ms[STAMPS_PER_BOUNCE];
+        for (uint32_t i = 0; i < STAMPS_PER_BOUNCE; i++) {
+            uint32_t stamp = 1 + bounce * STAMPS_PER_BOUNCE + i;
+            uint64_t delta = (ticks[stamp] - ticks[stamp - 1]) & wavefront->valid_mask;
+            ms[i] = delta * wavefront->timestamp_period * 1e-6;
+        }
+        wavefront->timing_sums[WavefrontTiming_Sort][bounce] += ms[0] + ms[2];
+        wavefront->timing_sums[WavefrontTiming_Extend][bounce] += ms[1];
+        wavefront->timing_sums[WavefrontTiming_Shade][bounce] += ms[3];
+    }
+    wavefront->timing_samples_n += 1;
+}
+
+// Recording into this output again means its previous frame completed.
+static void wavefront_collect_status(struct Wavefront *wavefront, uint32_t output) {
+    if (!wavefront->status_pending[output]) return;
+    wavefront->status_pending[output] = 0;
+
+    const uint32_t *stats = wavefront->status_mapped + output * WavefrontStat_N;
+    wavefront->frames_n += 1;
+    wavefront->rays_n += stats[WavefrontStat_Rays];
+    wavefront->shadow_rays_n += stats[WavefrontStat_ShadowRays];
+}
+
+static void wavefront_dispatch(
+        struct Wavefront *wavefront,
+        VkCommandBuffer command_buffer,
+        enum WavefrontStage stage,
+        const struct WavefrontPush *push,
+        int indirect_queue) {
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, wavefront->pipelines[stage]);
+    vkCmdPushConstants(
+            command_buffer,
+            wavefront->pipeline_layout,
+            VK_SHADER_STAGE_ALL,
+            0,
+            sizeof(*push),
+            push);
+    if (indirect_queue >= 0)
+        vkCmdDispatchIndirect(command_buffer, wavefront->counters, indirect_queue * 4 * sizeof(uint32_t));
+    else
+        vkCmdDispatch(command_buffer, (push->width * push->height + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE, 1, 1);
+
+    // Each stage consumes what the previous appended, and the next dispatch
+    // size.
+    wavefront_barrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+// Empties queues, after the stages reading them.
+static void wavefront_reset_queues(
+        struct Wavefront *wavefront,
+        VkCommandBuffer command_buffer,
+        const uint32_t *counters,
+        uint32_t first,
+        uint32_t n) {
+    wavefront_barrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_TRANSFER_WRITE_BIT);
+    vkCmdUpdateBuffer(
+            command_buffer,
+            wavefront->counters,
+            first * 4 * sizeof(uint32_t),
+            n * 4 * sizeof(uint32_t),
+            counters + first * 4);
+    wavefront_barrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+// Writes the keys of queue's entries into the radix sort's pairs and sorts
+// them, leaving the permutation in pairs[0].
+static void wavefront_sort(
+        struct Wavefront *wavefront,
+        VkCommandBuffer command_buffer,
+        enum WavefrontStage keys_stage,
+        struct WavefrontPush *push,
+        uint32_t queue) {
+    push->order = wavefront->radix.pair_slots[0];
+    wavefront_dispatch(wavefront, command_buffer, keys_stage, push, queue);
+    radix_sort_record(
+            &wavefront->radix,
+            command_buffer,
+            wavefront->counters,
+            queue * 4 * sizeof(uint32_t),
+            wavefront->counters_slot,
+            queue * 4 + 3,
+            wavefront->key_bits);
+    vkCmdBindDescriptorSets(
+            command_buffer,
+            VK_PIPELINE_BIND_POINT_COMPUTE,
+            wavefront->pipeline_layout,
+            0,
+            1,
+            &wavefront->bindless->set,
+            0,
+            NULL);
+}
+
+void wavefront_record(
+        struct Wavefront *wavefront,
+        VkCommandBuffer command_buffer,
+        struct Tracer *tracer,
+        uint32_t output) {
+#if DEBUG_INPUT_VALIDATION
+    if (wavefront == NULL) return;
+    if (command_buffer == VK_NULL_HANDLE) return;
+    if (tracer == NULL) return;
+    if (output >= TRACE_OUTPUTS) return;
+#endif
+
+    wavefront_collect_status(wavefront, output);
+    wavefront_collect_timings(wavefront, output);
+    int timed = wavefront->query_pool != VK_NULL_HANDLE;
+    if (timed)
+        vkCmdResetQueryPool(command_buffer, wavefront->query_pool, output * STAMPS_N, STAMPS_N);
+
+    // The previous dispatch's accumulation writes, on this same queue, must
+    // land first. Restarting throws the old contents away.
+    VkImageMemoryBarrier accum_barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        .oldLayout = tracer->samples_n == 0 ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_GENERAL,
+        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = tracer->accum_image,
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+    };
+    vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            0,
+            NULL,
+            0,
+            NULL,
+            1,
+            &accum_barrier);
+
+    // Every sample starts with one camera ray per rendered pixel in the
+    // first ray queue and the others empty. Empty dispatches are 0 x 1 x 1
+    // groups.
+    uint32_t paths_n = tracer->render_extent.width * tracer->render_extent.height;
+    uint32_t counters[COUNTERS_N] = { 0 };
+    for (uint32_t i = 0; i < WavefrontQueue_N; i++) {
+        counters[i * 4 + 1] = 1;
+        counters[i * 4 + 2] = 1;
+    }
+    counters[WavefrontQueue_Rays0 * 4 + 0] = (paths_n + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE;
+    counters[WavefrontQueue_Rays0 * 4 + 3] = paths_n;
+
+    //
+    struct WavefrontPush push = {
+        .counters = wavefront->counters_slot,
+        .radiance = wavefront->radiance_slot,
+        .lights = wavefront->lights_slot,
+        .lights_n = wavefront->lights_n,
+        .capacity = wavefront->capacity,
+        .bounces = tracer->settings.bounces,
+        .accum = tracer->accum_slot,
+        .target = tracer->outputs[output].storage_slot,
+        .width = tracer->render_extent.width,
+        .height = tracer->render_extent.height,
+        .camera_position = {
+            tracer->camera.position[0],
+            tracer->camera.position[1],
+            tracer->camera.position[2],
+            tracer->camera.fov,
+        },
+        .camera_target = {
+            tracer->camera.target[0],
+            tracer->camera.target[1],
+            tracer->camera.target[2],
+        },
+        .environment = tracer->environment_slot,
+    };
+    memcpy(push.buffers, tracer->buffer_slots, sizeof(push.buffers));
+    memcpy(push.queues, wavefront->queue_slots, sizeof(push.queues));
+    vkCmdBindDescriptorSets(
+            command_buffer,
+            VK_PIPELINE_BIND_POINT_COMPUTE,
+            wavefront->pipeline_layout,
+            0,
+            1,
+            &wavefront->bindless->set,
+            0,
+            NULL);
+
+    // The previous frame's stages and ray count copy are done with the
+    // counters once the first reset waits for them.
+    wavefront_reset_queues(wavefront, command_buffer, counters, 0, WavefrontQueue_N);
+    vkCmdFillBuffer(
+            command_buffer,
+            wavefront->counters,
+            WavefrontQueue_N * 4 * sizeof(uint32_t),
+            WavefrontStat_N * sizeof(uint32_t),
+            0);
+    wavefront_barrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    // Stage timestamps of the first sample.
+    uint32_t stamp = output * STAMPS_N;
+    for (uint32_t s = 0; s < tracer->settings.samples_per_dispatch; s++) {
+        if (s > 0) wavefront_reset_queues(wavefront, command_buffer, counters, 0, WavefrontQueue_N);
+        push.samples_n = tracer->samples_n;
+        push.order = BINDLESS_INVALID;
+        wavefront_dispatch(wavefront, command_buffer, WavefrontStage_Generate, &push, -1);
+        int stamping = timed && s == 0;
+        if (stamping)
+            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, wavefront->query_pool, stamp++);
+
+        for (uint32_t bounce = 0; bounce < tracer->settings.bounces; bounce++) {
+            uint32_t rays_in = bounce % 2 == 0 ? WavefrontQueue_Rays0 : WavefrontQueue_Rays1;
+            uint32_t rays_out = rays_in == WavefrontQueue_Rays0 ? WavefrontQueue_Rays1 : WavefrontQueue_Rays0;
+            if (bounce > 0) {
+                wavefront_reset_queues(wavefront, command_buffer, counters, rays_out, 1);
+                wavefront_reset_queues(wavefront, command_buffer, counters, WavefrontQueue_Hits, 2);
+            }
+            push.rays_in = rays_in;
+            push.bounce = bounce;
+            int stamping_bounce = stamping && bounce < wavefront->timed_bounces_n;
+
+            // Camera rays leave generation in pixel order, already coherent.
+            push.order = BINDLESS_INVALID;
+            if (wavefront->sorting && wavefront->sort == WavefrontSort_Morton && bounce > 0) {
+                wavefront_sort(wavefront, command_buffer, WavefrontStage_SortRays, &push, rays_in);
+                push.order = wavefront->radix.pair_slots[0];
+            }
+            if (stamping_bounce)
+                vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, wavefront->query_pool, stamp++);
+            wavefront_dispatch(wavefront, command_buffer, WavefrontStage_Extend, &push, rays_in);
+            if (stamping_bounce)
+                vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, wavefront->query_pool, stamp++);
+
+            push.order = BINDLESS_INVALID;
+            if (wavefront->sorting && wavefront->sort == WavefrontSort_Material) {
+                wavefront_sort(wavefront, command_buffer, WavefrontStage_SortHits, &push, WavefrontQueue_Hits);
+                push.order = wavefront->radix.pair_slots[0];
+            }
+            if (stamping_bounce)
+                vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, wavefront->query_pool, stamp++);
+            wavefront_dispatch(wavefront, command_buffer, WavefrontStage_Shade, &push, WavefrontQueue_Hits);
+            push.order = BINDLESS_INVALID;
+            wavefront_dispatch(wavefront, command_buffer, WavefrontStage_Connect, &push, WavefrontQueue_Shadows);
+            if (stamping_bounce)
+                vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, wavefront->query_pool, stamp++);
+        }
+
+        wavefront_dispatch(wavefront, command_buffer, WavefrontStage_Accumulate, &push, -1);
+        tracer->samples_n += 1;
+    }
+    if (timed) {
+        wavefront->timed_pending[output] = 1;
+        wavefront->timed_sorting[output] = wavefront->sorting;
+    }
+
+    // Ray counts for the host.
+    wavefront_barrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_TRANSFER_READ_BIT);
+    VkBufferCopy region = {
+        .srcOffset = WavefrontQueue_N * 4 * sizeof(uint32_t),
+        .dstOffset = output * WavefrontStat_N * sizeof(uint32_t),
+        .size = WavefrontStat_N * sizeof(uint32_t),
+    };
+    vkCmdCopyBuffer(command_buffer, wavefront->counters, wavefront->status, 1, &region);
+    wavefront_barrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_HOST_BIT,
+            VK_ACCESS_HOST_READ_BIT);
+    wavefront->status_pending[output] = 1;
+}
+
+void wavefront_report(struct Wavefront *wavefront, double trace_ms) {
+    if (wavefront->device == VK_NULL_HANDLE || wavefront->frames_n == 0) return;
+
+    double rays = (double)wavefront->rays_n / wavefront->frames_n;
+    double shadow_rays = (double)wavefront->shadow_rays_n / wavefront->frames_n;
+    printf("[wavefront] %.2f M extension and %.2f M shadow rays per frame, %u lights",
+            rays * 1e-6,
+            shadow_rays * 1e-6,
+            wavefront->lights_n);
+    if (trace_ms > 0.0)
+        printf(", %.1f Mrays/s", (rays + shadow_rays) / trace_ms * 1e-3);
+    printf("\n");
+    if (wavefront->sort == WavefrontSort_None || wavefront->timing_samples_n == 0) return;
+
+    // Averages of the period that just ended, then measure the other way.
+    double (*ms)[WAVEFRONT_TIMED_BOUNCES] = wavefront->timing_ms[wavefront->sorting];
+    for (uint32_t i = 0; i < WavefrontTiming_N; i++) {
+        for (uint32_t bounce = 0; bounce < wavefront->timed_bounces_n; bounce++)
+            ms[i][bounce] = wavefront->timing_sums[i][bounce] / wavefront->timing_samples_n;
+    }
+    memset(wavefront->timing_sums, 0, sizeof(wavefront->timing_sums));
+    wavefront->timing_samples_n = 0;
+    wavefront->sorting = !wavefront->sorting;
+
+    double (*off)[WAVEFRONT_TIMED_BOUNCES] = wavefront->timing_ms[0];
+    double (*on)[WAVEFRONT_TIMED_BOUNCES] = wavefront->timing_ms[1];
+    if (off[WavefrontTiming_Extend][0] <= 0.0 || on[WavefrontTiming_Extend][0] <= 0.0) return;
+    static const char *sort_names[] = { "no", "morton", "material" };
+    printf("[wavefront] %s sort per bounce, unsorted -> sorted:\n", sort_names[wavefront->sort]);
+    for (uint32_t bounce = 0; bounce < wavefront->timed_bounces_n; bounce++) {
+        double unsorted = off[WavefrontTiming_Extend][bounce] + off[WavefrontTiming_Shade][bounce];
+        double sorted = on[WavefrontTiming_Sort][bounce]
+            + on[WavefrontTiming_Extend][bounce]
+            + on[WavefrontTiming_Shade][bounce];
+        printf("  depth %u: sort %.3f ms, extend %.3f -> %.3f ms (%.2fx), shade %.3f -> %.3f ms (%.2fx), net %.2fx\n",
+                bounce,
+                on[WavefrontTiming_Sort][bounce],
+                off[WavefrontTiming_Extend][bounce],
+                on[WavefrontTiming_Extend][bounce],
+                off[WavefrontTiming_Extend][bounce] / on[WavefrontTiming_Extend][bounce],
+                off[WavefrontTiming_Shade][bounce],
+                on[WavefrontTiming_Shade][bounce],
+                off[WavefrontTiming_Shade][bounce] / on[WavefrontTiming_Shade][bounce],
+                sorted > 0.0 ? unsorted / sorted : 0.0);
+    }
+}
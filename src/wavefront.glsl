@@ -0,0 +1,87 @@
+// Shared by the wavefront stages, see struct Wavefront. Include after
+// scene.glsl.
+
+#define GROUP_SIZE 64 // must match WAVEFRONT_GROUP_SIZE
+
+layout(local_size_x = GROUP_SIZE) in;
+
+// Must match enum WavefrontQueue. Each queue's counters are its indirect
+// dispatch x, y, z and its length.
+#define QUEUE_HITS 2
+#define QUEUE_SHADOWS 3
+#define QUEUES_N 4
+#define STAT_RAYS (QUEUES_N * 4 + 0) // extension rays this frame
+#define STAT_SHADOW_RAYS (QUEUES_N * 4 + 1)
+
+// Must match struct WavefrontPush in wavefront.c.
+layout(push_constant) uniform Push {
+    uint buffers[BUFFERS_N];
+    uint queues[QUEUES_N];
+    uint counters;
+    uint radiance; // per pixel, this sample
+    uint lights; // light tree nodes
+    uint lights_n;
+    uint capacity; // entries per queue, one per pixel
+    uint rays_in; // queue the extension stage reads, the other is shaded into
+    uint bounce;
+    uint bounces;
+    uint accum;
+    uint target;
+    uint samples_n;
+    uint width;
+    uint height;
+    uint order; // keys then permutation of the stage's queue, BINDLESS_INVALID for queue order
+    vec4 camera_position; // w is the vertical fov
+    vec3 camera_target;
+    uint environment; // BINDLESS_INVALID for the sky
+} pc;
+
+// Queues are structures of arrays, one array of capacity entries per field:
+//     rays     vec4 origin, direction, throughput and the direction's BSDF pdf,
+//              then uint pixel, rng state
+//     hits     uint ray, triangle, distance bits
+//     shadows  vec4 origin, direction and distance, contribution, then uint pixel
+BINDLESS_BUFFER(Vec4s, vec4);
+BINDLESS_BUFFER(Words, uint);
+
+#define VEC4_FIELD(queue, field, i) Vec4s[pc.queues[queue]].data[(field) * pc.capacity + (i)]
+#define UINT_FIELD(queue, field, i) Words[pc.queues[queue]].data[(field) * pc.capacity + (i)]
+#define RAY_ORIGIN 0
+#define RAY_DIRECTION 1
+#define RAY_THROUGHPUT 2
+#define RAY_PIXEL 12 // after three vec4 arrays
+#define RAY_STATE 13
+#define HIT_RAY 0
+#define HIT_TRIANGLE 1
+#define HIT_DISTANCE 2
+#define SHADOW_ORIGIN 0
+#define SHADOW_DIRECTION 1
+#define SHADOW_CONTRIBUTION 2
+#define SHADOW_PIXEL 12
+
+// Chance a shaded vertex's shadow ray goes to the environment, which shares
+// the connections with the lights when there are any.
+#define ENVIRONMENT_FRACTION (pc.lights_n > 0 ? 0.5 : 1.0)
+
+// Entry a thread of a queue dispatch works on.
+uint queue_entry(uint i) {
+    return pc.order == BINDLESS_INVALID ? i : Words[pc.order].data[pc.capacity + i];
+}
+
+uint queue_length(uint queue) {
+    return Words[pc.counters].data[queue * 4 + 3];
+}
+
+// Reserves an entry, growing the queue's indirect dispatch by a group every
+// GROUP_SIZE entries.
+uint queue_append(uint queue) {
+    uint index = atomicAdd(Words[pc.counters].data[queue * 4 + 3], 1u);
+    if (index % uint(GROUP_SIZE) == 0) atomicAdd(Words[pc.counters].data[queue * 4], 1u);
+    return index;
+}
+
+// Counts the group's live entries of a queue dispatch into a frame stat.
+void count_group(uint stat, uint queued) {
+    if (gl_LocalInvocationIndex == 0)
+        atomicAdd(Words[pc.counters].data[stat], min(uint(GROUP_SIZE), queued - gl_WorkGroupID.x * GROUP_SIZE));
+}
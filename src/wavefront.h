@@ -0,0 +1,155 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include "bindless.h"
+#include "pipeline.h"
+#include "light_tree.h"
+#include "radix_sort.h"
+#include "scene.h"
+#include "trace.h"
+
+#define WAVEFRONT_GROUP_SIZE 64 // threads per queue dispatch, must match wavefront.glsl
+#define WAVEFRONT_TIMED_BOUNCES 8 // bounce depths with GPU stage times
+
+// How the tracer runs its paths.
+enum PathMode {
+    PathMode_Megakernel = 0, // one dispatch traces whole paths, see trace.comp
+    PathMode_Wavefront, // one dispatch per stage and bounce, see struct Wavefront
+    PathMode_Compare, // alternates between both
+};
+
+// Ray, hit and shadow ray queues, must match wavefront.glsl.
+enum WavefrontQueue {
+    WavefrontQueue_Rays0 = 0, // extended this bounce or shaded into, swapping every bounce
+    WavefrontQueue_Rays1,
+    WavefrontQueue_Hits,
+    WavefrontQueue_Shadows,
+    WavefrontQueue_N,
+};
+
+// How queues are reordered between stages, for coherent traversal or
+// shading.
+enum WavefrontSort {
+    WavefrontSort_None = 0,
+    WavefrontSort_Morton, // rays by direction octant, then Morton code of the origin
+    WavefrontSort_Material, // hits by material id
+};
+
+enum WavefrontStage {
+    WavefrontStage_Generate = 0, // camera rays
+    WavefrontStage_Extend, // closest hits, sky on misses
+    WavefrontStage_Shade, // materials, shadow rays and continuation rays
+    WavefrontStage_Connect, // shadow rays
+    WavefrontStage_Accumulate,
+    WavefrontStage_SortRays, // sort keys of the ray queue, only with a sort
+    WavefrontStage_SortHits,
+    WavefrontStage_N,
+};
+
+// GPU time per bounce depth, from timestamps around the stages of each
+// frame's first sample.
+enum WavefrontTiming {
+    WavefrontTiming_Sort = 0, // keys and radix sort
+    WavefrontTiming_Extend,
+    WavefrontTiming_Shade, // with the shadow rays
+    WavefrontTiming_N,
+};
+
+// Counters buffer: per queue the indirect dispatch x, y, z and the length,
+// then the frame's ray counts.
+enum WavefrontStat {
+    WavefrontStat_Rays = 0,
+    WavefrontStat_ShadowRays,
+    WavefrontStat_N,
+};
+
+// Wavefront path tracer over the tracer's scene, accumulation and outputs.
+// Each stage is its own small kernel over a queue in storage buffers, so
+// threads of a dispatch run the same code whatever their paths do. Stages
+// append to the next queue with atomics, and each queue's length sizes the
+// indirect dispatch of the stage consuming it. Direct light comes from shadow
+// rays towards the scene's emissive triangles, picked through the light tree.
+//
+// With a sort, each bounce reorders the ray queue before extension or the
+// hit queue before shading through a permutation from a GPU radix sort. Runs
+// alternate between sorted and unsorted every report to measure both.
+struct Wavefront {
+    VkDevice device;
+    struct Bindless *bindless;
+    VkExtent2D extent; // the tracer's allocated extent, paths cover its render_extent
+    uint32_t capacity; // entries per queue, one path per pixel
+    VkPipelineLayout pipeline_layout;
+    VkPipeline pipelines[WavefrontStage_N];
+    //
+    VkBuffer queues[WavefrontQueue_N];
+    VkDeviceMemory queue_memories[WavefrontQueue_N];
+    uint32_t queue_slots[WavefrontQueue_N];
+    VkBuffer radiance; // per pixel, the sample in flight
+    VkDeviceMemory radiance_memory;
+    uint32_t radiance_slot;
+    VkBuffer counters;
+    VkDeviceMemory counters_memory;
+    uint32_t counters_slot;
+    VkBuffer lights; // light tree nodes
+    VkDeviceMemory lights_memory;
+    uint32_t lights_slot;
+    uint32_t lights_n;
+    // Reordering.
+    enum WavefrontSort sort;
+    int sorting; // this frame reorders, flips every report
+    struct RadixSort radix; // its pairs[0] holds keys, then the permutation
+    uint32_t key_bits;
+    // Stage timestamps per frame slot.
+    VkQueryPool query_pool; // VK_NULL_HANDLE when the queue has no timestamps
+    double timestamp_period; // nanoseconds per tick
+    uint64_t valid_mask;
+    uint32_t timed_bounces_n;
+    int timed_pending[TRACE_OUTPUTS];
+    int timed_sorting[TRACE_OUTPUTS];
+    double timing_sums[WavefrontTiming_N][WAVEFRONT_TIMED_BOUNCES]; // since the last report
+    uint64_t timing_samples_n;
+    double timing_ms[2][WavefrontTiming_N][WAVEFRONT_TIMED_BOUNCES]; // averages, unsorted and sorted
+    // Ray counts read back per frame slot, host visible.
+    VkBuffer status;
+    VkDeviceMemory status_memory;
+    const uint32_t *status_mapped;
+    int status_pending[TRACE_OUTPUTS];
+    // Stats.
+    uint64_t frames_n; // read back
+    uint64_t rays_n;
+    uint64_t shadow_rays_n;
+};
+
+// Queues the stage pipelines onto pipelines.
+int wavefront_precompile(struct PipelineBatch *pipelines, int ray_query, enum WavefrontSort sort);
+
+// Uploads lights, the tree over the scene's emissive triangles, through
+// queue. Traces with tracer's scene buffers and traversal, which has to
+// outlive the wavefront.
+int wavefront_init(
+        struct Wavefront *wavefront,
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        VkQueue queue,
+        uint32_t queue_family,
+        const char *path,
+        struct PipelineBatch *pipelines,
+        struct Bindless *bindless,
+        const struct Scene *scene,
+        const struct LightTree *lights,
+        const struct Tracer *tracer,
+        enum WavefrontSort sort);
+void wavefront_free(struct Wavefront *wavefront);
+
+// Drop-in for tracer_record without guides or tiles: records
+// settings.samples_per_dispatch samples into the tracer's accumulation and
+// resolves them into tracer->outputs[output].
+void wavefront_record(
+        struct Wavefront *wavefront,
+        VkCommandBuffer command_buffer,
+        struct Tracer *tracer,
+        uint32_t output);
+// Rays per frame and per second, given the measured trace time per frame.
+// With a sort, also the sort's cost and the stage speedups per bounce
+// depth, then switches sorting for the next report.
+void wavefront_report(struct Wavefront *wavefront, double trace_ms);
@@ -0,0 +1,141 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "util.h"
+#include "worker.h"
+
+static void *worker_main(void *arg) {
+    struct Workers *workers = arg;
+
+    pthread_mutex_lock(&workers->lock);
+    while (1) {
+        while (workers->jobs_n == 0 && !workers->quit)
+            pthread_cond_wait(&workers->wake, &workers->lock);
+        if (workers->jobs_n == 0 && workers->quit) break;
+
+        // Pop front.
+        struct WorkerJob job = workers->jobs[workers->jobs_head];
+        workers->jobs_head = (workers->jobs_head + 1) % workers->jobs_cap;
+        workers->jobs_n -= 1;
+        workers->busy_n += 1;
+
+        pthread_mutex_unlock(&workers->lock);
+        job.fn(job.arg);
+        pthread_mutex_lock(&workers->lock);
+
+        workers->busy_n -= 1;
+        if (workers->jobs_n == 0 && workers->busy_n == 0)
+            pthread_cond_broadcast(&workers->idle);
+    }
+    pthread_mutex_unlock(&workers->lock);
+
+    return NULL;
+}
+
+int workers_init(struct Workers *workers, uint32_t threads_n) {
+#if DEBUG_INPUT_VALIDATION
+    if (workers == NULL) return 1;
+    if (!IS_ZERO_PTR(workers)) return 1;
+#endif
+
+    if (threads_n == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads_n = cpus > 1 ? cpus - 1 : 1;
+    }
+
+    pthread_mutex_init(&workers->lock, NULL);
+    pthread_cond_init(&workers->wake, NULL);
+    pthread_cond_init(&workers->idle, NULL);
+
+    workers->jobs_cap = 64;
+    workers->jobs = calloc(workers->jobs_cap, sizeof(struct WorkerJob));
+
+    workers->threads = calloc(threads_n, sizeof(pthread_t));
+    for (; workers->threads_n < threads_n; workers->threads_n++) {
+        int result = pthread_create(workers->threads + workers->threads_n, NULL, worker_main, workers);
+        if (result != 0) return 2;
+    }
+
+    return 0;
+}
+
+void workers_free(struct Workers *workers) {
+    // Let queued jobs finish, then join.
+    pthread_mutex_lock(&workers->lock);
+    workers->quit = 1;
+    pthread_cond_broadcast(&workers->wake);
+    pthread_mutex_unlock(&workers->lock);
+    for (uint32_t i = 0; i < workers->threads_n; i++)
+        pthread_join(workers->threads[i], NULL);
+
+    pthread_cond_destroy(&workers->idle);
+    pthread_cond_destroy(&workers->wake);
+    pthread_mutex_destroy(&workers->lock);
+    free(workers->threads);
+    free(workers->jobs);
+
+    memset(workers, 0, sizeof(*workers));
+}
+
+void workers_push(struct Workers *workers, WorkerFn fn, void *arg) {
+    pthread_mutex_lock(&workers->lock);
+
+    // Grow the ring, unrolling it so head is at 0.
+    if (workers->jobs_n == workers->jobs_cap) {
+        struct WorkerJob *jobs = calloc(workers->jobs_cap * 2, sizeof(struct WorkerJob));
+        for (uint32_t i = 0; i < workers->jobs_n; i++)
+            jobs[i] = workers->jobs[(workers->jobs_head + i) % workers->jobs_cap];
+        free(workers->jobs);
+        workers->jobs = jobs;
+        workers->jobs_cap *= 2;
+        workers->jobs_head = 0;
+    }
+
+    uint32_t tail = (workers->jobs_head + workers->jobs_n) % workers->jobs_cap;
+    workers->jobs[tail] = (struct WorkerJob) { .fn = fn, .arg = arg };
+    workers->jobs_n += 1;
+
+    pthread_cond_signal(&workers->wake);
+    pthread_mutex_unlock(&workers->lock);
+}
+
+void workers_wait_idle(struct Workers *workers) {
+    pthread_mutex_lock(&workers->lock);
+    while (workers->jobs_n > 0 || workers->busy_n > 0)
+        pthread_cond_wait(&workers->idle, &workers->lock);
+    pthread_mutex_unlock(&workers->lock);
+}
+
+void worker_group_init(struct WorkerGroup *group) {
+    pthread_mutex_init(&group->lock, NULL);
+    pthread_cond_init(&group->done, NULL);
+    group->pending_n = 0;
+}
+
+void worker_group_free(struct WorkerGroup *group) {
+    pthread_cond_destroy(&group->done);
+    pthread_mutex_destroy(&group->lock);
+    memset(group, 0, sizeof(*group));
+}
+
+void workers_push_group(struct Workers *workers, struct WorkerGroup *group, WorkerFn fn, void *arg) {
+    pthread_mutex_lock(&group->lock);
+    group->pending_n += 1;
+    pthread_mutex_unlock(&group->lock);
+    workers_push(workers, fn, arg);
+}
+
+void worker_group_done(struct WorkerGroup *group) {
+    pthread_mutex_lock(&group->lock);
+    group->pending_n -= 1;
+    if (group->pending_n == 0) pthread_cond_broadcast(&group->done);
+    pthread_mutex_unlock(&group->lock);
+}
+
+void worker_group_wait(struct WorkerGroup *group) {
+    pthread_mutex_lock(&group->lock);
+    while (group->pending_n > 0)
+        pthread_cond_wait(&group->done, &group->lock);
+    pthread_mutex_unlock(&group->lock);
+}
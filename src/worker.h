@@ -0,0 +1,47 @@
+#pragma once
+#include <pthread.h>
+#include <stdint.h>
+
+typedef void (*WorkerFn)(void *arg);
+
+struct WorkerJob {
+    WorkerFn fn;
+    void *arg;
+};
+
+// Fixed pool of threads draining a FIFO of jobs.
+struct Workers {
+    pthread_t *threads; // array with size of threads_n
+    uint32_t threads_n;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    // Ring buffer of pending jobs.
+    struct WorkerJob *jobs; // array with size of jobs_cap
+    uint32_t jobs_cap;
+    uint32_t jobs_head;
+    uint32_t jobs_n;
+    uint32_t busy_n;
+    int quit;
+};
+
+// threads_n of 0 picks one thread per online CPU, minus the main thread.
+int workers_init(struct Workers *workers, uint32_t threads_n);
+void workers_free(struct Workers *workers);
+
+void workers_push(struct Workers *workers, WorkerFn fn, void *arg);
+void workers_wait_idle(struct Workers *workers);
+
+// Jobs of one batch, waited for without waiting for the rest of the pool.
+// Each job calls worker_group_done when it finishes.
+struct WorkerGroup {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    uint32_t pending_n;
+};
+
+void worker_group_init(struct WorkerGroup *group);
+void worker_group_free(struct WorkerGroup *group);
+void workers_push_group(struct Workers *workers, struct WorkerGroup *group, WorkerFn fn, void *arg);
+void worker_group_done(struct WorkerGroup *group);
+void worker_group_wait(struct WorkerGroup *group);